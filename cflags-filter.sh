@@ -0,0 +1 @@
+# Compiler understands normal flags; nothing to filter out
@@ -0,0 +1,734 @@
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "events.h"
+#include "monoclock.h"
+#include "noeintr.h"
+#include "queue.h"
+#include "sock.h"
+#include "sock_util.h"
+#include "warnp.h"
+
+#include "dnspool.h"
+
+/* Parameters of the pool returned by dnspool_shared(). */
+#define SHARED_NTHREADS 4
+#define SHARED_TTL 1.0
+
+/* Lookup states. */
+#define LOOKUP_QUEUED 0
+#define LOOKUP_RUNNING 1
+#define LOOKUP_DONE 2
+
+struct dnspool_req;
+
+/* An address being resolved, on behalf of one or more requests. */
+struct lookup {
+	/* Set when created; read by the worker thread. */
+	char * addr;
+
+	/* Protected by the pool mutex. */
+	int state;			/* LOOKUP_* as above. */
+	struct sock_addr ** sas;	/* Results. */
+	int res_errno;			/* Errno on failure. */
+	TAILQ_ENTRY(lookup) q;		/* In the work or done queue. */
+
+	/* Only accessed by the event loop thread. */
+	LIST_HEAD(, dnspool_req) waiters;
+	LIST_ENTRY(lookup) entries;	/* In the list of lookups. */
+};
+
+/* A cached result. */
+struct cache_entry {
+	char * addr;
+	struct sock_addr ** sas;
+	struct timeval expires;
+	LIST_ENTRY(cache_entry) entries;
+};
+
+/* A request from a caller. */
+struct dnspool_req {
+	struct dnspool * P;
+	struct lookup * L;		/* NULL if answered from the cache. */
+	struct sock_addr ** sas;	/* Answer from the cache. */
+	void * immediate_cookie;
+	int (* callback)(void *, struct sock_addr **);
+	void * cookie;
+	LIST_ENTRY(dnspool_req) entries;
+};
+
+struct dnspool {
+	/* Threading glue. */
+	pthread_mutex_t mtx;		/* Controls access to this structure. */
+	pthread_cond_t cv;		/* Threads sleep on this. */
+	int wakeupsock[2];		/* Writes to [0], reads from [1]. */
+
+	/* Protected by the mutex. */
+	size_t nthreads;		/* Threads which have not exited. */
+	int shutdown;			/* Threads should exit. */
+	TAILQ_HEAD(, lookup) work;	/* Lookups waiting for a thread. */
+	TAILQ_HEAD(, lookup) done;	/* Lookups waiting for callbacks. */
+
+	/* Only accessed by the event loop thread. */
+	size_t nusers;			/* Callers holding the pool. */
+	double ttl;			/* Cache lifetime. */
+	int registered;			/* Waiting on the wakeup socket. */
+	LIST_HEAD(, lookup) lookups;	/* Lookups which are not finished. */
+	LIST_HEAD(, cache_entry) cache;	/* Cached results. */
+};
+
+/* The pool returned by dnspool_shared(). */
+static struct dnspool * shared = NULL;
+
+static int callback_wakeup(void *);
+
+/* Free the lookup ${L}, and its results. */
+static void
+lookup_free(struct lookup * L)
+{
+
+	sock_addr_freelist(L->sas);
+	free(L->addr);
+	free(L);
+}
+
+/* Free the cache entry ${E}. */
+static void
+cache_free(struct cache_entry * E)
+{
+
+	LIST_REMOVE(E, entries);
+	sock_addr_freelist(E->sas);
+	free(E->addr);
+	free(E);
+}
+
+/* Free the pool structure, once no threads are using it. */
+static void
+pool_destroy(struct dnspool * P)
+{
+	int rc;
+
+	/* Close the socket pair. */
+	close(P->wakeupsock[1]);
+	close(P->wakeupsock[0]);
+
+	/* Destroy the condition variable and mutex. */
+	if ((rc = pthread_cond_destroy(&P->cv)) != 0)
+		warn0("pthread_cond_destroy: %s", strerror(rc));
+	if ((rc = pthread_mutex_destroy(&P->mtx)) != 0)
+		warn0("pthread_mutex_destroy: %s", strerror(rc));
+
+	/* Free the structure. */
+	free(P);
+}
+
+/* Address resolution thread. */
+static void *
+workthread(void * cookie)
+{
+	struct dnspool * P = cookie;
+	struct lookup * L;
+	struct sock_addr ** sas;
+	int res_errno;
+	int wasempty;
+	int rc;
+	uint8_t zero = 0;
+
+	/* Grab the mutex. */
+	if ((rc = pthread_mutex_lock(&P->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* Do work until told to exit. */
+	do {
+		/* Sleep until there is work to do or we need to exit. */
+		while (TAILQ_EMPTY(&P->work) && !P->shutdown) {
+			if ((rc = pthread_cond_wait(&P->cv, &P->mtx)) != 0) {
+				warn0("pthread_cond_wait: %s", strerror(rc));
+				exit(1);
+			}
+		}
+
+		/* If we need to exit, stop looping. */
+		if (P->shutdown)
+			break;
+
+		/* Grab the work. */
+		L = TAILQ_FIRST(&P->work);
+		TAILQ_REMOVE(&P->work, L, q);
+		L->state = LOOKUP_RUNNING;
+
+		/* Release the mutex. */
+		if ((rc = pthread_mutex_unlock(&P->mtx)) != 0) {
+			warn0("pthread_mutex_unlock: %s", strerror(rc));
+			exit(1);
+		}
+
+		/* Perform the address resolution. */
+		res_errno = 0;
+		if ((sas = sock_resolve(L->addr)) == NULL)
+			res_errno = errno;
+
+		/* Grab the mutex again. */
+		if ((rc = pthread_mutex_lock(&P->mtx)) != 0) {
+			warn0("pthread_mutex_lock: %s", strerror(rc));
+			exit(1);
+		}
+
+		/* Write the answer back. */
+		L->sas = sas;
+		L->res_errno = res_errno;
+
+		/* If the pool is being shut down, nobody wants the answer. */
+		if (P->shutdown) {
+			lookup_free(L);
+			break;
+		}
+
+		/* Hand the lookup back, and wake up the event loop if needed. */
+		L->state = LOOKUP_DONE;
+		wasempty = TAILQ_EMPTY(&P->done);
+		TAILQ_INSERT_TAIL(&P->done, L, q);
+		if (wasempty &&
+		    (noeintr_write(P->wakeupsock[0], &zero, 1) != 1)) {
+			warnp("Error writing to wakeup socket");
+			exit(1);
+		}
+	} while (1);
+
+	/* This thread is exiting; the last one out frees the pool. */
+	if (--P->nthreads == 0) {
+		/* Release the mutex. */
+		if ((rc = pthread_mutex_unlock(&P->mtx)) != 0) {
+			warn0("pthread_mutex_unlock: %s", strerror(rc));
+			exit(1);
+		}
+
+		/* Free the pool. */
+		pool_destroy(P);
+	} else {
+		/* Release the mutex. */
+		if ((rc = pthread_mutex_unlock(&P->mtx)) != 0) {
+			warn0("pthread_mutex_unlock: %s", strerror(rc));
+			exit(1);
+		}
+	}
+
+	/* Successful thread termination. */
+	return (NULL);
+}
+
+/* Shut down the pool ${P}; free it if no threads are running. */
+static void
+pool_shutdown(struct dnspool * P)
+{
+	struct lookup * L;
+	struct dnspool_req * R;
+	struct cache_entry * E;
+	int destroy;
+	int rc;
+
+	/* We don't want to hear from the threads any more. */
+	if (P->registered)
+		events_network_cancel(P->wakeupsock[1], EVENTS_NETWORK_OP_READ);
+
+	/* Free the cache. */
+	while ((E = LIST_FIRST(&P->cache)) != NULL)
+		cache_free(E);
+
+	/* Lock the structure. */
+	if ((rc = pthread_mutex_lock(&P->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* Cancel all requests, and free the lookups the threads don't own. */
+	while ((L = LIST_FIRST(&P->lookups)) != NULL) {
+		LIST_REMOVE(L, entries);
+		while ((R = LIST_FIRST(&L->waiters)) != NULL) {
+			LIST_REMOVE(R, entries);
+			free(R);
+		}
+		if (L->state == LOOKUP_QUEUED)
+			TAILQ_REMOVE(&P->work, L, q);
+		else if (L->state == LOOKUP_DONE)
+			TAILQ_REMOVE(&P->done, L, q);
+		if (L->state != LOOKUP_RUNNING)
+			lookup_free(L);
+	}
+
+	/* Tell the threads to exit, and wake them up. */
+	P->shutdown = 1;
+	if ((rc = pthread_cond_broadcast(&P->cv)) != 0) {
+		warn0("pthread_cond_broadcast: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* If no threads are running, it's up to us to free the pool. */
+	destroy = (P->nthreads == 0);
+
+	/* Unlock the structure. */
+	if ((rc = pthread_mutex_unlock(&P->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		exit(1);
+	}
+
+	/* Free the pool if necessary. */
+	if (destroy)
+		pool_destroy(P);
+}
+
+/**
+ * dnspool_init(nthreads, ttl):
+ * Spawn ${nthreads} threads for performing address resolution in parallel.
+ * Concurrent requests to resolve the same address are merged, and results
+ * are cached for ${ttl} seconds (since getaddrinfo(3) does not tell us the
+ * DNS TTLs); if ${ttl} is 0, results are not cached.  Return a pool which
+ * can be passed to dnspool_resolve() and dnspool_free().
+ */
+struct dnspool *
+dnspool_init(size_t nthreads, double ttl)
+{
+	struct dnspool * P;
+	pthread_t thr;
+	size_t i;
+	int rc;
+
+	/* Allocate a pool structure. */
+	if ((P = malloc(sizeof(struct dnspool))) == NULL)
+		goto err0;
+	P->nthreads = 0;
+	P->shutdown = 0;
+	TAILQ_INIT(&P->work);
+	TAILQ_INIT(&P->done);
+	P->nusers = 1;
+	P->ttl = ttl;
+	P->registered = 0;
+	LIST_INIT(&P->lookups);
+	LIST_INIT(&P->cache);
+
+	/* Create a mutex and condition variable. */
+	if ((rc = pthread_mutex_init(&P->mtx, NULL)) != 0) {
+		warn0("pthread_mutex_init: %s", strerror(rc));
+		goto err1;
+	}
+	if ((rc = pthread_cond_init(&P->cv, NULL)) != 0) {
+		warn0("pthread_cond_init: %s", strerror(rc));
+		goto err2;
+	}
+
+	/* Create wakeup socketpair. */
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, P->wakeupsock)) {
+		warnp("socketpair");
+		goto err3;
+	}
+
+	/* Lock the structure while we create the threads. */
+	if ((rc = pthread_mutex_lock(&P->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		goto err4;
+	}
+
+	/* Create the threads; they free themselves when they exit. */
+	for (i = 0; i < nthreads; i++) {
+		if ((rc = pthread_create(&thr, NULL, workthread, P)) != 0) {
+			warn0("pthread_create: %s", strerror(rc));
+			goto err5;
+		}
+		P->nthreads++;
+		if ((rc = pthread_detach(thr)) != 0) {
+			warn0("pthread_detach: %s", strerror(rc));
+			goto err5;
+		}
+	}
+
+	/* Unlock the structure. */
+	if ((rc = pthread_mutex_unlock(&P->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		goto err0;
+	}
+
+	/* Success! */
+	return (P);
+
+err5:
+	pthread_mutex_unlock(&P->mtx);
+
+	/* Any threads we created will free the pool. */
+	pool_shutdown(P);
+	goto err0;
+err4:
+	close(P->wakeupsock[1]);
+	close(P->wakeupsock[0]);
+err3:
+	pthread_cond_destroy(&P->cv);
+err2:
+	pthread_mutex_destroy(&P->mtx);
+err1:
+	free(P);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * dnspool_shared(void):
+ * Return a pool shared by all callers within this process, creating it if
+ * necessary.  Each call must be paired with a call to dnspool_free().
+ */
+struct dnspool *
+dnspool_shared(void)
+{
+
+	/* If we already have a shared pool, add a user. */
+	if (shared != NULL) {
+		shared->nusers++;
+		return (shared);
+	}
+
+	/* Create the shared pool. */
+	return (shared = dnspool_init(SHARED_NTHREADS, SHARED_TTL));
+}
+
+/* Invoke the callback for a request answered from the cache. */
+static int
+callback_cached(void * cookie)
+{
+	struct dnspool_req * R = cookie;
+	int rc;
+
+	/* Invoke the callback. */
+	rc = (R->callback)(R->cookie, R->sas);
+
+	/* Free the request. */
+	free(R);
+
+	/* Return status from the callback. */
+	return (rc);
+}
+
+/* Look for a cached result for ${addr}, discarding expired entries. */
+static struct cache_entry *
+cache_find(struct dnspool * P, const char * addr)
+{
+	struct cache_entry * E;
+	struct cache_entry * E_tmp;
+	struct timeval tv;
+
+	/* If we can't tell the time, nothing is fresh. */
+	if (monoclock_get(&tv))
+		return (NULL);
+
+	/* Look for the address. */
+	LIST_FOREACH_SAFE(E, &P->cache, entries, E_tmp) {
+		if (timeval_diff(tv, E->expires) <= 0.0)
+			cache_free(E);
+		else if (strcmp(E->addr, addr) == 0)
+			return (E);
+	}
+
+	/* Not found. */
+	return (NULL);
+}
+
+/* Cache the results of the lookup ${L}. */
+static void
+cache_add(struct dnspool * P, struct lookup * L)
+{
+	struct cache_entry * E;
+	struct timeval tv;
+
+	/* Discard any existing entry. */
+	if ((E = cache_find(P, L->addr)) != NULL)
+		cache_free(E);
+
+	/* Figure out when the entry expires; if we can't, don't cache. */
+	if (monoclock_get(&tv))
+		return;
+	tv.tv_sec += (time_t)P->ttl;
+	tv.tv_usec += (suseconds_t)((P->ttl - (double)(time_t)P->ttl) *
+	    1000000.0);
+	if (tv.tv_usec >= 1000000) {
+		tv.tv_sec += 1;
+		tv.tv_usec -= 1000000;
+	}
+
+	/* Take over the address and results from the lookup. */
+	if ((E = malloc(sizeof(struct cache_entry))) == NULL)
+		return;
+	E->addr = L->addr;
+	E->sas = L->sas;
+	E->expires = tv;
+	L->addr = NULL;
+	L->sas = NULL;
+
+	/* Add the entry. */
+	LIST_INSERT_HEAD(&P->cache, E, entries);
+}
+
+/* Make sure we'll hear about completed lookups. */
+static int
+listen_wakeup(struct dnspool * P)
+{
+
+	/* Nothing to do if we're already listening. */
+	if (P->registered)
+		return (0);
+
+	/* Wait for the wakeup socket to become readable. */
+	if (events_network_register(callback_wakeup, P, P->wakeupsock[1],
+	    EVENTS_NETWORK_OP_READ)) {
+		warnp("Error registering wakeup listener");
+		return (-1);
+	}
+	P->registered = 1;
+
+	/* Success! */
+	return (0);
+}
+
+/**
+ * dnspool_resolve(P, addr, callback, cookie):
+ * Using the pool ${P}, resolve the address ${addr}, which must be in one of
+ * the forms accepted by sock_resolve().  Upon completion, invoke
+ * ${callback}(${cookie}, sas), where ${sas} is a NULL-terminated array of
+ * pointers to sock_addr structures (which the callback must free) or NULL on
+ * resolution failure.  Return a cookie which can be passed to
+ * dnspool_cancel(), or NULL on error.
+ */
+void *
+dnspool_resolve(struct dnspool * P, const char * addr,
+    int (* callback)(void *, struct sock_addr **), void * cookie)
+{
+	struct dnspool_req * R;
+	struct cache_entry * E;
+	struct lookup * L;
+	int rc;
+
+	/* Bake a cookie. */
+	if ((R = malloc(sizeof(struct dnspool_req))) == NULL)
+		goto err0;
+	R->P = P;
+	R->L = NULL;
+	R->sas = NULL;
+	R->immediate_cookie = NULL;
+	R->callback = callback;
+	R->cookie = cookie;
+
+	/* If we have a fresh answer, return a copy of it. */
+	if ((E = cache_find(P, addr)) != NULL) {
+		if ((R->sas = sock_addr_duplist(E->sas)) == NULL)
+			goto err1;
+		if ((R->immediate_cookie = events_immediate_register(
+		    callback_cached, R, 0)) == NULL)
+			goto err2;
+
+		/* Success! */
+		return (R);
+	}
+
+	/* If we're already looking up this address, wait for the answer. */
+	LIST_FOREACH(L, &P->lookups, entries) {
+		if (strcmp(L->addr, addr) == 0)
+			break;
+	}
+	if (L != NULL) {
+		R->L = L;
+		LIST_INSERT_HEAD(&L->waiters, R, entries);
+
+		/* Success! */
+		return (R);
+	}
+
+	/* Create a new lookup. */
+	if ((L = malloc(sizeof(struct lookup))) == NULL)
+		goto err1;
+	if ((L->addr = strdup(addr)) == NULL)
+		goto err3;
+	L->sas = NULL;
+	L->res_errno = 0;
+	L->state = LOOKUP_QUEUED;
+	LIST_INIT(&L->waiters);
+
+	/* Make sure we'll hear about the answer. */
+	if (listen_wakeup(P))
+		goto err4;
+
+	/* Queue the lookup and wake up a thread. */
+	if ((rc = pthread_mutex_lock(&P->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		goto err4;
+	}
+	TAILQ_INSERT_TAIL(&P->work, L, q);
+	if ((rc = pthread_cond_signal(&P->cv)) != 0) {
+		warn0("pthread_cond_signal: %s", strerror(rc));
+		goto err5;
+	}
+	if ((rc = pthread_mutex_unlock(&P->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		goto err0;
+	}
+
+	/* Record the lookup and this request. */
+	LIST_INSERT_HEAD(&P->lookups, L, entries);
+	R->L = L;
+	LIST_INSERT_HEAD(&L->waiters, R, entries);
+
+	/* Success! */
+	return (R);
+
+err5:
+	TAILQ_REMOVE(&P->work, L, q);
+	pthread_mutex_unlock(&P->mtx);
+err4:
+	free(L->addr);
+err3:
+	free(L);
+	goto err1;
+err2:
+	sock_addr_freelist(R->sas);
+err1:
+	free(R);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Callback from the wakeup socket: some lookups have completed. */
+static int
+callback_wakeup(void * cookie)
+{
+	struct dnspool * P = cookie;
+	TAILQ_HEAD(, lookup) done = TAILQ_HEAD_INITIALIZER(done);
+	struct lookup * L;
+	struct dnspool_req * R;
+	struct sock_addr ** sas;
+	uint8_t zero;
+	int rc = 0;
+	int rc2;
+
+	/* We're not listening any more. */
+	P->registered = 0;
+
+	/* Drain the byte from the socketpair. */
+	if (read(P->wakeupsock[1], &zero, 1) != 1) {
+		warn0("Error reading from wakeup socket");
+		goto err0;
+	}
+
+	/* Take all of the completed lookups. */
+	if ((rc2 = pthread_mutex_lock(&P->mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc2));
+		goto err0;
+	}
+	TAILQ_CONCAT(&done, &P->done, q);
+	if ((rc2 = pthread_mutex_unlock(&P->mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc2));
+		goto err0;
+	}
+
+	/* Handle each lookup. */
+	while ((L = TAILQ_FIRST(&done)) != NULL) {
+		TAILQ_REMOVE(&done, L, q);
+		LIST_REMOVE(L, entries);
+
+		/* Answer each request; callbacks may cancel other requests. */
+		while ((R = LIST_FIRST(&L->waiters)) != NULL) {
+			LIST_REMOVE(R, entries);
+
+			/* Give each request its own copy of the results. */
+			if (L->sas == NULL) {
+				sas = NULL;
+				errno = L->res_errno;
+			} else if ((sas = sock_addr_duplist(L->sas)) == NULL) {
+				warnp("Error copying resolved addresses");
+			}
+
+			/* Invoke the callback. */
+			if ((R->callback)(R->cookie, sas))
+				rc = -1;
+			free(R);
+		}
+
+		/* Cache successful results. */
+		if ((L->sas != NULL) && (P->ttl > 0.0))
+			cache_add(P, L);
+
+		/* Free the lookup. */
+		lookup_free(L);
+	}
+
+	/* If we're still waiting for lookups, keep listening. */
+	if (!LIST_EMPTY(&P->lookups) && listen_wakeup(P))
+		goto err0;
+
+	/* Return status from callbacks. */
+	return (rc);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * dnspool_cancel(cookie):
+ * Cancel the address resolution request for which ${cookie} was returned by
+ * dnspool_resolve().  Do not invoke the callback.
+ */
+void
+dnspool_cancel(void * cookie)
+{
+	struct dnspool_req * R = cookie;
+
+	/*
+	 * If the request is waiting for a lookup, stop waiting; the lookup
+	 * will continue, so that its results can be cached.
+	 */
+	if (R->L != NULL)
+		LIST_REMOVE(R, entries);
+
+	/* If the request was answered from the cache, discard the answer. */
+	if (R->immediate_cookie != NULL) {
+		events_immediate_cancel(R->immediate_cookie);
+		sock_addr_freelist(R->sas);
+	}
+
+	/* Free the request. */
+	free(R);
+}
+
+/**
+ * dnspool_free(P):
+ * Release the pool ${P}.  Once no callers hold the pool, cancel all pending
+ * requests, and instruct the threads to exit once any address resolutions
+ * they are performing have completed.  Must not be called from within a
+ * dnspool_resolve() callback.
+ */
+void
+dnspool_free(struct dnspool * P)
+{
+
+	/* Be compatible with free(NULL). */
+	if (P == NULL)
+		return;
+
+	/* Is anyone else still using the pool? */
+	if (--P->nusers > 0)
+		return;
+
+	/* The shared pool is going away. */
+	if (P == shared)
+		shared = NULL;
+
+	/* Shut down the pool. */
+	pool_shutdown(P);
+}
@@ -0,0 +1,55 @@
+#ifndef _DNSPOOL_H_
+#define _DNSPOOL_H_
+
+#include <stddef.h>
+
+/* Opaque types. */
+struct dnspool;
+struct sock_addr;
+
+/**
+ * dnspool_init(nthreads, ttl):
+ * Spawn ${nthreads} threads for performing address resolution in parallel.
+ * Concurrent requests to resolve the same address are merged, and results
+ * are cached for ${ttl} seconds (since getaddrinfo(3) does not tell us the
+ * DNS TTLs); if ${ttl} is 0, results are not cached.  Return a pool which
+ * can be passed to dnspool_resolve() and dnspool_free().
+ */
+struct dnspool * dnspool_init(size_t, double);
+
+/**
+ * dnspool_shared(void):
+ * Return a pool shared by all callers within this process, creating it if
+ * necessary.  Each call must be paired with a call to dnspool_free().
+ */
+struct dnspool * dnspool_shared(void);
+
+/**
+ * dnspool_resolve(P, addr, callback, cookie):
+ * Using the pool ${P}, resolve the address ${addr}, which must be in one of
+ * the forms accepted by sock_resolve().  Upon completion, invoke
+ * ${callback}(${cookie}, sas), where ${sas} is a NULL-terminated array of
+ * pointers to sock_addr structures (which the callback must free) or NULL on
+ * resolution failure.  Return a cookie which can be passed to
+ * dnspool_cancel(), or NULL on error.
+ */
+void * dnspool_resolve(struct dnspool *, const char *,
+    int (*)(void *, struct sock_addr **), void *);
+
+/**
+ * dnspool_cancel(cookie):
+ * Cancel the address resolution request for which ${cookie} was returned by
+ * dnspool_resolve().  Do not invoke the callback.
+ */
+void dnspool_cancel(void *);
+
+/**
+ * dnspool_free(P):
+ * Release the pool ${P}.  Once no callers hold the pool, cancel all pending
+ * requests, and instruct the threads to exit once any address resolutions
+ * they are performing have completed.  Must not be called from within a
+ * dnspool_resolve() callback.
+ */
+void dnspool_free(struct dnspool *);
+
+#endif /* !_DNSPOOL_H_ */
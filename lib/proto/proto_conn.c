@@ -1,15 +1,20 @@
 #include <sys/socket.h>
+#include <sys/time.h>
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
 #include <assert.h>
+#include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include "events.h"
 #include "network.h"
 #include "sock.h"
+#include "sockbuf.h"
+#include "warnp.h"
 
 #include "proto_crypt.h"
 #include "proto_handshake.h"
@@ -18,6 +23,7 @@
 #include "proto_conn.h"
 
 struct conn_state {
+	int (* callback_target)(void *, size_t, int);
 	int (* callback_dead)(void *, int);
 	void * cookie;
 	struct sock_addr ** sas;
@@ -41,13 +47,116 @@ struct conn_state {
 	int stat_r;
 };
 
-static int callback_connect_done(void *, int);
+/* Socket buffer sizing for new connections. */
+static struct sockbufs {
+	size_t bufsize_s;
+	size_t bufsize_t;
+	size_t bdp_rate;
+	int warned;
+} sockbufs;
+
+/* Delay between connection attempts to different target addresses. */
+static struct timeval connect_delay = {0, 250000};
+static int connect_delay_enabled = 1;
+
+static int callback_connect_done(void *, int, const struct sock_addr *);
 static int callback_connect_timeout(void *);
 static int callback_handshake_done(void *, struct proto_keys *,
     struct proto_keys *);
 static int callback_handshake_timeout(void *);
 static int callback_pipestatus(void *);
 
+/* Set the buffer sizes of ${s} to ${size}, and warn if we're limited. */
+static void
+setbufsize(int s, size_t size)
+{
+	size_t got;
+
+	/*
+	 * Ignore failures: as with keep-alives, the socket might not be of a
+	 * type for which the buffer sizes are meaningful.  But if the system
+	 * limits the buffer size, the user probably wants to know about it.
+	 */
+	if (((got = sockbuf_set(s, size)) != 0) && (got < size) &&
+	    !sockbufs.warned) {
+		warn0("Socket buffer size limited to %zu bytes by the system",
+		    got);
+		sockbufs.warned = 1;
+	}
+}
+
+/* Size the buffers of the encrypted socket ${s} for its BDP. */
+static void
+setbufsize_bdp(int s)
+{
+	double rtt;
+	double bdp;
+	size_t size;
+	size_t got;
+
+	/* If we don't know the round-trip time, leave autotuning alone. */
+	if (sockbuf_rtt(s, &rtt))
+		return;
+
+	/*
+	 * Allow for twice the bandwidth-delay product, so that the window
+	 * doesn't close while waiting for acknowledgements; but don't shrink
+	 * buffers below the size which TCP needs to work well on a LAN.
+	 */
+	bdp = 2.0 * rtt * (double)sockbufs.bdp_rate;
+	if (bdp < 65536.0)
+		return;
+	if (bdp > (double)(SIZE_MAX / 2))
+		bdp = (double)(SIZE_MAX / 2);
+	size = (size_t)bdp;
+
+	/*
+	 * Setting a size turns off automatic tuning, which may be allowed to
+	 * grow the buffers further than we can set them; so only raise the
+	 * buffers where that helps, and warn if they can't reach the size.
+	 */
+	if (((got = sockbuf_raise(s, size)) != 0) && (got < size) &&
+	    !sockbufs.warned) {
+		warn0("Socket buffer size limited to %zu bytes by the system",
+		    got);
+		sockbufs.warned = 1;
+	}
+}
+
+/* Tell the upstream which target addresses failed, and which one we used. */
+static int
+reporttargets(struct conn_state * C, const struct sock_addr * sa)
+{
+	size_t i;
+
+	/* Nothing to do if the upstream isn't interested. */
+	if (C->callback_target == NULL)
+		return (0);
+
+	/* Report the addresses which failed or were overtaken. */
+	for (i = 0; C->sas[i] != NULL; i++) {
+		if (!network_connect_tried(C->connect_cookie, C->sas[i]))
+			continue;
+		if ((C->callback_target)(C->cookie, i, 0))
+			goto err0;
+	}
+
+	/* Report the address we connected to. */
+	for (i = 0; (sa != NULL) && (C->sas[i] != NULL); i++) {
+		if (C->sas[i] != sa)
+			continue;
+		if ((C->callback_target)(C->cookie, i, 1))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 /* Start a handshake. */
 static int
 starthandshake(struct conn_state * C, int s, int decr)
@@ -111,6 +220,11 @@ launchpipes(struct conn_state * C)
 	 * more expensive.  Consequently, the maximum TCP/IP overhead ratio of
 	 * 80/1061 is almost certain to hold even with weighted byte costs.
 	 *
+	 * When more input is already buffered, proto_pipe() asks the kernel
+	 * (via MSG_MORE, where available) to hold back partial segments until
+	 * its next write, so bulk transfers still fill full-sized segments;
+	 * once the input drains, data is sent immediately.
+	 *
 	 * We ignore errors since (as with keep-alives) we may be dealing with
 	 * a non-TCP socket; and also because while POSIX requires TCP_NODELAY
 	 * to be defined, it is not required to be implemented as a socket
@@ -119,6 +233,18 @@ launchpipes(struct conn_state * C)
 	(void)setsockopt(C->s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 	(void)setsockopt(C->t, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
+	/*
+	 * Size the buffers of the encrypted socket for the bandwidth-delay
+	 * product, if requested and not sized explicitly.  By now we have
+	 * exchanged several packets, so the kernel has an RTT estimate.
+	 */
+	if (sockbufs.bdp_rate != 0) {
+		if (C->decr && (sockbufs.bufsize_s == 0))
+			setbufsize_bdp(C->s);
+		if (!C->decr && (sockbufs.bufsize_t == 0))
+			setbufsize_bdp(C->t);
+	}
+
 	/* Create two pipes. */
 	if ((C->pipe_f = proto_pipe(C->s, C->t, C->decr, C->k_f,
 	    &C->stat_f, callback_pipestatus, C)) == NULL)
@@ -135,6 +261,49 @@ err0:
 	return (-1);
 }
 
+/**
+ * proto_conn_sockbufs(bufsize_s, bufsize_t, bdp_rate):
+ * For connections created from now on, set the send and receive buffer sizes
+ * of the incoming socket to ${bufsize_s} bytes and of the target socket to
+ * ${bufsize_t} bytes; a size of 0 leaves the operating system's automatic
+ * tuning alone.  If ${bdp_rate} is non-zero, once the handshake has
+ * completed, estimate the bandwidth-delay product of the encrypted socket
+ * from its measured round-trip time and a link rate of ${bdp_rate} bytes per
+ * second, and size its buffers to twice that unless a size was given for it
+ * explicitly.
+ */
+void
+proto_conn_sockbufs(size_t bufsize_s, size_t bufsize_t, size_t bdp_rate)
+{
+
+	/* Record the settings. */
+	sockbufs.bufsize_s = bufsize_s;
+	sockbufs.bufsize_t = bufsize_t;
+	sockbufs.bdp_rate = bdp_rate;
+}
+
+/**
+ * proto_conn_connect_delay(delay):
+ * For connections created from now on, if the target has several addresses,
+ * start connecting to the next address if the previous attempt hasn't
+ * succeeded within ${delay} seconds, without abandoning it (RFC 8305).  If
+ * ${delay} is 0, try the addresses one at a time.  The default is 0.25 s.
+ * The delay must be finite.
+ */
+void
+proto_conn_connect_delay(double delay)
+{
+
+	/* Sanity-check. */
+	assert(isfinite(delay) && (delay >= 0.0));
+
+	/* Record the delay, or that we're not staggering attempts. */
+	connect_delay.tv_sec = (time_t)delay;
+	connect_delay.tv_usec = (suseconds_t)((delay -
+	    (double)connect_delay.tv_sec) * 1000000.0);
+	connect_delay_enabled = (delay > 0.0);
+}
+
 /**
  * proto_conn_drop(conn_cookie, reason):
  * Drop connection and free memory associated with ${conn_cookie}, due to
@@ -192,7 +361,7 @@ proto_conn_drop(void * conn_cookie, int reason)
 
 /**
  * proto_conn_create(s, sas, sa_b, decr, nopfs, requirepfs, nokeepalive, K,
- *     timeo, callback_dead, cookie):
+ *     timeo, callback_target, callback_dead, cookie):
  * Create a connection with one end at ${s} and the other end connecting to
  * the target addresses ${sas}.  Bind outgoing address to ${sa_b} if it is
  * not NULL.  If ${decr} is 0, encrypt the outgoing data; if ${decr} is
@@ -201,16 +370,21 @@ proto_conn_drop(void * conn_cookie, int reason)
  * if the other end tries to disable perfect forward secrecy.  Enable
  * transport layer keep-alives (if applicable) on both sockets if and only if
  * ${nokeepalive} is zero.  Drop the connection if the handshake or
- * connecting to the target takes more than ${timeo} seconds.  When the
- * connection is dropped, invoke ${callback_dead}(${cookie}).  Free ${sas}
- * once it is no longer needed.  Return a cookie which can be passed to
- * proto_conn_drop().  If there is a connection error after this
- * function returns, close ${s}.
+ * connecting to the target takes more than ${timeo} seconds.  Once the
+ * outcome of connecting to the target is known, if ${callback_target} is not
+ * NULL, invoke ${callback_target}(${cookie}, i, 0) for each address which
+ * failed or was overtaken (see network_connect_tried()), and then
+ * ${callback_target}(${cookie}, i, 1) for the address used (if any), where i
+ * is the index of the address within ${sas}.  When the connection is dropped,
+ * invoke ${callback_dead}(${cookie}).  Free ${sas} once it is no longer
+ * needed.  Return a cookie which can be passed to proto_conn_drop().  If
+ * there is a connection error after this function returns, close ${s}.
  */
 void *
 proto_conn_create(int s, struct sock_addr ** sas, const struct sock_addr * sa_b,
     int decr, int nopfs, int requirepfs, int nokeepalive,
     const struct proto_secret * K, double timeo,
+    int (* callback_target)(void *, size_t, int),
     int (* callback_dead)(void *, int), void * cookie)
 {
 	struct conn_state * C;
@@ -218,6 +392,7 @@ proto_conn_create(int s, struct sock_addr ** sas, const struct sock_addr * sa_b,
 	/* Bake a cookie for this connection. */
 	if ((C = malloc(sizeof(struct conn_state))) == NULL)
 		goto err0;
+	C->callback_target = callback_target;
 	C->callback_dead = callback_dead;
 	C->cookie = cookie;
 	C->sas = sas;
@@ -237,14 +412,19 @@ proto_conn_create(int s, struct sock_addr ** sas, const struct sock_addr * sa_b,
 	C->pipe_f = C->pipe_r = NULL;
 	C->stat_f = C->stat_r = 1;
 
+	/* Set the buffer sizes of the incoming socket (if applicable). */
+	if (sockbufs.bufsize_s != 0)
+		setbufsize(C->s, sockbufs.bufsize_s);
+
 	/* Start the connect timer. */
 	if ((C->connect_timeout_cookie = events_timer_register_double(
 	    callback_connect_timeout, C, C->timeo)) == NULL)
 		goto err1;
 
-	/* Connect to target. */
-	if ((C->connect_cookie =
-	    network_connect_bind(C->sas, sa_b, callback_connect_done, C)) == NULL)
+	/* Connect to target, trying several addresses in parallel. */
+	if ((C->connect_cookie = network_connect_staggered(C->sas, sa_b,
+	    connect_delay_enabled ? &connect_delay : NULL,
+	    callback_connect_done, C)) == NULL)
 		goto err2;
 
 	/* If we're decrypting, start the handshake. */
@@ -269,9 +449,13 @@ err0:
 
 /* We have connected to the target. */
 static int
-callback_connect_done(void * cookie, int t)
+callback_connect_done(void * cookie, int t, const struct sock_addr * sa)
 {
 	struct conn_state * C = cookie;
+	int rc;
+
+	/* Tell the upstream which target addresses worked. */
+	rc = reporttargets(C, sa);
 
 	/* This connection attempt is no longer pending. */
 	C->connect_cookie = NULL;
@@ -288,6 +472,19 @@ callback_connect_done(void * cookie, int t)
 	if ((C->t = t) == -1)
 		return (proto_conn_drop(C, PROTO_CONN_CONNECT_FAILED));
 
+	/* Did the upstream fail? */
+	if (rc)
+		goto err1;
+
+	/*
+	 * Set the buffer sizes of the target socket (if applicable).  We do
+	 * this before sending anything; and the TCP window scale option,
+	 * which must be chosen when connecting, is based on system-wide
+	 * limits on Linux and the BSDs rather than on this socket's buffers.
+	 */
+	if (sockbufs.bufsize_t != 0)
+		setbufsize(C->t, sockbufs.bufsize_t);
+
 	/* If we're encrypting, start the handshake. */
 	if (!C->decr) {
 		if (starthandshake(C, C->t, C->decr))
@@ -326,6 +523,12 @@ callback_connect_timeout(void * cookie)
 	 * connect.
 	 */
 
+	/* The target addresses we tried didn't answer in time. */
+	if (reporttargets(C, NULL)) {
+		proto_conn_drop(C, PROTO_CONN_ERROR);
+		return (-1);
+	}
+
 	/* Drop the connection. */
 	return (proto_conn_drop(C, PROTO_CONN_ERROR));
 }
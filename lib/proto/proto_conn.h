@@ -1,6 +1,8 @@
 #ifndef _PROTO_CONN_H_
 #define _PROTO_CONN_H_
 
+#include <stddef.h>
+
 /* Opaque structures. */
 struct proto_secret;
 struct sock_addr;
@@ -16,7 +18,7 @@ enum {
 
 /**
  * proto_conn_create(s, sas, sa_b, decr, nopfs, requirepfs, nokeepalive, K,
- *     timeo, callback_dead, cookie):
+ *     timeo, callback_target, callback_dead, cookie):
  * Create a connection with one end at ${s} and the other end connecting to
  * the target addresses ${sas}.  Bind outgoing address to ${sa_b} if it is
  * not NULL.  If ${decr} is 0, encrypt the outgoing data; if ${decr} is
@@ -25,15 +27,42 @@ enum {
  * if the other end tries to disable perfect forward secrecy.  Enable
  * transport layer keep-alives (if applicable) on both sockets if and only if
  * ${nokeepalive} is zero.  Drop the connection if the handshake or
- * connecting to the target takes more than ${timeo} seconds.  When the
- * connection is dropped, invoke ${callback_dead}(${cookie}).  Free ${sas}
- * once it is no longer needed.  Return a cookie which can be passed to
- * proto_conn_drop().  If there is a connection error after this
- * function returns, close ${s}.
+ * connecting to the target takes more than ${timeo} seconds.  Once the
+ * outcome of connecting to the target is known, if ${callback_target} is not
+ * NULL, invoke ${callback_target}(${cookie}, i, 0) for each address which
+ * failed or was overtaken (see network_connect_tried()), and then
+ * ${callback_target}(${cookie}, i, 1) for the address used (if any), where i
+ * is the index of the address within ${sas}.  When the connection is dropped,
+ * invoke ${callback_dead}(${cookie}).  Free ${sas} once it is no longer
+ * needed.  Return a cookie which can be passed to proto_conn_drop().  If
+ * there is a connection error after this function returns, close ${s}.
  */
 void * proto_conn_create(int, struct sock_addr **, const struct sock_addr *,
-    int, int, int, int, const struct proto_secret *, double, int (*)(void *,
-    int), void *);
+    int, int, int, int, const struct proto_secret *, double,
+    int (*)(void *, size_t, int), int (*)(void *, int), void *);
+
+/**
+ * proto_conn_sockbufs(bufsize_s, bufsize_t, bdp_rate):
+ * For connections created from now on, set the send and receive buffer sizes
+ * of the incoming socket to ${bufsize_s} bytes and of the target socket to
+ * ${bufsize_t} bytes; a size of 0 leaves the operating system's automatic
+ * tuning alone.  If ${bdp_rate} is non-zero, once the handshake has
+ * completed, estimate the bandwidth-delay product of the encrypted socket
+ * from its measured round-trip time and a link rate of ${bdp_rate} bytes per
+ * second, and size its buffers to twice that unless a size was given for it
+ * explicitly.
+ */
+void proto_conn_sockbufs(size_t, size_t, size_t);
+
+/**
+ * proto_conn_connect_delay(delay):
+ * For connections created from now on, if the target has several addresses,
+ * start connecting to the next address if the previous attempt hasn't
+ * succeeded within ${delay} seconds, without abandoning it (RFC 8305).  If
+ * ${delay} is 0, try the addresses one at a time.  The default is 0.25 s.
+ * The delay must be finite.
+ */
+void proto_conn_connect_delay(double);
 
 /**
  * proto_conn_drop(conn_cookie, reason):
@@ -1,3 +1,5 @@
+#include <sys/uio.h>
+
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -5,14 +7,13 @@
 #include <string.h>
 #include <unistd.h>
 
-#include "crypto_aes.h"
-#include "crypto_aesctr.h"
 #include "crypto_verify_bytes.h"
 #include "insecure_memzero.h"
 #include "sha256.h"
-#include "sysendian.h"
 #include "warnp.h"
 
+#include "proto_crypt_engine.h"
+
 #include "proto_crypt.h"
 
 struct proto_secret {
@@ -20,11 +21,22 @@ struct proto_secret {
 };
 
 struct proto_keys {
-	struct crypto_aes_key * k_aes;
-	HMAC_SHA256_CTX ctx_init;
+	const struct proto_crypt_engine * engine;
+	void * ks;
 	uint64_t pnum;
 };
 
+/* Available engines, starting with the default. */
+const struct proto_crypt_engine * const proto_crypt_engines[] = {
+	&proto_crypt_engine_libcperciva,
+	&proto_crypt_engine_openssl,
+	NULL
+};
+
+/* Engine to use for new protocol key structures. */
+static const struct proto_crypt_engine * engine =
+    &proto_crypt_engine_libcperciva;
+
 /**
  * mkkeypair(kbuf):
  * Convert the 64 bytes of ${kbuf} into a protocol key structure.
@@ -43,13 +55,11 @@ mkkeypair(uint8_t kbuf[64])
 	if ((k = malloc(sizeof(struct proto_keys))) == NULL)
 		goto err0;
 
-	/* Expand the AES key. */
-	if ((k->k_aes = crypto_aes_key_expand(&kbuf[0], 32)) == NULL)
+	/* Set up the keys using the selected engine. */
+	k->engine = engine;
+	if ((k->ks = k->engine->keysetup(kbuf)) == NULL)
 		goto err1;
 
-	/* Initialize the HMAC_SHA256 context. */
-	HMAC_SHA256_Init(&k->ctx_init, &kbuf[32], 32);
-
 	/* The first packet will be packet number zero. */
 	k->pnum = 0;
 
@@ -63,6 +73,36 @@ err0:
 	return (NULL);
 }
 
+/**
+ * proto_crypt_engine_lookup(name):
+ * Return the engine called ${name}, or NULL if there is no such engine.
+ */
+const struct proto_crypt_engine *
+proto_crypt_engine_lookup(const char * name)
+{
+	size_t i;
+
+	/* Look for an engine with the right name. */
+	for (i = 0; proto_crypt_engines[i] != NULL; i++) {
+		if (strcmp(proto_crypt_engines[i]->name, name) == 0)
+			return (proto_crypt_engines[i]);
+	}
+
+	/* No such engine. */
+	return (NULL);
+}
+
+/**
+ * proto_crypt_engine_select(engine):
+ * Use ${engine} for protocol key structures created from now on.
+ */
+void
+proto_crypt_engine_select(const struct proto_crypt_engine * e)
+{
+
+	engine = e;
+}
+
 /**
  * proto_crypt_secret(filename):
  * Read the key file ${filename} and return a protocol secret structure.
@@ -318,41 +358,42 @@ err0:
 /**
  * proto_crypt_enc(ibuf, len, obuf, k):
  * Encrypt ${len} bytes from ${ibuf} into PCRYPT_ESZ bytes using the keys in
- * ${k}, and write the result into ${obuf}.
+ * ${k}, and write the result into ${obuf}.  The buffers must not overlap.
+ * Return 0 on success or -1 on error.
  */
-void
+int
 proto_crypt_enc(uint8_t * ibuf, size_t len, uint8_t obuf[PCRYPT_ESZ],
     struct proto_keys * k)
 {
-	HMAC_SHA256_CTX ctx;
-	uint8_t pnum_exp[8];
 
 	/* Sanity-check the length. */
 	assert(len <= PCRYPT_MAXDSZ);
 
-	/* Copy the decrypted data into the encrypted buffer. */
-	memcpy(obuf, ibuf, len);
-
-	/* Pad up to PCRYPT_MAXDSZ with zeroes. */
-	memset(&obuf[len], 0, PCRYPT_MAXDSZ - len);
-
-	/* Add the length. */
-	be32enc(&obuf[PCRYPT_MAXDSZ], (uint32_t)len);
-
-	/* Encrypt the buffer in-place. */
-	crypto_aesctr_buf(k->k_aes, k->pnum, obuf, obuf, PCRYPT_MAXDSZ + 4);
+	/* Encrypt a batch of one packet. */
+	return (proto_crypt_enc_batch(ibuf, len, obuf, k));
+}
 
-	/* Copy the original (initialized) context. */
-	memcpy(&ctx, &k->ctx_init, sizeof(HMAC_SHA256_CTX));
+/**
+ * proto_crypt_enc_batch(ibuf, len, obuf, k):
+ * Encrypt ${len} bytes from ${ibuf} into PCRYPT_NPACKETS(${len}) consecutive
+ * PCRYPT_ESZ-byte packets using the keys in ${k}, and write the result into
+ * ${obuf}.  Each packet except the last holds PCRYPT_MAXDSZ bytes.  The
+ * buffers must not overlap.  Return 0 on success or -1 on error.
+ */
+int
+proto_crypt_enc_batch(const uint8_t * ibuf, size_t len, uint8_t * obuf,
+    struct proto_keys * k)
+{
 
-	/* Append an HMAC. */
-	be64enc(pnum_exp, k->pnum);
-	HMAC_SHA256_Update(&ctx, obuf, PCRYPT_MAXDSZ + 4);
-	HMAC_SHA256_Update(&ctx, pnum_exp, 8);
-	HMAC_SHA256_Final(&obuf[PCRYPT_MAXDSZ + 4], &ctx);
+	/* Encrypt the packets. */
+	if (k->engine->enc_batch(k->ks, k->pnum, ibuf, len, obuf))
+		return (-1);
 
 	/* Increment packet number. */
-	k->pnum += 1;
+	k->pnum += PCRYPT_NPACKETS(len);
+
+	/* Success! */
+	return (0);
 }
 
 /**
@@ -365,40 +406,44 @@ ssize_t
 proto_crypt_dec(uint8_t ibuf[PCRYPT_ESZ], uint8_t * obuf,
     struct proto_keys * k)
 {
-	HMAC_SHA256_CTX ctx;
-	uint8_t hbuf[32];
-	uint8_t pnum_exp[8];
-	size_t len;
-
-	/* Copy the original (initialized) context. */
-	memcpy(&ctx, &k->ctx_init, sizeof(HMAC_SHA256_CTX));
-
-	/* Verify HMAC. */
-	be64enc(pnum_exp, k->pnum);
-	HMAC_SHA256_Update(&ctx, ibuf, PCRYPT_MAXDSZ + 4);
-	HMAC_SHA256_Update(&ctx, pnum_exp, 8);
-	HMAC_SHA256_Final(hbuf, &ctx);
-	if (crypto_verify_bytes(hbuf, &ibuf[PCRYPT_MAXDSZ + 4], 32))
+	struct iovec iov;
+	ssize_t len;
+
+	/* Decrypt a batch of one packet. */
+	if ((len = proto_crypt_dec_batch(ibuf, 1, &iov, k)) == -1)
 		return (-1);
 
-	/* Decrypt the buffer in-place. */
-	crypto_aesctr_buf(k->k_aes, k->pnum, ibuf, ibuf, PCRYPT_MAXDSZ + 4);
+	/* Copy the bytes into the output buffer. */
+	memcpy(obuf, iov.iov_base, iov.iov_len);
 
-	/* Increment packet number. */
-	k->pnum += 1;
+	/* Return the decrypted length. */
+	return (len);
+}
 
-	/* Parse length. */
-	len = be32dec(&ibuf[PCRYPT_MAXDSZ]);
+/**
+ * proto_crypt_dec_batch(ibuf, npackets, iov, k):
+ * Verify the MACs of ${npackets} consecutive PCRYPT_ESZ-byte packets from
+ * ${ibuf} using the keys in ${k}, and then decrypt them in place.  If all of
+ * the packets are valid, point the ${npackets} elements of ${iov} at the
+ * data within each decrypted packet and return the total length; otherwise,
+ * return -1.
+ */
+ssize_t
+proto_crypt_dec_batch(uint8_t * ibuf, size_t npackets, struct iovec * iov,
+    struct proto_keys * k)
+{
+	ssize_t totlen;
 
-	/* Make sure nobody is being evil here... */
-	if ((len == 0) || (len > PCRYPT_MAXDSZ))
+	/* Verify and decrypt the packets. */
+	if ((totlen = k->engine->dec_batch(k->ks, k->pnum, ibuf, npackets,
+	    iov)) == -1)
 		return (-1);
 
-	/* Copy the bytes into the output buffer. */
-	memcpy(obuf, ibuf, len);
+	/* Increment packet number. */
+	k->pnum += npackets;
 
-	/* Return the decrypted length. */
-	return ((ssize_t)len);
+	/* Return the total decrypted length. */
+	return (totlen);
 }
 
 /**
@@ -432,8 +477,8 @@ proto_crypt_free(struct proto_keys * k)
 	if (k == NULL)
 		return;
 
-	/* Free the AES key. */
-	crypto_aes_key_free(k->k_aes);
+	/* Free the engine's key state. */
+	k->engine->keyfree(k->ks);
 
 	/* Free the key structure. */
 	free(k);
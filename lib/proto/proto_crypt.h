@@ -10,6 +10,9 @@
 struct proto_keys;
 struct proto_secret;
 
+/* Buffer descriptor, from <sys/uio.h>. */
+struct iovec;
+
 /* Size of nonce. */
 #define PCRYPT_NONCE_LEN 32
 
@@ -81,12 +84,27 @@ int proto_crypt_mkkeys(const struct proto_secret *,
 /* Size of an encrypted packet. */
 #define PCRYPT_ESZ (PCRYPT_MAXDSZ + 4 /* len */ + 32 /* hmac */)
 
+/* Number of packets needed to hold ${len} bytes; at least one. */
+#define PCRYPT_NPACKETS(len)						\
+	(((len) == 0) ? 1 : ((len) + PCRYPT_MAXDSZ - 1) / PCRYPT_MAXDSZ)
+
 /**
  * proto_crypt_enc(ibuf, len, obuf, k):
  * Encrypt ${len} bytes from ${ibuf} into PCRYPT_ESZ bytes using the keys in
- * ${k}, and write the result into ${obuf}.
+ * ${k}, and write the result into ${obuf}.  The buffers must not overlap.
+ * Return 0 on success or -1 on error.
+ */
+int proto_crypt_enc(uint8_t *, size_t, uint8_t[PCRYPT_ESZ],
+    struct proto_keys *);
+
+/**
+ * proto_crypt_enc_batch(ibuf, len, obuf, k):
+ * Encrypt ${len} bytes from ${ibuf} into PCRYPT_NPACKETS(${len}) consecutive
+ * PCRYPT_ESZ-byte packets using the keys in ${k}, and write the result into
+ * ${obuf}.  Each packet except the last holds PCRYPT_MAXDSZ bytes.  The
+ * buffers must not overlap.  Return 0 on success or -1 on error.
  */
-void proto_crypt_enc(uint8_t *, size_t, uint8_t[PCRYPT_ESZ],
+int proto_crypt_enc_batch(const uint8_t *, size_t, uint8_t *,
     struct proto_keys *);
 
 /**
@@ -97,6 +115,17 @@ void proto_crypt_enc(uint8_t *, size_t, uint8_t[PCRYPT_ESZ],
  */
 ssize_t proto_crypt_dec(uint8_t[PCRYPT_ESZ], uint8_t *, struct proto_keys *);
 
+/**
+ * proto_crypt_dec_batch(ibuf, npackets, iov, k):
+ * Verify the MACs of ${npackets} consecutive PCRYPT_ESZ-byte packets from
+ * ${ibuf} using the keys in ${k}, and then decrypt them in place.  If all of
+ * the packets are valid, point the ${npackets} elements of ${iov} at the
+ * data within each decrypted packet and return the total length; otherwise,
+ * return -1.
+ */
+ssize_t proto_crypt_dec_batch(uint8_t *, size_t, struct iovec *,
+    struct proto_keys *);
+
 /**
  * proto_crypt_secret_free(K):
  * Free the protocol secret structure ${K}.
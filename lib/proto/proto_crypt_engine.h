@@ -0,0 +1,77 @@
+#ifndef _PROTO_CRYPT_ENGINE_H_
+#define _PROTO_CRYPT_ENGINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* Buffer descriptor, from <sys/uio.h>. */
+struct iovec;
+
+/*
+ * A packet encryption engine: an implementation of the spiped packet format
+ * (AES-256-CTR encryption of the data, padding and length, using the packet
+ * number as the nonce, followed by an HMAC-SHA256 of the encrypted bytes and
+ * the packet number).  All engines must produce identical output.
+ */
+struct proto_crypt_engine {
+	/* Name used to select the engine. */
+	const char * name;
+
+	/**
+	 * keysetup(kbuf):
+	 * Convert the 32-byte AES key and 32-byte HMAC key in the 64 bytes of
+	 * ${kbuf} into engine-specific key state.  Return NULL on error.
+	 */
+	void * (* keysetup)(const uint8_t[64]);
+
+	/**
+	 * enc_batch(ks, pnum, ibuf, len, obuf):
+	 * Encrypt ${len} bytes from ${ibuf} as PCRYPT_NPACKETS(${len})
+	 * consecutive PCRYPT_ESZ-byte packets in ${obuf}, using the key state
+	 * ${ks} and packet numbers starting at ${pnum}.  Each packet except
+	 * the last holds PCRYPT_MAXDSZ bytes.  The buffers must not overlap.
+	 * Return 0 on success or -1 on error.
+	 */
+	int (* enc_batch)(void *, uint64_t, const uint8_t *, size_t,
+	    uint8_t *);
+
+	/**
+	 * dec_batch(ks, pnum, ibuf, npackets, iov):
+	 * Verify the MACs of ${npackets} consecutive PCRYPT_ESZ-byte packets
+	 * from ${ibuf} using the key state ${ks} and packet numbers starting at
+	 * ${pnum}, and then decrypt them in place.  If all of the packets are
+	 * valid, point the ${npackets} elements of ${iov} at the data within
+	 * each decrypted packet and return the total length; otherwise, return
+	 * -1.
+	 */
+	ssize_t (* dec_batch)(void *, uint64_t, uint8_t *, size_t,
+	    struct iovec *);
+
+	/**
+	 * keyfree(ks):
+	 * Free the key state ${ks}.  Must be compatible with free(NULL).
+	 */
+	void (* keyfree)(void *);
+};
+
+/* Engines. */
+extern const struct proto_crypt_engine proto_crypt_engine_libcperciva;
+extern const struct proto_crypt_engine proto_crypt_engine_openssl;
+
+/* NULL-terminated list of engines, starting with the default engine. */
+extern const struct proto_crypt_engine * const proto_crypt_engines[];
+
+/**
+ * proto_crypt_engine_lookup(name):
+ * Return the engine called ${name}, or NULL if there is no such engine.
+ */
+const struct proto_crypt_engine * proto_crypt_engine_lookup(const char *);
+
+/**
+ * proto_crypt_engine_select(engine):
+ * Use ${engine} for protocol key structures created from now on.
+ */
+void proto_crypt_engine_select(const struct proto_crypt_engine *);
+
+#endif /* !_PROTO_CRYPT_ENGINE_H_ */
@@ -0,0 +1,207 @@
+#include <sys/uio.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crypto_aes.h"
+#include "crypto_aesctr.h"
+#include "crypto_verify_bytes.h"
+#include "ctassert.h"
+#include "insecure_memzero.h"
+#include "sha256.h"
+#include "sysendian.h"
+
+#include "proto_crypt.h"
+
+#include "proto_crypt_engine.h"
+
+/* Packet encryption using the libcperciva AES and SHA256 code. */
+struct libcperciva_keys {
+	struct crypto_aes_key * k_aes;
+	struct crypto_aesctr * stream;
+	HMAC_SHA256_MIDSTATE hmac;
+};
+
+/*
+ * The packet HMAC covers the PCRYPT_MAXDSZ + 4 encrypted bytes followed by
+ * the 8-byte packet number.  Together with the 64-byte HMAC key block, the
+ * inner hash thus processes (PCRYPT_MAXDSZ + 4) / 64 full blocks of packet
+ * data followed by a final block holding the remaining bytes of packet data,
+ * the packet number, and SHA256 padding for a constant length.
+ */
+#define HMAC_NBLOCKS ((PCRYPT_MAXDSZ + 4) / 64)
+#define HMAC_TAILLEN ((PCRYPT_MAXDSZ + 4) % 64)
+#define HMAC_MSGLEN (64 + PCRYPT_MAXDSZ + 4 + 8)
+CTASSERT(HMAC_TAILLEN + 8 == HMAC_MSGLEN % 64);
+CTASSERT(HMAC_MSGLEN % 64 < 56);
+static const uint8_t hmac_lastblock[64] = SHA256_PADBLOCK(HMAC_MSGLEN);
+
+/**
+ * packet_hmac(k, pnum, buf, hbuf):
+ * Compute the HMAC of the PCRYPT_MAXDSZ + 4 bytes in ${buf} and the packet
+ * number ${pnum} using the keys in ${k}, and write it into ${hbuf}.
+ */
+static void
+packet_hmac(const struct libcperciva_keys * k, uint64_t pnum,
+    const uint8_t * buf, uint8_t hbuf[32])
+{
+	uint8_t lastblock[64];
+
+	/* Fill in the data tail and packet number; padding is precomputed. */
+	memcpy(lastblock, hmac_lastblock, 64);
+	memcpy(lastblock, &buf[HMAC_NBLOCKS * 64], HMAC_TAILLEN);
+	be64enc(&lastblock[HMAC_TAILLEN], pnum);
+
+	/* Hash the full blocks directly from the packet buffer. */
+	HMAC_SHA256_Midstate_Final(hbuf, &k->hmac, buf, HMAC_NBLOCKS,
+	    lastblock);
+}
+
+/* Free the key state ${cookie}. */
+static void
+keyfree(void * cookie)
+{
+	struct libcperciva_keys * k = cookie;
+
+	/* Be compatible with free(NULL). */
+	if (k == NULL)
+		return;
+
+	/* Free the AES-CTR stream and the AES key. */
+	crypto_aesctr_free(k->stream);
+	crypto_aes_key_free(k->k_aes);
+
+	/* Clear the HMAC key states from memory. */
+	insecure_memzero(&k->hmac, sizeof(HMAC_SHA256_MIDSTATE));
+
+	/* Free the key structure. */
+	free(k);
+}
+
+/* Convert the 64 bytes of ${kbuf} into key state. */
+static void *
+keysetup(const uint8_t kbuf[64])
+{
+	struct libcperciva_keys * k;
+
+	/* Allocate a structure. */
+	if ((k = malloc(sizeof(struct libcperciva_keys))) == NULL)
+		goto err0;
+
+	/* Expand the AES key. */
+	if ((k->k_aes = crypto_aes_key_expand(&kbuf[0], 32)) == NULL)
+		goto err1;
+
+	/* Allocate an AES-CTR stream for encrypting and decrypting. */
+	if ((k->stream = crypto_aesctr_alloc()) == NULL)
+		goto err2;
+
+	/* Precompute the inner and outer HMAC_SHA256 states. */
+	HMAC_SHA256_Midstate_Init(&k->hmac, &kbuf[32], 32);
+
+	/* Success! */
+	return (k);
+
+err2:
+	crypto_aes_key_free(k->k_aes);
+err1:
+	free(k);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Encrypt ${len} bytes from ${ibuf} into packets in ${obuf}. */
+static int
+enc_batch(void * cookie, uint64_t pnum, const uint8_t * ibuf, size_t len,
+    uint8_t * obuf)
+{
+	struct libcperciva_keys * k = cookie;
+	size_t plen;
+
+	do {
+		/* How much data goes into this packet? */
+		plen = (len > PCRYPT_MAXDSZ) ? PCRYPT_MAXDSZ : len;
+
+		/* Encrypt the data directly into the output buffer. */
+		crypto_aesctr_init2(k->stream, k->k_aes, pnum);
+		crypto_aesctr_stream(k->stream, ibuf, obuf, plen);
+
+		/* Pad up to PCRYPT_MAXDSZ with zeroes. */
+		memset(&obuf[plen], 0, PCRYPT_MAXDSZ - plen);
+
+		/* Add the length. */
+		be32enc(&obuf[PCRYPT_MAXDSZ], (uint32_t)plen);
+
+		/* Encrypt the padding and length in-place. */
+		crypto_aesctr_stream(k->stream, &obuf[plen], &obuf[plen],
+		    PCRYPT_MAXDSZ + 4 - plen);
+
+		/* Append an HMAC. */
+		packet_hmac(k, pnum, obuf, &obuf[PCRYPT_MAXDSZ + 4]);
+
+		/* Move on to the next packet. */
+		ibuf += plen;
+		len -= plen;
+		obuf += PCRYPT_ESZ;
+		pnum += 1;
+	} while (len > 0);
+
+	/* Success! */
+	return (0);
+}
+
+/* Verify and decrypt ${npackets} packets in place. */
+static ssize_t
+dec_batch(void * cookie, uint64_t pnum, uint8_t * ibuf, size_t npackets,
+    struct iovec * iov)
+{
+	struct libcperciva_keys * k = cookie;
+	uint8_t hbuf[32];
+	uint8_t * pbuf;
+	size_t totlen = 0;
+	size_t len;
+	size_t i;
+
+	/* Verify all of the HMACs before we decrypt anything. */
+	for (i = 0; i < npackets; i++) {
+		pbuf = &ibuf[i * PCRYPT_ESZ];
+		packet_hmac(k, pnum + i, pbuf, hbuf);
+		if (crypto_verify_bytes(hbuf, &pbuf[PCRYPT_MAXDSZ + 4], 32))
+			return (-1);
+	}
+
+	/* Decrypt the packets in place. */
+	for (i = 0; i < npackets; i++) {
+		pbuf = &ibuf[i * PCRYPT_ESZ];
+
+		/* Each packet uses its packet number as the AES-CTR nonce. */
+		crypto_aesctr_init2(k->stream, k->k_aes, pnum + i);
+		crypto_aesctr_stream(k->stream, pbuf, pbuf, PCRYPT_MAXDSZ + 4);
+
+		/* Parse length. */
+		len = be32dec(&pbuf[PCRYPT_MAXDSZ]);
+
+		/* Make sure nobody is being evil here... */
+		if ((len == 0) || (len > PCRYPT_MAXDSZ))
+			return (-1);
+
+		/* Record where the data is. */
+		iov[i].iov_base = pbuf;
+		iov[i].iov_len = len;
+		totlen += len;
+	}
+
+	/* Return the total decrypted length. */
+	return ((ssize_t)totlen);
+}
+
+const struct proto_crypt_engine proto_crypt_engine_libcperciva = {
+	.name = "libcperciva",
+	.keysetup = keysetup,
+	.enc_batch = enc_batch,
+	.dec_batch = dec_batch,
+	.keyfree = keyfree
+};
@@ -0,0 +1,272 @@
+#include <sys/uio.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+
+#include "crypto_verify_bytes.h"
+#include "insecure_memzero.h"
+#include "sysendian.h"
+#include "warnp.h"
+
+#include "proto_crypt.h"
+
+#include "proto_crypt_engine.h"
+
+/* OpenSSL 1.1.0 renamed these. */
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+
+/* Packet encryption using the OpenSSL EVP interface. */
+struct openssl_keys {
+	EVP_CIPHER_CTX * aes;
+	EVP_MD_CTX * ihash;
+	EVP_MD_CTX * ohash;
+	EVP_MD_CTX * hash;
+};
+
+/* Compute the HMAC of a packet, as in proto_crypt_libcperciva.c. */
+static int
+packet_hmac(struct openssl_keys * k, uint64_t pnum, const uint8_t * buf,
+    uint8_t hbuf[32])
+{
+	uint8_t pnum_be[8];
+	uint8_t ihbuf[32];
+
+	/* Inner hash: H(K ^ ipad || buf || pnum). */
+	be64enc(pnum_be, pnum);
+	if (!EVP_MD_CTX_copy_ex(k->hash, k->ihash) ||
+	    !EVP_DigestUpdate(k->hash, buf, PCRYPT_MAXDSZ + 4) ||
+	    !EVP_DigestUpdate(k->hash, pnum_be, 8) ||
+	    !EVP_DigestFinal_ex(k->hash, ihbuf, NULL))
+		goto err0;
+
+	/* Outer hash: H(K ^ opad || inner hash). */
+	if (!EVP_MD_CTX_copy_ex(k->hash, k->ohash) ||
+	    !EVP_DigestUpdate(k->hash, ihbuf, 32) ||
+	    !EVP_DigestFinal_ex(k->hash, hbuf, NULL))
+		goto err0;
+
+	/* Clean up. */
+	insecure_memzero(ihbuf, 32);
+
+	/* Success! */
+	return (0);
+
+err0:
+	insecure_memzero(ihbuf, 32);
+
+	/* Failure! */
+	warn0("OpenSSL HMAC-SHA256 failed");
+	return (-1);
+}
+
+/* Start encrypting or decrypting packet number ${pnum}. */
+static int
+packet_aes_init(struct openssl_keys * k, uint64_t pnum)
+{
+	uint8_t iv[16];
+
+	/* The nonce is the packet number, and the counter starts at zero. */
+	be64enc(&iv[0], pnum);
+	be64enc(&iv[8], 0);
+	if (!EVP_EncryptInit_ex(k->aes, NULL, NULL, NULL, iv)) {
+		warn0("OpenSSL AES-CTR failed");
+		return (-1);
+	}
+
+	/* Success! */
+	return (0);
+}
+
+/* Apply the AES-CTR keystream to ${len} bytes of ${in}, writing to ${out}. */
+static int
+packet_aes(struct openssl_keys * k, const uint8_t * in, uint8_t * out,
+    size_t len)
+{
+	int outl;
+
+	if (!EVP_EncryptUpdate(k->aes, out, &outl, in, (int)len)) {
+		warn0("OpenSSL AES-CTR failed");
+		return (-1);
+	}
+
+	/* Success! */
+	return (0);
+}
+
+/* Free the key state ${cookie}. */
+static void
+keyfree(void * cookie)
+{
+	struct openssl_keys * k = cookie;
+
+	/* Be compatible with free(NULL). */
+	if (k == NULL)
+		return;
+
+	/* OpenSSL wipes the key material when freeing these. */
+	EVP_MD_CTX_free(k->hash);
+	EVP_MD_CTX_free(k->ohash);
+	EVP_MD_CTX_free(k->ihash);
+	EVP_CIPHER_CTX_free(k->aes);
+
+	/* Free the key structure. */
+	free(k);
+}
+
+/* Convert the 64 bytes of ${kbuf} into key state. */
+static void *
+keysetup(const uint8_t kbuf[64])
+{
+	struct openssl_keys * k;
+	uint8_t pad[64];
+	size_t i;
+
+	/* Allocate a structure. */
+	if ((k = malloc(sizeof(struct openssl_keys))) == NULL)
+		goto err0;
+	k->aes = EVP_CIPHER_CTX_new();
+	k->ihash = EVP_MD_CTX_new();
+	k->ohash = EVP_MD_CTX_new();
+	k->hash = EVP_MD_CTX_new();
+	if ((k->aes == NULL) || (k->ihash == NULL) || (k->ohash == NULL) ||
+	    (k->hash == NULL)) {
+		warn0("Cannot allocate OpenSSL contexts");
+		goto err1;
+	}
+
+	/* Set the AES key; the IV is set for each packet. */
+	if (!EVP_EncryptInit_ex(k->aes, EVP_aes_256_ctr(), NULL, &kbuf[0],
+	    NULL)) {
+		warn0("Cannot set OpenSSL AES key");
+		goto err1;
+	}
+
+	/* Hash the inner and outer HMAC key blocks. */
+	memset(pad, 0x36, 64);
+	for (i = 0; i < 32; i++)
+		pad[i] ^= kbuf[32 + i];
+	if (!EVP_DigestInit_ex(k->ihash, EVP_sha256(), NULL) ||
+	    !EVP_DigestUpdate(k->ihash, pad, 64))
+		goto err2;
+	memset(pad, 0x5c, 64);
+	for (i = 0; i < 32; i++)
+		pad[i] ^= kbuf[32 + i];
+	if (!EVP_DigestInit_ex(k->ohash, EVP_sha256(), NULL) ||
+	    !EVP_DigestUpdate(k->ohash, pad, 64))
+		goto err2;
+
+	/* Clean up. */
+	insecure_memzero(pad, 64);
+
+	/* Success! */
+	return (k);
+
+err2:
+	insecure_memzero(pad, 64);
+	warn0("Cannot set OpenSSL HMAC key");
+err1:
+	keyfree(k);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Encrypt ${len} bytes from ${ibuf} into packets in ${obuf}. */
+static int
+enc_batch(void * cookie, uint64_t pnum, const uint8_t * ibuf, size_t len,
+    uint8_t * obuf)
+{
+	struct openssl_keys * k = cookie;
+	size_t plen;
+
+	do {
+		/* How much data goes into this packet? */
+		plen = (len > PCRYPT_MAXDSZ) ? PCRYPT_MAXDSZ : len;
+
+		/* Add the padding and length, and encrypt the packet. */
+		memset(&obuf[plen], 0, PCRYPT_MAXDSZ - plen);
+		be32enc(&obuf[PCRYPT_MAXDSZ], (uint32_t)plen);
+		if (packet_aes_init(k, pnum) ||
+		    packet_aes(k, ibuf, obuf, plen) ||
+		    packet_aes(k, &obuf[plen], &obuf[plen],
+			PCRYPT_MAXDSZ + 4 - plen))
+			goto err0;
+
+		/* Append an HMAC. */
+		if (packet_hmac(k, pnum, obuf, &obuf[PCRYPT_MAXDSZ + 4]))
+			goto err0;
+
+		/* Move on to the next packet. */
+		ibuf += plen;
+		len -= plen;
+		obuf += PCRYPT_ESZ;
+		pnum += 1;
+	} while (len > 0);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Verify and decrypt ${npackets} packets in place. */
+static ssize_t
+dec_batch(void * cookie, uint64_t pnum, uint8_t * ibuf, size_t npackets,
+    struct iovec * iov)
+{
+	struct openssl_keys * k = cookie;
+	uint8_t hbuf[32];
+	uint8_t * pbuf;
+	size_t totlen = 0;
+	size_t len;
+	size_t i;
+
+	/* Verify all of the HMACs before we decrypt anything. */
+	for (i = 0; i < npackets; i++) {
+		pbuf = &ibuf[i * PCRYPT_ESZ];
+		if (packet_hmac(k, pnum + i, pbuf, hbuf))
+			return (-1);
+		if (crypto_verify_bytes(hbuf, &pbuf[PCRYPT_MAXDSZ + 4], 32))
+			return (-1);
+	}
+
+	/* Decrypt the packets in place. */
+	for (i = 0; i < npackets; i++) {
+		pbuf = &ibuf[i * PCRYPT_ESZ];
+		if (packet_aes_init(k, pnum + i) ||
+		    packet_aes(k, pbuf, pbuf, PCRYPT_MAXDSZ + 4))
+			return (-1);
+
+		/* Parse length. */
+		len = be32dec(&pbuf[PCRYPT_MAXDSZ]);
+
+		/* Make sure nobody is being evil here... */
+		if ((len == 0) || (len > PCRYPT_MAXDSZ))
+			return (-1);
+
+		/* Record where the data is. */
+		iov[i].iov_base = pbuf;
+		iov[i].iov_len = len;
+		totlen += len;
+	}
+
+	/* Return the total decrypted length. */
+	return ((ssize_t)totlen);
+}
+
+const struct proto_crypt_engine proto_crypt_engine_openssl = {
+	.name = "openssl",
+	.keysetup = keysetup,
+	.enc_batch = enc_batch,
+	.dec_batch = dec_batch,
+	.keyfree = keyfree
+};
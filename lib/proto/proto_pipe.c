@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -15,6 +16,12 @@
 /* Maximum size of data to output in a single callback_pipe_read() call. */
 #define OUTBUFSIZE (8 * PCRYPT_ESZ)
 
+/* Maximum number of packets to decrypt in a single callback_pipe_read(). */
+#define MAXDECPACKETS 8
+
+/* Maximum size of data to encrypt in a single callback_pipe_read() call. */
+#define MAXENCSIZE ((OUTBUFSIZE / PCRYPT_ESZ) * PCRYPT_MAXDSZ)
+
 struct pipe_cookie {
 	int (* callback)(void *);
 	void * cookie;
@@ -24,11 +31,12 @@ struct pipe_cookie {
 	int decr;
 	struct proto_keys * k;
 	uint8_t outbuf[OUTBUFSIZE];
+	struct iovec iov[MAXDECPACKETS];
 	struct netbuf_read * R;
 	void * write_cookie;
 	ssize_t wlen;
+	size_t consumelen;
 	size_t minread;
-	size_t full_buflen;
 };
 
 static int callback_pipe_read(void *, int);
@@ -60,16 +68,19 @@ proto_pipe(int s_in, int s_out, int decr, struct proto_keys * k,
 	P->k = k;
 	P->write_cookie = NULL;
 
-	/* Initialize reader. */
-	if ((P->R = netbuf_read_init(P->s_in)) == NULL)
+	/*
+	 * Initialize reader, with room for two full batches of packets; the
+	 * default buffer would hold fewer than four packets.  A single read
+	 * can then pick up the next batch while this one is being written,
+	 * and we know that more input is waiting without asking the kernel.
+	 */
+	if ((P->R = netbuf_read_init_buflen(P->s_in, P->decr ?
+	    2 * MAXDECPACKETS * PCRYPT_ESZ : 2 * MAXENCSIZE)) == NULL)
 		goto err1;
 
 	/* Set the minimum number of bytes to read. */
 	P->minread = P->decr ? PCRYPT_ESZ : 1;
 
-	/* Set the number of bytes in a full buffer. */
-	P->full_buflen = P->decr ? PCRYPT_ESZ : PCRYPT_MAXDSZ;
-
 	/* Start reading. */
 	if (netbuf_read_wait(P->R, P->minread, callback_pipe_read, P))
 		goto err2;
@@ -93,10 +104,9 @@ callback_pipe_read(void * cookie, int status)
 	struct pipe_cookie * P = cookie;
 	uint8_t * inbuf;
 	size_t inlen;
-	size_t inpos = 0;
-	size_t outpos = 0;
-	size_t loop_inlen;
-	ssize_t loop_outlen;
+	size_t npackets;
+	size_t leftover;
+	int wflags = 0;
 
 	/* Did we read EOF? */
 	if (status == 1)
@@ -110,47 +120,72 @@ callback_pipe_read(void * cookie, int status)
 	netbuf_read_peek(P->R, &inbuf, &inlen);
 
 	/* Process as many packets as possible. */
-	while (inlen > 0) {
-		/* Stop processing if we don't have space for more output. */
-		if (outpos + P->full_buflen > OUTBUFSIZE)
-			break;
+	if (P->decr) {
+		/* How many complete packets can we handle? */
+		npackets = inlen / PCRYPT_ESZ;
+		if (npackets > MAXDECPACKETS)
+			npackets = MAXDECPACKETS;
 
-		/* How many bytes should we process this time? */
-		loop_inlen = (inlen > P->full_buflen) ? P->full_buflen : inlen;
+		/*
+		 * Verify and decrypt them as a single batch, in place in the
+		 * netbuf buffer.  Any partial packet is left until the next
+		 * time callback_pipe_read() is called.
+		 */
+		if ((P->wlen = proto_crypt_dec_batch(inbuf, npackets,
+		    P->iov, P->k)) == -1)
+			goto fail;
+		P->consumelen = npackets * PCRYPT_ESZ;
+
+		/*
+		 * If another complete packet is already buffered, we will write
+		 * again as soon as this write completes; let the kernel hold
+		 * back a partial segment until then.
+		 */
+		leftover = inlen - P->consumelen;
+		if (leftover >= PCRYPT_ESZ)
+			wflags = NETWORK_WRITE_MORE;
 
 		/*
-		 * If we don't have enough data to decrypt, leave it until the
-		 * next time callback_pipe_read() is called.
+		 * Write the decrypted data straight out of the netbuf buffer;
+		 * it will be consumed once the write completes.
 		 */
-		if ((P->decr) && (loop_inlen < PCRYPT_ESZ))
-			break;
-
-		/* Encrypt or decrypt the data. */
-		if (P->decr) {
-			if ((loop_outlen = proto_crypt_dec(&inbuf[inpos],
-			    &P->outbuf[outpos], P->k)) == -1)
-				goto fail;
-		} else {
-			proto_crypt_enc(&inbuf[inpos], loop_inlen,
-			    &P->outbuf[outpos], P->k);
-			loop_outlen = PCRYPT_ESZ;
+		if ((P->write_cookie = network_writev_flags(P->s_out, P->iov,
+		    (int)npackets, (size_t)P->wlen, wflags,
+		    callback_pipe_write, P)) == NULL)
+			goto err0;
+	} else {
+		/* Don't encrypt more than we have space to output. */
+		leftover = 0;
+		if (inlen > MAXENCSIZE) {
+			leftover = inlen - MAXENCSIZE;
+			inlen = MAXENCSIZE;
 		}
 
-		/* We've processed this data. */
-		inlen -= loop_inlen;
-		inpos += loop_inlen;
-		outpos += (size_t)loop_outlen;
-	}
+		/* Encrypt straight from the netbuf buffer, as a batch. */
+		if (proto_crypt_enc_batch(inbuf, inlen, P->outbuf, P->k))
+			goto fail;
 
-	/* Let netbuf layer know what we've used. */
-	netbuf_read_consume(P->R, inpos);
+		/* Let netbuf layer know what we've used. */
+		netbuf_read_consume(P->R, inlen);
+		P->consumelen = 0;
 
-	/* Write the encrypted or decrypted data. */
-	P->wlen = (ssize_t)outpos;
-	if ((P->write_cookie = network_write(P->s_out, P->outbuf,
-	    (size_t)P->wlen, (size_t)P->wlen, callback_pipe_write,
-	    P)) == NULL)
-		goto err0;
+		/*
+		 * If more input is already buffered, we will write again as
+		 * soon as this write completes; but if the buffer has drained,
+		 * send everything now so that interactive traffic isn't held.
+		 */
+		if (leftover > 0)
+			wflags = NETWORK_WRITE_MORE;
+
+		/* Write the encrypted data. */
+		P->wlen = (ssize_t)(PCRYPT_NPACKETS(inlen) * PCRYPT_ESZ);
+		P->iov[0].iov_base = P->outbuf;
+		P->iov[0].iov_len = (size_t)P->wlen;
+		if ((P->write_cookie = network_writev_flags(P->s_out, P->iov,
+		    1, (size_t)P->wlen, wflags, callback_pipe_write,
+		    P)) == NULL)
+			goto err0;
+	}
 
 	/* Success! */
 	return (0);
@@ -192,6 +227,9 @@ callback_pipe_write(void * cookie, ssize_t len)
 	if (len < P->wlen)
 		goto fail;
 
+	/* Release any input which was written directly from the buffer. */
+	netbuf_read_consume(P->R, P->consumelen);
+
 	/* Launch another read. */
 	if (netbuf_read_wait(P->R, P->minread, callback_pipe_read, P))
 		goto err0;
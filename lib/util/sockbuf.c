@@ -0,0 +1,251 @@
+/* We use non-POSIX functionality in this file. */
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+/* On Linux, struct tcp_info is only visible with extensions enabled. */
+#if defined(__linux__)
+#define _GNU_SOURCE 1
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#if defined(__FreeBSD__)
+#include <sys/sysctl.h>
+#endif
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "sockbuf.h"
+
+/*
+ * Linux and FreeBSD report the kernel's smoothed round-trip time estimate,
+ * in microseconds, via the TCP_INFO socket option.
+ */
+#if defined(TCP_INFO) && (defined(__linux__) || defined(__FreeBSD__))
+#define HAVE_TCP_INFO_RTT
+#endif
+
+/*
+ * Linux doubles the buffer sizes it is asked for, to allow for bookkeeping
+ * overhead, and reports the doubled sizes; we report the sizes granted.
+ */
+#if defined(__linux__)
+#define BUFSIZE_SCALE 2
+#else
+#define BUFSIZE_SCALE 1
+#endif
+
+/*
+ * Limits on each buffer: the largest size which setsockopt(2) will grant,
+ * and the largest size to which automatic tuning can grow it; 0 if unknown.
+ * These are looked up once, the first time they are needed.
+ */
+static struct bufopt {
+	int opt;
+	const char * setmax_name;
+	const char * automax_name;
+	size_t setmax;
+	size_t automax;
+	int known;
+} bufopts[] = {
+#if defined(__linux__)
+	{ SO_SNDBUF, "/proc/sys/net/core/wmem_max",
+	    "/proc/sys/net/ipv4/tcp_wmem", 0, 0, 0 },
+	{ SO_RCVBUF, "/proc/sys/net/core/rmem_max",
+	    "/proc/sys/net/ipv4/tcp_rmem", 0, 0, 0 }
+#elif defined(__FreeBSD__)
+	{ SO_SNDBUF, NULL, "net.inet.tcp.sendbuf_max", 0, 0, 0 },
+	{ SO_RCVBUF, NULL, "net.inet.tcp.recvbuf_max", 0, 0, 0 }
+#else
+	{ SO_SNDBUF, NULL, NULL, 0, 0, 0 },
+	{ SO_RCVBUF, NULL, NULL, 0, 0, 0 }
+#endif
+};
+
+/* Return the last number in the system setting ${name}, or 0 if unknown. */
+static size_t
+getlimit(const char * name)
+{
+#if defined(__linux__)
+	FILE * f;
+	unsigned long val, last = 0;
+
+	/* Read the numbers in the /proc file, and keep the last one. */
+	if ((f = fopen(name, "r")) == NULL)
+		return (0);
+	while (fscanf(f, "%lu", &val) == 1)
+		last = val;
+	fclose(f);
+
+	/* Return the limit. */
+	return ((size_t)last);
+#elif defined(__FreeBSD__)
+	u_long val;
+	size_t len = sizeof(val);
+
+	/* Ask the kernel. */
+	if (sysctlbyname(name, &val, &len, NULL, 0) || (len != sizeof(val)))
+		return (0);
+
+	/* Return the limit. */
+	return ((size_t)val);
+#else
+	(void)name; /* UNUSED */
+
+	/* We don't know how to find out. */
+	return (0);
+#endif
+}
+
+/* Return the size of the buffer ${B} of ${s}, or 0 on error. */
+static size_t
+getsize(int s, const struct bufopt * B)
+{
+	int val;
+	socklen_t len = sizeof(val);
+
+	/* Ask the kernel, and undo any doubling. */
+	if (getsockopt(s, SOL_SOCKET, B->opt, &val, &len) || (val <= 0))
+		return (0);
+	return ((size_t)val / BUFSIZE_SCALE);
+}
+
+/* Raise the buffer ${B} of ${s} to ${size}; return the size it can reach. */
+static size_t
+raise1(int s, struct bufopt * B, size_t size)
+{
+	size_t cur;
+	size_t target;
+	int val;
+
+	/* Look up the limits on this buffer, if we haven't already. */
+	if (!B->known) {
+		if (B->setmax_name != NULL)
+			B->setmax = getlimit(B->setmax_name);
+		if (B->automax_name != NULL)
+			B->automax = getlimit(B->automax_name);
+		B->known = 1;
+	}
+
+	/* How big is the buffer now, and how big can we make it? */
+	if ((cur = getsize(s, B)) == 0)
+		return (0);
+	target = size;
+	if ((B->setmax != 0) && (target > B->setmax))
+		target = B->setmax;
+
+	/*
+	 * Setting a size turns off automatic tuning; don't do it unless we'd
+	 * get a larger buffer than we have, or than automatic tuning can reach.
+	 */
+	if ((target <= cur) || (target <= B->automax))
+		return ((cur > B->automax) ? cur : B->automax);
+
+	/* Ask for the size, and see what we actually got. */
+	val = (target > INT_MAX) ? INT_MAX : (int)target;
+	if (setsockopt(s, SOL_SOCKET, B->opt, &val, sizeof(val)))
+		return (0);
+	return (getsize(s, B));
+}
+
+/**
+ * sockbuf_set(s, size):
+ * Set the send and receive buffer sizes of the socket ${s} to ${size} bytes.
+ * This turns off any automatic tuning of the buffer sizes by the operating
+ * system.  Return the smaller of the send and receive buffer sizes granted
+ * by the operating system (which may be less than ${size} due to
+ * system-wide limits), or 0 on error.
+ */
+size_t
+sockbuf_set(int s, size_t size)
+{
+	int val;
+	size_t sndbuf, rcvbuf;
+
+	/* The socket API uses an int. */
+	val = (size > INT_MAX) ? INT_MAX : (int)size;
+
+	/* Ask for the buffer sizes. */
+	if (setsockopt(s, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val)) ||
+	    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)))
+		goto err0;
+
+	/* See what we actually got. */
+	if (((sndbuf = getsize(s, &bufopts[0])) == 0) ||
+	    ((rcvbuf = getsize(s, &bufopts[1])) == 0))
+		goto err0;
+
+	/* Return the smaller of the two. */
+	return ((sndbuf < rcvbuf) ? sndbuf : rcvbuf);
+
+err0:
+	/* Failure! */
+	return (0);
+}
+
+/**
+ * sockbuf_raise(s, size):
+ * Raise the send and receive buffer sizes of the socket ${s} to ${size}
+ * bytes, as far as system-wide limits allow.  Since setting a size turns
+ * off automatic tuning of that buffer, leave each buffer alone unless this
+ * would make it larger than it is now and than automatic tuning could make
+ * it.  Return the smaller of the sizes which the send and receive buffers
+ * can now reach, by either means, or 0 on error.
+ */
+size_t
+sockbuf_raise(int s, size_t size)
+{
+	size_t sndbuf, rcvbuf;
+
+	/* Raise each buffer separately, since their limits differ. */
+	if (((sndbuf = raise1(s, &bufopts[0], size)) == 0) ||
+	    ((rcvbuf = raise1(s, &bufopts[1], size)) == 0))
+		goto err0;
+
+	/* Return the smaller of the two. */
+	return ((sndbuf < rcvbuf) ? sndbuf : rcvbuf);
+
+err0:
+	/* Failure! */
+	return (0);
+}
+
+/**
+ * sockbuf_rtt(s, rtt):
+ * Set ${rtt} to the smoothed round-trip time, in seconds, which the kernel
+ * has measured for the TCP socket ${s}.  Return 0 on success, or -1 if the
+ * round-trip time is not available (e.g., ${s} is not a TCP socket, or the
+ * platform doesn't support TCP_INFO).
+ */
+int
+sockbuf_rtt(int s, double * rtt)
+{
+#ifdef HAVE_TCP_INFO_RTT
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+
+	/* Ask the kernel; a zero RTT means there is no estimate yet. */
+	if (getsockopt(s, IPPROTO_TCP, TCP_INFO, &ti, &len) ||
+	    (ti.tcpi_rtt == 0))
+		goto err0;
+
+	/* Convert from microseconds. */
+	*rtt = ti.tcpi_rtt / 1000000.0;
+
+	/* Success! */
+	return (0);
+
+err0:
+#else
+	(void)s; /* UNUSED */
+	(void)rtt; /* UNUSED */
+#endif
+
+	/* Failure! */
+	return (-1);
+}
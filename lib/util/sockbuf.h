@@ -0,0 +1,36 @@
+#ifndef _SOCKBUF_H_
+#define _SOCKBUF_H_
+
+#include <stddef.h>
+
+/**
+ * sockbuf_set(s, size):
+ * Set the send and receive buffer sizes of the socket ${s} to ${size} bytes.
+ * This turns off any automatic tuning of the buffer sizes by the operating
+ * system.  Return the smaller of the send and receive buffer sizes granted
+ * by the operating system (which may be less than ${size} due to
+ * system-wide limits), or 0 on error.
+ */
+size_t sockbuf_set(int, size_t);
+
+/**
+ * sockbuf_raise(s, size):
+ * Raise the send and receive buffer sizes of the socket ${s} to ${size}
+ * bytes, as far as system-wide limits allow.  Since setting a size turns
+ * off automatic tuning of that buffer, leave each buffer alone unless this
+ * would make it larger than it is now and than automatic tuning could make
+ * it.  Return the smaller of the sizes which the send and receive buffers
+ * can now reach, by either means, or 0 on error.
+ */
+size_t sockbuf_raise(int, size_t);
+
+/**
+ * sockbuf_rtt(s, rtt):
+ * Set ${rtt} to the smoothed round-trip time, in seconds, which the kernel
+ * has measured for the TCP socket ${s}.  Return 0 on success, or -1 if the
+ * round-trip time is not available (e.g., ${s} is not a TCP socket, or the
+ * platform doesn't support TCP_INFO).
+ */
+int sockbuf_rtt(int, double *);
+
+#endif /* !_SOCKBUF_H_ */
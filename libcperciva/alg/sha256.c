@@ -5,6 +5,7 @@
 #include "cpusupport.h"
 #include "insecure_memzero.h"
 #include "sha256_arm.h"
+#include "sha256_avx2.h"
 #include "sha256_shani.h"
 #include "sha256_sse2.h"
 #include "sysendian.h"
@@ -13,6 +14,7 @@
 #include "sha256.h"
 
 #if defined(CPUSUPPORT_X86_SHANI) && defined(CPUSUPPORT_X86_SSSE3) ||	\
+    defined(CPUSUPPORT_X86_AVX2) && defined(CPUSUPPORT_X86_BMI2) ||	\
     defined(CPUSUPPORT_X86_SSE2) ||					\
     defined(CPUSUPPORT_ARM_SHA256)
 #define HWACCEL
@@ -22,6 +24,9 @@ static enum {
 #if defined(CPUSUPPORT_X86_SHANI) && defined(CPUSUPPORT_X86_SSSE3)
 	HW_X86_SHANI,
 #endif
+#if defined(CPUSUPPORT_X86_AVX2) && defined(CPUSUPPORT_X86_BMI2)
+	HW_X86_AVX2,
+#endif
 #if defined(CPUSUPPORT_X86_SSE2)
 	HW_X86_SSE2,
 #endif
@@ -159,19 +164,18 @@ hwtest(const uint32_t state[static restrict 8],
 	return (memcmp(state_sw, state_hw, sizeof(state_sw)));
 }
 
-/* Which type of hardware acceleration should we use, if any? */
+/*
+ * Which type of hardware acceleration should we use, if any?  Pick the
+ * fastest which is available, or only consider ${want} unless it is HW_UNSET.
+ */
 static void
-hwaccel_init(void)
+hwaccel_select(int want)
 {
 	uint32_t W[64];
 	uint32_t S[8];
 	uint8_t block[64];
 	uint8_t i;
 
-	/* If we've already set hwaccel, we're finished. */
-	if (hwaccel != HW_UNSET)
-		return;
-
 	/* Default to software. */
 	hwaccel = HW_SOFTWARE;
 
@@ -180,22 +184,108 @@ hwaccel_init(void)
 		block[i] = i;
 
 #if defined(CPUSUPPORT_X86_SHANI) && defined(CPUSUPPORT_X86_SSSE3)
-	CPUSUPPORT_VALIDATE(hwaccel, HW_X86_SHANI,
-	    cpusupport_x86_shani() && cpusupport_x86_ssse3(),
-	    hwtest(initial_state, block, W, S,
-		SHA256_Transform_shani_with_W_S));
+	if ((want == HW_UNSET) || (want == HW_X86_SHANI))
+		CPUSUPPORT_VALIDATE(hwaccel, HW_X86_SHANI,
+		    cpusupport_x86_shani() && cpusupport_x86_ssse3(),
+		    hwtest(initial_state, block, W, S,
+			SHA256_Transform_shani_with_W_S));
+#endif
+#if defined(CPUSUPPORT_X86_AVX2) && defined(CPUSUPPORT_X86_BMI2)
+	if ((want == HW_UNSET) || (want == HW_X86_AVX2))
+		CPUSUPPORT_VALIDATE(hwaccel, HW_X86_AVX2,
+		    cpusupport_x86_avx2() && cpusupport_x86_bmi2(),
+		    hwtest(initial_state, block, W, S,
+			SHA256_Transform_avx2));
 #endif
 #if defined(CPUSUPPORT_X86_SSE2)
-	CPUSUPPORT_VALIDATE(hwaccel, HW_X86_SSE2, cpusupport_x86_sse2(),
-	    hwtest(initial_state, block, W, S, SHA256_Transform_sse2));
+	if ((want == HW_UNSET) || (want == HW_X86_SSE2))
+		CPUSUPPORT_VALIDATE(hwaccel, HW_X86_SSE2,
+		    cpusupport_x86_sse2(),
+		    hwtest(initial_state, block, W, S,
+			SHA256_Transform_sse2));
 #endif
 #if defined(CPUSUPPORT_ARM_SHA256)
-	CPUSUPPORT_VALIDATE(hwaccel, HW_ARM_SHA256, cpusupport_arm_sha256(),
-	    hwtest(initial_state, block, W, S, SHA256_Transform_arm_with_W_S));
+	if ((want == HW_UNSET) || (want == HW_ARM_SHA256))
+		CPUSUPPORT_VALIDATE(hwaccel, HW_ARM_SHA256,
+		    cpusupport_arm_sha256(),
+		    hwtest(initial_state, block, W, S,
+			SHA256_Transform_arm_with_W_S));
 #endif
 }
+
+/* Use the fastest hardware acceleration, unless we've already chosen. */
+static void
+hwaccel_init(void)
+{
+
+	/* If we've already set hwaccel, we're finished. */
+	if (hwaccel != HW_UNSET)
+		return;
+
+	/* Pick the fastest. */
+	hwaccel_select(HW_UNSET);
+}
 #endif /* HWACCEL */
 
+/**
+ * SHA256_Transform_force(name):
+ * Use the SHA256 block compression function implementation ${name} ("SHANI",
+ * "AVX2", "SSE2", "SHA256" for the ARM instructions, or "software") from now
+ * on, rather than the fastest one available; this is intended for
+ * benchmarking.  Return 0 on success, or -1 if that implementation is not
+ * available on this system.
+ */
+int
+SHA256_Transform_force(const char * name)
+{
+#ifdef HWACCEL
+	int want;
+
+	/* Which implementation is this? */
+	if (strcmp(name, "software") == 0)
+		want = HW_SOFTWARE;
+	else
+#if defined(CPUSUPPORT_X86_SHANI) && defined(CPUSUPPORT_X86_SSSE3)
+	if (strcmp(name, "SHANI") == 0)
+		want = HW_X86_SHANI;
+	else
+#endif
+#if defined(CPUSUPPORT_X86_AVX2) && defined(CPUSUPPORT_X86_BMI2)
+	if (strcmp(name, "AVX2") == 0)
+		want = HW_X86_AVX2;
+	else
+#endif
+#if defined(CPUSUPPORT_X86_SSE2)
+	if (strcmp(name, "SSE2") == 0)
+		want = HW_X86_SSE2;
+	else
+#endif
+#if defined(CPUSUPPORT_ARM_SHA256)
+	if (strcmp(name, "SHA256") == 0)
+		want = HW_ARM_SHA256;
+	else
+#endif
+		goto err0;
+
+	/* Use it if the CPU supports it; otherwise, go back to the fastest. */
+	hwaccel_select(want);
+	if ((int)hwaccel != want) {
+		hwaccel_select(HW_UNSET);
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+#else
+	/* Only the software implementation is available. */
+	return ((strcmp(name, "software") == 0) ? 0 : -1);
+#endif /* HWACCEL */
+}
+
 /* Elementary functions used by SHA256 */
 #define Ch(x, y, z)	((x & (y ^ z)) ^ z)
 #define Maj(x, y, z)	((x & (y | z)) | (y & z))
@@ -254,6 +344,11 @@ SHA256_Transform(uint32_t state[static restrict 8],
 		SHA256_Transform_shani(state, block);
 		return;
 #endif
+#if defined(CPUSUPPORT_X86_AVX2) && defined(CPUSUPPORT_X86_BMI2)
+	case HW_X86_AVX2:
+		SHA256_Transform_avx2(state, block, W, S);
+		return;
+#endif
 #if defined(CPUSUPPORT_X86_SSE2)
 	case HW_X86_SSE2:
 		SHA256_Transform_sse2(state, block, W, S);
@@ -327,6 +422,12 @@ static const uint8_t PAD[64] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
+/*
+ * Padding for the outer HMAC-SHA256 hash, which always processes a 64-byte
+ * key block followed by a 32-byte inner hash, i.e., 768 bits.
+ */
+static const uint8_t HMAC_OPAD[64] = SHA256_PADBLOCK(64 + 32);
+
 /* Add padding and terminating bit-count. */
 static void
 SHA256_Pad(SHA256_CTX * ctx, uint32_t tmp32[static restrict 72])
@@ -626,6 +727,85 @@ HMAC_SHA256_Buf(const void * K, size_t Klen, const void * in, size_t len,
 	insecure_memzero(tmp8, 96);
 }
 
+/**
+ * HMAC_SHA256_Midstate_Init(mctx, K, Klen):
+ * Store into ${mctx} the inner and outer SHA256 states which result from
+ * processing the padded HMAC-SHA256 key derived from ${Klen} bytes of ${K}.
+ */
+void
+HMAC_SHA256_Midstate_Init(HMAC_SHA256_MIDSTATE * mctx, const void * K,
+    size_t Klen)
+{
+	HMAC_SHA256_CTX ctx;
+	uint32_t tmp32[72];
+	uint8_t tmp8[96];
+
+	/* Absorb the padded key into the inner and outer hashes. */
+	_HMAC_SHA256_Init(&ctx, K, Klen, tmp32, &tmp8[0], &tmp8[64]);
+
+	/* Each has processed exactly one block; keep only the states. */
+	memcpy(mctx->istate, ctx.ictx.state, sizeof(mctx->istate));
+	memcpy(mctx->ostate, ctx.octx.state, sizeof(mctx->ostate));
+
+	/* Clean the stack. */
+	insecure_memzero(&ctx, sizeof(HMAC_SHA256_CTX));
+	insecure_memzero(tmp32, sizeof(uint32_t) * 72);
+	insecure_memzero(tmp8, 96);
+}
+
+/**
+ * HMAC_SHA256_Midstate_Final(digest, mctx, in, nblocks, last):
+ * Compute the HMAC-SHA256, using the key states ${mctx}, of a message
+ * consisting of ${nblocks} 64-byte blocks from ${in} followed by the block
+ * ${last}, and write the result to ${digest}.  The block ${last} must hold
+ * the tail of the message followed by SHA256 padding for the length of the
+ * message plus the 64-byte key block, i.e., it is the final block of the
+ * inner hash.  No data is copied or buffered from ${in}.
+ */
+static void
+_HMAC_SHA256_Midstate_Final(uint8_t digest[32],
+    const HMAC_SHA256_MIDSTATE * mctx, const uint8_t * in, size_t nblocks,
+    const uint8_t last[64], uint32_t tmp32[static restrict 72],
+    uint32_t state[static restrict 8], uint8_t oblock[static restrict 64])
+{
+	size_t i;
+
+	/* Inner hash: continue from the state after the key block. */
+	memcpy(state, mctx->istate, 32);
+	for (i = 0; i < nblocks; i++)
+		SHA256_Transform(state, &in[i * 64], &tmp32[0], &tmp32[64]);
+	SHA256_Transform(state, last, &tmp32[0], &tmp32[64]);
+
+	/* The outer hash processes the inner hash plus fixed padding. */
+	be32enc_vect(&oblock[0], state, 32);
+	memcpy(&oblock[32], &HMAC_OPAD[32], 32);
+	memcpy(state, mctx->ostate, 32);
+	SHA256_Transform(state, oblock, &tmp32[0], &tmp32[64]);
+
+	/* Write the HMAC. */
+	be32enc_vect(digest, state, 32);
+}
+
+/* Wrapper function for intermediate-values sanitization. */
+void
+HMAC_SHA256_Midstate_Final(uint8_t digest[32],
+    const HMAC_SHA256_MIDSTATE * mctx, const uint8_t * in, size_t nblocks,
+    const uint8_t last[64])
+{
+	uint32_t tmp32[72];
+	uint32_t state[8];
+	uint8_t oblock[64];
+
+	/* Call the real function. */
+	_HMAC_SHA256_Midstate_Final(digest, mctx, in, nblocks, last, tmp32,
+	    state, oblock);
+
+	/* Clean the stack. */
+	insecure_memzero(tmp32, sizeof(uint32_t) * 72);
+	insecure_memzero(state, 32);
+	insecure_memzero(oblock, 64);
+}
+
 /**
  * PBKDF2_SHA256(passwd, passwdlen, salt, saltlen, c, buf, dkLen):
  * Compute PBKDF2(passwd, salt, c, dkLen) using HMAC-SHA256 as the PRF, and
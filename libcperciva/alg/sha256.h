@@ -12,12 +12,16 @@
 #define SHA256_Update libcperciva_SHA256_Update
 #define SHA256_Final libcperciva_SHA256_Final
 #define SHA256_Buf libcperciva_SHA256_Buf
+#define SHA256_Transform_force libcperciva_SHA256_Transform_force
 #define SHA256_CTX libcperciva_SHA256_CTX
 #define HMAC_SHA256_Init libcperciva_HMAC_SHA256_Init
 #define HMAC_SHA256_Update libcperciva_HMAC_SHA256_Update
 #define HMAC_SHA256_Final libcperciva_HMAC_SHA256_Final
 #define HMAC_SHA256_Buf libcperciva_HMAC_SHA256_Buf
 #define HMAC_SHA256_CTX libcperciva_HMAC_SHA256_CTX
+#define HMAC_SHA256_Midstate_Init libcperciva_HMAC_SHA256_Midstate_Init
+#define HMAC_SHA256_Midstate_Final libcperciva_HMAC_SHA256_Midstate_Final
+#define HMAC_SHA256_MIDSTATE libcperciva_HMAC_SHA256_MIDSTATE
 
 /* Context structure for SHA256 operations. */
 typedef struct {
@@ -51,6 +55,16 @@ void SHA256_Final(uint8_t[32], SHA256_CTX *);
  */
 void SHA256_Buf(const void *, size_t, uint8_t[32]);
 
+/**
+ * SHA256_Transform_force(name):
+ * Use the SHA256 block compression function implementation ${name} ("SHANI",
+ * "AVX2", "SSE2", "SHA256" for the ARM instructions, or "software") from now
+ * on, rather than the fastest one available; this is intended for
+ * benchmarking.  Return 0 on success, or -1 if that implementation is not
+ * available on this system.
+ */
+int SHA256_Transform_force(const char *);
+
 /* Context structure for HMAC-SHA256 operations. */
 typedef struct {
 	SHA256_CTX ictx;
@@ -84,6 +98,52 @@ void HMAC_SHA256_Final(uint8_t[32], HMAC_SHA256_CTX *);
  */
 void HMAC_SHA256_Buf(const void *, size_t, const void *, size_t, uint8_t[32]);
 
+/**
+ * SHA256_PADBLOCK(len):
+ * Expand to an initializer for a 64-byte block holding the SHA256 padding
+ * for a message of ${len} bytes, where ${len} is a constant expression with
+ * ${len} % 64 < 56.  The padding starts at offset ${len} % 64; the caller
+ * must copy the tail of the message into the bytes before it.
+ */
+#define SHA256_PADBLOCK(len) {						\
+	[(len) % 64] = 0x80,						\
+	[56] = (uint8_t)(((uint64_t)(len) << 3) >> 56),			\
+	[57] = (uint8_t)(((uint64_t)(len) << 3) >> 48),			\
+	[58] = (uint8_t)(((uint64_t)(len) << 3) >> 40),			\
+	[59] = (uint8_t)(((uint64_t)(len) << 3) >> 32),			\
+	[60] = (uint8_t)(((uint64_t)(len) << 3) >> 24),			\
+	[61] = (uint8_t)(((uint64_t)(len) << 3) >> 16),			\
+	[62] = (uint8_t)(((uint64_t)(len) << 3) >> 8),			\
+	[63] = (uint8_t)((uint64_t)(len) << 3)				\
+}
+
+/* Precomputed HMAC-SHA256 inner and outer hash states for a fixed key. */
+typedef struct {
+	uint32_t istate[8];
+	uint32_t ostate[8];
+} HMAC_SHA256_MIDSTATE;
+
+/**
+ * HMAC_SHA256_Midstate_Init(mctx, K, Klen):
+ * Store into ${mctx} the inner and outer SHA256 states which result from
+ * processing the padded HMAC-SHA256 key derived from ${Klen} bytes of ${K}.
+ */
+void HMAC_SHA256_Midstate_Init(HMAC_SHA256_MIDSTATE *, const void *, size_t);
+
+/**
+ * HMAC_SHA256_Midstate_Final(digest, mctx, in, nblocks, last):
+ * Compute the HMAC-SHA256, using the key states ${mctx}, of a message
+ * consisting of ${nblocks} 64-byte blocks from ${in} followed by the block
+ * ${last}, and write the result to ${digest}.  The block ${last} must hold
+ * the tail of the message followed by SHA256 padding for the length of the
+ * message plus the 64-byte key block, i.e., it is the final block of the
+ * inner hash; for messages of constant length this padding can be
+ * generated at compile time by SHA256_PADBLOCK(64 + length).  No data is
+ * copied or buffered from ${in}.
+ */
+void HMAC_SHA256_Midstate_Final(uint8_t[32], const HMAC_SHA256_MIDSTATE *,
+    const uint8_t *, size_t, const uint8_t[64]);
+
 /**
  * PBKDF2_SHA256(passwd, passwdlen, salt, saltlen, c, buf, dkLen):
  * Compute PBKDF2(passwd, salt, c, dkLen) using HMAC-SHA256 as the PRF, and
@@ -0,0 +1,193 @@
+#include "cpusupport.h"
+#if defined(CPUSUPPORT_X86_AVX2) && defined(CPUSUPPORT_X86_BMI2)
+/**
+ * CPUSUPPORT CFLAGS: X86_AVX2 X86_BMI2
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "sha256_avx2.h"
+
+/* SHA256 round constants. */
+static const uint32_t Krnd[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*
+ * Elementary functions used by SHA256.  With -mbmi2, the compiler turns
+ * ROTR into RORX, which does not modify the flags and takes a separate
+ * destination register, shortening the dependency chains in each round.
+ */
+#define Ch(x, y, z)	((x & (y ^ z)) ^ z)
+#define Maj(x, y, z)	((x & (y | z)) | (y & z))
+#define ROTR(x, n)	((x >> n) | (x << (32 - n)))
+#define S0(x)		(ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define S1(x)		(ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+
+/* SHA256 round function; ${k} includes the round constant. */
+#define RND(a, b, c, d, e, f, g, h, k)			\
+	h += S1(e) + Ch(e, f, g) + k;			\
+	d += h;						\
+	h += S0(a) + Maj(a, b, c)
+
+/* Adjusted round function for rotating state */
+#define RNDr(S, WK, i, ii)			\
+	RND(S[(64 - i) % 8], S[(65 - i) % 8],	\
+	    S[(66 - i) % 8], S[(67 - i) % 8],	\
+	    S[(68 - i) % 8], S[(69 - i) % 8],	\
+	    S[(70 - i) % 8], S[(71 - i) % 8],	\
+	    WK[i + ii])
+
+/* Message schedule computation */
+#define SHR32(x, n) (_mm_srli_epi32(x, n))
+#define ROTR32(x, n) (_mm_or_si128(SHR32(x, n), _mm_slli_epi32(x, (32-n))))
+#define s0_128(x) _mm_xor_si128(_mm_xor_si128(			\
+	ROTR32(x, 7), ROTR32(x, 18)), SHR32(x, 3))
+
+/**
+ * s1_128_half(a, sel):
+ * Compute s1 of the two words of ${a} selected by ${sel}, which must be
+ * either _MM_SHUFFLE(3, 3, 2, 2) for the upper two words or
+ * _MM_SHUFFLE(1, 1, 0, 0) for the lower two words; return them in the low
+ * two words of the result, with the high two words zeroed.
+ */
+#define s1_128_half(a, sel) (_mm_shuffle_epi8(				\
+	_mm_xor_si128(_mm_xor_si128(					\
+	    _mm_srli_epi64(_mm_shuffle_epi32(a, sel), 17),		\
+	    _mm_srli_epi64(_mm_shuffle_epi32(a, sel), 19)),		\
+	    _mm_srli_epi32(_mm_shuffle_epi32(a, sel), 10)),		\
+	_mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1,			\
+	    11, 10, 9, 8, 3, 2, 1, 0)))
+
+/**
+ * MSG4(X0, X1, X2, X3):
+ * Calculate the next four values of the message schedule.  If we define
+ * ${W[j]} as the first unknown value in the message schedule, then the input
+ * arguments are:
+ *     X0 = W[j - 16] : W[j - 13]
+ *     X1 = W[j - 12] : W[j - 9]
+ *     X2 = W[j - 8] : W[j - 5]
+ *     X3 = W[j - 4] : W[j - 1]
+ * This function therefore calculates:
+ *     X4 = W[j + 0] : W[j + 3]
+ */
+static inline __m128i
+MSG4(__m128i X0, __m128i X1, __m128i X2, __m128i X3)
+{
+	__m128i X4;
+
+	/* W[j - 16] + W[j - 7] + s0(W[j - 15]). */
+	X4 = _mm_add_epi32(X0, _mm_alignr_epi8(X3, X2, 4));
+	X4 = _mm_add_epi32(X4, s0_128(_mm_alignr_epi8(X1, X0, 4)));
+
+	/* First half of s1. */
+	X4 = _mm_add_epi32(X4, s1_128_half(X3, _MM_SHUFFLE(3, 3, 2, 2)));
+
+	/* Second half of s1; this depends on the above value of X4. */
+	X4 = _mm_add_epi32(X4, _mm_slli_si128(
+	    s1_128_half(X4, _MM_SHUFFLE(1, 1, 0, 0)), 8));
+
+	return (X4);
+}
+
+/**
+ * SHA256_Transform_avx2(state, block, W, S):
+ * Compute the SHA256 block compression function, transforming ${state} using
+ * the data in ${block}.  This implementation uses x86 AVX2 and BMI2
+ * instructions, and should only be used if CPUSUPPORT_X86_AVX2 and
+ * CPUSUPPORT_X86_BMI2 are defined and cpusupport_x86_avx2() and
+ * cpusupport_x86_bmi2() return nonzero.  The arrays W and S may be filled
+ * with sensitive data, and should be cleared by the callee.
+ */
+#ifdef POSIXFAIL_ABSTRACT_DECLARATOR
+void
+SHA256_Transform_avx2(uint32_t state[8], const uint8_t block[64],
+    uint32_t W[64], uint32_t S[8])
+#else
+void
+SHA256_Transform_avx2(uint32_t state[static restrict 8],
+    const uint8_t block[static restrict 64], uint32_t W[static restrict 64],
+    uint32_t S[static restrict 8])
+#endif
+{
+	const __m256i bswap = _mm256_set_epi8(
+	    12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+	    12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m256i Y0, Y1;
+	__m128i X[4];
+	int i;
+
+	/* 1. Prepare the first part of the message schedule W. */
+	Y0 = _mm256_shuffle_epi8(
+	    _mm256_loadu_si256((const __m256i *)&block[0]), bswap);
+	Y1 = _mm256_shuffle_epi8(
+	    _mm256_loadu_si256((const __m256i *)&block[32]), bswap);
+	X[0] = _mm256_castsi256_si128(Y0);
+	X[1] = _mm256_extracti128_si256(Y0, 1);
+	X[2] = _mm256_castsi256_si128(Y1);
+	X[3] = _mm256_extracti128_si256(Y1, 1);
+
+	/* 2. Compute the rest of the message schedule, plus round constants. */
+	for (i = 0; i < 64; i += 16) {
+		/* Store W[i] + K[i], eight words at a time. */
+		_mm256_storeu_si256((__m256i *)&W[i], _mm256_add_epi32(
+		    _mm256_set_m128i(X[1], X[0]),
+		    _mm256_loadu_si256((const __m256i *)&Krnd[i])));
+		_mm256_storeu_si256((__m256i *)&W[i + 8], _mm256_add_epi32(
+		    _mm256_set_m128i(X[3], X[2]),
+		    _mm256_loadu_si256((const __m256i *)&Krnd[i + 8])));
+
+		if (i == 48)
+			break;
+		X[0] = MSG4(X[0], X[1], X[2], X[3]);
+		X[1] = MSG4(X[1], X[2], X[3], X[0]);
+		X[2] = MSG4(X[2], X[3], X[0], X[1]);
+		X[3] = MSG4(X[3], X[0], X[1], X[2]);
+	}
+
+	/* 3. Initialize working variables. */
+	memcpy(S, state, 32);
+
+	/* 4. Mix. */
+	for (i = 0; i < 64; i += 16) {
+		RNDr(S, W, 0, i);
+		RNDr(S, W, 1, i);
+		RNDr(S, W, 2, i);
+		RNDr(S, W, 3, i);
+		RNDr(S, W, 4, i);
+		RNDr(S, W, 5, i);
+		RNDr(S, W, 6, i);
+		RNDr(S, W, 7, i);
+		RNDr(S, W, 8, i);
+		RNDr(S, W, 9, i);
+		RNDr(S, W, 10, i);
+		RNDr(S, W, 11, i);
+		RNDr(S, W, 12, i);
+		RNDr(S, W, 13, i);
+		RNDr(S, W, 14, i);
+		RNDr(S, W, 15, i);
+	}
+
+	/* 5. Mix local working variables into global state. */
+	for (i = 0; i < 8; i++)
+		state[i] += S[i];
+}
+#endif /* CPUSUPPORT_X86_AVX2 && CPUSUPPORT_X86_BMI2 */
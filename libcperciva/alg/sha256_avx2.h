@@ -0,0 +1,24 @@
+#ifndef _SHA256_AVX2_H_
+#define _SHA256_AVX2_H_
+
+#include <stdint.h>
+
+/**
+ * SHA256_Transform_avx2(state, block, W, S):
+ * Compute the SHA256 block compression function, transforming ${state} using
+ * the data in ${block}.  This implementation uses x86 AVX2 and BMI2
+ * instructions, and should only be used if CPUSUPPORT_X86_AVX2 and
+ * CPUSUPPORT_X86_BMI2 are defined and cpusupport_x86_avx2() and
+ * cpusupport_x86_bmi2() return nonzero.  The arrays W and S may be filled
+ * with sensitive data, and should be cleared by the callee.
+ */
+#ifdef POSIXFAIL_ABSTRACT_DECLARATOR
+void SHA256_Transform_avx2(uint32_t state[8],
+    const uint8_t block[64], uint32_t W[64], uint32_t S[8]);
+#else
+void SHA256_Transform_avx2(uint32_t[static restrict 8],
+    const uint8_t[static restrict 64], uint32_t W[static restrict 64],
+    uint32_t S[static restrict 8]);
+#endif
+
+#endif /* !_SHA256_AVX2_H_ */
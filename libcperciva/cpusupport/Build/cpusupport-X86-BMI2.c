@@ -0,0 +1,11 @@
+#include <immintrin.h>
+#include <stdint.h>
+
+int
+main(void)
+{
+	uint32_t x = 0x12345678;
+
+	x = _pdep_u32(x, 0x0f0f0f0f);
+	return ((int)(x & 0xff));
+}
@@ -123,6 +123,8 @@
  * compiled and linked in.
  */
 CPUSUPPORT_FEATURE(x86, aesni, X86_AESNI);
+CPUSUPPORT_FEATURE(x86, avx2, X86_AVX2);
+CPUSUPPORT_FEATURE(x86, bmi2, X86_BMI2);
 CPUSUPPORT_FEATURE(x86, rdrand, X86_RDRAND);
 CPUSUPPORT_FEATURE(x86, shani, X86_SHANI);
 CPUSUPPORT_FEATURE(x86, sse2, X86_SSE2);
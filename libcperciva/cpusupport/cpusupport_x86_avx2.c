@@ -0,0 +1,53 @@
+#include "cpusupport.h"
+
+#ifdef CPUSUPPORT_X86_CPUID_COUNT
+#include <cpuid.h>
+
+#define CPUID_OSXSAVE_BIT (1 << 27)
+#define CPUID_AVX_BIT (1 << 28)
+#define CPUID_AVX2_BIT (1 << 5)
+#define XCR0_SSE_AVX_BITS 0x6
+#endif
+
+CPUSUPPORT_FEATURE_DECL(x86, avx2)
+{
+#ifdef CPUSUPPORT_X86_CPUID_COUNT
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int maxlevel;
+
+	/* Check if CPUID supports the level we need. */
+	if (!__get_cpuid(0, &maxlevel, &ebx, &ecx, &edx))
+		goto unsupported;
+	if (maxlevel < 7)
+		goto unsupported;
+
+	/* Ask about CPU features. */
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		goto unsupported;
+
+	/* We need AVX, and the XGETBV instruction to check OS support. */
+	if ((ecx & (CPUID_OSXSAVE_BIT | CPUID_AVX_BIT)) !=
+	    (CPUID_OSXSAVE_BIT | CPUID_AVX_BIT))
+		goto unsupported;
+
+	/* Check that the OS saves the XMM and YMM registers. */
+	__asm__ __volatile__("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	if ((eax & XCR0_SSE_AVX_BITS) != XCR0_SSE_AVX_BITS)
+		goto unsupported;
+
+	/*
+	 * Ask about extended CPU features.  Note that this macro violates
+	 * the principle of being "function-like" by taking the variables
+	 * used for holding output registers as named parameters rather than
+	 * as pointers (which would be necessary if __cpuid_count were a
+	 * function).
+	 */
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	/* Return the relevant feature bit. */
+	return ((ebx & CPUID_AVX2_BIT) ? 1 : 0);
+
+unsupported:
+#endif
+	return (0);
+}
@@ -0,0 +1,150 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "warnp.h"
+
+#include "mpscq.h"
+
+/*
+ * Nodes are pushed onto a singly-linked stack; the consumer takes the whole
+ * stack at once and reverses it.  With compare-and-swap and atomic exchange
+ * operations this needs no locking; there is no ABA problem, since nothing
+ * but the consumer ever removes nodes and it removes all of them.
+ */
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+#define MPSCQ_ATOMIC
+#endif
+
+struct mpscq {
+	struct mpscq_node * head;
+#ifndef MPSCQ_ATOMIC
+	pthread_mutex_t mtx;
+#endif
+};
+
+/**
+ * mpscq_init(void):
+ * Create and return an empty queue.
+ */
+struct mpscq *
+mpscq_init(void)
+{
+	struct mpscq * Q;
+#ifndef MPSCQ_ATOMIC
+	int rc;
+#endif
+
+	/* Allocate a structure. */
+	if ((Q = malloc(sizeof(struct mpscq))) == NULL)
+		goto err0;
+
+	/* The queue is empty. */
+	Q->head = NULL;
+
+#ifndef MPSCQ_ATOMIC
+	/* Create a mutex. */
+	if ((rc = pthread_mutex_init(&Q->mtx, NULL)) != 0) {
+		warn0("pthread_mutex_init: %s", strerror(rc));
+		goto err1;
+	}
+#endif
+
+	/* Success! */
+	return (Q);
+
+#ifndef MPSCQ_ATOMIC
+err1:
+	free(Q);
+#endif
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * mpscq_push(Q, node):
+ * Add ${node} to the queue ${Q}.  This function is thread-safe.  Return 1 if
+ * the queue was empty, and 0 otherwise; the caller can use this to avoid
+ * waking the consumer if a previous push has already done so.
+ */
+int
+mpscq_push(struct mpscq * Q, struct mpscq_node * node)
+{
+	struct mpscq_node * head;
+
+#ifdef MPSCQ_ATOMIC
+	/* Link the node in front of the current head until nobody races us. */
+	head = __atomic_load_n(&Q->head, __ATOMIC_RELAXED);
+	do {
+		node->next = head;
+	} while (!__atomic_compare_exchange_n(&Q->head, &head, node, 1,
+	    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+#else
+	/* Lock, link, and unlock; mutexes cannot fail if used correctly. */
+	pthread_mutex_lock(&Q->mtx);
+	head = Q->head;
+	node->next = head;
+	Q->head = node;
+	pthread_mutex_unlock(&Q->mtx);
+#endif
+
+	/* Was the queue empty? */
+	return (head == NULL);
+}
+
+/**
+ * mpscq_drain(Q):
+ * Remove all of the nodes from the queue ${Q} and return them as a linked
+ * list, in the order they were pushed and terminated by a NULL next pointer;
+ * or return NULL if the queue is empty.  This function must only be called
+ * by one thread at once.
+ */
+struct mpscq_node *
+mpscq_drain(struct mpscq * Q)
+{
+	struct mpscq_node * head;
+	struct mpscq_node * list = NULL;
+	struct mpscq_node * next;
+
+	/* Take the whole stack. */
+#ifdef MPSCQ_ATOMIC
+	head = __atomic_exchange_n(&Q->head, NULL, __ATOMIC_ACQUIRE);
+#else
+	pthread_mutex_lock(&Q->mtx);
+	head = Q->head;
+	Q->head = NULL;
+	pthread_mutex_unlock(&Q->mtx);
+#endif
+
+	/* Reverse it so that the oldest node comes first. */
+	for (; head != NULL; head = next) {
+		next = head->next;
+		head->next = list;
+		list = head;
+	}
+
+	/* Return the list. */
+	return (list);
+}
+
+/**
+ * mpscq_free(Q):
+ * Free the queue ${Q}.  Any nodes still queued are not freed.
+ */
+void
+mpscq_free(struct mpscq * Q)
+{
+
+	/* Behave consistently with free(NULL). */
+	if (Q == NULL)
+		return;
+
+#ifndef MPSCQ_ATOMIC
+	/* Destroy the mutex. */
+	pthread_mutex_destroy(&Q->mtx);
+#endif
+
+	/* Free the structure. */
+	free(Q);
+}
@@ -0,0 +1,50 @@
+#ifndef _MPSCQ_H_
+#define _MPSCQ_H_
+
+/**
+ * Multiple-producer single-consumer queue.  Any number of threads may push
+ * nodes onto the queue concurrently; a single consumer thread removes all
+ * of the queued nodes at once.  Where the compiler provides atomic
+ * operations, pushing and draining are lock-free and take O(1) time (plus
+ * O(N) to put the N drained nodes back into order); otherwise, a mutex is
+ * used.  Queues do not allocate memory once created.
+ */
+
+/* Opaque queue type. */
+struct mpscq;
+
+/* Queue linkage; embed this in the structures being queued. */
+struct mpscq_node {
+	struct mpscq_node * next;
+};
+
+/**
+ * mpscq_init(void):
+ * Create and return an empty queue.
+ */
+struct mpscq * mpscq_init(void);
+
+/**
+ * mpscq_push(Q, node):
+ * Add ${node} to the queue ${Q}.  This function is thread-safe.  Return 1 if
+ * the queue was empty, and 0 otherwise; the caller can use this to avoid
+ * waking the consumer if a previous push has already done so.
+ */
+int mpscq_push(struct mpscq *, struct mpscq_node *);
+
+/**
+ * mpscq_drain(Q):
+ * Remove all of the nodes from the queue ${Q} and return them as a linked
+ * list, in the order they were pushed and terminated by a NULL next pointer;
+ * or return NULL if the queue is empty.  This function must only be called
+ * by one thread at once.
+ */
+struct mpscq_node * mpscq_drain(struct mpscq *);
+
+/**
+ * mpscq_free(Q):
+ * Free the queue ${Q}.  Any nodes still queued are not freed.
+ */
+void mpscq_free(struct mpscq *);
+
+#endif /* !_MPSCQ_H_ */
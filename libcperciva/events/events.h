@@ -76,6 +76,33 @@ void events_timer_cancel(void *);
  */
 int events_timer_reset(void *);
 
+/**
+ * events_wakeup_register(func, cookie):
+ * Register ${func}(${cookie}) to be run from the event loop after
+ * events_wakeup_signal() is called on the returned cookie.  Signals which
+ * arrive before ${func} has run are merged, so ${func} must handle all of
+ * the work which was waiting when it is called.  The registration remains
+ * in place until the cookie is passed to events_wakeup_cancel().
+ */
+void * events_wakeup_register(int (*)(void *), void *);
+
+/**
+ * events_wakeup_signal(cookie):
+ * Arrange for the function registered via events_wakeup_register() which
+ * returned ${cookie} to be run.  This function is thread-safe and may be
+ * called from threads other than the one running the event loop; it must
+ * not be called after events_wakeup_cancel().
+ */
+int events_wakeup_signal(void *);
+
+/**
+ * events_wakeup_cancel(cookie):
+ * Cancel the registration for which the cookie ${cookie} was returned by
+ * events_wakeup_register().  No thread may be calling
+ * events_wakeup_signal() on ${cookie}.
+ */
+void events_wakeup_cancel(void *);
+
 /**
  * events_run(void):
  * Run events.  Events registered via events_immediate_register() will be run
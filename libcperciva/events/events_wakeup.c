@@ -0,0 +1,230 @@
+/* We use non-POSIX functionality in this file. */
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+/*
+ * On Linux an eventfd is a cheaper wakeup mechanism than a pipe: it is a
+ * single descriptor with a counter in place of a buffer, so signalling it
+ * never blocks and draining it takes a single read(2).
+ */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/eventfd.h>)
+#define _DEFAULT_SOURCE 1
+
+#include <sys/eventfd.h>
+
+#if defined(EFD_NONBLOCK) && defined(EFD_CLOEXEC)
+#define EVENTS_WAKEUP_EVENTFD
+#endif
+#endif
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "warnp.h"
+
+#include "events.h"
+
+/*
+ * The pending flag records whether a wakeup has been signalled but not yet
+ * handled, so that a burst of signals costs one write(2) and one read(2).
+ */
+#if defined(__GNUC__) && defined(__ATOMIC_ACQ_REL)
+#define EVENTS_WAKEUP_ATOMIC
+#endif
+
+struct wakeup {
+	int (*func)(void *);
+	void * cookie;
+	int rfd;
+	int wfd;
+	int pending;
+};
+
+/* Callback for the read side of the wakeup descriptor becoming readable. */
+static int
+callback_wakeup(void * cookie)
+{
+	struct wakeup * W = cookie;
+#ifdef EVENTS_WAKEUP_EVENTFD
+	uint64_t cnt;
+#else
+	char buf[64];
+#endif
+	ssize_t len;
+
+	/* Drain the descriptor. */
+	do {
+#ifdef EVENTS_WAKEUP_EVENTFD
+		len = read(W->rfd, &cnt, sizeof(cnt));
+#else
+		len = read(W->rfd, buf, sizeof(buf));
+#endif
+	} while ((len > 0) || ((len == -1) && (errno == EINTR)));
+	if ((len == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+		warnp("read");
+		goto err0;
+	}
+
+	/*
+	 * Clear the pending flag before calling back, so that a signal which
+	 * arrives while the callback is running (and might not have been
+	 * seen by it) results in another wakeup.
+	 */
+#ifdef EVENTS_WAKEUP_ATOMIC
+	(void)__atomic_exchange_n(&W->pending, 0, __ATOMIC_ACQ_REL);
+#endif
+
+	/* Wait for the next wakeup. */
+	if (events_network_register(callback_wakeup, W, W->rfd,
+	    EVENTS_NETWORK_OP_READ)) {
+		warnp("events_network_register");
+		goto err0;
+	}
+
+	/* Do the work. */
+	return ((W->func)(W->cookie));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * events_wakeup_register(func, cookie):
+ * Register ${func}(${cookie}) to be run from the event loop after
+ * events_wakeup_signal() is called on the returned cookie.  Signals which
+ * arrive before ${func} has run are merged, so ${func} must handle all of
+ * the work which was waiting when it is called.  The registration remains
+ * in place until the cookie is passed to events_wakeup_cancel().
+ */
+void *
+events_wakeup_register(int (*func)(void *), void * cookie)
+{
+	struct wakeup * W;
+#ifndef EVENTS_WAKEUP_EVENTFD
+	int fd[2];
+#endif
+
+	/* Allocate a structure. */
+	if ((W = malloc(sizeof(struct wakeup))) == NULL)
+		goto err0;
+	W->func = func;
+	W->cookie = cookie;
+	W->pending = 0;
+
+	/* Create a non-blocking descriptor (pair). */
+#ifdef EVENTS_WAKEUP_EVENTFD
+	if ((W->rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		warnp("eventfd");
+		goto err1;
+	}
+	W->wfd = W->rfd;
+#else
+	if (pipe(fd)) {
+		warnp("pipe");
+		goto err1;
+	}
+	W->rfd = fd[0];
+	W->wfd = fd[1];
+	if (fcntl(W->rfd, F_SETFL, O_NONBLOCK) == -1) {
+		warnp("fcntl(O_NONBLOCK)");
+		goto err2;
+	}
+	if (fcntl(W->wfd, F_SETFL, O_NONBLOCK) == -1) {
+		warnp("fcntl(O_NONBLOCK)");
+		goto err2;
+	}
+#endif
+
+	/* Wait for a wakeup. */
+	if (events_network_register(callback_wakeup, W, W->rfd,
+	    EVENTS_NETWORK_OP_READ)) {
+		warnp("events_network_register");
+		goto err2;
+	}
+
+	/* Success! */
+	return (W);
+
+err2:
+	if (W->wfd != W->rfd)
+		close(W->wfd);
+	close(W->rfd);
+err1:
+	free(W);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * events_wakeup_signal(cookie):
+ * Arrange for the function registered via events_wakeup_register() which
+ * returned ${cookie} to be run.  This function is thread-safe and may be
+ * called from threads other than the one running the event loop; it must
+ * not be called after events_wakeup_cancel().
+ */
+int
+events_wakeup_signal(void * cookie)
+{
+	struct wakeup * W = cookie;
+#ifdef EVENTS_WAKEUP_EVENTFD
+	uint64_t cnt = 1;
+#else
+	char cnt = 0;
+#endif
+	ssize_t len;
+
+#ifdef EVENTS_WAKEUP_ATOMIC
+	/* If a wakeup is already pending, we don't need another one. */
+	if (__atomic_exchange_n(&W->pending, 1, __ATOMIC_ACQ_REL))
+		return (0);
+#endif
+
+	/*
+	 * Poke the descriptor.  If the pipe is full (or the eventfd counter
+	 * is saturated) it is already readable, so that's fine.
+	 */
+	do {
+		len = write(W->wfd, &cnt, sizeof(cnt));
+	} while ((len == -1) && (errno == EINTR));
+	if ((len == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+		warnp("write");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * events_wakeup_cancel(cookie):
+ * Cancel the registration for which the cookie ${cookie} was returned by
+ * events_wakeup_register().  No thread may be calling
+ * events_wakeup_signal() on ${cookie}.
+ */
+void
+events_wakeup_cancel(void * cookie)
+{
+	struct wakeup * W = cookie;
+
+	/* Stop waiting for wakeups. */
+	events_network_cancel(W->rfd, EVENTS_NETWORK_OP_READ);
+
+	/* Close the descriptor(s). */
+	if (W->wfd != W->rfd)
+		close(W->wfd);
+	close(W->rfd);
+
+	/* Free the structure. */
+	free(W);
+}
@@ -17,6 +17,13 @@ struct netbuf_write;
  */
 struct netbuf_read * netbuf_read_init(int);
 
+/**
+ * netbuf_read_init_buflen(s, buflen):
+ * Behave like netbuf_read_init, but buffer up to ${buflen} bytes at once
+ * (rather than 4096 bytes) unless a larger netbuf_read_wait() requires more.
+ */
+struct netbuf_read * netbuf_read_init_buflen(int, size_t);
+
 /**
  * netbuf_read_peek(R, data, datalen):
  * Set ${data} to point to the currently buffered data in the reader ${R}; set
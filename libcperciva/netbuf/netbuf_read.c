@@ -37,29 +37,15 @@ struct netbuf_read {
 	size_t datalen;			/* Position of write pointer in buf. */
 };
 
+/* Size of the buffer allocated by netbuf_read_init() and _init2(). */
+#define BUFLEN_DEFAULT 4096
+
 static int callback_success(void *);
 static int callback_read(void *, ssize_t);
 
-/**
- * netbuf_read_init(s):
- * Create and return a buffered reader attached to socket ${s}.  The caller
- * is responsible for ensuring that no attempts are made to read from said
- * socket except via the returned reader.
- */
-struct netbuf_read *
-netbuf_read_init(int s)
-{
-
-    return (netbuf_read_init2(s, NULL));
-}
-
-/**
- * netbuf_read_init2(s, ssl):
- * Behave like netbuf_read_init if ${ssl} is NULL.  If the SSL context ${ssl}
- * is not NULL, use it and ignore ${s}.
- */
-struct netbuf_read *
-netbuf_read_init2(int s, struct network_ssl_ctx * ssl)
+/* Create a buffered reader with a ${buflen}-byte buffer. */
+static struct netbuf_read *
+init(int s, struct network_ssl_ctx * ssl, size_t buflen)
 {
 	struct netbuf_read * R;
 
@@ -72,7 +58,7 @@ netbuf_read_init2(int s, struct network_ssl_ctx * ssl)
 	R->immediate_cookie = NULL;
 
 	/* Allocate buffer. */
-	R->buflen = 4096;
+	R->buflen = buflen;
 	if ((R->buf = malloc(R->buflen)) == NULL)
 		goto err1;
 	R->bufpos = 0;
@@ -88,6 +74,46 @@ err0:
 	return (NULL);
 }
 
+/**
+ * netbuf_read_init(s):
+ * Create and return a buffered reader attached to socket ${s}.  The caller
+ * is responsible for ensuring that no attempts are made to read from said
+ * socket except via the returned reader.
+ */
+struct netbuf_read *
+netbuf_read_init(int s)
+{
+
+	return (init(s, NULL, BUFLEN_DEFAULT));
+}
+
+/**
+ * netbuf_read_init_buflen(s, buflen):
+ * Behave like netbuf_read_init, but buffer up to ${buflen} bytes at once
+ * (rather than 4096 bytes) unless a larger netbuf_read_wait() requires more.
+ */
+struct netbuf_read *
+netbuf_read_init_buflen(int s, size_t buflen)
+{
+
+	/* Sanity-check. */
+	assert(buflen > 0);
+
+	return (init(s, NULL, buflen));
+}
+
+/**
+ * netbuf_read_init2(s, ssl):
+ * Behave like netbuf_read_init if ${ssl} is NULL.  If the SSL context ${ssl}
+ * is not NULL, use it and ignore ${s}.
+ */
+struct netbuf_read *
+netbuf_read_init2(int s, struct network_ssl_ctx * ssl)
+{
+
+	return (init(s, ssl, BUFLEN_DEFAULT));
+}
+
 /**
  * netbuf_read_peek(R, data, datalen):
  * Set ${data} to point to the currently buffered data in the reader ${R}; set
@@ -10,20 +10,45 @@
 /* Opaque address structure. */
 struct sock_addr;
 
+/* Buffer descriptor, from <sys/uio.h>. */
+struct iovec;
+
+/* Maximum number of buffers in a single network_writev() call. */
+#define NETWORK_WRITEV_MAXIOV 16
+
+/* Flags for network_writev_flags(). */
+#define NETWORK_WRITE_MORE	1	/* More data will follow shortly. */
+
 /**
  * network_accept(fd, callback, cookie):
  * Asynchronously accept a connection on the socket ${fd}, which must be
  * already marked as listening and non-blocking.  When a connection has been
  * accepted or an error occurs, invoke ${callback}(${cookie}, s) where s is
  * the accepted connection or -1 on error.  Return a cookie which can be
- * passed to network_accept_cancel() in order to cancel the accept.
+ * passed to network_accept_cancel() in order to cancel the accept.  Where
+ * accept4(2) is available, the accepted connection is marked as non-blocking
+ * and close-on-exec.
  */
 void * network_accept(int, int (*)(void *, int), void *);
 
+/**
+ * network_accept_batch(fd, budget, callback, cookie):
+ * Asynchronously accept connections on the socket ${fd}, which must be
+ * already marked as listening and non-blocking.  Each time a connection
+ * arrives, accept it and any others which are waiting, up to ${budget}
+ * connections, invoking ${callback}(${cookie}, s) for each accepted
+ * connection s; then wait for another connection.  If an error occurs,
+ * invoke ${callback}(${cookie}, -1) and stop accepting connections.  Return a
+ * cookie which can be passed to network_accept_cancel() in order to stop
+ * accepting connections; this may be done from within ${callback}.
+ */
+void * network_accept_batch(int, size_t, int (*)(void *, int), void *);
+
 /**
  * network_accept_cancel(cookie):
  * Cancel the connection accept for which the cookie ${cookie} was returned
- * by network_accept().  Do not invoke the callback associated with the accept.
+ * by network_accept() or network_accept_batch().  Do not invoke the callback
+ * associated with the accept.
  */
 void network_accept_cancel(void *);
 
@@ -60,6 +85,32 @@ void * network_connect_bind(struct sock_addr * const *,
 void * network_connect_timeo(struct sock_addr * const *, const struct timeval *,
     int (*)(void *, int), void *);
 
+/**
+ * network_connect_staggered(sas, sa_b, delay, callback, cookie):
+ * Behave as network_connect_bind(), but attempt to connect to several of the
+ * addresses in ${sas} in parallel, as described in RFC 8305 ("Happy
+ * Eyeballs"): alternate between address families, and start the next
+ * attempt as soon as the previous attempt fails or once ${delay} has elapsed
+ * since it started, whichever comes first.  When one attempt succeeds,
+ * cancel the others.  If ${delay} is NULL, behave as network_connect_bind().
+ * Invoke ${callback}(${cookie}, s, sa), where sa is the element of ${sas} to
+ * which s is connected, or NULL if s is -1.
+ */
+void * network_connect_staggered(struct sock_addr * const *,
+    const struct sock_addr *, const struct timeval *,
+    int (*)(void *, int, const struct sock_addr *), void *);
+
+/**
+ * network_connect_tried(cookie, sa):
+ * Return non-zero if ${sa}, one of the addresses passed to
+ * network_connect_staggered(), was attempted before the address to which
+ * the connection for which ${cookie} was returned succeeded (or at all, if
+ * none has succeeded); that is, if the attempt to connect to ${sa} failed or
+ * was overtaken.  This may be called from the connection callback, or before
+ * calling network_connect_cancel().
+ */
+int network_connect_tried(void *, const struct sock_addr *);
+
 /**
  * network_connect_cancel(cookie):
  * Cancel the connection attempt for which ${cookie} was returned by
@@ -98,11 +149,44 @@ void network_read_cancel(void *);
 void * network_write(int, const uint8_t *, size_t, size_t,
     int (*)(void *, ssize_t), void *);
 
+/**
+ * network_writev(fd, iov, iovcnt, minwrite, callback, cookie):
+ * Asynchronously write up to the total length of the ${iovcnt} buffers
+ * described by ${iov}, in order, to ${fd}.  The iovec array is copied, but
+ * the buffers must remain valid until the callback is invoked or the write
+ * is cancelled; ${iovcnt} must be between 1 and NETWORK_WRITEV_MAXIOV.
+ * Otherwise behave as network_write().
+ */
+void * network_writev(int, const struct iovec *, int, size_t,
+    int (*)(void *, ssize_t), void *);
+
+/**
+ * network_writev_flags(fd, iov, iovcnt, minwrite, flags, callback, cookie):
+ * Behave as network_writev(), but if ${flags} includes NETWORK_WRITE_MORE,
+ * tell the kernel that more data will be written to ${fd} as soon as this
+ * write completes, so that it may hold back a partial segment rather than
+ * sending it immediately.  This is a hint; it is ignored on platforms which
+ * lack MSG_MORE.  The last write of a burst must not use NETWORK_WRITE_MORE.
+ */
+void * network_writev_flags(int, const struct iovec *, int, size_t, int,
+    int (*)(void *, ssize_t), void *);
+
 /**
  * network_write_cancel(cookie):
  * Cancel the buffer write for which the cookie ${cookie} was returned by
- * network_write().  Do not invoke the callback associated with the write.
+ * network_write() or network_writev().  Do not invoke the callback associated
+ * with the write.
  */
 void network_write_cancel(void *);
 
+/**
+ * network_uring_enable(void):
+ * Perform network_accept(), network_read(), and network_write[v]()
+ * operations by submitting them to an io_uring rather than by waiting for
+ * socket readiness.  This must be called before any network operations are
+ * started, and after any fork(2).  Return 0 on success, or -1 if io_uring is
+ * not available (in which case the readiness-based code is used).
+ */
+int network_uring_enable(void);
+
 #endif /* !_NETWORK_H_ */
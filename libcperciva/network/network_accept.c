@@ -1,51 +1,217 @@
+/* We use non-POSIX functionality in this file. */
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+/*
+ * accept4(2) is not in POSIX.1-2008, but lets us mark accepted sockets as
+ * non-blocking and close-on-exec without extra system calls.  It must be
+ * made visible before the regular includes.
+ */
+#if defined(__linux__)
+#define _GNU_SOURCE 1
+#define HAVE_ACCEPT4
+#elif defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#define HAVE_ACCEPT4
+#endif
+
 #include <sys/socket.h>
 
+#include <assert.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 #include "events.h"
 
 #include "network.h"
+#include "network_uring.h"
 
 struct accept_cookie {
 	int (* callback)(void *, int);
 	void * cookie;
 	int fd;
+	size_t budget;
+	int persist;
+	int incallback;
+	int cancelled;
+	struct network_uring_req * req;
 };
 
-/* Accept the connection and invoke the callback. */
+/* Accept a connection, marking it as non-blocking if we can. */
 static int
-callback_accept(void * cookie)
+acceptnb(int fd)
 {
-	struct accept_cookie * C = cookie;
+
+#ifdef HAVE_ACCEPT4
+	return (accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC));
+#else
+	return (accept(fd, NULL, NULL));
+#endif
+}
+
+static int callback_accept(void *);
+static int callback_uring(void *, int);
+
+/* Wait for a connection to arrive. */
+static int
+acceptwait(struct accept_cookie * C)
+{
+
+	/*
+	 * Submit the accept directly if we're using io_uring.  Otherwise,
+	 * register a network event; a connection arriving on a listening
+	 * socket is treated by select(2) as the socket becoming readable.
+	 */
+	if (network_uring_enabled()) {
+		if ((C->req = network_uring_accept(C->fd, callback_uring,
+		    C)) == NULL)
+			return (-1);
+		return (0);
+	}
+	return (events_network_register(callback_accept, C, C->fd,
+	    EVENTS_NETWORK_OP_READ));
+}
+
+/* Accept up to ${n} connection(s) and invoke the callback. */
+static int
+acceptsome(struct accept_cookie * C, size_t n)
+{
+	size_t i;
 	int s;
 	int rc;
 
-	/* Attempt to accept a new connection. */
-	if ((s = accept(C->fd, NULL, NULL)) == -1) {
-		/* If a connection isn't available, reset the callback. */
-		if ((errno == EAGAIN) ||
+	/* Accept up to ${n} connections. */
+	for (i = 0; i < n; i++) {
+		/* Attempt to accept a new connection. */
+		if ((s = acceptnb(C->fd)) == -1) {
+			/* If no connection is available, reset the callback. */
+			if ((errno == EAGAIN) ||
 #if EAGAIN != EWOULDBLOCK
-		    (errno == EWOULDBLOCK) ||
+			    (errno == EWOULDBLOCK) ||
 #endif
-		    (errno == ECONNABORTED) ||
-		    (errno == EINTR))
-			goto tryagain;
+			    (errno == ECONNABORTED) ||
+			    (errno == EINTR))
+				goto tryagain;
+
+			/* Something went wrong; report it and stop. */
+			goto failed;
+		}
+
+		/* Call the upstream callback. */
+		C->incallback = 1;
+		rc = (C->callback)(C->cookie, s);
+		C->incallback = 0;
+
+		/* Are we done accepting connections? */
+		if (!C->persist || C->cancelled) {
+			free(C);
+			return (rc);
+		}
+
+		/* Pass failures back to the event loop. */
+		if (rc)
+			return (rc);
 	}
 
-	/* Call the upstream callback. */
-	rc = (C->callback)(C->cookie, s);
+tryagain:
+	/*
+	 * Reset the callback.  If we used up our budget, this gives other
+	 * sockets a chance to be serviced before we accept more connections.
+	 */
+	return (acceptwait(C));
+
+failed:
+	/*
+	 * Call the upstream callback.  We're done with the cookie whether or
+	 * not the callback cancels the accept, so mark ourselves as being in
+	 * the callback to stop network_accept_cancel from freeing it.
+	 */
+	C->incallback = 1;
+	rc = (C->callback)(C->cookie, -1);
+	C->incallback = 0;
 
 	/* Free the cookie. */
 	free(C);
 
 	/* Return status from upstream callback. */
 	return (rc);
+}
 
-tryagain:
-	/* Reset the callback. */
-	return (events_network_register(callback_accept, C, C->fd,
-	    EVENTS_NETWORK_OP_READ));
+/* Accept connection(s) and invoke the callback. */
+static int
+callback_accept(void * cookie)
+{
+	struct accept_cookie * C = cookie;
+
+	/* Accept up to ${budget} connections. */
+	return (acceptsome(C, C->budget));
+}
+
+/* An accept(2) submitted via io_uring has completed. */
+static int
+callback_uring(void * cookie, int res)
+{
+	struct accept_cookie * C = cookie;
+	int rc;
+
+	/* The request is no longer pending. */
+	C->req = NULL;
+
+	/* If a connection isn't available, try again. */
+	if ((res == -EAGAIN) ||
+#if EAGAIN != EWOULDBLOCK
+	    (res == -EWOULDBLOCK) ||
+#endif
+	    (res == -ECONNABORTED) ||
+	    (res == -EINTR)) {
+		if ((C->req = network_uring_accept(C->fd, callback_uring,
+		    C)) != NULL)
+			return (0);
+
+		/* Report the failure upstream. */
+		res = -errno;
+	}
+
+	/* Set errno so that the upstream callback can report errors. */
+	if (res < 0) {
+		errno = -res;
+		res = -1;
+	}
+
+	/*
+	 * If we're accepting a batch of connections, hand this one over and
+	 * accept any others which are already waiting, up to our budget,
+	 * before submitting another accept.
+	 */
+	if (C->persist && (res != -1)) {
+		C->incallback = 1;
+		rc = (C->callback)(C->cookie, res);
+		C->incallback = 0;
+
+		/* Are we done accepting connections? */
+		if (C->cancelled) {
+			free(C);
+			return (rc);
+		}
+
+		/* Pass failures back to the event loop. */
+		if (rc)
+			return (rc);
+
+		/* Accept more connections. */
+		return (acceptsome(C, C->budget - 1));
+	}
+
+	/* Call the upstream callback, which may try to cancel the accept. */
+	C->incallback = 1;
+	rc = (C->callback)(C->cookie, res);
+	C->incallback = 0;
+
+	/* Free the cookie. */
+	free(C);
+
+	/* Return status from upstream callback. */
+	return (rc);
 }
 
 /**
@@ -54,7 +220,9 @@ tryagain:
  * already marked as listening and non-blocking.  When a connection has been
  * accepted or an error occurs, invoke ${callback}(${cookie}, s) where s is
  * the accepted connection or -1 on error.  Return a cookie which can be
- * passed to network_accept_cancel() in order to cancel the accept.
+ * passed to network_accept_cancel() in order to cancel the accept.  Where
+ * accept4(2) is available, the accepted connection is marked as non-blocking
+ * and close-on-exec.
  */
 void *
 network_accept(int fd, int (* callback)(void *, int), void * cookie)
@@ -67,13 +235,60 @@ network_accept(int fd, int (* callback)(void *, int), void * cookie)
 	C->callback = callback;
 	C->cookie = cookie;
 	C->fd = fd;
+	C->budget = 1;
+	C->persist = 0;
+	C->incallback = 0;
+	C->cancelled = 0;
+	C->req = NULL;
 
-	/*
-	 * Register a network event.  A connection arriving on a listening
-	 * socket is treated by select(2) as the socket becoming readable.
-	 */
-	if (events_network_register(callback_accept, C, C->fd,
-	    EVENTS_NETWORK_OP_READ))
+	/* Wait for a connection. */
+	if (acceptwait(C))
+		goto err1;
+
+	/* Success! */
+	return (C);
+
+err1:
+	free(C);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * network_accept_batch(fd, budget, callback, cookie):
+ * Asynchronously accept connections on the socket ${fd}, which must be
+ * already marked as listening and non-blocking.  Each time a connection
+ * arrives, accept it and any others which are waiting, up to ${budget}
+ * connections, invoking ${callback}(${cookie}, s) for each accepted
+ * connection s; then wait for another connection.  If an error occurs,
+ * invoke ${callback}(${cookie}, -1) and stop accepting connections.  Return a
+ * cookie which can be passed to network_accept_cancel() in order to stop
+ * accepting connections; this may be done from within ${callback}.
+ */
+void *
+network_accept_batch(int fd, size_t budget, int (* callback)(void *, int),
+    void * cookie)
+{
+	struct accept_cookie * C;
+
+	/* Make sure budget is non-zero. */
+	assert(budget != 0);
+
+	/* Bake a cookie. */
+	if ((C = malloc(sizeof(struct accept_cookie))) == NULL)
+		goto err0;
+	C->callback = callback;
+	C->cookie = cookie;
+	C->fd = fd;
+	C->budget = budget;
+	C->persist = 1;
+	C->incallback = 0;
+	C->cancelled = 0;
+	C->req = NULL;
+
+	/* Wait for a connection. */
+	if (acceptwait(C))
 		goto err1;
 
 	/* Success! */
@@ -89,15 +304,25 @@ err0:
 /**
  * network_accept_cancel(cookie):
  * Cancel the connection accept for which the cookie ${cookie} was returned
- * by network_accept().  Do not invoke the callback associated with the accept.
+ * by network_accept() or network_accept_batch().  Do not invoke the callback
+ * associated with the accept.
  */
 void
 network_accept_cancel(void * cookie)
 {
 	struct accept_cookie * C = cookie;
 
-	/* Cancel the network event. */
-	events_network_cancel(C->fd, EVENTS_NETWORK_OP_READ);
+	/* If we're inside the callback, the caller will clean up. */
+	if (C->incallback) {
+		C->cancelled = 1;
+		return;
+	}
+
+	/* Cancel the io_uring request or the network event. */
+	if (C->req != NULL)
+		network_uring_cancel(C->req);
+	else
+		events_network_cancel(C->fd, EVENTS_NETWORK_OP_READ);
 
 	/* Free the cookie. */
 	free(C);
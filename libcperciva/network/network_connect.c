@@ -8,23 +8,85 @@
 
 #include "events.h"
 #include "sock.h"
+#include "sock_util.h"
 
 #include "network.h"
 
+struct connect_cookie;
+
+/* A connection attempt to one of the target addresses. */
+struct connect_attempt {
+	struct connect_cookie * C;
+	const struct sock_addr * sa;
+	int s;
+	void * cookie_timeo;
+};
+
 struct connect_cookie {
 	int (* callback)(void *, int);
+	int (* callback_sa)(void *, int, const struct sock_addr *);
 	void * cookie;
 	struct sock_addr * const * sas;
+	struct sock_addr ** sas_interleaved;
+	struct connect_attempt * attempts;
+	size_t pos;
+	size_t ninflight;
 	const struct sock_addr * sa_b;
 	struct timeval timeo;
+	int timeo_enabled;
+	struct timeval delay;
+	int delay_enabled;
+	void * cookie_delay;
 	void * cookie_immediate;
 	int s;
-	int timeo_enabled;
-	void * cookie_timeo;
+	const struct sock_addr * sa;
 };
 
 static int tryconnect(struct connect_cookie *);
 
+/* Stop a connection attempt and close its socket. */
+static void
+attempt_cancel(struct connect_attempt * A)
+{
+
+	/* Cancel any timer. */
+	if (A->cookie_timeo != NULL) {
+		events_timer_cancel(A->cookie_timeo);
+		A->cookie_timeo = NULL;
+	}
+
+	/* Stop listening for this socket, and close it. */
+	events_network_cancel(A->s, EVENTS_NETWORK_OP_WRITE);
+	close(A->s);
+	A->s = -1;
+}
+
+/* Cancel everything which is in progress and free the cookie. */
+static void
+cleanup(struct connect_cookie * C)
+{
+	size_t i;
+
+	/* Cancel any attempts which are in progress. */
+	for (i = 0; i < C->pos; i++) {
+		if (C->attempts[i].s != -1)
+			attempt_cancel(&C->attempts[i]);
+	}
+
+	/* Cancel the timer for starting the next attempt. */
+	if (C->cookie_delay != NULL)
+		events_timer_cancel(C->cookie_delay);
+
+	/* Cancel any immediate callback. */
+	if (C->cookie_immediate != NULL)
+		events_immediate_cancel(C->cookie_immediate);
+
+	/* Free the cookie. */
+	free(C->attempts);
+	free(C->sas_interleaved);
+	free(C);
+}
+
 /* Invoke the upstream callback and clean up. */
 static int
 docallback(void * cookie)
@@ -32,11 +94,17 @@ docallback(void * cookie)
 	struct connect_cookie * C = cookie;
 	int rc;
 
+	/* We're not waiting for an immediate callback any more. */
+	C->cookie_immediate = NULL;
+
 	/* Invoke the upstream callback. */
-	rc = (C->callback)(C->cookie, C->s);
+	if (C->callback_sa != NULL)
+		rc = (C->callback_sa)(C->cookie, C->s, C->sa);
+	else
+		rc = (C->callback)(C->cookie, C->s);
 
 	/* Free the cookie. */
-	free(C);
+	cleanup(C);
 
 	/* Return status from upstream callback. */
 	return (rc);
@@ -44,17 +112,26 @@ docallback(void * cookie)
 
 /* An address failed to connect. */
 static int
-dofailed(struct connect_cookie * C)
+dofailed(struct connect_attempt * A)
 {
+	struct connect_cookie * C = A->C;
 
 	/* Close the socket which failed to connect. */
-	close(C->s);
+	close(A->s);
 
 	/* We don't have an open socket any more. */
-	C->s = -1;
+	A->s = -1;
+	C->ninflight--;
 
-	/* This address didn't work. */
-	C->sas++;
+	/*
+	 * Don't wait for the delay to expire before trying the next address;
+	 * and if there are no more addresses, we may still be waiting for
+	 * attempts which are already in progress.
+	 */
+	if (C->cookie_delay != NULL) {
+		events_timer_cancel(C->cookie_delay);
+		C->cookie_delay = NULL;
+	}
 
 	/* Try other addresses until we run out of options. */
 	return (tryconnect(C));
@@ -64,21 +141,27 @@ dofailed(struct connect_cookie * C)
 static int
 callback_connect(void * cookie)
 {
-	struct connect_cookie * C = cookie;
+	struct connect_attempt * A = cookie;
+	struct connect_cookie * C = A->C;
 	int sockerr;
 	socklen_t sockerrlen = sizeof(int);
 
 	/* Stop waiting for the timer callback. */
-	if (C->cookie_timeo != NULL) {
-		events_timer_cancel(C->cookie_timeo);
-		C->cookie_timeo = NULL;
+	if (A->cookie_timeo != NULL) {
+		events_timer_cancel(A->cookie_timeo);
+		A->cookie_timeo = NULL;
 	}
 
 	/* Did we succeed? */
-	if (getsockopt(C->s, SOL_SOCKET, SO_ERROR, &sockerr, &sockerrlen))
+	if (getsockopt(A->s, SOL_SOCKET, SO_ERROR, &sockerr, &sockerrlen))
 		goto err1;
 	if (sockerr != 0)
-		return (dofailed(C));
+		return (dofailed(A));
+
+	/* This socket is ours; the other attempts have lost. */
+	C->s = A->s;
+	C->sa = A->sa;
+	A->s = -1;
 
 	/*
 	 * Perform the callback (this can be done here rather than being
@@ -88,8 +171,7 @@ callback_connect(void * cookie)
 	return (docallback(C));
 
 err1:
-	close(C->s);
-	free(C);
+	cleanup(C);
 
 	/* Fatal error! */
 	return (-1);
@@ -99,53 +181,84 @@ err1:
 static int
 callback_timeo(void * cookie)
 {
-	struct connect_cookie * C = cookie;
+	struct connect_attempt * A = cookie;
 
 	/* We're not waiting for a timer callback any more. */
-	C->cookie_timeo = NULL;
+	A->cookie_timeo = NULL;
 
 	/* Stop listening for this socket. */
-	events_network_cancel(C->s, EVENTS_NETWORK_OP_WRITE);
+	events_network_cancel(A->s, EVENTS_NETWORK_OP_WRITE);
 
 	/* This connect attempt failed. */
-	return (dofailed(C));
+	return (dofailed(A));
+}
+
+/* Callback when it's time to start another connection attempt. */
+static int
+callback_delay(void * cookie)
+{
+	struct connect_cookie * C = cookie;
+
+	/* We're not waiting for a timer callback any more. */
+	C->cookie_delay = NULL;
+
+	/* Try the next address. */
+	return (tryconnect(C));
 }
 
 /* Try to launch a connection.  Free the cookie on fatal errors. */
 static int
 tryconnect(struct connect_cookie * C)
 {
+	struct connect_attempt * A = NULL;
 
 	/* Try addresses until we find one which doesn't fail immediately. */
-	for (; C->sas[0] != NULL; C->sas++) {
+	for (; C->sas[C->pos] != NULL; C->pos++) {
 		/* Can we try to connect to this address? */
-		if ((C->s = sock_connect_bind_nb(C->sas[0], C->sa_b)) != -1)
+		A = &C->attempts[C->pos];
+		A->sa = C->sas[C->pos];
+		if ((A->s = sock_connect_bind_nb(A->sa, C->sa_b)) != -1)
 			break;
 	}
 
 	/* Did we run out of addresses to try? */
-	if (C->sas[0] == NULL)
+	if (C->sas[C->pos] == NULL) {
+		/* Wait for any attempts which are still in progress. */
+		if (C->ninflight > 0)
+			return (0);
 		goto failed;
+	}
+
+	/* This attempt is now in progress. */
+	C->pos++;
+	C->ninflight++;
 
 	/* If we've been asked to have a timeout, set one. */
 	if (C->timeo_enabled) {
-		if ((C->cookie_timeo = events_timer_register(callback_timeo,
-		    C, &C->timeo)) == NULL)
+		if ((A->cookie_timeo = events_timer_register(callback_timeo,
+		    A, &C->timeo)) == NULL)
 			goto err1;
-	} else {
-		C->cookie_timeo = NULL;
 	}
 
 	/* Wait until this socket connects or fails to do so. */
-	if (events_network_register(callback_connect, C, C->s,
+	if (events_network_register(callback_connect, A, A->s,
 	    EVENTS_NETWORK_OP_WRITE))
-		goto err2;
+		goto err1;
+
+	/* If there are more addresses, try the next one after a delay. */
+	if (C->delay_enabled && (C->sas[C->pos] != NULL)) {
+		if ((C->cookie_delay = events_timer_register(callback_delay,
+		    C, &C->delay)) == NULL)
+			goto err1;
+	}
 
 	/* Success! */
 	return (0);
 
 failed:
 	/* Schedule a callback. */
+	C->s = -1;
+	C->sa = NULL;
 	if ((C->cookie_immediate =
 	    events_immediate_register(docallback, C, 0)) == NULL)
 		goto err1;
@@ -153,48 +266,57 @@ failed:
 	/* Failure successfully handled. */
 	return (0);
 
-err2:
-	if (C->cookie_timeo != NULL)
-		events_timer_cancel(C->cookie_timeo);
 err1:
-	if (C->s != -1)
-		close(C->s);
-	free(C);
+	cleanup(C);
 
 	/* Fatal error. */
 	return (-1);
 }
 
 /**
- * network_connect_internal(sas, sa_b, timeo, callback, cookie):
+ * network_connect_internal(sas, sa_b, timeo, delay, callback, callback_sa,
+ *     cookie):
  * Iterate through the addresses in ${sas}, attempting to create and connect
  * a non-blocking socket.  If ${timeo} is not NULL, wait a duration of at
  * most ${timeo} for each address which is being attempted.  If ${sa_b} is
- * not NULL, then bind the socket to ${sa_b}.
+ * not NULL, then bind the socket to ${sa_b}.  If ${delay} is not NULL,
+ * interleave address families and start a new attempt each time ${delay}
+ * elapses, without waiting for earlier attempts to fail.
  *
  * Once connected, invoke ${callback}(${cookie}, s) where s is the connected
  * socket; upon fatal error or if there are no addresses remaining to
- * attempt, invoke ${callback}(${cookie}, -1).  Return a cookie which can be
- * passed to network_connect_cancel() in order to cancel the connection
- * attempt.
+ * attempt, invoke ${callback}(${cookie}, -1).  If ${callback_sa} is not
+ * NULL, invoke ${callback_sa}(${cookie}, s, sa) instead, where sa is the
+ * element of ${sas} to which s is connected, or NULL.  Return a cookie which
+ * can be passed to network_connect_cancel() in order to cancel the
+ * connection attempt.
  */
 static void *
 network_connect_internal(struct sock_addr * const * sas,
     const struct sock_addr * sa_b, const struct timeval * timeo,
-    int (* callback)(void *, int), void * cookie)
+    const struct timeval * delay, int (* callback)(void *, int),
+    int (* callback_sa)(void *, int, const struct sock_addr *),
+    void * cookie)
 {
 	struct connect_cookie * C;
+	size_t n;
+	size_t i;
 
 	/* Bake a cookie. */
 	if ((C = malloc(sizeof(struct connect_cookie))) == NULL)
 		goto err0;
 	C->callback = callback;
+	C->callback_sa = callback_sa;
 	C->cookie = cookie;
 	C->sas = sas;
+	C->sas_interleaved = NULL;
+	C->pos = 0;
+	C->ninflight = 0;
 	C->sa_b = sa_b;
+	C->cookie_delay = NULL;
 	C->cookie_immediate = NULL;
-	C->cookie_timeo = NULL;
 	C->s = -1;
+	C->sa = NULL;
 
 	/* Do we have a timeout? */
 	if (timeo != NULL) {
@@ -204,6 +326,32 @@ network_connect_internal(struct sock_addr * const * sas,
 		C->timeo_enabled = 0;
 	}
 
+	/* Are we staggering connection attempts? */
+	if (delay != NULL) {
+		memcpy(&C->delay, delay, sizeof(struct timeval));
+		C->delay_enabled = 1;
+
+		/* Alternate between address families. */
+		if ((C->sas_interleaved = sock_addr_interleave(sas)) == NULL)
+			goto err1;
+		C->sas = C->sas_interleaved;
+	} else {
+		C->delay_enabled = 0;
+	}
+
+	/* Allocate space to track an attempt for each address. */
+	for (n = 0; sas[n] != NULL; n++)
+		continue;
+	if ((C->attempts = malloc((n + 1) *
+	    sizeof(struct connect_attempt))) == NULL)
+		goto err2;
+	for (i = 0; i < n + 1; i++) {
+		C->attempts[i].C = C;
+		C->attempts[i].sa = NULL;
+		C->attempts[i].s = -1;
+		C->attempts[i].cookie_timeo = NULL;
+	}
+
 	/* Try to connect to the first address. */
 	if (tryconnect(C))
 		goto err0;
@@ -211,6 +359,10 @@ network_connect_internal(struct sock_addr * const * sas,
 	/* Success! */
 	return (C);
 
+err2:
+	free(C->sas_interleaved);
+err1:
+	free(C);
 err0:
 	/* Failure! */
 	return (NULL);
@@ -231,7 +383,8 @@ network_connect(struct sock_addr * const * sas,
 {
 
 	/* Let network_connect_internal handle this. */
-	return (network_connect_internal(sas, NULL, NULL, callback, cookie));
+	return (network_connect_internal(sas, NULL, NULL, NULL, callback,
+	    NULL, cookie));
 }
 
 /**
@@ -251,7 +404,8 @@ network_connect_bind(struct sock_addr * const * sas,
 {
 
 	/* Let network_connect_internal handle this. */
-	return (network_connect_internal(sas, sa_b, NULL, callback, cookie));
+	return (network_connect_internal(sas, sa_b, NULL, NULL, callback,
+	    NULL, cookie));
 }
 
 /**
@@ -266,7 +420,58 @@ network_connect_timeo(struct sock_addr * const * sas,
 {
 
 	/* Let network_connect_internal handle this. */
-	return (network_connect_internal(sas, NULL, timeo, callback, cookie));
+	return (network_connect_internal(sas, NULL, timeo, NULL, callback,
+	    NULL, cookie));
+}
+
+/**
+ * network_connect_staggered(sas, sa_b, delay, callback, cookie):
+ * Behave as network_connect_bind(), but attempt to connect to several of the
+ * addresses in ${sas} in parallel, as described in RFC 8305 ("Happy
+ * Eyeballs"): alternate between address families, and start the next
+ * attempt as soon as the previous attempt fails or once ${delay} has elapsed
+ * since it started, whichever comes first.  When one attempt succeeds,
+ * cancel the others.  If ${delay} is NULL, behave as network_connect_bind().
+ * Invoke ${callback}(${cookie}, s, sa), where sa is the element of ${sas} to
+ * which s is connected, or NULL if s is -1.
+ */
+void *
+network_connect_staggered(struct sock_addr * const * sas,
+    const struct sock_addr * sa_b, const struct timeval * delay,
+    int (* callback)(void *, int, const struct sock_addr *), void * cookie)
+{
+
+	/* Let network_connect_internal handle this. */
+	return (network_connect_internal(sas, sa_b, NULL, delay, NULL,
+	    callback, cookie));
+}
+
+/**
+ * network_connect_tried(cookie, sa):
+ * Return non-zero if ${sa}, one of the addresses passed to
+ * network_connect_staggered(), was attempted before the address to which
+ * the connection for which ${cookie} was returned succeeded (or at all, if
+ * none has succeeded); that is, if the attempt to connect to ${sa} failed or
+ * was overtaken.  This may be called from the connection callback, or before
+ * calling network_connect_cancel().
+ */
+int
+network_connect_tried(void * cookie, const struct sock_addr * sa)
+{
+	struct connect_cookie * C = cookie;
+	size_t i;
+
+	/* Look for the address among the attempts we've started. */
+	for (i = 0; i < C->pos; i++) {
+		/* Attempts after the one which succeeded don't count. */
+		if (C->attempts[i].sa == C->sa)
+			break;
+		if (C->attempts[i].sa == sa)
+			return (1);
+	}
+
+	/* We didn't try this address first. */
+	return (0);
 }
 
 /**
@@ -279,24 +484,10 @@ network_connect_cancel(void * cookie)
 {
 	struct connect_cookie * C = cookie;
 
-	/* We should have either an immediate callback or a socket. */
-	assert((C->cookie_immediate != NULL) || (C->s != -1));
-	assert((C->cookie_immediate == NULL) || (C->s == -1));
-
-	/* Cancel any timer. */
-	if (C->cookie_timeo != NULL)
-		events_timer_cancel(C->cookie_timeo);
-
-	/* Cancel any immediate callback. */
-	if (C->cookie_immediate != NULL)
-		events_immediate_cancel(C->cookie_immediate);
-
-	/* Close any socket. */
-	if (C->s != -1) {
-		events_network_cancel(C->s, EVENTS_NETWORK_OP_WRITE);
-		close(C->s);
-	}
+	/* We should have either an immediate callback or an attempt. */
+	assert((C->cookie_immediate != NULL) || (C->ninflight > 0));
+	assert((C->cookie_immediate == NULL) || (C->ninflight == 0));
 
-	/* Free the cookie. */
-	free(C);
+	/* Cancel everything and free the cookie. */
+	cleanup(C);
 }
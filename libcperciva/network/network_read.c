@@ -11,6 +11,7 @@
 #include "mpool.h"
 
 #include "network.h"
+#include "network_uring.h"
 
 struct network_read_cookie {
 	int (*callback)(void *, ssize_t);
@@ -20,6 +21,7 @@ struct network_read_cookie {
 	size_t buflen;
 	size_t minlen;
 	size_t bufpos;
+	struct network_uring_req * req;
 };
 
 MPOOL(network_read_cookie, struct network_read_cookie, 16);
@@ -100,6 +102,67 @@ failed:
 	return (docallback(C, -1));
 }
 
+/* A recv(2) submitted via io_uring has completed. */
+static int
+callback_uring(void * cookie, int res)
+{
+	struct network_read_cookie * C = cookie;
+
+	/* The request is no longer pending. */
+	C->req = NULL;
+
+	/* Failure? */
+	if (res < 0) {
+		/* Wait for readiness if the kernel didn't. */
+		if ((res == -EAGAIN) ||
+#if EAGAIN != EWOULDBLOCK
+		    (res == -EWOULDBLOCK) ||
+#endif
+		    (res == -EINTR))
+			goto tryagain;
+
+		/* Something went wrong. */
+		goto failed;
+	} else if (res == 0) {
+		/* The socket was shut down by the remote host. */
+		goto eof;
+	}
+
+	/* We processed some data. */
+	C->bufpos += (size_t)res;
+
+	/* Do we need to keep going? */
+	if (C->bufpos < C->minlen) {
+		if ((C->req = network_uring_recv(C->fd, C->buf + C->bufpos,
+		    C->buflen - C->bufpos, callback_uring, C)) == NULL)
+			goto failed;
+		return (0);
+	}
+
+	/* Sanity-check: buffer position must fit into a ssize_t. */
+	assert(C->bufpos <= SSIZE_MAX);
+
+	/* Invoke the callback and return. */
+	return (docallback(C, (ssize_t)C->bufpos));
+
+tryagain:
+	/* Fall back to waiting for network readiness. */
+	if (events_network_register(callback_buf, C, C->fd,
+	    EVENTS_NETWORK_OP_READ))
+		goto failed;
+
+	/* Callback was reset. */
+	return (0);
+
+eof:
+	/* Invoke the callback with an EOF status and return. */
+	return (docallback(C, 0));
+
+failed:
+	/* Invoke the callback with a failure status and return. */
+	return (docallback(C, -1));
+}
+
 /**
  * network_read(fd, buf, buflen, minread, callback, cookie):
  * Asynchronously read up to ${buflen} bytes of data from ${fd} into ${buf}.
@@ -131,11 +194,21 @@ network_read(int fd, uint8_t * buf, size_t buflen, size_t minread,
 	C->buflen = buflen;
 	C->minlen = minread;
 	C->bufpos = 0;
-
-	/* Register a callback for network readiness. */
-	if (events_network_register(callback_buf, C, C->fd,
-	    EVENTS_NETWORK_OP_READ))
-		goto err1;
+	C->req = NULL;
+
+	/*
+	 * Submit the read directly if we're using io_uring; otherwise,
+	 * register a callback for network readiness.
+	 */
+	if (network_uring_enabled()) {
+		if ((C->req = network_uring_recv(C->fd, C->buf, C->buflen,
+		    callback_uring, C)) == NULL)
+			goto err1;
+	} else {
+		if (events_network_register(callback_buf, C, C->fd,
+		    EVENTS_NETWORK_OP_READ))
+			goto err1;
+	}
 
 	/* Success! */
 	return (C);
@@ -157,8 +230,11 @@ network_read_cancel(void * cookie)
 {
 	struct network_read_cookie * C = cookie;
 
-	/* Kill the network event. */
-	events_network_cancel(C->fd, EVENTS_NETWORK_OP_READ);
+	/* Kill the io_uring request or the network event. */
+	if (C->req != NULL)
+		network_uring_cancel(C->req);
+	else
+		events_network_cancel(C->fd, EVENTS_NETWORK_OP_READ);
 
 	/* Free the cookie. */
 	mpool_network_read_cookie_free(C);
@@ -0,0 +1,677 @@
+/* We use non-POSIX functionality in this file. */
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+/*
+ * The io_uring interface is only available on Linux, and we talk to the
+ * kernel directly rather than depending upon liburing; we need the kernel
+ * headers and syscall(2) for that.
+ */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define _DEFAULT_SOURCE 1
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+/* We need IORING_FEAT_FAST_POLL (Linux 5.7) for sane socket operations. */
+#if defined(IORING_FEAT_FAST_POLL) && defined(__NR_io_uring_setup)
+#define NETWORK_URING
+#endif
+#endif
+#endif
+
+#include <sys/socket.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "events.h"
+#include "mpool.h"
+#include "queue.h"
+#include "warnp.h"
+
+#include "network.h"
+#include "network_uring.h"
+
+#ifdef NETWORK_URING
+
+/* Number of submission queue entries to request. */
+#define URING_ENTRIES 256
+
+/* Request states. */
+#define REQ_INFLIGHT 0
+#define REQ_DONE 1
+#define REQ_CANCELLED 2
+
+struct network_uring_req {
+	int (* callback)(void *, int);
+	void * cookie;
+	STAILQ_ENTRY(network_uring_req) entries;
+	int opcode;
+	int res;
+	int state;
+};
+
+MPOOL(network_uring_req, struct network_uring_req, 32);
+
+/* The ring, and our view of the memory it shares with the kernel. */
+static struct {
+	int fd;
+	void * sqring;
+	size_t sqringlen;
+	void * cqring;
+	size_t cqringlen;
+	struct io_uring_sqe * sqes;
+	size_t sqeslen;
+	unsigned * sqhead;
+	unsigned * sqtail;
+	unsigned sqmask;
+	unsigned sqentries;
+	unsigned * cqhead;
+	unsigned * cqtail;
+	unsigned cqmask;
+	struct io_uring_cqe * cqes;
+} R = { .fd = -1 };
+
+/* Number of queued-but-not-submitted SQEs. */
+static unsigned npending = 0;
+
+/* Number of requests we're waiting for the kernel to complete. */
+static size_t ninflight = 0;
+
+/* Completed requests which have not been dispatched yet. */
+static STAILQ_HEAD(, network_uring_req) done = STAILQ_HEAD_INITIALIZER(done);
+
+/* Pending events-loop callbacks. */
+static void * flush_timer = NULL;
+static void * dispatch_immediate = NULL;
+static int ring_registered = 0;
+
+static int callback_flush(void *);
+static int callback_ring(void *);
+static int callback_dispatch(void *);
+
+/* Wrappers around the io_uring system calls. */
+static int
+uring_setup(unsigned entries, struct io_uring_params * p)
+{
+
+	return ((int)syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+
+	return ((int)syscall(__NR_io_uring_enter, R.fd, to_submit,
+	    min_complete, flags, NULL, 0));
+}
+
+/* Submit all queued SQEs to the kernel. */
+static int
+submit(void)
+{
+	int n;
+
+	while (npending > 0) {
+		if ((n = uring_enter(npending, 0, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			warnp("io_uring_enter");
+			goto err0;
+		}
+		npending -= (unsigned)n;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Move any completions from the CQ ring onto the done list. */
+static void
+reap(void)
+{
+	struct io_uring_cqe * cqe;
+	struct network_uring_req * req;
+	unsigned head, tail;
+
+	head = *R.cqhead;
+	tail = __atomic_load_n(R.cqtail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &R.cqes[head & R.cqmask];
+
+		/* Completions for cancellation requests have no owner. */
+		if ((req = (struct network_uring_req *)(uintptr_t)
+		    cqe->user_data) == NULL)
+			continue;
+
+		/* Record the result and queue the request for dispatch. */
+		req->res = cqe->res;
+		req->state = REQ_DONE;
+		STAILQ_INSERT_TAIL(&done, req, entries);
+		ninflight--;
+	}
+	__atomic_store_n(R.cqhead, head, __ATOMIC_RELEASE);
+}
+
+/* Arrange to collect completions and dispatch finished requests. */
+static int
+schedule(void)
+{
+
+	/* Wake up when the kernel posts a completion. */
+	if ((ninflight > 0) && !ring_registered) {
+		if (events_network_register(callback_ring, NULL, R.fd,
+		    EVENTS_NETWORK_OP_READ))
+			goto err0;
+		ring_registered = 1;
+	}
+
+	/* Dispatch requests which have already completed. */
+	if (!STAILQ_EMPTY(&done) && (dispatch_immediate == NULL)) {
+		if ((dispatch_immediate =
+		    events_immediate_register(callback_dispatch, NULL, 0))
+		    == NULL)
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Submit queued SQEs; called once per events loop turn. */
+static int
+callback_flush(void * cookie)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* This callback is no longer pending. */
+	flush_timer = NULL;
+
+	/* Submit everything which has been queued. */
+	if (submit())
+		goto err0;
+
+	/* Wait for completions. */
+	return (schedule());
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Invoke callbacks for completed requests. */
+static int
+dispatch(void)
+{
+	struct network_uring_req * req;
+	int rc;
+
+	while ((req = STAILQ_FIRST(&done)) != NULL) {
+		STAILQ_REMOVE_HEAD(&done, entries);
+
+		/* Cancelled requests are simply discarded. */
+		if (req->state == REQ_CANCELLED) {
+			/* Don't leak connections we never asked for. */
+			if ((req->opcode == IORING_OP_ACCEPT) &&
+			    (req->res >= 0))
+				close(req->res);
+			mpool_network_uring_req_free(req);
+			continue;
+		}
+
+		/* Invoke the callback. */
+		rc = (req->callback)(req->cookie, req->res);
+		mpool_network_uring_req_free(req);
+		if (rc)
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* The ring has completions for us. */
+static int
+callback_ring(void * cookie)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* This callback is no longer registered. */
+	ring_registered = 0;
+
+	/* Collect and dispatch completions. */
+	reap();
+	if (dispatch())
+		goto err0;
+
+	/* Wait for further completions. */
+	return (schedule());
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Dispatch requests which were reaped while cancelling another request. */
+static int
+callback_dispatch(void * cookie)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* This callback is no longer pending. */
+	dispatch_immediate = NULL;
+
+	/* Dispatch completions. */
+	if (dispatch())
+		goto err0;
+
+	/* Wait for further completions. */
+	return (schedule());
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Get an SQE, submitting queued SQEs first if the ring is full. */
+static struct io_uring_sqe *
+getsqe(uint64_t user_data)
+{
+	struct io_uring_sqe * sqe;
+	unsigned tail;
+
+	/* If the submission queue is full, flush it now. */
+	tail = *R.sqtail;
+	if (tail - __atomic_load_n(R.sqhead, __ATOMIC_ACQUIRE) ==
+	    R.sqentries) {
+		if (submit())
+			goto err0;
+	}
+
+	/* Fill in the common fields. */
+	sqe = &R.sqes[tail & R.sqmask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->user_data = user_data;
+
+	/* Success! */
+	return (sqe);
+
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Make the SQE most recently returned by getsqe() visible to the kernel. */
+static void
+pushsqe(void)
+{
+
+	__atomic_store_n(R.sqtail, *R.sqtail + 1, __ATOMIC_RELEASE);
+	npending++;
+}
+
+/* Queue an operation; the caller fills in the opcode-specific fields. */
+static struct io_uring_sqe *
+queue(int opcode, int fd, int (* callback)(void *, int), void * cookie,
+    struct network_uring_req ** reqp)
+{
+	struct network_uring_req * req;
+	struct io_uring_sqe * sqe;
+
+	/* Bake a request. */
+	if ((req = mpool_network_uring_req_malloc()) == NULL)
+		goto err0;
+	req->callback = callback;
+	req->cookie = cookie;
+	req->opcode = opcode;
+	req->state = REQ_INFLIGHT;
+
+	/* Submit queued requests at the end of this events loop turn. */
+	if ((flush_timer == NULL) && ((flush_timer =
+	    events_timer_register_double(callback_flush, NULL, 0.0)) == NULL))
+		goto err1;
+
+	/* Grab an SQE. */
+	if ((sqe = getsqe((uint64_t)(uintptr_t)req)) == NULL)
+		goto err1;
+	sqe->opcode = (uint8_t)opcode;
+	sqe->fd = fd;
+
+	/* We're now waiting for this request. */
+	ninflight++;
+
+	/* Success! */
+	*reqp = req;
+	return (sqe);
+
+err1:
+	mpool_network_uring_req_free(req);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * network_uring_enable(void):
+ * Perform network_accept(), network_read(), and network_write[v]()
+ * operations by submitting them to an io_uring rather than by waiting for
+ * socket readiness.  This must be called before any network operations are
+ * started, and after any fork(2).  Return 0 on success, or -1 if io_uring is
+ * not available (in which case the readiness-based code is used).
+ */
+int
+network_uring_enable(void)
+{
+	struct io_uring_params p;
+	unsigned * sqarray;
+	unsigned i;
+
+	/* Have we already done this? */
+	if (R.fd != -1)
+		return (0);
+
+	/* Create the ring. */
+	memset(&p, 0, sizeof(struct io_uring_params));
+	if ((R.fd = uring_setup(URING_ENTRIES, &p)) == -1) {
+		warnp("io_uring_setup");
+		goto err0;
+	}
+
+	/*
+	 * Make sure the kernel polls sockets internally rather than handing
+	 * EAGAIN back to us, and never drops completions.
+	 */
+	if (!(p.features & IORING_FEAT_FAST_POLL) ||
+	    !(p.features & IORING_FEAT_NODROP) ||
+	    !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		warn0("io_uring is missing required features");
+		goto err1;
+	}
+
+	/* Map the rings; the SQ and CQ rings share a single mapping. */
+	R.sqringlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	R.cqringlen = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (R.cqringlen > R.sqringlen)
+		R.sqringlen = R.cqringlen;
+	if ((R.sqring = mmap(NULL, R.sqringlen, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, R.fd, IORING_OFF_SQ_RING)) ==
+	    MAP_FAILED) {
+		warnp("mmap(io_uring)");
+		goto err1;
+	}
+	R.cqring = R.sqring;
+	R.sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+	if ((R.sqes = mmap(NULL, R.sqeslen, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, R.fd, IORING_OFF_SQES)) == MAP_FAILED) {
+		warnp("mmap(io_uring)");
+		goto err2;
+	}
+
+	/* Find the fields within the rings. */
+	R.sqhead = (unsigned *)((uint8_t *)R.sqring + p.sq_off.head);
+	R.sqtail = (unsigned *)((uint8_t *)R.sqring + p.sq_off.tail);
+	R.sqmask = *(unsigned *)((uint8_t *)R.sqring + p.sq_off.ring_mask);
+	R.sqentries = p.sq_entries;
+	R.cqhead = (unsigned *)((uint8_t *)R.cqring + p.cq_off.head);
+	R.cqtail = (unsigned *)((uint8_t *)R.cqring + p.cq_off.tail);
+	R.cqmask = *(unsigned *)((uint8_t *)R.cqring + p.cq_off.ring_mask);
+	R.cqes = (struct io_uring_cqe *)((uint8_t *)R.cqring +
+	    p.cq_off.cqes);
+
+	/* SQ ring slot i always holds SQE i. */
+	sqarray = (unsigned *)((uint8_t *)R.sqring + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; i++)
+		sqarray[i] = i;
+
+	/* Success! */
+	return (0);
+
+err2:
+	munmap(R.sqring, R.sqringlen);
+err1:
+	close(R.fd);
+	R.fd = -1;
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * network_uring_enabled(void):
+ * Return non-zero if network_uring_enable() has been called successfully.
+ */
+int
+network_uring_enabled(void)
+{
+
+	return (R.fd != -1);
+}
+
+/**
+ * network_uring_recv(fd, buf, buflen, callback, cookie):
+ * Queue a recv(2) of up to ${buflen} bytes from ${fd} into ${buf}.  When it
+ * completes, invoke ${callback}(${cookie}, res) where res is the number of
+ * bytes read or a negated errno value.  Return a request which can be passed
+ * to network_uring_cancel().
+ */
+struct network_uring_req *
+network_uring_recv(int fd, void * buf, size_t buflen,
+    int (* callback)(void *, int), void * cookie)
+{
+	struct network_uring_req * req;
+	struct io_uring_sqe * sqe;
+
+	/* Queue the operation. */
+	if ((sqe = queue(IORING_OP_RECV, fd, callback, cookie, &req)) == NULL)
+		return (NULL);
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = (buflen > INT32_MAX) ? INT32_MAX : (uint32_t)buflen;
+	pushsqe();
+
+	/* Success! */
+	return (req);
+}
+
+/**
+ * network_uring_sendmsg(fd, msg, flags, callback, cookie):
+ * Queue a sendmsg(2) of ${msg} to ${fd} with ${flags}; ${msg} and the
+ * buffers it describes must remain valid until the request completes or is
+ * cancelled.  Otherwise behave as network_uring_recv().
+ */
+struct network_uring_req *
+network_uring_sendmsg(int fd, const struct msghdr * msg, int flags,
+    int (* callback)(void *, int), void * cookie)
+{
+	struct network_uring_req * req;
+	struct io_uring_sqe * sqe;
+
+	/* Queue the operation. */
+	if ((sqe = queue(IORING_OP_SENDMSG, fd, callback, cookie,
+	    &req)) == NULL)
+		return (NULL);
+	sqe->addr = (uint64_t)(uintptr_t)msg;
+	sqe->len = 1;
+	sqe->msg_flags = (uint32_t)flags;
+	pushsqe();
+
+	/* Success! */
+	return (req);
+}
+
+/**
+ * network_uring_accept(fd, callback, cookie):
+ * Queue an accept(2) on the listening socket ${fd}.  When it completes,
+ * invoke ${callback}(${cookie}, res) where res is the accepted socket (marked
+ * as non-blocking and close-on-exec) or a negated errno value.  Return a
+ * request which can be passed to network_uring_cancel().
+ */
+struct network_uring_req *
+network_uring_accept(int fd, int (* callback)(void *, int), void * cookie)
+{
+	struct network_uring_req * req;
+	struct io_uring_sqe * sqe;
+
+	/* Queue the operation. */
+	if ((sqe = queue(IORING_OP_ACCEPT, fd, callback, cookie,
+	    &req)) == NULL)
+		return (NULL);
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	pushsqe();
+
+	/* Success! */
+	return (req);
+}
+
+/**
+ * network_uring_cancel(req):
+ * Cancel the request ${req}.  Do not invoke the associated callback.  On
+ * return, the kernel has stopped accessing any buffers used by ${req}; any
+ * data which a cancelled read had already received is discarded.
+ */
+void
+network_uring_cancel(struct network_uring_req * req)
+{
+	struct io_uring_sqe * sqe;
+	int n;
+
+	/* If the request is in flight, ask the kernel to cancel it. */
+	if (req->state == REQ_INFLIGHT) {
+		if ((sqe = getsqe(0)) == NULL)
+			goto fatal;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uint64_t)(uintptr_t)req;
+		pushsqe();
+
+		/*
+		 * Wait for the request to complete; the caller is about to
+		 * free the buffers it refers to.  Completions for other
+		 * requests are collected along the way.
+		 */
+		do {
+			if ((n = uring_enter(npending, 1,
+			    IORING_ENTER_GETEVENTS)) == -1) {
+				if (errno == EINTR)
+					continue;
+				warnp("io_uring_enter");
+				goto fatal;
+			}
+			npending -= (unsigned)n;
+			reap();
+		} while (req->state == REQ_INFLIGHT);
+	}
+
+	/* The request is on the done list; have it discarded. */
+	req->state = REQ_CANCELLED;
+	if (schedule())
+		goto fatal;
+
+	/* Success! */
+	return;
+
+fatal:
+	/* We can't safely return while the kernel might touch the buffers. */
+	warn0("Cannot cancel io_uring request");
+	abort();
+}
+
+#else /* !NETWORK_URING */
+
+/**
+ * network_uring_enable(void):
+ * Perform network_accept(), network_read(), and network_write[v]()
+ * operations by submitting them to an io_uring rather than by waiting for
+ * socket readiness.  This must be called before any network operations are
+ * started, and after any fork(2).  Return 0 on success, or -1 if io_uring is
+ * not available (in which case the readiness-based code is used).
+ */
+int
+network_uring_enable(void)
+{
+
+	/* Not supported on this platform. */
+	warn0("io_uring is not supported on this platform");
+	return (-1);
+}
+
+/**
+ * network_uring_enabled(void):
+ * Return non-zero if network_uring_enable() has been called successfully.
+ */
+int
+network_uring_enabled(void)
+{
+
+	return (0);
+}
+
+/* These are never called, since network_uring_enabled() returns zero. */
+struct network_uring_req *
+network_uring_recv(int fd, void * buf, size_t buflen,
+    int (* callback)(void *, int), void * cookie)
+{
+
+	(void)fd; /* UNUSED */
+	(void)buf; /* UNUSED */
+	(void)buflen; /* UNUSED */
+	(void)callback; /* UNUSED */
+	(void)cookie; /* UNUSED */
+	abort();
+}
+
+struct network_uring_req *
+network_uring_sendmsg(int fd, const struct msghdr * msg, int flags,
+    int (* callback)(void *, int), void * cookie)
+{
+
+	(void)fd; /* UNUSED */
+	(void)msg; /* UNUSED */
+	(void)flags; /* UNUSED */
+	(void)callback; /* UNUSED */
+	(void)cookie; /* UNUSED */
+	abort();
+}
+
+struct network_uring_req *
+network_uring_accept(int fd, int (* callback)(void *, int), void * cookie)
+{
+
+	(void)fd; /* UNUSED */
+	(void)callback; /* UNUSED */
+	(void)cookie; /* UNUSED */
+	abort();
+}
+
+void
+network_uring_cancel(struct network_uring_req * req)
+{
+
+	(void)req; /* UNUSED */
+	abort();
+}
+
+#endif /* !NETWORK_URING */
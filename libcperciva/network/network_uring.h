@@ -0,0 +1,52 @@
+#ifndef _NETWORK_URING_H_
+#define _NETWORK_URING_H_
+
+#include <stddef.h>
+
+/* Opaque types. */
+struct msghdr;
+struct network_uring_req;
+
+/**
+ * network_uring_enabled(void):
+ * Return non-zero if network_uring_enable() has been called successfully.
+ */
+int network_uring_enabled(void);
+
+/**
+ * network_uring_recv(fd, buf, buflen, callback, cookie):
+ * Queue a recv(2) of up to ${buflen} bytes from ${fd} into ${buf}.  When it
+ * completes, invoke ${callback}(${cookie}, res) where res is the number of
+ * bytes read or a negated errno value.  Return a request which can be passed
+ * to network_uring_cancel().
+ */
+struct network_uring_req * network_uring_recv(int, void *, size_t,
+    int (*)(void *, int), void *);
+
+/**
+ * network_uring_sendmsg(fd, msg, flags, callback, cookie):
+ * Queue a sendmsg(2) of ${msg} to ${fd} with ${flags}; ${msg} and the
+ * buffers it describes must remain valid until the request completes or is
+ * cancelled.  Otherwise behave as network_uring_recv().
+ */
+struct network_uring_req * network_uring_sendmsg(int, const struct msghdr *,
+    int, int (*)(void *, int), void *);
+
+/**
+ * network_uring_accept(fd, callback, cookie):
+ * Queue an accept(2) on the listening socket ${fd}.  When it completes,
+ * invoke ${callback}(${cookie}, res) where res is the accepted socket (marked
+ * as non-blocking and close-on-exec) or a negated errno value.  Return a
+ * request which can be passed to network_uring_cancel().
+ */
+struct network_uring_req * network_uring_accept(int, int (*)(void *, int),
+    void *);
+
+/**
+ * network_uring_cancel(req):
+ * Cancel the request ${req}.  Do not invoke the associated callback.  On
+ * return, the kernel has stopped accessing any buffers used by ${req}.
+ */
+void network_uring_cancel(struct network_uring_req *);
+
+#endif /* !_NETWORK_URING_H_ */
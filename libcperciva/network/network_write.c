@@ -1,4 +1,5 @@
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -6,6 +7,7 @@
 #include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "events.h"
@@ -13,6 +15,7 @@
 #include "warnp.h"
 
 #include "network.h"
+#include "network_uring.h"
 
 /**
  * POSIX.1-2008 requires that MSG_NOSIGNAL be defined as a flag for send(2)
@@ -31,18 +34,33 @@
 #endif
 #endif
 
+/*
+ * Linux and some other platforms allow send(2) to be told that more data is
+ * about to follow, so that a partial segment is held back even if Nagle's
+ * algorithm is disabled.  Elsewhere, NETWORK_WRITE_MORE has no effect.
+ */
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
 struct network_write_cookie {
 	int (*callback)(void *, ssize_t);
 	void * cookie;
 	int fd;
-	const uint8_t * buf;
-	size_t buflen;
+	struct iovec iov[NETWORK_WRITEV_MAXIOV];
+	int iovcnt;
+	int iovpos;
 	size_t minlen;
 	size_t bufpos;
+	int sendflags;
+	struct msghdr msg;
+	struct network_uring_req * req;
 };
 
 MPOOL(network_write_cookie, struct network_write_cookie, 16);
 
+static int callback_uring(void *, int);
+
 /* Invoke the callback, clean up, and return the callback's status. */
 static int
 docallback(struct network_write_cookie * C, ssize_t nbytes)
@@ -59,12 +77,50 @@ docallback(struct network_write_cookie * C, ssize_t nbytes)
 	return (rc);
 }
 
+/* Record that ${len} bytes were written. */
+static void
+advance(struct network_write_cookie * C, size_t len)
+{
+	size_t oplen;
+
+	/* We processed some data. */
+	C->bufpos += len;
+
+	/* Skip past the buffers which were written completely. */
+	for (oplen = len; oplen > 0; C->iovpos++) {
+		if (oplen < C->iov[C->iovpos].iov_len) {
+			C->iov[C->iovpos].iov_base =
+			    (uint8_t *)C->iov[C->iovpos].iov_base + oplen;
+			C->iov[C->iovpos].iov_len -= oplen;
+			break;
+		}
+		oplen -= C->iov[C->iovpos].iov_len;
+	}
+}
+
+/* Submit a sendmsg(2) of the remaining buffers via io_uring. */
+static int
+submit_uring(struct network_write_cookie * C)
+{
+
+	/* The message header must remain valid until the request completes. */
+	memset(&C->msg, 0, sizeof(struct msghdr));
+	C->msg.msg_iov = &C->iov[C->iovpos];
+	C->msg.msg_iovlen = (size_t)(C->iovcnt - C->iovpos);
+	if ((C->req = network_uring_sendmsg(C->fd, &C->msg, C->sendflags,
+	    callback_uring, C)) == NULL)
+		return (-1);
+
+	/* Success! */
+	return (0);
+}
+
 /* The socket is ready for reading/writing. */
 static int
 callback_buf(void * cookie)
 {
 	struct network_write_cookie * C = cookie;
-	size_t oplen;
+	struct msghdr msg;
 	ssize_t len;
 #ifdef POSIXFAIL_MSG_NOSIGNAL
 	void (*oldsig)(int);
@@ -79,9 +135,11 @@ callback_buf(void * cookie)
 	}
 #endif
 
-	/* Attempt to read/write data to/from the buffer. */
-	oplen = C->buflen - C->bufpos;
-	len = send(C->fd, C->buf + C->bufpos, oplen, MSG_NOSIGNAL);
+	/* Attempt to write data from the remaining buffers. */
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = &C->iov[C->iovpos];
+	msg.msg_iovlen = (size_t)(C->iovcnt - C->iovpos);
+	len = sendmsg(C->fd, &msg, C->sendflags);
 
 	/* We should never see a send length of zero. */
 	assert(len != 0);
@@ -115,7 +173,7 @@ callback_buf(void * cookie)
 	}
 
 	/* We processed some data. */
-	C->bufpos += (size_t)len;
+	advance(C, (size_t)len);
 
 	/* Do we need to keep going? */
 	if (C->bufpos < C->minlen)
@@ -141,6 +199,62 @@ failed:
 	return (docallback(C, -1));
 }
 
+/* A sendmsg(2) submitted via io_uring has completed. */
+static int
+callback_uring(void * cookie, int res)
+{
+	struct network_write_cookie * C = cookie;
+
+	/* The request is no longer pending. */
+	C->req = NULL;
+
+	/* Failure? */
+	if (res < 0) {
+		/* Wait for readiness if the kernel didn't. */
+		if ((res == -EAGAIN) ||
+#if EAGAIN != EWOULDBLOCK
+		    (res == -EWOULDBLOCK) ||
+#endif
+		    (res == -EINTR))
+			goto tryagain;
+
+		/* Something went wrong. */
+		goto failed;
+	}
+
+	/* We should never see a send length of zero. */
+	assert(res != 0);
+
+	/* We processed some data. */
+	advance(C, (size_t)res);
+
+	/* Do we need to keep going? */
+	if (C->bufpos < C->minlen) {
+		if (submit_uring(C))
+			goto failed;
+		return (0);
+	}
+
+	/* Sanity-check: buffer position must fit into a ssize_t. */
+	assert(C->bufpos <= SSIZE_MAX);
+
+	/* Invoke the callback and return. */
+	return (docallback(C, (ssize_t)C->bufpos));
+
+tryagain:
+	/* Fall back to waiting for network readiness. */
+	if (events_network_register(callback_buf, C, C->fd,
+	    EVENTS_NETWORK_OP_WRITE))
+		goto failed;
+
+	/* Callback was reset. */
+	return (0);
+
+failed:
+	/* Invoke the callback with a failure status and return. */
+	return (docallback(C, -1));
+}
+
 /**
  * network_write(fd, buf, buflen, minwrite, callback, cookie):
  * Asynchronously write up to ${buflen} bytes of data from ${buf} to ${fd}.
@@ -153,8 +267,56 @@ failed:
 void *
 network_write(int fd, const uint8_t * buf, size_t buflen, size_t minwrite,
     int (* callback)(void *, ssize_t), void * cookie)
+{
+	struct iovec iov;
+
+	/* Write from a single buffer. */
+	iov.iov_base = (void *)(uintptr_t)buf;
+	iov.iov_len = buflen;
+	return (network_writev(fd, &iov, 1, minwrite, callback, cookie));
+}
+
+/**
+ * network_writev(fd, iov, iovcnt, minwrite, callback, cookie):
+ * Asynchronously write up to the total length of the ${iovcnt} buffers
+ * described by ${iov}, in order, to ${fd}.  The iovec array is copied, but
+ * the buffers must remain valid until the callback is invoked or the write
+ * is cancelled; ${iovcnt} must be between 1 and NETWORK_WRITEV_MAXIOV.
+ * Otherwise behave as network_write().
+ */
+void *
+network_writev(int fd, const struct iovec * iov, int iovcnt, size_t minwrite,
+    int (* callback)(void *, ssize_t), void * cookie)
+{
+
+	/* No flags. */
+	return (network_writev_flags(fd, iov, iovcnt, minwrite, 0, callback,
+	    cookie));
+}
+
+/**
+ * network_writev_flags(fd, iov, iovcnt, minwrite, flags, callback, cookie):
+ * Behave as network_writev(), but if ${flags} includes NETWORK_WRITE_MORE,
+ * tell the kernel that more data will be written to ${fd} as soon as this
+ * write completes, so that it may hold back a partial segment rather than
+ * sending it immediately.  This is a hint; it is ignored on platforms which
+ * lack MSG_MORE.  The last write of a burst must not use NETWORK_WRITE_MORE.
+ */
+void *
+network_writev_flags(int fd, const struct iovec * iov, int iovcnt,
+    size_t minwrite, int flags, int (* callback)(void *, ssize_t),
+    void * cookie)
 {
 	struct network_write_cookie * C;
+	size_t buflen = 0;
+	int i;
+
+	/* Sanity-check the number of buffers. */
+	assert((iovcnt > 0) && (iovcnt <= NETWORK_WRITEV_MAXIOV));
+
+	/* Add up the buffer lengths. */
+	for (i = 0; i < iovcnt; i++)
+		buflen += iov[i].iov_len;
 
 	/* Make sure buflen is non-zero. */
 	assert(buflen != 0);
@@ -162,21 +324,37 @@ network_write(int fd, const uint8_t * buf, size_t buflen, size_t minwrite,
 	/* Sanity-check: # bytes must fit into a ssize_t. */
 	assert(buflen <= SSIZE_MAX);
 
+	/* Sanity-check: we can't need to write more than we have. */
+	assert(minwrite <= buflen);
+
 	/* Bake a cookie. */
 	if ((C = mpool_network_write_cookie_malloc()) == NULL)
 		goto err0;
 	C->callback = callback;
 	C->cookie = cookie;
 	C->fd = fd;
-	C->buf = buf;
-	C->buflen = buflen;
+	memcpy(C->iov, iov, (size_t)iovcnt * sizeof(struct iovec));
+	C->iovcnt = iovcnt;
+	C->iovpos = 0;
 	C->minlen = minwrite;
 	C->bufpos = 0;
-
-	/* Register a callback for network readiness. */
-	if (events_network_register(callback_buf, C, C->fd,
-	    EVENTS_NETWORK_OP_WRITE))
-		goto err1;
+	C->sendflags = MSG_NOSIGNAL;
+	if (flags & NETWORK_WRITE_MORE)
+		C->sendflags |= MSG_MORE;
+	C->req = NULL;
+
+	/*
+	 * Submit the write directly if we're using io_uring; otherwise,
+	 * register a callback for network readiness.
+	 */
+	if (network_uring_enabled()) {
+		if (submit_uring(C))
+			goto err1;
+	} else {
+		if (events_network_register(callback_buf, C, C->fd,
+		    EVENTS_NETWORK_OP_WRITE))
+			goto err1;
+	}
 
 	/* Success! */
 	return (C);
@@ -191,15 +369,19 @@ err0:
 /**
  * network_write_cancel(cookie):
  * Cancel the buffer write for which the cookie ${cookie} was returned by
- * network_write().  Do not invoke the callback associated with the write.
+ * network_write() or network_writev().  Do not invoke the callback associated
+ * with the write.
  */
 void
 network_write_cancel(void * cookie)
 {
 	struct network_write_cookie * C = cookie;
 
-	/* Kill the network event. */
-	events_network_cancel(C->fd, EVENTS_NETWORK_OP_WRITE);
+	/* Kill the io_uring request or the network event. */
+	if (C->req != NULL)
+		network_uring_cancel(C->req);
+	else
+		events_network_cancel(C->fd, EVENTS_NETWORK_OP_WRITE);
 
 	/* Free the cookie. */
 	mpool_network_write_cookie_free(C);
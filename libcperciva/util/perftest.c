@@ -1,14 +1,473 @@
+/* We use non-POSIX functionality in this file. */
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+/*
+ * CPU affinity masks are a GNU extension on Linux, and perf_event_open(2)
+ * is Linux-only; we need the kernel headers and syscall(2) for the latter.
+ */
+#if defined(__linux__)
+#define _GNU_SOURCE 1
+#include <sched.h>
+
+#if defined(CPU_SET)
+#define PERFTEST_PIN
+#endif
+
+#if defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#include <sys/syscall.h>
+
+#include <linux/perf_event.h>
+
+#if defined(__NR_perf_event_open)
+#define PERFTEST_PERF_EVENT
+#endif
+#endif
+#endif
+#endif
+
+/* The timestamp counter is available on x86. */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PERFTEST_TSC
+#endif
+
 #include <assert.h>
+#include <math.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "monoclock.h"
 #include "warnp.h"
 
 #include "perftest.h"
 
+/* Ways of counting CPU cycles. */
+#define CYCLES_NONE	0
+#define CYCLES_PERF	1
+#define CYCLES_TSC	2
+
+/* Options set by perftest_init(). */
+static size_t ntrials = 1;
+static int format = PERFTEST_FORMAT_TEXT;
+static int cycles = CYCLES_NONE;
+
+/* Name of the test, set by perftest_name(). */
+static char name[256] = "";
+
+/* Have we printed the CSV header lines? */
+static int csv_header = 0;
+static int csv_header_ops = 0;
+
+/* Open a perf_event_open(2) CPU cycle counter, or return -1. */
+static int
+perf_open(void)
+{
+#ifdef PERFTEST_PERF_EVENT
+	struct perf_event_attr attr;
+	long fd;
+
+	/* Count cycles used by this process and any threads it creates. */
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.inherit = 1;
+	attr.exclude_hv = 1;
+
+	/* Count cycles in the kernel too, if we're allowed to. */
+	if ((fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0)) == -1) {
+		attr.exclude_kernel = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	return ((int)fd);
+#else
+	return (-1);
+#endif
+}
+
+/* Read the cycle counter ${fd}, or the timestamp counter if ${fd} is -1. */
+static int
+cycles_read(int fd, uint64_t * val)
+{
+
+	/* Read the perf counter. */
+	if (fd != -1) {
+		if (read(fd, val, sizeof(uint64_t)) != sizeof(uint64_t)) {
+			warnp("read");
+			goto err0;
+		}
+		return (0);
+	}
+
+#ifdef PERFTEST_TSC
+	/* Read the timestamp counter. */
+	*val = __builtin_ia32_rdtsc();
+	return (0);
+#endif
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Pin this process to CPU number ${cpu}. */
+static int
+pincpu(int cpu)
+{
+#ifdef PERFTEST_PIN
+	cpu_set_t set;
+
+	/* Sanity-check. */
+	if ((cpu < 0) || (cpu >= CPU_SETSIZE)) {
+		warn0("Invalid CPU number: %d", cpu);
+		goto err0;
+	}
+
+	/* Run on that CPU only. */
+	CPU_ZERO(&set);
+	CPU_SET((size_t)cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		warnp("sched_setaffinity");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+#else
+	(void)cpu; /* UNUSED */
+
+	warn0("CPU pinning is not supported on this platform");
+	goto err0;
+#endif
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * perftest_init(ntrials, format, cycles, cpu):
+ * Configure subsequent calls to perftest_buffers() and perftest_ops(): time
+ * each block size (or set of operations) ${ntrials} times and report the
+ * median, minimum, and standard deviation of the times; print results in
+ * ${format}, which is one of PERFTEST_FORMAT_*; if ${cycles} is non-zero,
+ * also count CPU cycles (using perf_event_open(2) on Linux, or the timestamp
+ * counter on x86); and if ${cpu} is not -1, pin this process to CPU number
+ * ${cpu} (on Linux).  Without this, each block size is timed once and the
+ * results are printed as text.
+ */
+int
+perftest_init(size_t _ntrials, int _format, int _cycles, int cpu)
+{
+	int fd;
+
+	/* Sanity-check. */
+	assert(_ntrials > 0);
+	assert((_format == PERFTEST_FORMAT_TEXT) ||
+	    (_format == PERFTEST_FORMAT_CSV) ||
+	    (_format == PERFTEST_FORMAT_JSON));
+
+	/* Pin to a CPU, if requested. */
+	if ((cpu != -1) && pincpu(cpu))
+		goto err0;
+
+	/* Figure out how to count cycles, if requested. */
+	cycles = CYCLES_NONE;
+	if (_cycles) {
+		if ((fd = perf_open()) != -1) {
+			close(fd);
+			cycles = CYCLES_PERF;
+		} else {
+#ifdef PERFTEST_TSC
+			cycles = CYCLES_TSC;
+#else
+			warn0("Cannot count CPU cycles on this platform");
+			goto err0;
+#endif
+		}
+	}
+
+	/* Record options. */
+	ntrials = _ntrials;
+	format = _format;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * perftest_name(format, ...):
+ * Name the test performed by subsequent calls to perftest_buffers() or
+ * perftest_ops(), using a printf-style ${format}.  When printing text, print
+ * "Testing <name>".
+ */
+void
+perftest_name(const char * fmt, ...)
+{
+	va_list ap;
+
+	/* Record the name; it's fine if it is truncated. */
+	va_start(ap, fmt);
+	vsnprintf(name, sizeof(name), fmt, ap);
+	va_end(ap);
+
+	/* Report what we're doing. */
+	if (format == PERFTEST_FORMAT_TEXT)
+		printf("Testing %s\n", name);
+}
+
+/* Print the test name as a CSV or JSON string. */
+static void
+print_name(void)
+{
+	const char * s;
+
+	putchar('"');
+	for (s = name; *s != '\0'; s++) {
+		if ((format == PERFTEST_FORMAT_CSV) && (*s == '"'))
+			printf("\"\"");
+		else if ((format == PERFTEST_FORMAT_JSON) &&
+		    ((*s == '"') || (*s == '\\')))
+			printf("\\%c", *s);
+		else if ((format == PERFTEST_FORMAT_JSON) &&
+		    ((unsigned char)*s < 0x20))
+			printf("\\u%04x", (unsigned int)(unsigned char)*s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+/* Compare two doubles, for qsort(). */
+static int
+cmp_double(const void * x, const void * y)
+{
+	double a = *(const double *)x;
+	double b = *(const double *)y;
+
+	return ((a > b) - (a < b));
+}
+
+/*
+ * Find the median, minimum, and standard deviation of the ${n} values ${x},
+ * which are sorted in the process.
+ */
+static void
+summarize(double * x, size_t n, double * median, double * min,
+    double * stddev)
+{
+	double mean = 0.0;
+	double var = 0.0;
+	size_t i;
+
+	/* Standard deviation. */
+	for (i = 0; i < n; i++)
+		mean += x[i];
+	mean /= (double)n;
+	for (i = 0; i < n; i++)
+		var += (x[i] - mean) * (x[i] - mean);
+	*stddev = (n > 1) ? sqrt(var / (double)(n - 1)) : 0.0;
+
+	/* Median and minimum. */
+	qsort(x, n, sizeof(double), cmp_double);
+	if (n % 2)
+		*median = x[n / 2];
+	else
+		*median = (x[n / 2 - 1] + x[n / 2]) / 2.0;
+	*min = x[0];
+}
+
+/*
+ * Get the current time (cpu time if ${cputime} is non-zero) and, if we're
+ * counting cycles, the cycle count from ${fd}.  The cycle count is read
+ * after the time, so that reading the clock is not counted.
+ */
+static int
+timer_start(int cputime, int fd, struct timeval * tv, uint64_t * cyc)
+{
+
+	/* Get the time. */
+	if (cputime) {
+		if (monoclock_get_cputime(tv)) {
+			warnp("monoclock_get_cputime()");
+			goto err0;
+		}
+	} else {
+		if (monoclock_get(tv)) {
+			warnp("monoclock_get()");
+			goto err0;
+		}
+	}
+
+	/* Get the cycle count. */
+	if ((cycles != CYCLES_NONE) && cycles_read(fd, cyc))
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Get the cycle count from ${fd} if we're counting cycles, and the current
+ * time; and store the time and number of cycles since timer_start() was
+ * called with ${begin} and ${cycles_begin} in ${delta} and ${ncycles}.
+ */
+static int
+timer_stop(int cputime, int fd, struct timeval begin, uint64_t cycles_begin,
+    double * delta, double * ncycles)
+{
+	struct timeval end;
+	uint64_t cycles_end;
+
+	/* Get the cycle count. */
+	if ((cycles != CYCLES_NONE) && cycles_read(fd, &cycles_end))
+		goto err0;
+
+	/* Get the time. */
+	if (cputime) {
+		if (monoclock_get_cputime(&end)) {
+			warnp("monoclock_get_cputime()");
+			goto err0;
+		}
+	} else {
+		if (monoclock_get(&end)) {
+			warnp("monoclock_get()");
+			goto err0;
+		}
+	}
+
+	/* Record the differences. */
+	*delta = timeval_diff(begin, end);
+	if (cycles != CYCLES_NONE)
+		*ncycles = (double)(cycles_end - cycles_begin);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Print the results for one block size. */
+static void
+print_result(size_t num_buffers, size_t buflen, double median, double min,
+    double stddev, double cpb)
+{
+	const char * cycles_type = (cycles == CYCLES_PERF) ? "cycles" : "tsc";
+	double speed;
+
+	/* We might not be processing an integer number of buffers. */
+	speed = (double)(buflen * num_buffers) / 1e6 / median;
+
+	switch (format) {
+	case PERFTEST_FORMAT_TEXT:
+		printf("%zu blocks of size %zu\t%.06f s\t%.06f MB/s",
+		    num_buffers, buflen, median, speed);
+		if (ntrials > 1)
+			printf("\tmin %.06f s\tstddev %.06f s", min, stddev);
+		if (cycles != CYCLES_NONE)
+			printf("\t%.3f %s/byte", cpb, cycles_type);
+		printf("\n");
+		break;
+	case PERFTEST_FORMAT_CSV:
+		if (!csv_header) {
+			printf("test,blocks,blocksize,trials,time_median,"
+			    "time_min,time_stddev,speed_MBps,"
+			    "cycles_per_byte,cycles_type\n");
+			csv_header = 1;
+		}
+		print_name();
+		printf(",%zu,%zu,%zu,%.06f,%.06f,%.06f,%.06f,", num_buffers,
+		    buflen, ntrials, median, min, stddev, speed);
+		if (cycles != CYCLES_NONE)
+			printf("%.3f,%s", cpb, cycles_type);
+		else
+			printf(",");
+		printf("\n");
+		break;
+	case PERFTEST_FORMAT_JSON:
+		printf("{\"test\": ");
+		print_name();
+		printf(", \"blocks\": %zu, \"blocksize\": %zu, \"trials\": %zu,"
+		    " \"time_median\": %.06f, \"time_min\": %.06f,"
+		    " \"time_stddev\": %.06f, \"speed_MBps\": %.06f",
+		    num_buffers, buflen, ntrials, median, min, stddev, speed);
+		if (cycles != CYCLES_NONE)
+			printf(", \"cycles_per_byte\": %.3f,"
+			    " \"cycles_type\": \"%s\"", cpb, cycles_type);
+		printf("}\n");
+		break;
+	}
+}
+
+/* Print the results for ${nops} operations. */
+static void
+print_ops_result(size_t nops, double median, double min, double stddev,
+    double cpo)
+{
+	const char * cycles_type = (cycles == CYCLES_PERF) ? "cycles" : "tsc";
+	double rate, latency;
+
+	/* Operations per second, and microseconds per operation. */
+	rate = (double)nops / median;
+	latency = median * 1e6 / (double)nops;
+
+	switch (format) {
+	case PERFTEST_FORMAT_TEXT:
+		printf("%zu operations\t%.06f s\t%.1f ops/s\t%.3f us/op",
+		    nops, median, rate, latency);
+		if (ntrials > 1)
+			printf("\tmin %.06f s\tstddev %.06f s", min, stddev);
+		if (cycles != CYCLES_NONE)
+			printf("\t%.0f %s/op", cpo, cycles_type);
+		printf("\n");
+		break;
+	case PERFTEST_FORMAT_CSV:
+		if (!csv_header_ops) {
+			printf("test,operations,trials,time_median,time_min,"
+			    "time_stddev,ops_per_sec,us_per_op,"
+			    "cycles_per_op,cycles_type\n");
+			csv_header_ops = 1;
+		}
+		print_name();
+		printf(",%zu,%zu,%.06f,%.06f,%.06f,%.1f,%.3f,", nops,
+		    ntrials, median, min, stddev, rate, latency);
+		if (cycles != CYCLES_NONE)
+			printf("%.0f,%s", cpo, cycles_type);
+		else
+			printf(",");
+		printf("\n");
+		break;
+	case PERFTEST_FORMAT_JSON:
+		printf("{\"test\": ");
+		print_name();
+		printf(", \"operations\": %zu, \"trials\": %zu,"
+		    " \"time_median\": %.06f, \"time_min\": %.06f,"
+		    " \"time_stddev\": %.06f, \"ops_per_sec\": %.1f,"
+		    " \"us_per_op\": %.3f", nops, ntrials, median, min, stddev,
+		    rate, latency);
+		if (cycles != CYCLES_NONE)
+			printf(", \"cycles_per_op\": %.0f,"
+			    " \"cycles_type\": \"%s\"", cpo, cycles_type);
+		printf("}\n");
+		break;
+	}
+}
+
 /**
  * perftest_buffers(nbytes, sizes, nsizes, nbytes_warmup, cputime,
  *     init_func, func, clean_func, cookie):
@@ -32,15 +491,21 @@ perftest_buffers(size_t nbytes, const size_t * sizes, size_t nsizes,
     int clean_func(void * cookie), void * cookie)
 {
 	uint8_t * buf;
-	struct timeval begin, end;
+	struct timeval begin;
 	double * delta_s;
-	double speed;
-	size_t i;
+	double * cycles_b;
+	double * median_s;
+	double * min_s;
+	double * stddev_s;
+	double * cpb;
+	double unused;
+	uint64_t cycles_begin;
+	size_t i, j;
 	size_t buflen;
 	size_t num_buffers;
 	size_t nbuffers_warmup;
-	size_t nbytes_in_buffer;
 	size_t max_buflen = 0;
+	int fd = -1;
 
 	/* Find the maximum buffer size. */
 	for (i = 0; i < nsizes; i++) {
@@ -54,19 +519,33 @@ perftest_buffers(size_t nbytes, const size_t * sizes, size_t nsizes,
 		warnp("malloc");
 		goto err0;
 	}
-	if ((delta_s = malloc(nsizes * sizeof(double))) == NULL) {
+	if ((delta_s = malloc(ntrials * 2 * sizeof(double))) == NULL) {
 		warnp("malloc");
 		goto err1;
 	}
+	cycles_b = &delta_s[ntrials];
+	if ((median_s = malloc(nsizes * 4 * sizeof(double))) == NULL) {
+		warnp("malloc");
+		goto err2;
+	}
+	min_s = &median_s[nsizes];
+	stddev_s = &median_s[nsizes * 2];
+	cpb = &median_s[nsizes * 3];
+
+	/* Open the cycle counter. */
+	if ((cycles == CYCLES_PERF) && ((fd = perf_open()) == -1)) {
+		warnp("perf_event_open");
+		goto err3;
+	}
 
 	/* Warm up. */
 	nbuffers_warmup = nbytes_warmup / max_buflen;
 	if (init_func && init_func(cookie, buf, max_buflen))
-		goto err2;
+		goto err4;
 	if (func(cookie, buf, max_buflen, nbuffers_warmup))
-		goto err3;
+		goto err5;
 	if (clean_func && clean_func(cookie))
-		goto err2;
+		goto err4;
 
 	/* Run operations. */
 	for (i = 0; i < nsizes; i++) {
@@ -75,72 +554,62 @@ perftest_buffers(size_t nbytes, const size_t * sizes, size_t nsizes,
 		assert(buflen > 0);
 		num_buffers = nbytes / buflen;
 
-		/* Set up. */
-		if (init_func && init_func(cookie, buf, buflen))
-			goto err2;
-
-		/* Get beginning time. */
-		if (cputime) {
-			if (monoclock_get_cputime(&begin)) {
-				warnp("monoclock_get_cputime()");
-				goto err3;
-			}
-		} else {
-			if (monoclock_get(&begin)) {
-				warnp("monoclock_get()");
-				goto err3;
-			}
-		}
+		for (j = 0; j < ntrials; j++) {
+			/* Set up. */
+			if (init_func && init_func(cookie, buf, buflen))
+				goto err4;
 
-		/* Time actual code. */
-		if (func(cookie, buf, buflen, num_buffers))
-			goto err3;
+			/* Time actual code. */
+			if (timer_start(cputime, fd, &begin, &cycles_begin))
+				goto err5;
+			if (func(cookie, buf, buflen, num_buffers))
+				goto err5;
+			if (timer_stop(cputime, fd, begin, cycles_begin,
+			    &delta_s[j], &cycles_b[j]))
+				goto err5;
 
-		/* Get ending time. */
-		if (cputime) {
-			if (monoclock_get_cputime(&end)) {
-				warnp("monoclock_get_cputime()");
-				goto err3;
-			}
-		} else {
-			if (monoclock_get(&end)) {
-				warnp("monoclock_get()");
-				goto err3;
-			}
+			/* Clean up. */
+			if (clean_func && clean_func(cookie))
+				goto err4;
 		}
 
-		/* Store time. */
-		delta_s[i] = timeval_diff(begin, end);
-
-		/* Clean up. */
-		if (clean_func && clean_func(cookie))
-			goto err2;
+		/* Summarize the trials. */
+		summarize(delta_s, ntrials, &median_s[i], &min_s[i],
+		    &stddev_s[i]);
+		if (cycles != CYCLES_NONE) {
+			summarize(cycles_b, ntrials, &cpb[i], &unused,
+			    &unused);
+			cpb[i] /= (double)(buflen * num_buffers);
+		} else
+			cpb[i] = 0.0;
 	}
 
 	/* Print output. */
 	for (i = 0; i < nsizes; i++) {
 		buflen = sizes[i];
 		num_buffers = nbytes / buflen;
-
-		/* We might not be processing an integer number of buffers. */
-		nbytes_in_buffer = buflen * num_buffers;
-		speed = (double)nbytes_in_buffer / 1e6 / delta_s[i];
-
-		/* Print output. */
-		printf("%zu blocks of size %zu\t%.06f s\t%.06f MB/s\n",
-		    num_buffers, buflen, delta_s[i], speed);
+		print_result(num_buffers, buflen, median_s[i], min_s[i],
+		    stddev_s[i], cpb[i]);
 	}
 
 	/* Clean up. */
+	if (fd != -1)
+		close(fd);
+	free(median_s);
 	free(delta_s);
 	free(buf);
 
 	/* Success! */
 	return (0);
 
-err3:
+err5:
 	if (clean_func)
 		clean_func(cookie);
+err4:
+	if (fd != -1)
+		close(fd);
+err3:
+	free(median_s);
 err2:
 	free(delta_s);
 err1:
@@ -149,3 +618,105 @@ err0:
 	/* Failure! */
 	return (-1);
 }
+
+/**
+ * perftest_ops(nops, nops_warmup, init_func, func, clean_func, cookie):
+ * Time using ${func} to perform ${nops} operations, after performing
+ * ${nops_warmup} operations which are not timed.  Invoke callback functions
+ * as:
+ *     init_func(cookie)
+ *     func(cookie, nops)
+ *     clean_func(cookie)
+ * and print the number of operations per second and the time taken by each
+ * operation.  ${init_func} and ${clean_func} may be NULL.  If ${init_func}
+ * has completed successfully, then ${clean_func} will be called if there is
+ * a subsequent error.
+ */
+int
+perftest_ops(size_t nops, size_t nops_warmup, int init_func(void * cookie),
+    int func(void * cookie, size_t nops), int clean_func(void * cookie),
+    void * cookie)
+{
+	struct timeval begin;
+	double * delta_s;
+	double * cycles_b;
+	double median_s, min_s, stddev_s;
+	double cpo;
+	double unused;
+	uint64_t cycles_begin;
+	size_t j;
+	int fd = -1;
+
+	/* Sanity-check. */
+	assert(nops > 0);
+
+	/* Allocate buffers. */
+	if ((delta_s = malloc(ntrials * 2 * sizeof(double))) == NULL) {
+		warnp("malloc");
+		goto err0;
+	}
+	cycles_b = &delta_s[ntrials];
+
+	/* Open the cycle counter. */
+	if ((cycles == CYCLES_PERF) && ((fd = perf_open()) == -1)) {
+		warnp("perf_event_open");
+		goto err1;
+	}
+
+	/* Warm up. */
+	if (init_func && init_func(cookie))
+		goto err2;
+	if (func(cookie, nops_warmup))
+		goto err3;
+	if (clean_func && clean_func(cookie))
+		goto err2;
+
+	/* Run operations. */
+	for (j = 0; j < ntrials; j++) {
+		/* Set up. */
+		if (init_func && init_func(cookie))
+			goto err2;
+
+		/* Time actual code. */
+		if (timer_start(0, fd, &begin, &cycles_begin))
+			goto err3;
+		if (func(cookie, nops))
+			goto err3;
+		if (timer_stop(0, fd, begin, cycles_begin, &delta_s[j],
+		    &cycles_b[j]))
+			goto err3;
+
+		/* Clean up. */
+		if (clean_func && clean_func(cookie))
+			goto err2;
+	}
+
+	/* Summarize the trials and print output. */
+	summarize(delta_s, ntrials, &median_s, &min_s, &stddev_s);
+	if (cycles != CYCLES_NONE) {
+		summarize(cycles_b, ntrials, &cpo, &unused, &unused);
+		cpo /= (double)nops;
+	} else
+		cpo = 0.0;
+	print_ops_result(nops, median_s, min_s, stddev_s, cpo);
+
+	/* Clean up. */
+	if (fd != -1)
+		close(fd);
+	free(delta_s);
+
+	/* Success! */
+	return (0);
+
+err3:
+	if (clean_func)
+		clean_func(cookie);
+err2:
+	if (fd != -1)
+		close(fd);
+err1:
+	free(delta_s);
+err0:
+	/* Failure! */
+	return (-1);
+}
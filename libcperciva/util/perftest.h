@@ -4,6 +4,32 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Output formats for perftest_buffers() and perftest_ops(). */
+#define PERFTEST_FORMAT_TEXT	0
+#define PERFTEST_FORMAT_CSV	1
+#define PERFTEST_FORMAT_JSON	2
+
+/**
+ * perftest_init(ntrials, format, cycles, cpu):
+ * Configure subsequent calls to perftest_buffers() and perftest_ops(): time
+ * each block size (or set of operations) ${ntrials} times and report the
+ * median, minimum, and standard deviation of the times; print results in
+ * ${format}, which is one of PERFTEST_FORMAT_*; if ${cycles} is non-zero,
+ * also count CPU cycles (using perf_event_open(2) on Linux, or the timestamp
+ * counter on x86); and if ${cpu} is not -1, pin this process to CPU number
+ * ${cpu} (on Linux).  Without this, each block size is timed once and the
+ * results are printed as text.
+ */
+int perftest_init(size_t, int, int, int);
+
+/**
+ * perftest_name(format, ...):
+ * Name the test performed by subsequent calls to perftest_buffers() or
+ * perftest_ops(), using a printf-style ${format}.  When printing text, print
+ * "Testing <name>".
+ */
+void perftest_name(const char *, ...);
+
 /**
  * perftest_buffers(nbytes, sizes, nsizes, nbytes_warmup, cputime,
  *     init_func, func, clean_func, cookie):
@@ -24,4 +50,20 @@ int perftest_buffers(size_t, const size_t *, size_t, size_t, int,
     int (*)(void *, uint8_t *, size_t, size_t),
     int (*)(void *), void *);
 
+/**
+ * perftest_ops(nops, nops_warmup, init_func, func, clean_func, cookie):
+ * Time using ${func} to perform ${nops} operations, after performing
+ * ${nops_warmup} operations which are not timed.  Invoke callback functions
+ * as:
+ *     init_func(cookie)
+ *     func(cookie, nops)
+ *     clean_func(cookie)
+ * and print the number of operations per second and the time taken by each
+ * operation.  ${init_func} and ${clean_func} may be NULL.  If ${init_func}
+ * has completed successfully, then ${clean_func} will be called if there is
+ * a subsequent error.
+ */
+int perftest_ops(size_t, size_t, int (*)(void *), int (*)(void *, size_t),
+    int (*)(void *), void *);
+
 #endif /* !_PERFTESTS_H_ */
@@ -296,13 +296,21 @@ err0:
 	return (NULL);
 }
 
-/**
- * sock_listener(sa):
- * Create a socket, attempt to set SO_REUSEADDR, bind it to the socket address
- * ${sa}, mark it for listening, and mark it as non-blocking.
+/*
+ * Socket option which lets several sockets listen on the same address with
+ * the kernel distributing incoming connections between them.  On most BSDs
+ * SO_REUSEPORT allows the sockets to be bound but sends every connection to
+ * the same one, so we only use it where it load-balances.
  */
-int
-sock_listener(const struct sock_addr * sa)
+#if defined(SO_REUSEPORT_LB)
+#define SOCK_REUSEPORT SO_REUSEPORT_LB
+#elif defined(SO_REUSEPORT) && (defined(__linux__) || defined(__DragonFly__))
+#define SOCK_REUSEPORT SO_REUSEPORT
+#endif
+
+/* Create a listening socket, optionally setting SOCK_REUSEPORT. */
+static int
+listener(const struct sock_addr * sa, int reuseport)
 {
 	int s;
 	int val = 1;
@@ -322,6 +330,19 @@ sock_listener(const struct sock_addr * sa)
 		}
 	}
 
+#ifdef SOCK_REUSEPORT
+	/* Share the address with other sockets (if applicable). */
+	if (reuseport &&
+	    setsockopt(s, SOL_SOCKET, SOCK_REUSEPORT, &val, sizeof(val))) {
+		/* Our caller can cope with ENOPROTOOPT. */
+		if (errno != ENOPROTOOPT)
+			warnp("setsockopt(SO_REUSEPORT)");
+		goto err1;
+	}
+#else
+	(void)reuseport; /* UNUSED */
+#endif
+
 	/* Bind the socket. */
 	if (bind(s, sa->name, sa->namelen)) {
 		warnp("Error binding socket");
@@ -350,6 +371,44 @@ err0:
 	return (-1);
 }
 
+/**
+ * sock_listener(sa):
+ * Create a socket, attempt to set SO_REUSEADDR, bind it to the socket address
+ * ${sa}, mark it for listening, and mark it as non-blocking.
+ */
+int
+sock_listener(const struct sock_addr * sa)
+{
+
+	/* Create the socket. */
+	return (listener(sa, 0));
+}
+
+/**
+ * sock_listener_reuseport(sa):
+ * As sock_listener(), but allow several such sockets to be bound to ${sa},
+ * with incoming connections distributed between them by the kernel.  If
+ * this is not supported for the address ${sa} (e.g., because it is a Unix
+ * domain socket) or on this platform, return -1 with errno set to
+ * ENOPROTOOPT.
+ */
+int
+sock_listener_reuseport(const struct sock_addr * sa)
+{
+
+#ifdef SOCK_REUSEPORT
+	/* Unix domain sockets can't share a path. */
+	if (sa->ai_family != AF_UNIX)
+		return (listener(sa, 1));
+#else
+	(void)sa; /* UNUSED */
+#endif
+
+	/* Not supported. */
+	errno = ENOPROTOOPT;
+	return (-1);
+}
+
 /**
  * sock_connect(sas):
  * Iterate through the addresses in ${sas}, attempting to create a socket and
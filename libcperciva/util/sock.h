@@ -25,6 +25,16 @@ struct sock_addr ** sock_resolve(const char *);
  */
 int sock_listener(const struct sock_addr *);
 
+/**
+ * sock_listener_reuseport(sa):
+ * As sock_listener(), but allow several such sockets to be bound to ${sa},
+ * with incoming connections distributed between them by the kernel.  If
+ * this is not supported for the address ${sa} (e.g., because it is a Unix
+ * domain socket) or on this platform, return -1 with errno set to
+ * ENOPROTOOPT.
+ */
+int sock_listener_reuseport(const struct sock_addr *);
+
 /**
  * sock_connect(sas):
  * Iterate through the addresses in ${sas}, attempting to create a socket and
@@ -117,6 +117,76 @@ err0:
 	return (NULL);
 }
 
+/**
+ * sock_addr_interleave(sas):
+ * Return a NULL-terminated array holding the addresses in ${sas}, reordered
+ * so that address families alternate, starting with the family of the first
+ * address and otherwise preserving the order within each family (as
+ * recommended by RFC 8305).  The addresses are not duplicated; the array
+ * should be freed with free(3).
+ */
+struct sock_addr **
+sock_addr_interleave(struct sock_addr * const * sas)
+{
+	struct sock_addr ** sas2;
+	struct family {
+		int family;
+		size_t pos;
+	} * F;
+	size_t nfam = 0;
+	size_t n, i, j, k;
+
+	/* Count socket addresses. */
+	for (n = 0; sas[n] != NULL; n++)
+		continue;
+
+	/* Allocate the list, and space to track each address family. */
+	if ((sas2 = malloc((n + 1) * sizeof(struct sock_addr *))) == NULL)
+		goto err0;
+	if ((F = malloc((n + 1) * sizeof(struct family))) == NULL)
+		goto err1;
+
+	/* List the address families in order of first appearance. */
+	for (j = 0; j < n; j++) {
+		for (k = 0; k < nfam; k++) {
+			if (F[k].family == sas[j]->ai_family)
+				break;
+		}
+		if (k == nfam) {
+			F[nfam].family = sas[j]->ai_family;
+			F[nfam].pos = j;
+			nfam++;
+		}
+	}
+
+	/* Take the next address from each family in turn. */
+	for (i = 0; i < n; ) {
+		for (k = 0; k < nfam; k++) {
+			for (j = F[k].pos; j < n; j++) {
+				if (sas[j]->ai_family == F[k].family)
+					break;
+			}
+			if (j < n) {
+				sas2[i++] = sas[j];
+				F[k].pos = j + 1;
+			}
+		}
+	}
+	sas2[n] = NULL;
+
+	/* Clean up. */
+	free(F);
+
+	/* Success! */
+	return (sas2);
+
+err1:
+	free(sas2);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
 /**
  * sock_addr_serialize(sa, buf, buflen):
  * Allocate a buffer and serialize the socket address ${sa} into it.  Return
@@ -25,6 +25,16 @@ struct sock_addr * sock_addr_dup(const struct sock_addr *);
  */
 struct sock_addr ** sock_addr_duplist(struct sock_addr * const *);
 
+/**
+ * sock_addr_interleave(sas):
+ * Return a NULL-terminated array holding the addresses in ${sas}, reordered
+ * so that address families alternate, starting with the family of the first
+ * address and otherwise preserving the order within each family (as
+ * recommended by RFC 8305).  The addresses are not duplicated; the array
+ * should be freed with free(3).
+ */
+struct sock_addr ** sock_addr_interleave(struct sock_addr * const *);
+
 /**
  * sock_addr_serialize(sa, buf, buflen):
  * Allocate a buffer and serialize the socket address ${sa} into it.  Return
@@ -0,0 +1,137 @@
+#!/bin/sh
+
+# Compare performance results against a baseline, and report any metric which
+# has become worse by more than a noise threshold.
+#
+# Results files (as written by run-perftests.sh) contain comment lines
+# starting with "#", which record where and when the results were obtained,
+# and one line per metric with tab-separated fields:
+#
+#   name  value  unit  better  [threshold]
+#
+# where ${better} is "higher" or "lower" for numeric values, or "same" for
+# values (such as which AES implementation was used) which should not change
+# at all; and ${threshold}, if present, is the percentage by which that
+# metric may become worse before it is flagged, overriding -t.  Metrics are
+# matched by name; metrics in the baseline which are missing from the results
+# are flagged too.
+#
+# Exit with status 1 if anything was flagged.
+
+set -e -o noclobber -o nounset
+
+usage() {
+	echo "usage: $0 [-t <threshold percent>] baseline results" 1>&2
+	exit 1
+}
+
+# Defaults.
+threshold=10
+
+# Parse command line.
+while getopts "t:" opt; do
+	case ${opt} in
+	t)	threshold=${OPTARG} ;;
+	*)	usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+if [ "$#" -ne 2 ]; then
+	usage
+fi
+baseline=$1
+results=$2
+for f in "${baseline}" "${results}"; do
+	if ! [ -r "${f}" ]; then
+		echo "cannot read ${f}" 1>&2
+		exit 1
+	fi
+done
+if ! grep -q '^[^#]' "${baseline}"; then
+	echo "no metrics in ${baseline}" 1>&2
+	exit 1
+fi
+
+# Where did the two sets of results come from?
+sed -n 's/^# /baseline: /p' "${baseline}"
+sed -n 's/^# /results:  /p' "${results}"
+echo
+
+awk -F '\t' -v threshold="${threshold}" '
+	FNR == 1 {
+		nfile++
+	}
+
+	# Remember the baseline (the first file).
+	nfile == 1 {
+		if ($0 ~ /^#/ || NF < 4)
+			next
+		base[$1] = $2
+		unit[$1] = $3
+		better[$1] = $4
+		limit[$1] = (NF >= 5) ? $5 : threshold
+		order[n++] = $1
+		next
+	}
+
+	# Remember the results (the second file).
+	$0 !~ /^#/ && NF >= 4 {
+		cur[$1] = $2
+		if (!($1 in base))
+			extra[m++] = $1
+	}
+
+	function report(name, b, c, change, status) {
+		printf("%-10s %8s %14s %14s  %s\n", status, change, b, c,
+		    name)
+	}
+
+	END {
+		report("metric", "baseline", "current", "change", "status")
+		for (i = 0; i < n; i++) {
+			name = order[i]
+			label = name " (" unit[name] ")"
+			if (!(name in cur)) {
+				report(label, base[name], "-", "-", "MISSING")
+				nbad++
+				continue
+			}
+
+			# Values which should not change at all.
+			if (better[name] == "same") {
+				if (cur[name] == base[name]) {
+					status = "ok"
+				} else {
+					status = "CHANGED"
+					nbad++
+				}
+				report(label, base[name], cur[name], "-",
+				    status)
+				continue
+			}
+
+			# Percentage change, and how much worse that is.
+			if (base[name] == 0) {
+				report(label, base[name], cur[name], "-", "ok")
+				continue
+			}
+			change = (cur[name] - base[name]) / base[name] * 100
+			worse = (better[name] == "higher") ? -change : change
+			if (worse > limit[name]) {
+				status = "REGRESSION"
+				nbad++
+			} else if (-worse > limit[name]) {
+				status = "improved"
+			} else {
+				status = "ok"
+			}
+			report(label, base[name], cur[name],
+			    sprintf("%+.1f%%", change), status)
+		}
+		for (i = 0; i < m; i++)
+			report(extra[i], "-", cur[extra[i]], "-", "new")
+
+		printf("\n%d metrics compared, %d flagged (threshold %s%%)\n",
+		    n, nbad, threshold)
+		exit(nbad > 0)
+	}' "${baseline}" "${results}"
@@ -0,0 +1,104 @@
+#!/bin/sh
+
+# Measure how the cost of an event loop iteration grows with the number of
+# sockets being watched, for each events_network backend: for each number of
+# sockets, make a random subset of them readable and time how long it takes
+# to handle them.  Print a table of the time per iteration, in microseconds.
+#
+# Each socket is one end of a socketpair, so each needs two descriptors; the
+# largest counts are skipped if they would not fit within the descriptor
+# limit (ulimit -n).  The uring backend is skipped (and shown as "-") if
+# io_uring is not available.
+
+set -e -o noclobber -o nounset
+
+usage() {
+	echo "usage: $0 [-b <backends>] [-i <iterations>] [-n <trials>]" 1>&2
+	echo "    [-r <ready>] [nsockets ...]" 1>&2
+	exit 1
+}
+
+### Find script directory.
+scriptdir=$(CDPATH='' cd -- "$(dirname -- "$0")" && pwd -P)
+events_network_binary=${scriptdir}/events-network/events-network
+
+# Defaults.
+backends="poll network uring"
+iterations=1000
+trials=1
+nready=1
+
+# Parse command line.
+while getopts "b:i:n:r:" opt; do
+	case ${opt} in
+	b)	backends=${OPTARG} ;;
+	i)	iterations=${OPTARG} ;;
+	n)	trials=${OPTARG} ;;
+	r)	nready=${OPTARG} ;;
+	*)	usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+nsockets=${*:-10 100 1000 10000 100000}
+
+# Check that the binary has been built.
+if ! [ -x "${events_network_binary}" ]; then
+	echo "${events_network_binary} not found; did you run 'make'?" 1>&2
+	exit 1
+fi
+out=$(mktemp -d "${TMPDIR:-/tmp}/spiped-perftest.XXXXXX")
+trap 'rm -rf "${out}"' EXIT
+trap 'exit 1' INT TERM
+
+# Use as many descriptors as we're allowed to, and skip counts which won't
+# fit (leaving some room for stdio and the io_uring).
+ulimit -n "$(ulimit -H -n)" 2>/dev/null || true
+maxfds=$(ulimit -n)
+counts=""
+for n in ${nsockets}; do
+	if [ "${maxfds}" != "unlimited" ] &&				\
+	    [ $((2 * n + 16)) -gt "${maxfds}" ]; then
+		echo "skipping ${n} sockets: descriptor limit is ${maxfds}" 1>&2
+		continue
+	fi
+	counts="${counts} ${n}"
+done
+
+# Run each backend over all of the counts.
+for backend in ${backends}; do
+	if ! "${events_network_binary}" -b "${backend}" -f csv		\
+	    -i "${iterations}" -n "${trials}" -r "${nready}" ${counts}	\
+	    > "${out}/${backend}.csv"; then
+		echo "${backend} backend failed" 1>&2
+	fi
+done
+
+# Print a table of microseconds per iteration.  The test names (which contain
+# commas) include "<n> sockets", and us_per_op is the third-last field.
+echo "ready sockets per iteration: ${nready}; us per iteration:"
+for backend in ${backends}; do
+	awk -F, -v backend="${backend}" '
+		NR > 1 && match($0, /[0-9]+ sockets/) {
+			n = substr($0, RSTART, RLENGTH - 8)
+			printf("%s %s %s\n", n, backend, $(NF - 2))
+		}' "${out}/${backend}.csv"
+done | awk -v counts="${counts}" -v backends="${backends}" '
+	{
+		t[$1, $2] = $3
+	}
+	END {
+		nc = split(counts, c, " ")
+		nb = split(backends, b, " ")
+		printf("%10s", "sockets")
+		for (j = 1; j <= nb; j++)
+			printf("%12s", b[j])
+		printf("\n")
+		for (i = 1; i <= nc; i++) {
+			printf("%10s", c[i])
+			for (j = 1; j <= nb; j++) {
+				v = ((c[i], b[j]) in t) ? t[c[i], b[j]] : "-"
+				printf("%12s", v)
+			}
+			printf("\n")
+		}
+	}'
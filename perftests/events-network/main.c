@@ -0,0 +1,430 @@
+#include <sys/socket.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "events.h"
+#include "getopt.h"
+#include "network.h"
+#include "parsenum.h"
+#include "perftest.h"
+#include "warnp.h"
+
+/*
+ * Measure how the cost of running the event loop grows with the number of
+ * sockets it is watching.  For each NSOCKETS, create that many socketpairs
+ * and wait for one end of each to become readable; then, in each operation,
+ * write a byte to a random subset of NREADY sockets and run the event loop
+ * until every one of them has been handled.
+ *
+ * Each operation performs NREADY one-byte writes and reads whatever the
+ * number of sockets, so any growth in the time per operation comes from the
+ * event loop.  The backends are:
+ *
+ *   poll     events_network_register() directly.
+ *   network  network_read() on top of events_network_register().
+ *   uring    network_read() with requests submitted via io_uring.
+ */
+
+/* Backends. */
+#define BACKEND_POLL	0
+#define BACKEND_NETWORK	1
+#define BACKEND_URING	2
+
+/* A watched socketpair. */
+struct sock {
+	void * read_cookie;
+	int s[2];
+	uint8_t byte;
+};
+
+/* Benchmark state. */
+static int backend;
+static struct sock * socks;
+static size_t nsocks;
+static size_t * perm;
+static size_t nready;
+static size_t nfired;
+static uint64_t rngstate = 1;
+
+/* Event loop exit flag. */
+static int done;
+
+static int callback_ready(void *);
+static int callback_read(void *, ssize_t);
+
+/* Return a pseudo-random number (xorshift64). */
+static uint64_t
+rng(void)
+{
+
+	rngstate ^= rngstate << 13;
+	rngstate ^= rngstate >> 7;
+	rngstate ^= rngstate << 17;
+	return (rngstate);
+}
+
+/* Wait for ${S} to become readable, using the selected backend. */
+static int
+watch(struct sock * S)
+{
+
+	if (backend == BACKEND_POLL) {
+		if (events_network_register(callback_ready, S, S->s[0],
+		    EVENTS_NETWORK_OP_READ)) {
+			warnp("events_network_register");
+			goto err0;
+		}
+	} else {
+		if ((S->read_cookie = network_read(S->s[0], &S->byte, 1, 1,
+		    callback_read, S)) == NULL) {
+			warnp("network_read");
+			goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Stop waiting for ${S} to become readable. */
+static void
+unwatch(struct sock * S)
+{
+
+	if (backend == BACKEND_POLL)
+		events_network_cancel(S->s[0], EVENTS_NETWORK_OP_READ);
+	else if (S->read_cookie != NULL)
+		network_read_cancel(S->read_cookie);
+	S->read_cookie = NULL;
+}
+
+/* A byte has been received on a socket; wait for the next one. */
+static int
+fired(struct sock * S)
+{
+
+	/* Are we finished with this operation? */
+	if (++nfired == nready)
+		done = 1;
+
+	/* Keep watching this socket. */
+	return (watch(S));
+}
+
+/* A socket is readable (poll backend). */
+static int
+callback_ready(void * cookie)
+{
+	struct sock * S = cookie;
+
+	/* Read the byte. */
+	if (read(S->s[0], &S->byte, 1) != 1) {
+		warnp("read");
+		goto err0;
+	}
+
+	/* Handle it. */
+	return (fired(S));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* A byte has been read (network and uring backends). */
+static int
+callback_read(void * cookie, ssize_t len)
+{
+	struct sock * S = cookie;
+
+	/* The read is no longer pending. */
+	S->read_cookie = NULL;
+
+	/* Check results. */
+	if (len != 1) {
+		warnp("network_read");
+		goto err0;
+	}
+
+	/* Handle it. */
+	return (fired(S));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Create ${n} socketpairs and start watching them. */
+static int
+setup(size_t n)
+{
+	size_t i;
+
+	/* Allocate arrays. */
+	if ((socks = malloc(n * sizeof(struct sock))) == NULL) {
+		warnp("malloc");
+		goto err0;
+	}
+	if ((perm = malloc(n * sizeof(size_t))) == NULL) {
+		warnp("malloc");
+		goto err1;
+	}
+
+	/* Create socketpairs, and wait for each one to become readable. */
+	for (nsocks = 0; nsocks < n; nsocks++) {
+		perm[nsocks] = nsocks;
+		socks[nsocks].read_cookie = NULL;
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks[nsocks].s)) {
+			warnp("socketpair");
+			goto err2;
+		}
+		if (fcntl(socks[nsocks].s[0], F_SETFL, O_NONBLOCK) == -1) {
+			warnp("fcntl");
+			goto err3;
+		}
+		if (watch(&socks[nsocks]))
+			goto err3;
+	}
+
+	/* Success! */
+	return (0);
+
+err3:
+	close(socks[nsocks].s[1]);
+	close(socks[nsocks].s[0]);
+err2:
+	for (i = 0; i < nsocks; i++) {
+		unwatch(&socks[i]);
+		close(socks[i].s[1]);
+		close(socks[i].s[0]);
+	}
+	free(perm);
+err1:
+	free(socks);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Stop watching the socketpairs, and close them. */
+static void
+teardown(void)
+{
+	size_t i;
+
+	for (i = 0; i < nsocks; i++) {
+		unwatch(&socks[i]);
+		close(socks[i].s[1]);
+		close(socks[i].s[0]);
+	}
+	free(perm);
+	free(socks);
+}
+
+/* Perform ${nops} operations. */
+static int
+perftest_func(void * cookie, size_t nops)
+{
+	size_t i, j, k;
+	size_t t;
+
+	(void)cookie; /* UNUSED */
+
+	for (i = 0; i < nops; i++) {
+		/* Pick NREADY distinct sockets, and make them readable. */
+		for (k = 0; k < nready; k++) {
+			j = k + (size_t)(rng() % (nsocks - k));
+			t = perm[k];
+			perm[k] = perm[j];
+			perm[j] = t;
+			if (write(socks[perm[k]].s[1], "", 1) != 1) {
+				warnp("write");
+				goto err0;
+			}
+		}
+
+		/* Run the event loop until they've all been handled. */
+		nfired = 0;
+		done = 0;
+		if (events_spin(&done)) {
+			warnp("Error running event loop");
+			goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: events-network [-b poll | network | uring]"
+	    " [-f text | csv | json]\n"
+	    "    [-i <iterations>] [-n <trials>] [-r <ready>]"
+	    " NSOCKETS ...\n");
+	exit(1);
+}
+
+/* Parse an argument, or print an error and exit. */
+#define OPT_EPARSE(opt, arg) do {					\
+	warnp("Error parsing argument: %s %s", opt, arg);		\
+	exit(1);							\
+} while (0)
+
+int
+main(int argc, char * argv[])
+{
+	/* Command-line parameters. */
+	const char * opt_b = NULL;
+	const char * opt_f = NULL;
+	size_t opt_i = 0;
+	size_t opt_n = 0;
+	size_t opt_r = 0;
+
+	/* Working variables. */
+	const char * ch;
+	const char * backend_name;
+	int format;
+	size_t n;
+	int i;
+
+	WARNP_INIT;
+
+	/* Parse command line. */
+	while ((ch = GETOPT(argc, argv)) != NULL) {
+		GETOPT_SWITCH(ch) {
+		GETOPT_OPTARG("-b"):
+			if (opt_b)
+				usage();
+			opt_b = optarg;
+			break;
+		GETOPT_OPTARG("-f"):
+			if (opt_f)
+				usage();
+			opt_f = optarg;
+			break;
+		GETOPT_OPTARG("-i"):
+			if (opt_i)
+				usage();
+			if (PARSENUM(&opt_i, optarg, 1, 100000000))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("-n"):
+			if (opt_n)
+				usage();
+			if (PARSENUM(&opt_n, optarg, 1, 1000))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("-r"):
+			if (opt_r)
+				usage();
+			if (PARSENUM(&opt_r, optarg, 1, SIZE_MAX))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_MISSING_ARG:
+			warn0("Missing argument to %s", ch);
+			usage();
+		GETOPT_DEFAULT:
+			warn0("illegal option -- %s", ch);
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	/* We need at least one number of sockets. */
+	if (argc < 1)
+		usage();
+
+	/* Set defaults. */
+	if (opt_i == 0)
+		opt_i = 1000;
+	if (opt_n == 0)
+		opt_n = 1;
+	if (opt_r == 0)
+		opt_r = 1;
+	nready = opt_r;
+
+	/* Figure out the backend. */
+	if ((opt_b == NULL) || (strcmp(opt_b, "poll") == 0))
+		backend = BACKEND_POLL;
+	else if (strcmp(opt_b, "network") == 0)
+		backend = BACKEND_NETWORK;
+	else if (strcmp(opt_b, "uring") == 0)
+		backend = BACKEND_URING;
+	else
+		usage();
+	backend_name = (opt_b != NULL) ? opt_b : "poll";
+
+	/* Figure out the output format. */
+	if ((opt_f == NULL) || (strcmp(opt_f, "text") == 0))
+		format = PERFTEST_FORMAT_TEXT;
+	else if (strcmp(opt_f, "csv") == 0)
+		format = PERFTEST_FORMAT_CSV;
+	else if (strcmp(opt_f, "json") == 0)
+		format = PERFTEST_FORMAT_JSON;
+	else
+		usage();
+
+	/* Set up the performance tests. */
+	if (perftest_init(opt_n, format, 0, -1))
+		goto err0;
+
+	/* Submit reads via io_uring, if requested. */
+	if ((backend == BACKEND_URING) && network_uring_enable()) {
+		warn0("io_uring is not available");
+		goto err0;
+	}
+
+	/* Time each number of sockets. */
+	for (i = 0; i < argc; i++) {
+		if (PARSENUM(&n, argv[i], 1, SIZE_MAX / sizeof(struct sock))) {
+			warnp("parsenum");
+			goto err0;
+		}
+		if (n < nready) {
+			warn0("Cannot make %zu of %zu sockets ready", nready, n);
+			goto err0;
+		}
+
+		/* Watch the sockets and time the event loop. */
+		if (setup(n))
+			goto err0;
+		perftest_name("%s backend, %zu sockets, %zu ready",
+		    backend_name, n, nready);
+		if (perftest_ops(opt_i, opt_i / 10, NULL, perftest_func, NULL,
+		    NULL)) {
+			warn0("perftest_ops");
+			goto err1;
+		}
+		if (fflush(stdout)) {
+			warnp("fflush");
+			goto err1;
+		}
+		teardown();
+	}
+
+	/* Success! */
+	exit(0);
+
+err1:
+	teardown();
+err0:
+	/* Failure! */
+	exit(1);
+}
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+# Measure how quickly new tunnels can be set up through an encrypting and a
+# decrypting spiped on loopback, with each handshake mode:
+#
+#   pfs:         the default (Diffie-Hellman handshake, perfect forward secrecy)
+#   nopfs:       -f on both ends (no Diffie-Hellman)
+#   requirepfs:  -g on both ends
+#
+# For each mode, report the number of connections per second, and the 50th,
+# 99th, and 99.9th percentiles of the time taken to set up a connection.
+
+set -e -o noclobber -o nounset
+
+usage() {
+	echo "usage: $0 [-c <concurrency>] [-t <seconds>] [mode ...]" 1>&2
+	exit 1
+}
+
+### Find script directory and load helper functions.
+scriptdir=$(CDPATH='' cd -- "$(dirname -- "$0")" && pwd -P)
+. "${scriptdir}/shared_perftest_functions.sh"
+handshake_rate_binary=${scriptdir}/handshake-rate/handshake-rate
+
+# Defaults.
+concurrency=16
+seconds=10
+
+# Parse command line.
+while getopts "c:t:" opt; do
+	case ${opt} in
+	c)	concurrency=${OPTARG} ;;
+	t)	seconds=${OPTARG} ;;
+	*)	usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+modes=${*:-pfs nopfs requirepfs}
+
+# Set up.
+perftest_setup
+if ! [ -x "${handshake_rate_binary}" ]; then
+	echo "${handshake_rate_binary} not found; did you run 'make'?" 1>&2
+	exit 1
+fi
+
+# Run each mode.
+for mode in ${modes}; do
+	case ${mode} in
+	pfs)		flags="" ;;
+	nopfs)		flags="-f" ;;
+	requirepfs)	flags="-g" ;;
+	*)		usage ;;
+	esac
+
+	echo "mode: ${mode}"
+	spiped_start "${flags}" "${flags}"
+	"${handshake_rate_binary}" "${src_sock}" "${dst_sock}"		\
+	    "${concurrency}" "${seconds}"
+	spiped_stop
+done
@@ -0,0 +1,364 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "elasticarray.h"
+#include "events.h"
+#include "monoclock.h"
+#include "network.h"
+#include "parsenum.h"
+#include "sock.h"
+#include "warnp.h"
+
+/*
+ * Open connections to SRC_ADDRESS (an encrypting spiped) and act as the
+ * server on DST_ADDRESS (behind the matching decrypting spiped), which sends
+ * a byte on each connection it accepts and closes it.  The time from
+ * starting a connection until that byte arrives is the time taken to set up
+ * the tunnel: connecting to both spipeds, the handshake, and connecting to
+ * the server.  Keep CONCURRENCY connections in progress for SECONDS seconds.
+ */
+
+ELASTICARRAY_DECL(DOUBLELIST, doublelist, double);
+
+/* A client connection. */
+struct conn {
+	struct timeval t0;
+	void * connect_cookie;
+	void * read_cookie;
+	int s;
+	uint8_t byte;
+};
+
+/* Shared state. */
+static struct sock_addr ** sas_src;
+static int s_dst;
+static void * accept_cookie;
+static DOUBLELIST latencies;
+static size_t nactive;
+static size_t nfailed;
+static int stopping;
+static int done;
+
+static int startconn(struct conn *);
+
+/* Accept a connection as the server, send a byte, and close it. */
+static int
+callback_accept(void * cookie, int s)
+{
+	uint8_t byte = 0;
+
+	(void)cookie; /* UNUSED */
+
+	/* This accept is no longer pending. */
+	accept_cookie = NULL;
+
+	/* Sanity-check. */
+	if (s == -1) {
+		warnp("network_accept");
+		goto err0;
+	}
+
+	/* The socket buffer is empty, so this won't block. */
+	if (write(s, &byte, 1) != 1)
+		nfailed++;
+	close(s);
+
+	/* Accept another connection. */
+	if ((accept_cookie = network_accept(s_dst, callback_accept,
+	    NULL)) == NULL) {
+		warnp("network_accept");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* A client connection has been set up, or has failed. */
+static int
+conndone(struct conn * C, int ok)
+{
+	struct timeval t1;
+	double latency;
+
+	/* Record the time taken. */
+	if (ok) {
+		if (monoclock_get(&t1)) {
+			warnp("monoclock_get");
+			goto err0;
+		}
+		latency = timeval_diff(C->t0, t1);
+		if (doublelist_append(latencies, &latency, 1)) {
+			warnp("doublelist_append");
+			goto err0;
+		}
+	} else
+		nfailed++;
+
+	/* Start another connection, unless it's time to stop. */
+	if (!stopping)
+		return (startconn(C));
+
+	/* This connection is finished. */
+	if (--nactive == 0)
+		done = 1;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* The server's byte has arrived (or not). */
+static int
+callback_read(void * cookie, ssize_t len)
+{
+	struct conn * C = cookie;
+
+	/* The read is no longer pending. */
+	C->read_cookie = NULL;
+
+	/* Close the connection and record the result. */
+	close(C->s);
+	return (conndone(C, len == 1));
+}
+
+/* We've connected to the encrypting spiped (or failed to). */
+static int
+callback_connect(void * cookie, int s)
+{
+	struct conn * C = cookie;
+
+	/* The connect is no longer pending. */
+	C->connect_cookie = NULL;
+
+	/* Did we fail? */
+	if (s == -1)
+		return (conndone(C, 0));
+
+	/* Wait for the server's byte. */
+	C->s = s;
+	if ((C->read_cookie = network_read(C->s, &C->byte, 1, 1,
+	    callback_read, C)) == NULL) {
+		warnp("network_read");
+		goto err1;
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	close(C->s);
+
+	/* Failure! */
+	return (-1);
+}
+
+/* Start a client connection. */
+static int
+startconn(struct conn * C)
+{
+
+	/* Note when we started. */
+	if (monoclock_get(&C->t0)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+
+	/* Connect to the encrypting spiped. */
+	if ((C->connect_cookie = network_connect(sas_src, callback_connect,
+	    C)) == NULL) {
+		warnp("network_connect");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Time's up. */
+static int
+callback_stop(void * cookie)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* Don't start any more connections. */
+	stopping = 1;
+
+	/* Success! */
+	return (0);
+}
+
+/* Compare two doubles, for qsort(). */
+static int
+cmp_double(const void * x, const void * y)
+{
+	double a = *(const double *)x;
+	double b = *(const double *)y;
+
+	return ((a > b) - (a < b));
+}
+
+/* Return the ${p}th percentile of the ${n} sorted values ${x}. */
+static double
+percentile(const double * x, size_t n, double p)
+{
+	size_t i;
+
+	/* Nearest-rank method. */
+	i = (size_t)(p / 100.0 * (double)n + 0.5);
+	if (i > 0)
+		i--;
+	if (i >= n)
+		i = n - 1;
+	return (x[i]);
+}
+
+int
+main(int argc, char ** argv)
+{
+	/* Command-line parameters. */
+	const char * addr_src;
+	const char * addr_dst;
+	size_t concurrency;
+	double seconds;
+
+	/* Working variables. */
+	struct sock_addr ** sas_dst;
+	struct conn * conns;
+	struct timeval begin, end;
+	double duration;
+	double * x;
+	size_t n;
+	size_t i;
+
+	WARNP_INIT;
+
+	/* Parse command-line arguments. */
+	if (argc != 5) {
+		fprintf(stderr, "usage: %s SRC_ADDRESS DST_ADDRESS"
+		    " CONCURRENCY SECONDS\n", argv[0]);
+		goto err0;
+	}
+	addr_src = argv[1];
+	addr_dst = argv[2];
+	if (PARSENUM(&concurrency, argv[3], 1, 65536)) {
+		warnp("parsenum");
+		goto err0;
+	}
+	if (PARSENUM(&seconds, argv[4], 0, 1e6)) {
+		warnp("parsenum");
+		goto err0;
+	}
+
+	/* Resolve the addresses. */
+	if ((sas_src = sock_resolve(addr_src)) == NULL) {
+		warnp("Error resolving socket address: %s", addr_src);
+		goto err0;
+	}
+	if ((sas_dst = sock_resolve(addr_dst)) == NULL) {
+		warnp("Error resolving socket address: %s", addr_dst);
+		goto err1;
+	}
+	if ((sas_src[0] == NULL) || (sas_dst[0] == NULL)) {
+		warn0("No addresses found");
+		goto err2;
+	}
+
+	/* Allocate connection state and the latency list. */
+	if ((conns = malloc(concurrency * sizeof(struct conn))) == NULL)
+		goto err2;
+	if ((latencies = doublelist_init(0)) == NULL)
+		goto err3;
+
+	/* Be the server. */
+	if ((s_dst = sock_listener(sas_dst[0])) == -1)
+		goto err4;
+	if ((accept_cookie = network_accept(s_dst, callback_accept,
+	    NULL)) == NULL) {
+		warnp("network_accept");
+		goto err5;
+	}
+
+	/* Start the clock. */
+	if (monoclock_get(&begin)) {
+		warnp("monoclock_get");
+		goto err5;
+	}
+	if (events_timer_register_double(callback_stop, NULL,
+	    seconds) == NULL) {
+		warnp("events_timer_register_double");
+		goto err5;
+	}
+
+	/* Start the clients. */
+	for (i = 0; i < concurrency; i++) {
+		if (startconn(&conns[i]))
+			goto err5;
+		nactive++;
+	}
+
+	/* Run until time's up and all connections have finished. */
+	if (events_spin(&done)) {
+		warnp("Error running event loop");
+		goto err5;
+	}
+
+	/* Stop the clock. */
+	if (monoclock_get(&end)) {
+		warnp("monoclock_get");
+		goto err5;
+	}
+	duration = timeval_diff(begin, end);
+
+	/* Report results. */
+	n = doublelist_getsize(latencies);
+	x = doublelist_get(latencies, 0);
+	qsort(x, n, sizeof(double), cmp_double);
+	printf("connections: %zu, failed: %zu, concurrency: %zu,"
+	    " duration: %.2f s\n", n, nfailed, concurrency, duration);
+	printf("rate: %.1f connections/s\n", (double)n / duration);
+	if (n > 0)
+		printf("setup latency: p50 %.3f ms, p99 %.3f ms,"
+		    " p999 %.3f ms\n", percentile(x, n, 50.0) * 1000.0,
+		    percentile(x, n, 99.0) * 1000.0,
+		    percentile(x, n, 99.9) * 1000.0);
+
+	/* Clean up. */
+	network_accept_cancel(accept_cookie);
+	close(s_dst);
+	doublelist_free(latencies);
+	free(conns);
+	sock_addr_freelist(sas_dst);
+	sock_addr_freelist(sas_src);
+
+	/* Success! */
+	exit(0);
+
+err5:
+	close(s_dst);
+err4:
+	doublelist_free(latencies);
+err3:
+	free(conns);
+err2:
+	sock_addr_freelist(sas_dst);
+err1:
+	sock_addr_freelist(sas_src);
+err0:
+	/* Failure! */
+	exit(1);
+}
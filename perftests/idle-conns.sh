@@ -0,0 +1,145 @@
+#!/bin/sh
+
+# Measure what idle tunnels cost an encrypting and a decrypting spiped on
+# this host:
+#
+#   idle-conns -> spiped -e -> spiped -d -> idle-conns (server)
+#
+# For each number of connections, open that many tunnels and leave them idle,
+# then report the memory used per connection by each spiped, the CPU used by
+# each spiped while the tunnels are idle, and the round-trip time and spiped
+# CPU time for a one-byte ping over one tunnel while the rest remain open
+# (i.e., the cost of an event loop wakeup with that many connections).
+#
+# By default the tunnels use UNIX sockets, to avoid running out of loopback
+# TCP ports; each spiped needs two descriptors per connection, so the number
+# of connections is limited by the descriptor limit (ulimit -n).
+
+set -e -o noclobber -o nounset
+
+usage() {
+	echo "usage: $0 [-T] [-E <spiped -e flags>] [-D <spiped -d flags>]" 1>&2
+	echo "    [-p <pings>] [-t <seconds>] [nconn ...]" 1>&2
+	exit 1
+}
+
+### Find script directory and load helper functions.
+scriptdir=$(CDPATH='' cd -- "$(dirname -- "$0")" && pwd -P)
+. "${scriptdir}/shared_perftest_functions.sh"
+idle_conns_binary=${scriptdir}/idle-conns/idle-conns
+
+# Defaults.
+tcp=0
+pings=1000
+seconds=10
+flags_e=""
+flags_d=""
+
+# Parse command line.
+while getopts "D:E:p:t:T" opt; do
+	case ${opt} in
+	D)	flags_d=${OPTARG} ;;
+	E)	flags_e=${OPTARG} ;;
+	p)	pings=${OPTARG} ;;
+	t)	seconds=${OPTARG} ;;
+	T)	tcp=1 ;;
+	*)	usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+nconns=${*:-1 10000 30000 100000}
+
+# Set up.
+perftest_setup
+if ! [ -x "${idle_conns_binary}" ]; then
+	echo "${idle_conns_binary} not found; did you run 'make'?" 1>&2
+	exit 1
+fi
+if [ "${tcp}" -eq 0 ]; then
+	src_sock=${out}/src.sock
+	mid_sock=${out}/mid.sock
+	dst_sock=${out}/dst.sock
+fi
+trap 'kill ${idle_pid:-} 2>/dev/null || true; perftest_cleanup' EXIT
+
+# Use as many descriptors as we're allowed to.
+ulimit -n "$(ulimit -H -n)" 2>/dev/null || true
+maxfds=$(ulimit -n)
+
+## waitfor(pattern):
+# Wait until idle-conns prints a line matching ${pattern}, and print it.
+waitfor() {
+	while ! grep -q "$1" "${out}/idle.txt"; do
+		if ! kill -0 "${idle_pid}" 2>/dev/null; then
+			echo "idle-conns failed" 1>&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+	grep "$1" "${out}/idle.txt"
+}
+
+for nconn in ${nconns}; do
+	# Each process has two descriptors per connection, plus a few more.
+	if [ "${maxfds}" != "unlimited" ] &&				\
+	    [ $((2 * nconn + 16)) -gt "${maxfds}" ]; then
+		echo "skipping ${nconn} connections: ulimit -n is ${maxfds}"
+		continue
+	fi
+
+	# Start the spipeds, and note how much memory they use.
+	rm -f "${src_sock}" "${mid_sock}" "${dst_sock}"
+	spiped_start "${flags_e}" "${flags_d}"
+	rss_e0=$(rss "${spiped_e_pid}")
+	rss_d0=$(rss "${spiped_d_pid}")
+
+	# Open the connections; idle-conns reads commands from a fifo.
+	rm -f "${out}/ctl" "${out}/idle.txt"
+	mkfifo "${out}/ctl"
+	"${idle_conns_binary}" "${src_sock}" "${dst_sock}" "${nconn}"	\
+	    < "${out}/ctl" > "${out}/idle.txt" &
+	idle_pid=$!
+	exec 3> "${out}/ctl"
+	waitfor "^connections:"
+
+	# Memory per connection.
+	rss_e1=$(rss "${spiped_e_pid}")
+	rss_d1=$(rss "${spiped_d_pid}")
+
+	# CPU while idle.
+	cpu_e0=$(cputime "${spiped_e_pid}")
+	cpu_d0=$(cputime "${spiped_d_pid}")
+	sleep "${seconds}"
+	cpu_e1=$(cputime "${spiped_e_pid}")
+	cpu_d1=$(cputime "${spiped_d_pid}")
+
+	# Wakeups.
+	echo "ping ${pings}" >&3
+	waitfor "^round trips:"
+	cpu_e2=$(cputime "${spiped_e_pid}")
+	cpu_d2=$(cputime "${spiped_d_pid}")
+
+	# Close the connections and stop the spipeds.
+	exec 3>&-
+	if ! wait "${idle_pid}"; then
+		echo "idle-conns failed" 1>&2
+		exit 1
+	fi
+	spiped_stop
+
+	awk -v n="${nconn}" -v secs="${seconds}" -v pings="${pings}"	\
+	    -v rss_e0="${rss_e0}" -v rss_e1="${rss_e1}"			\
+	    -v rss_d0="${rss_d0}" -v rss_d1="${rss_d1}"			\
+	    -v cpu_e0="${cpu_e0}" -v cpu_e1="${cpu_e1}" -v cpu_e2="${cpu_e2}" \
+	    -v cpu_d0="${cpu_d0}" -v cpu_d1="${cpu_d1}" -v cpu_d2="${cpu_d2}" \
+	    'BEGIN {
+		printf("spiped -e: %.1f kB RSS/conn, %.2f%% CPU idle,"	\
+		    " %.1f us CPU/round trip\n", (rss_e1 - rss_e0) / n,	\
+		    100 * (cpu_e1 - cpu_e0) / secs,			\
+		    1e6 * (cpu_e2 - cpu_e1) / pings)
+		printf("spiped -d: %.1f kB RSS/conn, %.2f%% CPU idle,"	\
+		    " %.1f us CPU/round trip\n", (rss_d1 - rss_d0) / n,	\
+		    100 * (cpu_d1 - cpu_d0) / secs,			\
+		    1e6 * (cpu_d2 - cpu_d1) / pings)
+	}'
+done
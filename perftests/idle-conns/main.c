@@ -0,0 +1,550 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elasticarray.h"
+#include "events.h"
+#include "monoclock.h"
+#include "network.h"
+#include "parsenum.h"
+#include "sock.h"
+#include "warnp.h"
+
+/*
+ * Act as a server on DST_ADDRESS (behind a decrypting spiped) and open NCONN
+ * connections to SRC_ADDRESS (the matching encrypting spiped).  The server
+ * sends a byte on each connection it accepts, so that the client knows the
+ * whole tunnel has been set up; then the connections sit idle.
+ *
+ * Once they are all open, read commands from stdin:
+ *
+ *   ping COUNT   Time COUNT one-byte round trips over the first connection.
+ *
+ * and close the connections and exit at EOF.  Only the first connection is
+ * being polled by this process while it pings, so the round-trip time grows
+ * with NCONN only because of the work done by the spipeds.
+ */
+
+/* Number of connections to set up at once. */
+#define NINFLIGHT 8
+
+ELASTICARRAY_DECL(DOUBLELIST, doublelist, double);
+
+/* A client connection being set up. */
+struct conn {
+	void * connect_cookie;
+	void * read_cookie;
+	int s;
+	uint8_t byte;
+};
+
+/* Connections. */
+static struct conn conns[NINFLIGHT];
+static struct sock_addr ** sas_src;
+static size_t nconn;
+static int * fds_c;
+static int * fds_s;
+static size_t nstarted;
+static size_t nc;
+static size_t ns;
+
+/* Server state. */
+static int s_listen;
+static void * accept_cookie;
+static void * echo_cookie;
+static uint8_t echo_byte;
+
+/* Ping state. */
+static struct timeval t0;
+static uint8_t ping_byte;
+static DOUBLELIST rtts;
+static size_t npings;
+static size_t count;
+
+/* Event loop exit flag. */
+static int done;
+
+static int startconn(struct conn *);
+static int ping(void);
+
+/* Accept a connection as the server, and send a byte. */
+static int
+callback_accept(void * cookie, int s)
+{
+	uint8_t byte = 0;
+
+	(void)cookie; /* UNUSED */
+
+	/* This accept is no longer pending. */
+	accept_cookie = NULL;
+
+	/* Sanity-check. */
+	if (s == -1) {
+		warnp("network_accept");
+		goto err0;
+	}
+
+	/* The socket buffer is empty, so this won't block. */
+	if (write(s, &byte, 1) != 1) {
+		warnp("write");
+		goto err1;
+	}
+	fds_s[ns++] = s;
+
+	/* Accept another connection, if we're expecting more. */
+	if ((ns < nconn) && ((accept_cookie = network_accept(s_listen,
+	    callback_accept, NULL)) == NULL)) {
+		warnp("network_accept");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	close(s);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* A client connection has received the server's byte. */
+static int
+callback_setup_read(void * cookie, ssize_t len)
+{
+	struct conn * C = cookie;
+	size_t i;
+
+	/* The read is no longer pending. */
+	C->read_cookie = NULL;
+
+	/* Check results. */
+	if (len != 1) {
+		warn0("Connection closed during setup");
+		goto err1;
+	}
+	fds_c[nc++] = C->s;
+
+	/* Are we finished? */
+	if (nc == nconn) {
+		done = 1;
+		return (0);
+	}
+
+	/*
+	 * The first connection is set up on its own, so that we know which
+	 * accepted socket belongs to it; now start the others.
+	 */
+	if (nc == 1) {
+		for (i = 1; i < NINFLIGHT; i++) {
+			if (startconn(&conns[i]))
+				goto err0;
+		}
+	}
+
+	/* Start another connection. */
+	return (startconn(C));
+
+err1:
+	close(C->s);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* We've connected to the encrypting spiped (or failed to). */
+static int
+callback_connect(void * cookie, int s)
+{
+	struct conn * C = cookie;
+
+	/* The connect is no longer pending. */
+	C->connect_cookie = NULL;
+
+	/* Did we fail? */
+	if (s == -1) {
+		warn0("Failed to connect");
+		goto err0;
+	}
+
+	/* Wait for the server's byte. */
+	C->s = s;
+	if ((C->read_cookie = network_read(C->s, &C->byte, 1, 1,
+	    callback_setup_read, C)) == NULL) {
+		warnp("network_read");
+		goto err1;
+	}
+
+	/* Success! */
+	return (0);
+
+err1:
+	close(C->s);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Start a client connection, if there are any left to start. */
+static int
+startconn(struct conn * C)
+{
+
+	/* Have we started them all? */
+	if (nstarted == nconn)
+		return (0);
+	nstarted++;
+
+	/* Connect to the encrypting spiped. */
+	if ((C->connect_cookie = network_connect(sas_src, callback_connect,
+	    C)) == NULL) {
+		warnp("network_connect");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* The server has received a byte; send it back. */
+static int
+callback_echo(void * cookie, ssize_t len)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* The read is no longer pending. */
+	echo_cookie = NULL;
+
+	/* Check results. */
+	if (len != 1) {
+		warn0("Connection closed");
+		goto err0;
+	}
+
+	/* The socket buffer is empty, so this won't block. */
+	if (write(fds_s[0], &echo_byte, 1) != 1) {
+		warnp("write");
+		goto err0;
+	}
+
+	/* Wait for another byte. */
+	if ((echo_cookie = network_read(fds_s[0], &echo_byte, 1, 1,
+	    callback_echo, NULL)) == NULL) {
+		warnp("network_read");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* The byte has come back. */
+static int
+callback_pong(void * cookie, ssize_t len)
+{
+	struct timeval t1;
+	double rtt;
+
+	(void)cookie; /* UNUSED */
+
+	/* Check results. */
+	if (len != 1) {
+		warn0("Connection closed");
+		goto err0;
+	}
+
+	/* Record the round-trip time. */
+	if (monoclock_get(&t1)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+	rtt = timeval_diff(t0, t1);
+	if (doublelist_append(rtts, &rtt, 1)) {
+		warnp("doublelist_append");
+		goto err0;
+	}
+
+	/* Are we finished? */
+	if (++npings == count) {
+		done = 1;
+		return (0);
+	}
+
+	/* Send another byte. */
+	return (ping());
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Send a byte over the first connection, and wait for it to come back. */
+static int
+ping(void)
+{
+
+	/* Note when we started. */
+	if (monoclock_get(&t0)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+
+	/* The socket buffer is empty, so this won't block. */
+	if (write(fds_c[0], &ping_byte, 1) != 1) {
+		warnp("write");
+		goto err0;
+	}
+
+	/* Wait for the byte to come back. */
+	if (network_read(fds_c[0], &ping_byte, 1, 1, callback_pong,
+	    NULL) == NULL) {
+		warnp("network_read");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Compare two doubles, for qsort(). */
+static int
+cmp_double(const void * x, const void * y)
+{
+	double a = *(const double *)x;
+	double b = *(const double *)y;
+
+	return ((a > b) - (a < b));
+}
+
+/* Return the ${p}th percentile of the ${n} sorted values ${x}. */
+static double
+percentile(const double * x, size_t n, double p)
+{
+	size_t i;
+
+	/* Nearest-rank method. */
+	i = (size_t)(p / 100.0 * (double)n + 0.5);
+	if (i > 0)
+		i--;
+	if (i >= n)
+		i = n - 1;
+	return (x[i]);
+}
+
+/* Time ${n} round trips over the first connection. */
+static int
+pings(size_t n)
+{
+	double * x;
+
+	/* Start pinging. */
+	count = n;
+	npings = 0;
+	done = 0;
+	if (doublelist_resize(rtts, 0)) {
+		warnp("doublelist_resize");
+		goto err0;
+	}
+	if (ping())
+		goto err0;
+
+	/* Wait until we've finished. */
+	if (events_spin(&done)) {
+		warnp("Error running event loop");
+		goto err0;
+	}
+
+	/* Report results, in microseconds. */
+	x = doublelist_get(rtts, 0);
+	qsort(x, n, sizeof(double), cmp_double);
+	printf("round trips: %zu, RTT: p50 %.1f us, p99 %.1f us,"
+	    " max %.1f us\n", n, percentile(x, n, 50.0) * 1e6,
+	    percentile(x, n, 99.0) * 1e6, x[n - 1] * 1e6);
+	if (fflush(stdout)) {
+		warnp("fflush");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+	/* Command-line parameters. */
+	const char * addr_src;
+	const char * addr_dst;
+
+	/* Working variables. */
+	struct sock_addr ** sas_dst;
+	struct timeval begin, end;
+	char * line = NULL;
+	size_t linecap = 0;
+	ssize_t len;
+	size_t n;
+	size_t i;
+
+	WARNP_INIT;
+
+	/* Parse command-line arguments. */
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s SRC_ADDRESS DST_ADDRESS NCONN\n",
+		    argv[0]);
+		goto err0;
+	}
+	addr_src = argv[1];
+	addr_dst = argv[2];
+	if (PARSENUM(&nconn, argv[3], 1, SIZE_MAX / sizeof(int))) {
+		warnp("parsenum");
+		goto err0;
+	}
+
+	/* Resolve the addresses. */
+	if ((sas_src = sock_resolve(addr_src)) == NULL) {
+		warnp("Error resolving socket address: %s", addr_src);
+		goto err0;
+	}
+	if ((sas_dst = sock_resolve(addr_dst)) == NULL) {
+		warnp("Error resolving socket address: %s", addr_dst);
+		goto err1;
+	}
+	if ((sas_src[0] == NULL) || (sas_dst[0] == NULL)) {
+		warn0("No addresses found");
+		goto err2;
+	}
+
+	/* Allocate arrays of sockets and round-trip times. */
+	if ((fds_c = malloc(nconn * sizeof(int))) == NULL)
+		goto err2;
+	if ((fds_s = malloc(nconn * sizeof(int))) == NULL)
+		goto err3;
+	if ((rtts = doublelist_init(0)) == NULL)
+		goto err4;
+
+	/* Be the server. */
+	if ((s_listen = sock_listener(sas_dst[0])) == -1)
+		goto err5;
+	if ((accept_cookie = network_accept(s_listen, callback_accept,
+	    NULL)) == NULL) {
+		warnp("network_accept");
+		goto err6;
+	}
+
+	/* Open the connections, starting with the first one on its own. */
+	if (monoclock_get(&begin)) {
+		warnp("monoclock_get");
+		goto err6;
+	}
+	if (startconn(&conns[0]))
+		goto err6;
+	if (events_spin(&done)) {
+		warnp("Error running event loop");
+		goto err7;
+	}
+	if (monoclock_get(&end)) {
+		warnp("monoclock_get");
+		goto err7;
+	}
+	printf("connections: %zu, set up in %.2f s\n", nconn,
+	    timeval_diff(begin, end));
+	if (fflush(stdout)) {
+		warnp("fflush");
+		goto err7;
+	}
+
+	/* Echo bytes sent over the first connection. */
+	if ((echo_cookie = network_read(fds_s[0], &echo_byte, 1, 1,
+	    callback_echo, NULL)) == NULL) {
+		warnp("network_read");
+		goto err7;
+	}
+
+	/* Handle commands until EOF. */
+	while ((len = getline(&line, &linecap, stdin)) != -1) {
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		if ((strncmp(line, "ping ", 5) != 0) ||
+		    PARSENUM(&n, &line[5], 1, SIZE_MAX)) {
+			warn0("Invalid command: %s", line);
+			goto err8;
+		}
+		if (pings(n))
+			goto err8;
+	}
+	if (ferror(stdin)) {
+		warnp("getline");
+		goto err8;
+	}
+
+	/* Clean up. */
+	network_read_cancel(echo_cookie);
+	for (i = 0; i < nconn; i++) {
+		close(fds_c[i]);
+		close(fds_s[i]);
+	}
+	free(line);
+	close(s_listen);
+	doublelist_free(rtts);
+	free(fds_s);
+	free(fds_c);
+	sock_addr_freelist(sas_dst);
+	sock_addr_freelist(sas_src);
+
+	/* Success! */
+	exit(0);
+
+err8:
+	free(line);
+	if (echo_cookie != NULL)
+		network_read_cancel(echo_cookie);
+err7:
+	if (accept_cookie != NULL)
+		network_accept_cancel(accept_cookie);
+	for (i = 0; i < NINFLIGHT; i++) {
+		if (conns[i].connect_cookie != NULL)
+			network_connect_cancel(conns[i].connect_cookie);
+		if (conns[i].read_cookie != NULL) {
+			network_read_cancel(conns[i].read_cookie);
+			close(conns[i].s);
+		}
+	}
+	for (i = 0; i < nc; i++)
+		close(fds_c[i]);
+	for (i = 0; i < ns; i++)
+		close(fds_s[i]);
+err6:
+	close(s_listen);
+err5:
+	doublelist_free(rtts);
+err4:
+	free(fds_s);
+err3:
+	free(fds_c);
+err2:
+	sock_addr_freelist(sas_dst);
+err1:
+	sock_addr_freelist(sas_src);
+err0:
+	/* Failure! */
+	exit(1);
+}
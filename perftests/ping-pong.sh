@@ -0,0 +1,77 @@
+#!/bin/sh
+
+# Measure request/response round-trip times through an encrypting and a
+# decrypting spiped on loopback, for a range of message sizes:
+#
+#   ping-pong client -> spiped -e -> spiped -d -> ping-pong server
+#
+# Each size is measured on an otherwise idle pair of spipeds, and again while
+# send-zeros pushes bulk flows through the same pair.  spiped pads each
+# packet to 1060 bytes, so the smallest messages show the cost of padding;
+# the bulk flows show how much a single event loop delays small messages
+# queued behind large transfers.
+
+set -e -o noclobber -o nounset
+
+usage() {
+	echo "usage: $0 [-b <bulk streams>] [-n <round trips>] [size ...]" 1>&2
+	exit 1
+}
+
+### Find script directory and load helper functions.
+scriptdir=$(CDPATH='' cd -- "$(dirname -- "$0")" && pwd -P)
+. "${scriptdir}/shared_perftest_functions.sh"
+ping_pong_binary=${scriptdir}/ping-pong/ping-pong
+
+# Defaults.
+nbulk=1
+count=10000
+
+# Parse command line.
+while getopts "b:n:" opt; do
+	case ${opt} in
+	b)	nbulk=${OPTARG} ;;
+	n)	count=${OPTARG} ;;
+	*)	usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+sizes=${*:-1 16 256 1024 4096 16384 65536}
+
+# Set up.
+perftest_setup
+if ! [ -x "${ping_pong_binary}" ]; then
+	echo "${ping_pong_binary} not found; did you run 'make'?" 1>&2
+	exit 1
+fi
+"${ping_pong_binary}" server "${dst_sock}" &
+server_pid=$!
+trap 'kill "${server_pid}" 2>/dev/null || true; perftest_cleanup' EXIT
+spiped_start
+sleep 1
+
+# Measure each size without and with bulk flows.
+for size in ${sizes}; do
+	for streams in 0 ${nbulk}; do
+		echo "bulk streams: ${streams}"
+
+		# Send zeros until we kill them.
+		bulk_pids=""
+		i=0
+		while [ "${i}" -lt "${streams}" ]; do
+			"${send_zeros_binary}" "${src_sock}" 65536	\
+			    1000000000 > /dev/null &
+			bulk_pids="${bulk_pids} $!"
+			i=$((i + 1))
+		done
+
+		"${ping_pong_binary}" client "${src_sock}" "${size}"	\
+		    "${count}"
+
+		# Stop the bulk flows.
+		for pid in ${bulk_pids}; do
+			kill "${pid}" 2>/dev/null || true
+			wait "${pid}" 2>/dev/null || true
+		done
+	done
+done
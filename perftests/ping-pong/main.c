@@ -0,0 +1,470 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elasticarray.h"
+#include "events.h"
+#include "monoclock.h"
+#include "network.h"
+#include "parsenum.h"
+#include "sock.h"
+#include "warnp.h"
+
+#include "simple_server.h"
+
+/*
+ * In server mode, run a simple_server on ADDRESS (behind a decrypting spiped)
+ * which answers each request with a response of the same length.  Requests
+ * are filled with 'p' bytes and end with a '.'; the server discards any data
+ * which starts with a zero byte, so that send-zeros can run bulk flows
+ * through the same pair of spiped instances at the same time.
+ *
+ * In client mode, connect to ADDRESS (the matching encrypting spiped), and
+ * time COUNT round trips of MSGLEN-byte requests.
+ */
+
+/* Round trips to make before we start measuring. */
+#define WARMUP 10
+
+/* Maximum number of connections (bulk flows) the server will accept. */
+#define NCONN_MAX 1024
+
+/* Maximum request size. */
+#define MSGLEN_MAX 1048576
+
+ELASTICARRAY_DECL(DOUBLELIST, doublelist, double);
+ELASTICARRAY_DECL(SIZELIST, sizelist, size_t);
+
+/* Server state. */
+static uint8_t * response;
+static SIZELIST received;	/* Request bytes received, by socket. */
+
+/* Client state. */
+struct pinger {
+	struct timeval t0;
+	uint8_t * request;
+	uint8_t * response;
+	size_t msglen;
+	size_t npings;
+	size_t count;
+	DOUBLELIST rtts;
+	void * connect_cookie;
+	void * write_cookie;
+	void * read_cookie;
+	int noutstanding;
+	int s;
+	int done;
+};
+
+static int ping(struct pinger *);
+
+/* The server has sent a response. */
+static int
+callback_server_wrote(void * cookie, ssize_t len)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* Check results. */
+	if (len == -1) {
+		warnp("network_write");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* The server has received data on socket ${sock}. */
+static int
+callback_server_read(void * cookie, uint8_t * buf, size_t buflen, int sock)
+{
+	size_t oldsize;
+	size_t * n;
+
+	(void)cookie; /* UNUSED */
+
+	/* Ignore bulk data. */
+	if (buf[0] == 0)
+		return (0);
+
+	/* Make sure we have a counter for this socket. */
+	if ((oldsize = sizelist_getsize(received)) <= (size_t)sock) {
+		if (sizelist_resize(received, (size_t)sock + 1)) {
+			warnp("sizelist_resize");
+			goto err0;
+		}
+		memset(sizelist_get(received, oldsize), 0,
+		    ((size_t)sock + 1 - oldsize) * sizeof(size_t));
+	}
+	n = sizelist_get(received, (size_t)sock);
+
+	/* Keep reading until we have the whole request. */
+	if ((*n += buflen) > MSGLEN_MAX) {
+		warn0("Request is too long");
+		goto err0;
+	}
+	if (buf[buflen - 1] != '.')
+		return (0);
+
+	/* Send a response of the same length. */
+	if (network_write(sock, response, *n, *n, callback_server_wrote,
+	    NULL) == NULL) {
+		warnp("network_write");
+		goto err0;
+	}
+	*n = 0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Run the server on ${addr} until we are killed. */
+static int
+server(const char * addr)
+{
+
+	/* Allocate a response and counters. */
+	if ((response = calloc(MSGLEN_MAX, 1)) == NULL) {
+		warnp("calloc");
+		goto err0;
+	}
+	if ((received = sizelist_init(0)) == NULL) {
+		warnp("sizelist_init");
+		goto err1;
+	}
+
+	/* Run the server; it never shuts itself down. */
+	if (simple_server(addr, NCONN_MAX, 0, callback_server_read, NULL)) {
+		warn0("simple_server failed");
+		goto err2;
+	}
+
+	/* Clean up. */
+	sizelist_free(received);
+	free(response);
+
+	/* Success! */
+	return (0);
+
+err2:
+	sizelist_free(received);
+err1:
+	free(response);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* A request has been sent or a response received. */
+static int
+pingdone(struct pinger * P)
+{
+	struct timeval t1;
+	double rtt;
+
+	/* Wait until both halves of the round trip have finished. */
+	if (--P->noutstanding > 0)
+		return (0);
+
+	/* Record the round-trip time, unless we're still warming up. */
+	if (monoclock_get(&t1)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+	if (P->npings++ >= WARMUP) {
+		rtt = timeval_diff(P->t0, t1);
+		if (doublelist_append(P->rtts, &rtt, 1)) {
+			warnp("doublelist_append");
+			goto err0;
+		}
+	}
+
+	/* Are we finished? */
+	if (P->npings == P->count + WARMUP) {
+		P->done = 1;
+		return (0);
+	}
+
+	/* Send another request. */
+	return (ping(P));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* The request has been sent. */
+static int
+callback_wrote(void * cookie, ssize_t len)
+{
+	struct pinger * P = cookie;
+
+	/* The write is no longer pending. */
+	P->write_cookie = NULL;
+
+	/* Check results. */
+	if (len == -1) {
+		warnp("network_write");
+		goto err0;
+	}
+
+	/* Record progress. */
+	return (pingdone(P));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* The response has arrived. */
+static int
+callback_read(void * cookie, ssize_t len)
+{
+	struct pinger * P = cookie;
+
+	/* The read is no longer pending. */
+	P->read_cookie = NULL;
+
+	/* Check results. */
+	if (len == -1) {
+		warnp("network_read");
+		goto err0;
+	} else if (len == 0) {
+		warn0("Connection closed");
+		goto err0;
+	}
+
+	/* Record progress. */
+	return (pingdone(P));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Send a request and wait for the response. */
+static int
+ping(struct pinger * P)
+{
+
+	/* Note when we started. */
+	if (monoclock_get(&P->t0)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+
+	/* Send the request and read the response in parallel. */
+	if ((P->write_cookie = network_write(P->s, P->request, P->msglen,
+	    P->msglen, callback_wrote, P)) == NULL) {
+		warnp("network_write");
+		goto err0;
+	}
+	if ((P->read_cookie = network_read(P->s, P->response, P->msglen,
+	    P->msglen, callback_read, P)) == NULL) {
+		warnp("network_read");
+		goto err0;
+	}
+	P->noutstanding = 2;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* We've connected to the encrypting spiped (or failed to). */
+static int
+callback_connect(void * cookie, int s)
+{
+	struct pinger * P = cookie;
+
+	/* The connect is no longer pending. */
+	P->connect_cookie = NULL;
+
+	/* Did we fail? */
+	if (s == -1) {
+		warn0("Failed to connect");
+		goto err0;
+	}
+	P->s = s;
+
+	/* Start pinging. */
+	return (ping(P));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Compare two doubles, for qsort(). */
+static int
+cmp_double(const void * x, const void * y)
+{
+	double a = *(const double *)x;
+	double b = *(const double *)y;
+
+	return ((a > b) - (a < b));
+}
+
+/* Return the ${p}th percentile of the ${n} sorted values ${x}. */
+static double
+percentile(const double * x, size_t n, double p)
+{
+	size_t i;
+
+	/* Nearest-rank method. */
+	i = (size_t)(p / 100.0 * (double)n + 0.5);
+	if (i > 0)
+		i--;
+	if (i >= n)
+		i = n - 1;
+	return (x[i]);
+}
+
+/* Time ${count} round trips of ${msglen}-byte requests to ${addr}. */
+static int
+client(const char * addr, size_t msglen, size_t count)
+{
+	struct sock_addr ** sas;
+	struct pinger pinger;
+	struct pinger * P = &pinger;
+	double * x;
+
+	/* Resolve the address. */
+	if ((sas = sock_resolve(addr)) == NULL) {
+		warnp("Error resolving socket address: %s", addr);
+		goto err0;
+	}
+	if (sas[0] == NULL) {
+		warn0("No addresses found for %s", addr);
+		goto err1;
+	}
+
+	/* Initialize the client. */
+	P->msglen = msglen;
+	P->npings = 0;
+	P->count = count;
+	P->connect_cookie = NULL;
+	P->write_cookie = NULL;
+	P->read_cookie = NULL;
+	P->s = -1;
+	P->done = 0;
+	if ((P->request = malloc(msglen)) == NULL) {
+		warnp("malloc");
+		goto err1;
+	}
+	memset(P->request, 'p', msglen - 1);
+	P->request[msglen - 1] = '.';
+	if ((P->response = malloc(msglen)) == NULL) {
+		warnp("malloc");
+		goto err2;
+	}
+	if ((P->rtts = doublelist_init(0)) == NULL) {
+		warnp("doublelist_init");
+		goto err3;
+	}
+
+	/* Connect to the encrypting spiped and ping until we're done. */
+	if ((P->connect_cookie = network_connect(sas, callback_connect,
+	    P)) == NULL) {
+		warnp("network_connect");
+		goto err4;
+	}
+	if (events_spin(&P->done)) {
+		warnp("Error running event loop");
+		goto err5;
+	}
+
+	/* Report results, in microseconds. */
+	x = doublelist_get(P->rtts, 0);
+	qsort(x, count, sizeof(double), cmp_double);
+	printf("message size: %zu bytes, round trips: %zu\n", msglen, count);
+	printf("RTT: min %.1f us, p50 %.1f us, p90 %.1f us, p99 %.1f us,"
+	    " p99.9 %.1f us, max %.1f us\n", x[0] * 1e6,
+	    percentile(x, count, 50.0) * 1e6,
+	    percentile(x, count, 90.0) * 1e6,
+	    percentile(x, count, 99.0) * 1e6,
+	    percentile(x, count, 99.9) * 1e6, x[count - 1] * 1e6);
+
+	/* Clean up. */
+	close(P->s);
+	doublelist_free(P->rtts);
+	free(P->response);
+	free(P->request);
+	sock_addr_freelist(sas);
+
+	/* Success! */
+	return (0);
+
+err5:
+	if (P->connect_cookie != NULL)
+		network_connect_cancel(P->connect_cookie);
+	if (P->write_cookie != NULL)
+		network_write_cancel(P->write_cookie);
+	if (P->read_cookie != NULL)
+		network_read_cancel(P->read_cookie);
+	if (P->s != -1)
+		close(P->s);
+err4:
+	doublelist_free(P->rtts);
+err3:
+	free(P->response);
+err2:
+	free(P->request);
+err1:
+	sock_addr_freelist(sas);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+	size_t msglen;
+	size_t count;
+
+	WARNP_INIT;
+
+	/* Parse command-line arguments and run. */
+	if ((argc == 3) && (strcmp(argv[1], "server") == 0)) {
+		if (server(argv[2]))
+			goto err0;
+	} else if ((argc == 5) && (strcmp(argv[1], "client") == 0)) {
+		if (PARSENUM(&msglen, argv[3], 1, MSGLEN_MAX)) {
+			warnp("parsenum");
+			goto err0;
+		}
+		if (PARSENUM(&count, argv[4], 1, SIZE_MAX - WARMUP)) {
+			warnp("parsenum");
+			goto err0;
+		}
+		if (client(argv[2], msglen, count))
+			goto err0;
+	} else {
+		fprintf(stderr, "usage: %s server ADDRESS\n", argv[0]);
+		fprintf(stderr, "       %s client ADDRESS MSGLEN COUNT\n",
+		    argv[0]);
+		goto err0;
+	}
+
+	/* Success! */
+	exit(0);
+
+err0:
+	/* Failure! */
+	exit(1);
+}
@@ -1,34 +1,143 @@
-#include <sys/socket.h>
-
-#include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "events.h"
+#include "network.h"
 #include "parsenum.h"
 #include "sock.h"
 #include "warnp.h"
 
+/*
+ * Accept NCONN connections on ADDRESS, and receive data from all of them
+ * (in a single event loop) until each one reaches EOF, but do nothing with
+ * it.
+ */
+
+/* A connection being received from. */
+struct conn {
+	void * read_cookie;
+	int s;
+};
+
+/* Connections. */
+static struct conn * conns;
+static size_t nconn;
+static size_t naccepted;
+static size_t nclosed;
+
+/* Listening socket. */
+static int s_listen;
+static void * accept_cookie;
+
+/* Data is read into (and discarded from) a single shared buffer. */
+static uint8_t * buffer;
+static size_t buflen;
+
+/* Event loop exit flag. */
+static int done;
+
+/* Data has arrived on a connection, or it has been closed. */
+static int
+callback_read(void * cookie, ssize_t len)
+{
+	struct conn * C = cookie;
+
+	/* The read is no longer pending. */
+	C->read_cookie = NULL;
+
+	/* Check results. */
+	if (len == -1) {
+		warnp("recv");
+		goto err0;
+	}
+
+	/* EOF: close the connection, and stop if they're all closed. */
+	if (len == 0) {
+		if (close(C->s)) {
+			warnp("close");
+			goto err0;
+		}
+		C->s = -1;
+		if (++nclosed == nconn)
+			done = 1;
+		return (0);
+	}
+
+	/* Read more data. */
+	if ((C->read_cookie = network_read(C->s, buffer, buflen, 1,
+	    callback_read, C)) == NULL) {
+		warnp("network_read");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Accept a connection, and start reading from it. */
+static int
+callback_accept(void * cookie, int s)
+{
+	struct conn * C = &conns[naccepted];
+
+	(void)cookie; /* UNUSED */
+
+	/* This accept is no longer pending. */
+	accept_cookie = NULL;
+
+	/* Sanity-check. */
+	if (s == -1) {
+		warnp("accept");
+		goto err0;
+	}
+	C->s = s;
+	naccepted++;
+
+	/* Start reading. */
+	if ((C->read_cookie = network_read(C->s, buffer, buflen, 1,
+	    callback_read, C)) == NULL) {
+		warnp("network_read");
+		goto err0;
+	}
+
+	/* Accept another connection, if we're expecting more. */
+	if ((naccepted < nconn) && ((accept_cookie = network_accept(s_listen,
+	    callback_accept, NULL)) == NULL)) {
+		warnp("network_accept");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 int
 main(int argc, char ** argv)
 {
 	/* Command-line parameters. */
 	const char * addr = NULL;
-	ssize_t buflen;
 
 	/* Working variables. */
 	struct sock_addr ** sas;
-	int socket;
-	int socket_recv;
-	char * buffer;
-	ssize_t r;
+	size_t i;
 
 	WARNP_INIT;
 
 	/* Parse command-line arguments. */
+	nconn = 1;
 	if (argc < 3) {
-		warn0("usage: %s ADDRESS BUFLEN", argv[0]);
+		warn0("usage: %s ADDRESS BUFLEN [NCONN]", argv[0]);
 		goto err0;
 	}
 	addr = argv[1];
@@ -36,70 +145,71 @@ main(int argc, char ** argv)
 		warnp("parsenum");
 		goto err0;
 	}
+	if ((argc > 3) && PARSENUM(&nconn, argv[3], 1, 65536)) {
+		warnp("parsenum");
+		goto err0;
+	}
 
-	/* Allocate buffer. */
-	if ((buffer = malloc((size_t)buflen)) == NULL) {
+	/* Allocate buffer and connections. */
+	if ((buffer = malloc(buflen)) == NULL) {
 		warnp("malloc");
 		goto err0;
 	}
+	if ((conns = malloc(nconn * sizeof(struct conn))) == NULL) {
+		warnp("malloc");
+		goto err1;
+	}
 
 	/* Resolve the address. */
 	if ((sas = sock_resolve(addr)) == NULL) {
 		warn0("sock_resolve");
-		goto err1;
+		goto err2;
 	}
 
 	/* Create a socket, bind it, mark it as listening. */
-	if ((socket = sock_listener(sas[0])) == -1) {
+	if ((s_listen = sock_listener(sas[0])) == -1) {
 		warn0("sock_listener");
-		goto err2;
-	}
-
-	/* Make it blocking. */
-	if (fcntl(socket, F_SETFL,
-	    fcntl(socket, F_GETFL, 0) & (~O_NONBLOCK)) == -1) {
-		warnp("Cannot make connection blocking");
-		goto err3;
-	}
-
-	/* Accept a connection. */
-	if ((socket_recv = accept(socket, NULL, NULL)) == -1) {
-		warnp("accept");
 		goto err3;
 	}
 
-	/* Receive data, but do nothing with it. */
-	do {
-		r = recv(socket_recv, buffer, (size_t)buflen, MSG_WAITALL);
-	} while (r == buflen);
-	if (r != 0) {
-		warnp("recv");
+	/* Accept connections, and receive from them until they're closed. */
+	if ((accept_cookie = network_accept(s_listen, callback_accept,
+	    NULL)) == NULL) {
+		warnp("network_accept");
 		goto err4;
 	}
-
-	/* Close the connection. */
-	if (close(socket_recv)) {
-		warnp("close");
-		goto err3;
+	if (events_spin(&done)) {
+		warnp("Error running event loop");
+		goto err5;
 	}
 
 	/* Clean up. */
-	if (close(socket)) {
+	if (close(s_listen)) {
 		warnp("close");
-		goto err2;
+		goto err3;
 	}
 	sock_addr_freelist(sas);
+	free(conns);
 	free(buffer);
 
 	/* Success! */
 	exit(0);
 
+err5:
+	if (accept_cookie != NULL)
+		network_accept_cancel(accept_cookie);
+	for (i = 0; i < naccepted; i++) {
+		if (conns[i].read_cookie != NULL)
+			network_read_cancel(conns[i].read_cookie);
+		if (conns[i].s != -1)
+			close(conns[i].s);
+	}
 err4:
-	close(socket_recv);
+	close(s_listen);
 err3:
-	close(socket);
-err2:
 	sock_addr_freelist(sas);
+err2:
+	free(conns);
 err1:
 	free(buffer);
 err0:
@@ -0,0 +1,202 @@
+#!/bin/sh
+
+# Run the performance test suite: the standalone crypto tests, the event-loop
+# scalability test, and short runs of the end-to-end tunnel tests.  Write
+# the results in the format read by compare-results.sh, and then compare them
+# against the baseline for this host (if there is one), exiting with status 1
+# if any metric has regressed.
+#
+# Baselines are results files saved (with -s) as
+# perftests/baselines/<hostname>.txt; they are only meaningful on the host
+# and build configuration which produced them.
+
+set -e -o noclobber -o nounset
+
+usage() {
+	echo "usage: $0 [-q] [-s] [-b <baseline>] [-o <results>]" 1>&2
+	echo "    [-t <threshold percent>]" 1>&2
+	exit 1
+}
+
+### Find script directory.
+scriptdir=$(CDPATH='' cd -- "$(dirname -- "$0")" && pwd -P)
+standalone_enc_binary=${scriptdir}/standalone-enc/test_standalone_enc
+events_network_binary=${scriptdir}/events-network/events-network
+
+# Defaults.
+baseline=${scriptdir}/baselines/$(uname -n).txt
+results=${scriptdir}/../perftests-output/results.txt
+quick=0
+save=0
+threshold=10
+
+# Parse command line.
+while getopts "b:o:qst:" opt; do
+	case ${opt} in
+	b)	baseline=${OPTARG} ;;
+	o)	results=${OPTARG} ;;
+	q)	quick=1 ;;
+	s)	save=1 ;;
+	t)	threshold=${OPTARG} ;;
+	*)	usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+if [ "$#" -ne 0 ]; then
+	usage
+fi
+
+# How long should we spend on each test?
+if [ "${quick}" -eq 1 ]; then
+	trials=1
+	seconds=1
+else
+	trials=3
+	seconds=5
+fi
+
+# Scratch space.
+out=$(mktemp -d "${TMPDIR:-/tmp}/spiped-perftest-suite.XXXXXX")
+trap 'rm -rf "${out}"' EXIT
+trap 'exit 1' INT TERM
+
+## run(name, command ...):
+# Run ${command}, saving its output in ${out}/${name}.txt; if it fails, warn
+# (its results will be reported as missing) rather than stopping.
+run() {
+	name=$1
+	shift
+	echo "Running ${name}..." 1>&2
+	if ! "$@" > "${out}/${name}.txt"; then
+		echo "${name} failed" 1>&2
+		rm -f "${out}/${name}.txt"
+		touch "${out}/${name}.txt"
+	fi
+}
+
+## perftest_json(prefix, file):
+# Convert the JSON lines written by perftest_buffers() and perftest_ops(), and
+# the hardware line written by test_standalone_enc, into results.
+perftest_json() {
+	awk -v prefix="$1" '
+		function jstr(k) {
+			if (!match($0, "\"" k "\": \"[^\"]*\""))
+				return ""
+			return substr($0, RSTART + length(k) + 5,
+			    RLENGTH - length(k) - 6)
+		}
+		function jnum(k) {
+			if (!match($0, "\"" k "\": [-0-9.e+]+"))
+				return ""
+			return substr($0, RSTART + length(k) + 4,
+			    RLENGTH - length(k) - 4)
+		}
+		/"hardware"/ {
+			if (!seen++) {
+				printf("%s: SHA256 implementation"	\
+				    "\t%s\t-\tsame\n", prefix, jstr("sha256"))
+				printf("%s: AES implementation"		\
+				    "\t%s\t-\tsame\n", prefix, jstr("aes"))
+			}
+			next
+		}
+		jnum("speed_MBps") != "" {
+			printf("%s: %s, %s byte blocks\t%s\tMB/s\thigher\n",
+			    prefix, jstr("test"), jnum("blocksize"),
+			    jnum("speed_MBps"))
+		}
+		# us_per_op has only 3 decimal places, which is too few for
+		# fast operations; work it out from ops_per_sec instead.
+		jnum("ops_per_sec") > 0 {
+			printf("%s: %s\t%.4g\tus\tlower\n", prefix,
+			    jstr("test"), 1e6 / jnum("ops_per_sec"))
+		}' "$2"
+}
+
+# Standalone crypto and handshake tests.
+for N in 1 2 3 4 5 6 7; do
+	run "standalone-enc-${N}" "${standalone_enc_binary}" -f json	\
+	    -n "${trials}" "${N}"
+done
+cat "${out}"/standalone-enc-*.txt > "${out}/standalone-enc.txt"
+perftest_json standalone-enc "${out}/standalone-enc.txt" > "${out}/results"
+
+# Event loop scalability; io_uring may not be available.
+for backend in poll uring; do
+	run "events-network-${backend}" "${events_network_binary}"	\
+	    -b "${backend}" -f json -n "${trials}" 10 1000
+	perftest_json events-network "${out}/events-network-${backend}.txt" \
+	    >> "${out}/results"
+done
+
+# Tunnel throughput with one and four streams.
+for n in 1 4; do
+	run "tunnel-throughput-${n}"					\
+	    "${scriptdir}/tunnel-throughput.sh" -n "${n}" -t "${seconds}"
+	awk -v n="${n}" '
+		/^throughput:/ {
+			printf("tunnel-throughput: %d stream(s)\t%s\tGbit/s" \
+			    "\thigher\n", n, $2)
+		}
+		/^spiped -[ed]:/ {
+			printf("tunnel-throughput: %d stream(s), %s %s\t%s" \
+			    "\tCPU-s/GB\tlower\n", n, $1, substr($2, 1, 2), $3)
+		}' "${out}/tunnel-throughput-${n}.txt" >> "${out}/results"
+done
+
+# Handshake rate, with and without Diffie-Hellman.
+run handshake-rate "${scriptdir}/handshake-rate.sh" -t "${seconds}"	\
+    nopfs pfs
+awk '
+	/^mode:/ {
+		mode = $2
+	}
+	/^rate:/ {
+		printf("handshake-rate: %s\t%s\tconnections/s\thigher\n",
+		    mode, $2)
+	}' "${out}/handshake-rate.txt" >> "${out}/results"
+
+# Round-trip time for small messages, without any bulk flows.
+run ping-pong "${scriptdir}/ping-pong.sh" -b 0 -n 2000 64
+awk '
+	/^RTT:/ && !seen++ {
+		printf("ping-pong: 64 bytes, p50 RTT\t%s\tus\tlower"	\
+		    "\t25\n", $6)
+		printf("ping-pong: 64 bytes, p99 RTT\t%s\tus\tlower"	\
+		    "\t50\n", $12)
+	}' "${out}/ping-pong.txt" >> "${out}/results"
+
+# Memory and wakeup cost with 1000 idle connections.
+run idle-conns "${scriptdir}/idle-conns.sh" -t "${seconds}" -p 500 1000
+awk '
+	/^spiped -[ed]:/ {
+		side = substr($2, 1, 2)
+		printf("idle-conns: 1000 connections, %s %s RSS\t%s"	\
+		    "\tkB/conn\tlower\n", $1, side, $3)
+		printf("idle-conns: 1000 connections, %s %s CPU per wakeup" \
+		    "\t%s\tus\tlower\t25\n", $1, side, $9)
+	}' "${out}/idle-conns.txt" >> "${out}/results"
+
+# Write the results, noting where they came from.
+mkdir -p "$(dirname -- "${results}")"
+{
+	echo "# date: $(date -u '+%Y-%m-%d %H:%M:%S UTC')"
+	echo "# host: $(uname -n) ($(uname -s) $(uname -r) $(uname -m))"
+	echo "# commit: $(git -C "${scriptdir}" rev-parse --short HEAD	\
+	    2>/dev/null || echo unknown)"
+	echo "# trials: ${trials}, seconds: ${seconds}"
+	cat "${out}/results"
+} >| "${results}"
+echo "Results written to ${results}" 1>&2
+
+# Save the results as the baseline, or compare them against it.
+if [ "${save}" -eq 1 ]; then
+	mkdir -p "$(dirname -- "${baseline}")"
+	cp "${results}" "${baseline}"
+	echo "Baseline saved to ${baseline}" 1>&2
+elif [ -e "${baseline}" ]; then
+	"${scriptdir}/compare-results.sh" -t "${threshold}"		\
+	    "${baseline}" "${results}"
+else
+	echo "No baseline at ${baseline}; run with -s to save one" 1>&2
+fi
@@ -1,8 +1,12 @@
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,10 +14,226 @@
 #include <unistd.h>
 
 #include "monoclock.h"
+#include "noeintr.h"
 #include "parsenum.h"
 #include "sock.h"
 #include "warnp.h"
 
+/*
+ * Open NSTREAMS connections to ADDRESS and send COUNT buffers of BUFLEN
+ * zero bytes over each of them, in parallel, stopping early after SECONDS
+ * if that is non-zero.  If MBPS is non-zero, pace each stream so that it
+ * sends at most MBPS * 10^6 bytes per second.
+ *
+ * For each stream, print the buffer size, the number of buffers sent, the
+ * duration, the throughput in MB/s, and the jitter: the standard deviation
+ * of the throughput measured over successive INTERVAL-second intervals.
+ * If there is more than one stream, then also print a line containing
+ * "total", the number of bytes sent, the longest duration, the aggregate
+ * throughput in MB/s, and Jain's fairness index of the per-stream
+ * throughputs (1.0 if every stream received the same share).
+ *
+ * On SIGTERM, stop sending and report the results so far, as if SECONDS
+ * had elapsed.
+ */
+
+/* Length of the intervals used to measure jitter, in seconds. */
+#define INTERVAL 0.1
+
+/* Results from one stream, passed from the child to the parent. */
+struct result {
+	size_t nwrites;
+	double duration_s;
+	double jitter;
+};
+
+/* Have we been asked to stop?  If so, which children should we tell? */
+static volatile sig_atomic_t stopping = 0;
+static pid_t * children = NULL;
+static size_t nchildren = 0;
+
+/* Stop sending, and tell any children to do the same. */
+static void
+handler_stop(int signo)
+{
+	size_t i;
+
+	stopping = 1;
+	for (i = 0; i < nchildren; i++)
+		kill(children[i], signo);
+}
+
+/* Sleep until ${t} seconds after ${begin}. */
+static int
+sleepuntil(struct timeval begin, double t)
+{
+	struct timeval now;
+	struct timespec ts;
+	double delay;
+
+	/* How long do we need to wait? */
+	if (monoclock_get(&now)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+	if ((delay = t - timeval_diff(begin, now)) <= 0.0)
+		return (0);
+
+	/* Sleep, resuming if we're interrupted. */
+	ts.tv_sec = (time_t)delay;
+	ts.tv_nsec = (long)((delay - (double)ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts)) {
+		if (errno != EINTR) {
+			warnp("nanosleep");
+			goto err0;
+		}
+		if (stopping)
+			break;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/*
+ * Send up to ${count} buffers of ${buflen} bytes from ${buffer} over the
+ * blocking socket ${s}, stopping after ${seconds} if non-zero and sending
+ * at most ${rate} bytes per second if non-zero, and record what happened in
+ * ${R}.
+ */
+static int
+sendstream(int s, char * buffer, size_t buflen, size_t count, double seconds,
+    double rate, struct result * R)
+{
+	struct timeval begin, now, end;
+	size_t to_send = count;
+	size_t nintervals = 0;
+	size_t interval_bytes = 0;
+	double elapsed;
+	double x, delta;
+	double mean = 0.0;
+	double m2 = 0.0;
+	ssize_t r;
+
+	/* Get beginning time. */
+	if (monoclock_get(&begin)) {
+		warn0("monoclock_get");
+		goto err0;
+	}
+
+	/* Send data, stopping early if we run out of time. */
+	while (to_send > 0) {
+		/* Wait until this buffer is due, if we're pacing. */
+		if ((rate > 0.0) && sleepuntil(begin,
+		    (double)(buflen * (count - to_send)) / rate))
+			goto err0;
+
+		/* If we're interrupted because we're stopping, don't worry. */
+		if (write(s, buffer, buflen) != (ssize_t)buflen) {
+			if (stopping)
+				break;
+			warnp("write failed");
+			goto err0;
+		}
+		to_send--;
+
+		/* Check the time. */
+		if (monoclock_get(&now)) {
+			warn0("monoclock_get");
+			goto err0;
+		}
+		elapsed = timeval_diff(begin, now);
+
+		/*
+		 * Fold each interval which has ended into the running mean
+		 * and variance of the per-interval throughput (Welford's
+		 * method).  A write which blocked for longer than an interval
+		 * leaves empty intervals behind it.
+		 */
+		while (elapsed >= (double)(nintervals + 1) * INTERVAL) {
+			x = (double)interval_bytes / INTERVAL / 1e6;
+			nintervals++;
+			delta = x - mean;
+			mean += delta / (double)nintervals;
+			m2 += delta * (x - mean);
+			interval_bytes = 0;
+		}
+		interval_bytes += buflen;
+
+		/* Have we run out of time, or been asked to stop? */
+		if (((seconds > 0.0) && (elapsed >= seconds)) || stopping)
+			break;
+	}
+	R->nwrites = count - to_send;
+
+	/* We're not going to send anything else. */
+	if (shutdown(s, SHUT_WR)) {
+		warnp("shutdown");
+		goto err0;
+	}
+
+	/*
+	 * The server should not send any data back, but attempting to read
+	 * will detect when the other end of the socket is closed.
+	 */
+	while ((r = read(s, buffer, 1)) != 0) {
+		if ((r == -1) && (errno == EINTR))
+			continue;
+		warnp("read");
+		goto err0;
+	}
+
+	/* Get ending time. */
+	if (monoclock_get(&end)) {
+		warn0("monoclock_get");
+		goto err0;
+	}
+	R->duration_s = timeval_diff(begin, end);
+	R->jitter = (nintervals > 1) ? sqrt(m2 / (double)(nintervals - 1)) :
+	    0.0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Read exactly ${len} bytes from ${fd} into ${buf}. */
+static int
+readall(int fd, void * buf, size_t len)
+{
+	char * p = buf;
+	ssize_t r;
+
+	while (len > 0) {
+		if ((r = read(fd, p, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			warnp("read");
+			goto err0;
+		}
+		if (r == 0) {
+			warn0("Unexpected EOF");
+			goto err0;
+		}
+		p += r;
+		len -= (size_t)r;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 int
 main(int argc, char ** argv)
 {
@@ -21,20 +241,37 @@ main(int argc, char ** argv)
 	const char * addr;
 	size_t buflen;
 	size_t count;
+	double seconds = 0.0;
+	size_t nstreams = 1;
+	double mbps = 0.0;
 
 	/* Working variables. */
 	struct sock_addr ** sas_t;
-	struct timeval begin, end;
+	struct result * results;
+	struct result R;
 	double duration_s;
+	double mbs;
+	double sum = 0.0;
+	double sumsq = 0.0;
 	char * buffer;
-	int socket;
-	size_t to_send;
+	int * sockets;
+	int go[2];
+	int res[2];
+	int status;
+	int failed = 0;
+	size_t nconnected = 0;
+	struct sigaction sa;
+	pid_t pid;
+	size_t nwrites = 0;
+	size_t i, j;
+	char c;
 
 	WARNP_INIT;
 
 	/* Parse command-line arguments. */
-	if (argc != 4) {
-		warn0("usage: %s ADDRESS BUFLEN COUNT", argv[0]);
+	if ((argc < 4) || (argc > 7)) {
+		warn0("usage: %s ADDRESS BUFLEN COUNT"
+		    " [SECONDS [NSTREAMS [MBPS]]]", argv[0]);
 		goto err0;
 	}
 	addr = argv[1];
@@ -46,6 +283,18 @@ main(int argc, char ** argv)
 		warnp("parsenum");
 		goto err0;
 	}
+	if ((argc > 4) && PARSENUM(&seconds, argv[4], 0, 1e6)) {
+		warnp("parsenum");
+		goto err0;
+	}
+	if ((argc > 5) && PARSENUM(&nstreams, argv[5], 1, 65536)) {
+		warnp("parsenum");
+		goto err0;
+	}
+	if ((argc > 6) && PARSENUM(&mbps, argv[6], 0, 1e6)) {
+		warnp("parsenum");
+		goto err0;
+	}
 
 	/* Sanity check */
 	if (count == 0) {
@@ -60,88 +309,190 @@ main(int argc, char ** argv)
 	}
 	memset(buffer, 0, buflen);
 
-	/* Initialize count. */
-	to_send = count;
+	/* Allocate arrays of sockets and results. */
+	if ((sockets = malloc(nstreams * sizeof(int))) == NULL) {
+		warnp("Out of memory");
+		goto err1;
+	}
+	if ((results = malloc(nstreams * sizeof(struct result))) == NULL) {
+		warnp("Out of memory");
+		goto err2;
+	}
+	if ((children = malloc(nstreams * sizeof(pid_t))) == NULL) {
+		warnp("Out of memory");
+		goto err3;
+	}
 
 	/* Resolve target address. */
 	if ((sas_t = sock_resolve(addr)) == NULL) {
 		warnp("Error resolving socket address: %s", addr);
-		goto err1;
+		goto err4;
 	}
 	if (sas_t[0] == NULL) {
 		warn0("No addresses found for %s", addr);
-		goto err2;
+		goto err5;
 	}
 
-	/* Connect to target. */
-	if ((socket = sock_connect(sas_t)) == -1) {
-		warnp("sock_connect");
-		goto err2;
+	/* Connect to target, once per stream. */
+	for (; nconnected < nstreams; nconnected++) {
+		if ((sockets[nconnected] = sock_connect(sas_t)) == -1) {
+			warnp("sock_connect");
+			goto err6;
+		}
+
+		/* Make it blocking. */
+		if (fcntl(sockets[nconnected], F_SETFL,
+		    fcntl(sockets[nconnected], F_GETFL, 0) &
+		    (~O_NONBLOCK)) == -1) {
+			warnp("Cannot make connection blocking");
+			close(sockets[nconnected]);
+			goto err6;
+		}
 	}
 
-	/* Make it blocking. */
-	if (fcntl(socket, F_SETFL,
-	    fcntl(socket, F_GETFL, 0) & (~O_NONBLOCK)) == -1) {
-		warnp("Cannot make connection blocking");
-		goto err3;
+	/*
+	 * The children wait for a byte on ${go}, so that they all start
+	 * sending at the same time, and report their results via ${res}.
+	 */
+	if (pipe(go)) {
+		warnp("pipe");
+		goto err6;
+	}
+	if (pipe(res)) {
+		warnp("pipe");
+		goto err7;
 	}
 
-	/* Get beginning time. */
-	if (monoclock_get(&begin)) {
-		warn0("monoclock_get");
-		goto err3;
+	/*
+	 * Stop early on SIGTERM.  Don't restart system calls, so that a write
+	 * which is blocked will notice.
+	 */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handler_stop;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGTERM, &sa, NULL)) {
+		warnp("sigaction");
+		goto err8;
 	}
 
-	/* Send data. */
-	while (to_send > 0) {
-		if (write(socket, buffer, buflen) != (ssize_t)buflen) {
-			warnp("write failed");
-			goto err3;
+	/* Send data over each connection in a child. */
+	for (i = 0; i < nstreams; i++) {
+		switch ((pid = fork())) {
+		case -1:
+			warnp("fork");
+			goto err9;
+		case 0:
+			/* We have no children of our own. */
+			nchildren = 0;
+			close(go[1]);
+			close(res[0]);
+			for (j = 0; j < nstreams; j++) {
+				if (j != i)
+					close(sockets[j]);
+			}
+			if ((read(go[0], &c, 1) != 1) ||
+			    sendstream(sockets[i], buffer, buflen, count,
+			    seconds, mbps * 1e6, &R) ||
+			    (noeintr_write(res[1], &R, sizeof(R)) !=
+			    (ssize_t)sizeof(R)))
+				_exit(1);
+			_exit(0);
+		default:
+			children[nchildren++] = pid;
 		}
-		to_send--;
 	}
 
-	/* We're not going to send anything else. */
-	if (shutdown(socket, SHUT_WR)) {
-		warnp("shutdown");
-		goto err3;
+	/* The sockets belong to the children now. */
+	for (; nconnected > 0; nconnected--)
+		close(sockets[nconnected - 1]);
+	close(res[1]);
+	res[1] = -1;
+
+	/* Start the children, and collect their results. */
+	for (i = 0; i < nstreams; i++) {
+		if (noeintr_write(go[1], "", 1) != 1) {
+			warnp("write");
+			goto err9;
+		}
+	}
+	for (i = 0; i < nstreams; i++) {
+		if (readall(res[0], &results[i], sizeof(struct result)))
+			goto err9;
 	}
 
-	/*
-	 * The server should not send any data back, but attempting to read
-	 * will detect when the other end of the socket is closed.
-	 */
-	if (read(socket, buffer, 1) != 0) {
-		warnp("read");
-		goto err3;
+	/* Wait for the children to exit. */
+	for (; nchildren > 0; nchildren--) {
+		if (wait(&status) == -1) {
+			warnp("wait");
+			goto err9;
+		}
+		if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+			failed = 1;
 	}
+	if (failed)
+		goto err8;
 
-	/* Get ending time. */
-	if (monoclock_get(&end)) {
-		warn0("monoclock_get");
-		goto err3;
+	/* Print duration, speed, and jitter for each stream. */
+	duration_s = 0.0;
+	for (i = 0; i < nstreams; i++) {
+		mbs = (double)(buflen * results[i].nwrites) /
+		    results[i].duration_s / 1e6;
+		printf("%zu\t%zu\t%.4f\t%.2f\t%.2f\n", buflen,
+		    results[i].nwrites, results[i].duration_s, mbs,
+		    results[i].jitter);
+		nwrites += results[i].nwrites;
+		if (results[i].duration_s > duration_s)
+			duration_s = results[i].duration_s;
+		sum += mbs;
+		sumsq += mbs * mbs;
 	}
 
-	/* Print duration and speed. */
-	duration_s = timeval_diff(begin, end);
-	printf("%zu\t%zu\t%.4f\t%.2f\n", buflen, count, duration_s,
-	    (double)(buflen * count) / duration_s / 1e6);
+	/* Print aggregate speed and fairness. */
+	if (nstreams > 1) {
+		printf("total\t%zu\t%.4f\t%.2f\t%.4f\n", buflen * nwrites,
+		    duration_s, (double)(buflen * nwrites) / duration_s / 1e6,
+		    (sumsq > 0.0) ? sum * sum / ((double)nstreams * sumsq) :
+		    1.0);
+	}
 
 	/* Clean up. */
-	if (close(socket)) {
-		warnp("close");
-		goto err2;
-	}
+	close(res[0]);
+	close(go[1]);
+	close(go[0]);
 	sock_addr_freelist(sas_t);
+	free(children);
+	free(results);
+	free(sockets);
 	free(buffer);
 
 	/* Success! */
 	exit(0);
 
+err9:
+	/* Children which have not been started will see EOF and exit. */
+	close(go[1]);
+	go[1] = -1;
+	for (; nchildren > 0; nchildren--)
+		wait(&status);
+err8:
+	close(res[0]);
+	if (res[1] != -1)
+		close(res[1]);
+err7:
+	close(go[0]);
+	if (go[1] != -1)
+		close(go[1]);
+err6:
+	for (; nconnected > 0; nconnected--)
+		close(sockets[nconnected - 1]);
+err5:
+	sock_addr_freelist(sas_t);
+err4:
+	free(children);
 err3:
-	close(socket);
+	free(results);
 err2:
-	sock_addr_freelist(sas_t);
+	free(sockets);
 err1:
 	free(buffer);
 err0:
@@ -0,0 +1,138 @@
+#!/bin/sh
+
+# Functions shared by the end-to-end performance tests, which run real spiped
+# processes on loopback.  Scripts using this must set ${scriptdir} to the
+# perftests directory before loading it.
+
+# Sockets for the traffic generator (src), the encrypting spiped (src -> mid),
+# the decrypting spiped (mid -> dst), and the traffic sink (dst).
+src_sock=${src_sock:-[127.0.0.1]:8101}
+mid_sock=${mid_sock:-[127.0.0.1]:8102}
+dst_sock=${dst_sock:-[127.0.0.1]:8103}
+
+# Binaries from this source tree.
+spiped_binary=${scriptdir}/../spiped/spiped
+send_zeros_binary=${scriptdir}/send-zeros/send-zeros
+recv_zeros_binary=${scriptdir}/recv-zeros/recv-zeros
+
+## perftest_setup():
+# Check that the binaries have been built, create a temporary directory
+# ${out} for pid files and results which is removed on exit, and generate a
+# key file.
+perftest_setup() {
+	for binary in ${spiped_binary} ${send_zeros_binary}		\
+	    ${recv_zeros_binary}; do
+		if ! [ -x "${binary}" ]; then
+			echo "${binary} not found; did you run 'make'?" 1>&2
+			exit 1
+		fi
+	done
+
+	out=$(mktemp -d "${TMPDIR:-/tmp}/spiped-perftest.XXXXXX")
+	trap 'perftest_cleanup' EXIT
+	trap 'exit 1' INT TERM
+
+	dd if=/dev/urandom of="${out}/keyfile" bs=32 count=1 2>/dev/null
+}
+
+## perftest_cleanup():
+# Stop any spiped processes we started, and remove ${out}.
+perftest_cleanup() {
+	spiped_stop
+	rm -rf "${out}"
+}
+
+## spiped_start(flags_e="", flags_d=""):
+# Start an encrypting spiped from ${src_sock} to ${mid_sock} and a decrypting
+# spiped from ${mid_sock} to ${dst_sock}, passing ${flags_e} and ${flags_d}
+# respectively, and set ${spiped_e_pid} and ${spiped_d_pid}.
+spiped_start() {
+	flags_e=${1:-}
+	flags_d=${2:-}
+
+	${spiped_binary} -d -s "${mid_sock}" -t "${dst_sock}"		\
+	    -k "${out}/keyfile" -p "${out}/spiped-d.pid" -n 0 ${flags_d}
+	${spiped_binary} -e -s "${src_sock}" -t "${mid_sock}"		\
+	    -k "${out}/keyfile" -p "${out}/spiped-e.pid" -n 0 ${flags_e}
+	spiped_d_pid=$(cat "${out}/spiped-d.pid")
+	spiped_e_pid=$(cat "${out}/spiped-e.pid")
+}
+
+## spiped_stop():
+# Stop the spiped processes started by spiped_start() (if any), and wait
+# for them to exit.
+spiped_stop() {
+	pids=""
+	for pidfile in "${out}/spiped-e.pid" "${out}/spiped-d.pid"; do
+		if [ -e "${pidfile}" ]; then
+			pids="${pids} $(cat "${pidfile}")"
+			rm "${pidfile}"
+		fi
+	done
+	for pid in ${pids}; do
+		kill "${pid}" 2>/dev/null || true
+	done
+	for pid in ${pids}; do
+		while kill -0 "${pid}" 2>/dev/null; do
+			sleep 0.1
+		done
+	done
+}
+
+## cputime(pid):
+# Print the CPU time (user plus system) used so far by process ${pid}, in
+# seconds.
+cputime() {
+	if [ -r "/proc/$1/stat" ]; then
+		# Fields 14 and 15 are utime and stime, in clock ticks; skip
+		# past the command name since it may contain spaces.
+		awk -v hz="$(getconf CLK_TCK)"				\
+		    '{ sub(/^.*\) /, ""); print ($12 + $13) / hz }'	\
+		    "/proc/$1/stat"
+	else
+		# This has a resolution of a second or a hundredth of a
+		# second, depending on the platform: [[dd-]hh:]mm:ss[.ss].
+		ps -o time= -p "$1" | awk -F'[-:]' '{
+			t = 0
+			for (i = 1; i <= NF; i++)
+				t = t * ((i == 2 && NF == 4) ? 24 : 60) + $i
+			print t
+		}'
+	fi
+}
+
+## rss(pid):
+# Print the resident set size of process ${pid}, in kB.
+rss() {
+	ps -o rss= -p "$1" | awk '{ print $1 }'
+}
+
+## syscalls_start(pid, name):
+# Start counting the system calls made by process ${pid}, under the label
+# ${name}, if perf(1) is available.
+syscalls_start() {
+	if ! command -v perf >/dev/null 2>&1; then
+		return
+	fi
+	perf stat -x, -e raw_syscalls:sys_enter -p "$1"			\
+	    -o "${out}/$2.perf" 2>/dev/null &
+	echo $! > "${out}/$2.perf.pid"
+}
+
+## syscalls_stop(name):
+# Stop counting the system calls for ${name}, and print the number made, or
+# "-" if they could not be counted.
+syscalls_stop() {
+	if ! [ -e "${out}/$1.perf.pid" ]; then
+		echo "-"
+		return
+	fi
+	pid=$(cat "${out}/$1.perf.pid")
+	kill -INT "${pid}" 2>/dev/null || true
+	wait "${pid}" 2>/dev/null || true
+	awk -F, '/raw_syscalls:sys_enter/ {
+		n = ($1 ~ /^[0-9]+$/) ? $1 : "-"
+	} END {
+		print (n == "") ? "-" : n
+	}' "${out}/$1.perf" 2>/dev/null || echo "-"
+}
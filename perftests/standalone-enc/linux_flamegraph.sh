@@ -0,0 +1,119 @@
+#!/bin/sh
+
+# Profile standalone tests with perf(1) and generate a flamegraph for each:
+#       ./linux_flamegraph.sh [-a] [-d] [-m <multiplier>] [-o <dir>] [test ...]
+#
+# By default, run tests 1-7, each with the work multiplied by 10, and write
+# flamegraph-<test>.svg (plus the perf data and folded stacks) to the current
+# directory.  As with freebsd_flamegraph.sh, only profile data from
+# pipe_enc_thread is kept for tests which have it, unless -a is given.
+#
+# perf unwinds stacks using frame pointers, so build with them first:
+#       make clean && make CFLAGS="-O2 -g -fno-omit-frame-pointer"
+# or run "make flamegraph" from the top-level directory, which does that and
+# then runs this script.  For a build without frame pointers, -d makes perf
+# unwind using DWARF debug information instead (which needs -g, and is much
+# slower and produces far more data).
+#
+# This needs perf(1), permission to profile our own processes (e.g.
+# kernel.perf_event_paranoid <= 2), and either stackcollapse-perf.pl and
+# flamegraph.pl from https://github.com/brendangregg/FlameGraph or
+# inferno-collapse-perf and inferno-flamegraph.
+
+set -e -o noclobber -o nounset
+
+usage() {
+	echo "usage: $0 [-a] [-d] [-m <multiplier>] [-o <dir>] [test ...]" 1>&2
+	exit 1
+}
+
+### Find script directory.
+scriptdir=$(CDPATH='' cd -- "$(dirname -- "$0")" && pwd -P)
+cmd=${scriptdir}/test_standalone_enc
+
+# Defaults.
+keep_all=0
+callgraph="fp"
+multiplier=10
+outdir="."
+
+# Parse command line.
+while getopts "adm:o:" opt; do
+	case ${opt} in
+	a)	keep_all=1 ;;
+	d)	callgraph="dwarf" ;;
+	m)	multiplier=${OPTARG} ;;
+	o)	outdir=${OPTARG} ;;
+	*)	usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+tests=${*:-1 2 3 4 5 6 7}
+
+# Find the tools we need.
+if ! [ -x "${cmd}" ]; then
+	echo "${cmd} not found; did you run 'make'?" 1>&2
+	exit 1
+fi
+if ! command -v perf > /dev/null 2>&1; then
+	echo "perf not found" 1>&2
+	exit 1
+fi
+if command -v stackcollapse-perf.pl > /dev/null 2>&1 &&		\
+    command -v flamegraph.pl > /dev/null 2>&1; then
+	COLLAPSE_CMD="stackcollapse-perf.pl"
+	FLAMEGRAPH_CMD="flamegraph.pl"
+elif command -v inferno-collapse-perf > /dev/null 2>&1 &&		\
+    command -v inferno-flamegraph > /dev/null 2>&1; then
+	COLLAPSE_CMD="inferno-collapse-perf"
+	FLAMEGRAPH_CMD="inferno-flamegraph"
+else
+	echo "FlameGraph scripts (or inferno) not found in PATH" 1>&2
+	exit 1
+fi
+mkdir -p "${outdir}"
+
+# Profile each test.
+for N in ${tests}; do
+	case ${N} in
+	1)	title="HMAC_SHA256" ;;
+	2)	title="AES-CTR" ;;
+	3)	title="HMAC_SHA256 with AES-CTR" ;;
+	4)	title="proto_crypt_enc()" ;;
+	5)	title="1 proto_pipe() doing encryption" ;;
+	6)	title="packet encryption engines" ;;
+	7)	title="handshake operations" ;;
+	*)	usage ;;
+	esac
+	outfilename="${outdir}/flamegraph-${N}"
+
+	# Clear previous data.
+	rm -f "${outfilename}.perf.data" "${outfilename}.folded"
+	rm -f "${outfilename}.svg" "${outfilename}.tmp"
+
+	# Get profile data and consolidate it.
+	echo "Profiling test ${N}: ${title}" 1>&2
+	perf record -F 997 --call-graph "${callgraph}"			\
+	    -o "${outfilename}.perf.data"				\
+	    -- "${cmd}" "${N}" "${multiplier}" > /dev/null
+	perf script -i "${outfilename}.perf.data" 2>/dev/null |		\
+	    ${COLLAPSE_CMD} > "${outfilename}.folded"
+
+	# Unless otherwise specified, only keep the pipe_enc_thread part.
+	# If there's no pipe_enc_thread, don't do any filtering.
+	if [ "${keep_all}" -eq 0 ] &&					\
+	    grep -q pipe_enc_thread "${outfilename}.folded"; then
+		grep pipe_enc_thread "${outfilename}.folded"		\
+		    > "${outfilename}.tmp"
+		mv "${outfilename}.tmp" "${outfilename}.folded"
+	fi
+
+	# Generate flamegraph image.
+	${FLAMEGRAPH_CMD}						\
+		--width 1000						\
+		--title "${title}"					\
+		--subtitle "test_standalone_enc ${N} ${multiplier}"	\
+		--hash							\
+		"${outfilename}.folded" > "${outfilename}.svg"
+	echo "Wrote ${outfilename}.svg" 1>&2
+done
@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cpusupport.h"
+#include "getopt.h"
 #include "parsenum.h"
+#include "perftest.h"
+#include "sha256.h"
 #include "warnp.h"
 
 #include "standalone.h"
@@ -10,75 +14,230 @@
 /* Smaller buffers are padded, so no point testing smaller values. */
 static const size_t perfsizes[] = {1024};
 static const size_t num_perf = sizeof(perfsizes) / sizeof(perfsizes[0]);
+static const size_t batchsizes[] = {1024, 16384, 65536};
+static const size_t num_batch = sizeof(batchsizes) / sizeof(batchsizes[0]);
 static size_t nbytes_perftest = 100000000;		/* 100 MB */
 static const size_t nbytes_warmup = 10000000;		/* 10 MB */
+static size_t nops_perftest = 1000;
 
-/* Print a string, then whether or not we're using hardware instructions. */
+/* SHA256 implementation selected with -s, if any. */
+static const char * sha_forced = NULL;
+
+/*
+ * Find which SHA256 and AES implementations will be used: the name of the
+ * hardware instructions, NULL for software, or "unknown".
+ */
 static void
-print_hardware(const char * str)
+get_hardware(const char ** sha, const char ** aes)
 {
 
-	/* Inform the user of the general topic... */
-	printf("%s", str);
-
-	/* ... and whether we're using hardware acceleration or not. */
 #if defined(CPUSUPPORT_CONFIG_FILE)
+	if ((sha_forced != NULL) && (strcmp(sha_forced, "software") == 0))
+		*sha = NULL;
+	else if (sha_forced != NULL)
+		*sha = sha_forced;
+	else
 #if defined(CPUSUPPORT_X86_SHANI) && defined(CPUSUPPORT_X86_SSSE3)
 	if (cpusupport_x86_shani() && cpusupport_x86_ssse3())
-		printf(" using hardware SHANI");
+		*sha = "SHANI";
+	else
+#endif
+#if defined(CPUSUPPORT_X86_AVX2) && defined(CPUSUPPORT_X86_BMI2)
+	if (cpusupport_x86_avx2() && cpusupport_x86_bmi2())
+		*sha = "AVX2";
 	else
 #endif
 #if defined(CPUSUPPORT_X86_SSE2)
 	if (cpusupport_x86_sse2())
-		printf(" using hardware SSE2");
+		*sha = "SSE2";
 	else
 #endif
 #if defined(CPUSUPPORT_ARM_SHA256)
 	if (cpusupport_arm_sha256())
-		printf(" using hardware SHA256");
+		*sha = "SHA256";
 	else
 #endif
-		printf(" using software SHA");
+		*sha = NULL;
 
 #if defined(CPUSUPPORT_X86_AESNI)
 	if (cpusupport_x86_aesni())
-		printf(" and hardware AESNI.\n");
+		*aes = "AESNI";
 	else
 #endif
-		printf(" and software AES.\n");
+#if defined(CPUSUPPORT_ARM_AES)
+	if (cpusupport_arm_aes())
+		*aes = "ARM AES";
+	else
+#endif
+		*aes = NULL;
 #else
-	printf(" with unknown hardware acceleration status.\n");
+	*sha = *aes = "unknown";
 #endif /* CPUSUPPORT_CONFIG_FILE */
 }
 
+/*
+ * Print a string, then whether or not we're using hardware instructions; or
+ * when printing JSON, print an object recording which implementations are
+ * in use, so that a fallback to software shows up in saved results.
+ */
+static void
+print_hardware(const char * str, int format)
+{
+	const char * sha;
+	const char * aes;
+
+	/* Which implementations will we use? */
+	get_hardware(&sha, &aes);
+
+	switch (format) {
+	case PERFTEST_FORMAT_TEXT:
+		/* Inform the user of the general topic... */
+		printf("%s", str);
+
+		/* ... and whether we're using hardware acceleration or not. */
+		if ((sha != NULL) && (strcmp(sha, "unknown") == 0)) {
+			printf(" with unknown hardware acceleration status.\n");
+			break;
+		}
+		if (sha != NULL)
+			printf(" using hardware %s", sha);
+		else
+			printf(" using software SHA");
+		if (aes != NULL)
+			printf(" and hardware %s.\n", aes);
+		else
+			printf(" and software AES.\n");
+		break;
+	case PERFTEST_FORMAT_JSON:
+		printf("{\"hardware\": {\"sha256\": \"%s\","
+		    " \"aes\": \"%s\"}}\n", (sha != NULL) ? sha : "software",
+		    (aes != NULL) ? aes : "software");
+		break;
+	}
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: test_standalone_enc [-c] [-f text | csv | json]"
+	    " [-n <trials>] [-p <cpu>]\n"
+	    "    [-s SHANI | AVX2 | SSE2 | SHA256 | software] NUM [MULT]\n");
+	exit(1);
+}
+
+/* Parse an argument, or print an error and exit. */
+#define OPT_EPARSE(opt, arg) do {					\
+	warnp("Error parsing argument: %s %s", opt, arg);		\
+	exit(1);							\
+} while (0)
+
 int
 main(int argc, char * argv[])
 {
+	/* Command-line parameters. */
+	int opt_c = 0;
+	const char * opt_f = NULL;
+	size_t opt_n = 0;
+	int opt_p = -1;
+	const char * opt_s = NULL;
 	int desired_test;
 	size_t multiplier;
 
+	/* Working variables. */
+	const char * ch;
+	int format;
+
 	WARNP_INIT;
 
 	/* Parse command line. */
-	if ((argc < 2) || (argc > 3)) {
-		fprintf(stderr, "usage: test_standalone_enc NUM [MULT]\n");
-		exit(1);
+	while ((ch = GETOPT(argc, argv)) != NULL) {
+		GETOPT_SWITCH(ch) {
+		GETOPT_OPT("-c"):
+			if (opt_c)
+				usage();
+			opt_c = 1;
+			break;
+		GETOPT_OPTARG("-f"):
+			if (opt_f)
+				usage();
+			opt_f = optarg;
+			break;
+		GETOPT_OPTARG("-n"):
+			if (opt_n)
+				usage();
+			if (PARSENUM(&opt_n, optarg, 1, 1000))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("-p"):
+			if (opt_p != -1)
+				usage();
+			if (PARSENUM(&opt_p, optarg, 0, 65535))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("-s"):
+			if (opt_s)
+				usage();
+			opt_s = optarg;
+			break;
+		GETOPT_MISSING_ARG:
+			warn0("Missing argument to %s", ch);
+			usage();
+		GETOPT_DEFAULT:
+			warn0("illegal option -- %s", ch);
+			usage();
+		}
 	}
-	if (PARSENUM(&desired_test, argv[1], 1, 5)) {
+	argc -= optind;
+	argv += optind;
+
+	/* Parse the test number and optional multiplier. */
+	if ((argc < 1) || (argc > 2))
+		usage();
+	if (PARSENUM(&desired_test, argv[0], 1, 7)) {
 		warnp("parsenum");
 		goto err0;
 	}
-	if (argc == 3) {
-		/* Multiply number of bytes by the user-supplied value. */
-		if (PARSENUM(&multiplier, argv[2], 1, 1000)) {
+	if (argc == 2) {
+		/* Multiply amount of work by the user-supplied value. */
+		if (PARSENUM(&multiplier, argv[1], 1, 1000)) {
 			warnp("parsenum");
 			goto err0;
 		}
 		nbytes_perftest *= multiplier;
+		nops_perftest *= multiplier;
 	}
 
+	/* Set defaults. */
+	if (opt_n == 0)
+		opt_n = 1;
+
+	/* Figure out the output format. */
+	if ((opt_f == NULL) || (strcmp(opt_f, "text") == 0))
+		format = PERFTEST_FORMAT_TEXT;
+	else if (strcmp(opt_f, "csv") == 0)
+		format = PERFTEST_FORMAT_CSV;
+	else if (strcmp(opt_f, "json") == 0)
+		format = PERFTEST_FORMAT_JSON;
+	else
+		usage();
+
+	/* Use the requested SHA256 implementation (if applicable). */
+	if (opt_s != NULL) {
+		if (SHA256_Transform_force(opt_s)) {
+			warn0("SHA256 implementation not available: %s",
+			    opt_s);
+			goto err0;
+		}
+		sha_forced = opt_s;
+	}
+
+	/* Set up the performance tests. */
+	if (perftest_init(opt_n, format, opt_c, opt_p))
+		goto err0;
+
 	/* Report what we're doing. */
-	print_hardware("Testing spiped speed limits");
+	print_hardware("Testing spiped speed limits", format);
 
 	/* Run the desired test. */
 	switch (desired_test) {
@@ -107,6 +266,15 @@ main(int argc, char * argv[])
 		    nbytes_perftest, nbytes_warmup))
 			goto err0;
 		break;
+	case 6:
+		if (engines_perftest(batchsizes, num_batch,
+		    nbytes_perftest, nbytes_warmup))
+			goto err0;
+		break;
+	case 7:
+		if (handshake_perftest(nops_perftest))
+			goto err0;
+		break;
 	default:
 		warn0("invalid test number");
 		goto err0;
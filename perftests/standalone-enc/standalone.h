@@ -33,4 +33,19 @@ int pce_perftest(const size_t *, size_t, size_t, size_t);
  */
 int pipe_perftest(const size_t *, size_t, size_t, size_t);
 
+/**
+ * engines_perftest(perfsizes, num_perf, nbytes_perftest, nbytes_warmup):
+ * Performance test for encrypting and decrypting batches of packets with
+ * each packet encryption engine.
+ */
+int engines_perftest(const size_t *, size_t, size_t, size_t);
+
+/**
+ * handshake_perftest(nops_perftest):
+ * Performance test for the cryptographic operations in a handshake: timing
+ * ${nops_perftest} of each Diffie-Hellman operation, with and without
+ * blinding, and 1000 times as many of each other operation.
+ */
+int handshake_perftest(size_t);
+
 #endif /* !_STANDALONE_H_ */
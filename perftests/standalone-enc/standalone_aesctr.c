@@ -56,7 +56,7 @@ aesctr_perftest(const size_t * perfsizes, size_t num_perf,
 	uint8_t kbuf[32];
 
 	/* Report what we're doing. */
-	printf("Testing AES-CTR\n");
+	perftest_name("AES-CTR");
 
 	/* Initialize. */
 	memset(kbuf, 0, 32);
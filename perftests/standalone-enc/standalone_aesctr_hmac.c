@@ -77,7 +77,7 @@ aesctr_hmac_perftest(const size_t * perfsizes, size_t num_perf,
 	uint8_t kbuf[32];
 
 	/* Report what we're doing. */
-	printf("Testing HMAC_SHA256 with AES-CTR\n");
+	perftest_name("HMAC_SHA256 with AES-CTR");
 
 	/* Initialize. */
 	ahc->ctx = &ctx;
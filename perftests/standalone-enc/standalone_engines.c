@@ -0,0 +1,160 @@
+#include <sys/uio.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "perftest.h"
+#include "proto_crypt.h"
+#include "proto_crypt_engine.h"
+#include "warnp.h"
+
+#include "standalone.h"
+
+/* Cookie for the engine functions. */
+struct engine {
+	const struct proto_crypt_engine * E;
+	void * ks;
+	int decrypt;
+	uint8_t * encbuf;
+	uint8_t * workbuf;
+	struct iovec * iov;
+	size_t maxlen;
+};
+
+static int
+engine_init(void * cookie, uint8_t * buf, size_t buflen)
+{
+	struct engine * e = cookie;
+	size_t esz = PCRYPT_NPACKETS(e->maxlen) * PCRYPT_ESZ;
+	uint8_t kbuf[64];
+	size_t i;
+
+	/* Set up encryption key. */
+	memset(kbuf, 0, 64);
+	if ((e->ks = e->E->keysetup(kbuf)) == NULL)
+		goto err0;
+
+	/* Allocate buffers for the encrypted packets. */
+	if ((e->encbuf = malloc(esz)) == NULL)
+		goto err1;
+	if ((e->workbuf = malloc(esz)) == NULL)
+		goto err2;
+	if ((e->iov = malloc(PCRYPT_NPACKETS(e->maxlen) *
+	    sizeof(struct iovec))) == NULL)
+		goto err3;
+
+	/* Set the input. */
+	for (i = 0; i < buflen; i++)
+		buf[i] = (uint8_t)(i & 0xff);
+
+	/* Encrypt it, in case we're timing decryption. */
+	if (e->E->enc_batch(e->ks, 0, buf, buflen, e->encbuf))
+		goto err4;
+
+	/* Success! */
+	return (0);
+
+err4:
+	free(e->iov);
+err3:
+	free(e->workbuf);
+err2:
+	free(e->encbuf);
+err1:
+	e->E->keyfree(e->ks);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+engine_func(void * cookie, uint8_t * buf, size_t buflen, size_t nreps)
+{
+	struct engine * e = cookie;
+	size_t npackets = PCRYPT_NPACKETS(buflen);
+	size_t i;
+
+	for (i = 0; i < nreps; i++) {
+		if (e->decrypt) {
+			/* Decryption is in-place, so work on a copy. */
+			memcpy(e->workbuf, e->encbuf, npackets * PCRYPT_ESZ);
+			if (e->E->dec_batch(e->ks, 0, e->workbuf, npackets,
+			    e->iov) != (ssize_t)buflen)
+				goto err0;
+		} else {
+			if (e->E->enc_batch(e->ks, 0, buf, buflen,
+			    e->workbuf))
+				goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+engine_cleanup(void * cookie)
+{
+	struct engine * e = cookie;
+
+	/* Clean up. */
+	free(e->iov);
+	free(e->workbuf);
+	free(e->encbuf);
+	e->E->keyfree(e->ks);
+
+	/* Success! */
+	return (0);
+}
+
+/**
+ * engines_perftest(perfsizes, num_perf, nbytes_perftest, nbytes_warmup):
+ * Performance test for encrypting and decrypting batches of packets with
+ * each packet encryption engine.
+ */
+int
+engines_perftest(const size_t * perfsizes, size_t num_perf,
+    size_t nbytes_perftest, size_t nbytes_warmup)
+{
+	const struct proto_crypt_engine * const * E;
+	struct engine e_actual;
+	struct engine * e = &e_actual;
+	size_t i;
+
+	/* Find the largest batch. */
+	e->maxlen = 0;
+	for (i = 0; i < num_perf; i++) {
+		if (perfsizes[i] > e->maxlen)
+			e->maxlen = perfsizes[i];
+	}
+
+	for (E = proto_crypt_engines; *E != NULL; E++) {
+		e->E = *E;
+		for (e->decrypt = 0; e->decrypt < 2; e->decrypt++) {
+			/* Report what we're doing. */
+			perftest_name("%s engine %s", e->E->name,
+			    e->decrypt ? "dec_batch" : "enc_batch");
+
+			/* Time the function. */
+			if (perftest_buffers(nbytes_perftest, perfsizes,
+			    num_perf, nbytes_warmup, 0, engine_init,
+			    engine_func, engine_cleanup, e)) {
+				warn0("perftest_buffers");
+				goto err0;
+			}
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (1);
+}
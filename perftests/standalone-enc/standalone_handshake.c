@@ -0,0 +1,454 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <openssl/bn.h>
+#include <openssl/err.h>
+
+#include "crypto_dh.h"
+#include "crypto_dh_group14.h"
+#include "perftest.h"
+#include "proto_crypt.h"
+#include "warnp.h"
+
+#include "standalone.h"
+
+/*
+ * The Diffie-Hellman operations are thousands of times slower than the
+ * others, so time this many times as many of the cheap operations.
+ */
+#define CHEAP_MULT 1000
+
+/* Cookie for handshake operations. */
+struct handshake {
+	struct proto_secret * K;
+	uint8_t nonce_l[PCRYPT_NONCE_LEN];
+	uint8_t nonce_r[PCRYPT_NONCE_LEN];
+	uint8_t dhmac_l[PCRYPT_DHMAC_LEN];
+	uint8_t dhmac_r[PCRYPT_DHMAC_LEN];
+	uint8_t yh_r[PCRYPT_YH_LEN];
+	uint8_t x[PCRYPT_X_LEN];
+	int nopfs;
+
+	/* For unblinded modular exponentiations. */
+	BIGNUM * two_bn;
+	BIGNUM * y_r_bn;
+	BIGNUM * x_bn;
+	BIGNUM * m_bn;
+	BN_CTX * ctx;
+};
+
+/* Compute ${r} = ${a}^(2^258 + x) mod p as crypto_dh does, but unblinded. */
+static int
+unblinded_modexp(struct handshake * H, const BIGNUM * a,
+    uint8_t r[CRYPTO_DH_PUBLEN])
+{
+	BIGNUM * r_bn;
+	int rlen;
+
+	/* Allocate space for the result. */
+	if ((r_bn = BN_new()) == NULL) {
+		warn0("%s", ERR_error_string(ERR_get_error(), NULL));
+		goto err0;
+	}
+
+	/* Perform the modular exponentiation. */
+	if (!BN_mod_exp(r_bn, a, H->x_bn, H->m_bn, H->ctx)) {
+		warn0("%s", ERR_error_string(ERR_get_error(), NULL));
+		goto err1;
+	}
+
+	/* Export to big-endian integer format. */
+	rlen = BN_num_bytes(r_bn);
+	if ((rlen < 0) || (rlen > CRYPTO_DH_PUBLEN)) {
+		warn0("Unexpected error in OpenSSL");
+		goto err1;
+	}
+	memset(r, 0, CRYPTO_DH_PUBLEN - (size_t)rlen);
+	BN_bn2bin(r_bn, &r[CRYPTO_DH_PUBLEN - (size_t)rlen]);
+
+	/* Clean up. */
+	BN_clear_free(r_bn);
+
+	/* Success! */
+	return (0);
+
+err1:
+	BN_clear_free(r_bn);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+dh_generate_func(void * cookie, size_t nops)
+{
+	uint8_t pub[CRYPTO_DH_PUBLEN];
+	uint8_t priv[CRYPTO_DH_PRIVLEN];
+	size_t i;
+
+	(void)cookie; /* UNUSED */
+
+	/* Generate a new key pair each time, as a handshake does. */
+	for (i = 0; i < nops; i++) {
+		if (crypto_dh_generate(pub, priv))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+dh_generate_pub_func(void * cookie, size_t nops)
+{
+	struct handshake * H = cookie;
+	uint8_t pub[CRYPTO_DH_PUBLEN];
+	size_t i;
+
+	/* Compute 2^(2^258 + x) with blinding. */
+	for (i = 0; i < nops; i++) {
+		if (crypto_dh_generate_pub(pub, H->x))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+dh_generate_pub_unblinded_func(void * cookie, size_t nops)
+{
+	struct handshake * H = cookie;
+	uint8_t pub[CRYPTO_DH_PUBLEN];
+	size_t i;
+
+	/* Compute 2^(2^258 + x) without blinding. */
+	for (i = 0; i < nops; i++) {
+		if (unblinded_modexp(H, H->two_bn, pub))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+dh_compute_func(void * cookie, size_t nops)
+{
+	struct handshake * H = cookie;
+	uint8_t key[CRYPTO_DH_KEYLEN];
+	size_t i;
+
+	/* Compute y_r^(2^258 + x) with blinding. */
+	for (i = 0; i < nops; i++) {
+		if (crypto_dh_compute(H->yh_r, H->x, key))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+dh_compute_unblinded_func(void * cookie, size_t nops)
+{
+	struct handshake * H = cookie;
+	uint8_t key[CRYPTO_DH_KEYLEN];
+	size_t i;
+
+	/* Compute y_r^(2^258 + x) without blinding. */
+	for (i = 0; i < nops; i++) {
+		if (unblinded_modexp(H, H->y_r_bn, key))
+			goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+dh_sanitycheck_func(void * cookie, size_t nops)
+{
+	struct handshake * H = cookie;
+	size_t i;
+
+	/* Check the remote public value. */
+	for (i = 0; i < nops; i++) {
+		if (crypto_dh_sanitycheck(H->yh_r)) {
+			warn0("Public value is insane");
+			goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+dhmac_func(void * cookie, size_t nops)
+{
+	struct handshake * H = cookie;
+	uint8_t dhmac_l[PCRYPT_DHMAC_LEN];
+	uint8_t dhmac_r[PCRYPT_DHMAC_LEN];
+	size_t i;
+
+	/* Compute the MAC keys with PBKDF2_SHA256. */
+	for (i = 0; i < nops; i++)
+		proto_crypt_dhmac(H->K, H->nonce_l, H->nonce_r, dhmac_l,
+		    dhmac_r, 0);
+
+	/* Success! */
+	return (0);
+}
+
+static int
+dh_validate_func(void * cookie, size_t nops)
+{
+	struct handshake * H = cookie;
+	size_t i;
+
+	/* Check the MAC and the public value. */
+	for (i = 0; i < nops; i++) {
+		if (proto_crypt_dh_validate(H->yh_r, H->dhmac_r, 1)) {
+			warn0("Public value is not valid");
+			goto err0;
+		}
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+mkkeys_func(void * cookie, size_t nops)
+{
+	struct handshake * H = cookie;
+	struct proto_keys * eh_c;
+	struct proto_keys * eh_s;
+	size_t i;
+
+	/* Compute the session keys, and throw them away. */
+	for (i = 0; i < nops; i++) {
+		if (proto_crypt_mkkeys(H->K, H->nonce_l, H->nonce_r, H->yh_r,
+		    H->x, H->nopfs, 0, &eh_c, &eh_s))
+			goto err0;
+		proto_crypt_free(eh_s);
+		proto_crypt_free(eh_c);
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Set up the handshake state and unblinded exponentiation parameters. */
+static int
+handshake_setup(struct handshake * H)
+{
+	uint8_t pub[CRYPTO_DH_PUBLEN];
+	uint8_t x_r[PCRYPT_X_LEN];
+
+	/* The key doesn't affect timings, so an empty key file will do. */
+	if ((H->K = proto_crypt_secret("/dev/null")) == NULL)
+		goto err0;
+
+	/* Fixed nonces, and the MAC keys derived from them. */
+	memset(H->nonce_l, 0x01, PCRYPT_NONCE_LEN);
+	memset(H->nonce_r, 0x02, PCRYPT_NONCE_LEN);
+	proto_crypt_dhmac(H->K, H->nonce_l, H->nonce_r, H->dhmac_l,
+	    H->dhmac_r, 0);
+
+	/* Our private value, and the remote party's MACed public value. */
+	if (crypto_dh_generate(pub, H->x))
+		goto err1;
+	if (proto_crypt_dh_generate(H->yh_r, x_r, H->dhmac_r, 0))
+		goto err1;
+
+	/* Allocate BN context. */
+	if ((H->ctx = BN_CTX_new()) == NULL) {
+		warn0("%s", ERR_error_string(ERR_get_error(), NULL));
+		goto err1;
+	}
+
+	/* Construct group #14 modulus in BN representation. */
+	if ((H->m_bn = BN_bin2bn(crypto_dh_group14, 256, NULL)) == NULL) {
+		warn0("%s", ERR_error_string(ERR_get_error(), NULL));
+		goto err2;
+	}
+
+	/* Construct 2^258 + x in BN representation. */
+	if ((H->x_bn = BN_bin2bn(H->x, PCRYPT_X_LEN, NULL)) == NULL) {
+		warn0("%s", ERR_error_string(ERR_get_error(), NULL));
+		goto err3;
+	}
+	if (!BN_set_bit(H->x_bn, 258)) {
+		warn0("%s", ERR_error_string(ERR_get_error(), NULL));
+		goto err4;
+	}
+
+	/* Construct the bases 2 and y_r in BN representation. */
+	if ((H->two_bn = BN_new()) == NULL) {
+		warn0("%s", ERR_error_string(ERR_get_error(), NULL));
+		goto err4;
+	}
+	if (!BN_set_word(H->two_bn, 2)) {
+		warn0("%s", ERR_error_string(ERR_get_error(), NULL));
+		goto err5;
+	}
+	if ((H->y_r_bn = BN_bin2bn(H->yh_r, CRYPTO_DH_PUBLEN,
+	    NULL)) == NULL) {
+		warn0("%s", ERR_error_string(ERR_get_error(), NULL));
+		goto err5;
+	}
+
+	/* Success! */
+	return (0);
+
+err5:
+	BN_free(H->two_bn);
+err4:
+	BN_clear_free(H->x_bn);
+err3:
+	BN_free(H->m_bn);
+err2:
+	BN_CTX_free(H->ctx);
+err1:
+	proto_crypt_secret_free(H->K);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Free the handshake state. */
+static void
+handshake_free(struct handshake * H)
+{
+
+	BN_free(H->y_r_bn);
+	BN_free(H->two_bn);
+	BN_clear_free(H->x_bn);
+	BN_free(H->m_bn);
+	BN_CTX_free(H->ctx);
+	proto_crypt_secret_free(H->K);
+}
+
+/* Report what we're doing, and time ${func}. */
+static int
+handshake_time(const char * name, size_t nops,
+    int func(void * cookie, size_t nops), struct handshake * H)
+{
+
+	/* Report what we're doing. */
+	perftest_name("%s", name);
+
+	/* Time the function. */
+	if (perftest_ops(nops, nops / 10, NULL, func, NULL, H)) {
+		warn0("perftest_ops");
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * handshake_perftest(nops_perftest):
+ * Performance test for the cryptographic operations in a handshake: timing
+ * ${nops_perftest} of each Diffie-Hellman operation, with and without
+ * blinding, and 1000 times as many of each other operation.
+ */
+int
+handshake_perftest(size_t nops_perftest)
+{
+	struct handshake H_actual;
+	struct handshake * H = &H_actual;
+	size_t nops_cheap = nops_perftest * CHEAP_MULT;
+
+	/* Set up. */
+	if (handshake_setup(H))
+		goto err0;
+
+	/* Diffie-Hellman computations. */
+	if (handshake_time("crypto_dh_generate()", nops_perftest,
+	    dh_generate_func, H))
+		goto err1;
+	if (handshake_time("crypto_dh_generate_pub() with blinding",
+	    nops_perftest, dh_generate_pub_func, H))
+		goto err1;
+	if (handshake_time("crypto_dh_generate_pub() without blinding",
+	    nops_perftest, dh_generate_pub_unblinded_func, H))
+		goto err1;
+	if (handshake_time("crypto_dh_compute() with blinding",
+	    nops_perftest, dh_compute_func, H))
+		goto err1;
+	if (handshake_time("crypto_dh_compute() without blinding",
+	    nops_perftest, dh_compute_unblinded_func, H))
+		goto err1;
+
+	/* Checks and key derivation. */
+	if (handshake_time("crypto_dh_sanitycheck()", nops_cheap,
+	    dh_sanitycheck_func, H))
+		goto err1;
+	if (handshake_time("proto_crypt_dh_validate()", nops_cheap,
+	    dh_validate_func, H))
+		goto err1;
+	if (handshake_time("proto_crypt_dhmac() (PBKDF2_SHA256)", nops_cheap,
+	    dhmac_func, H))
+		goto err1;
+	H->nopfs = 1;
+	if (handshake_time("proto_crypt_mkkeys() without PFS", nops_cheap,
+	    mkkeys_func, H))
+		goto err1;
+	H->nopfs = 0;
+	if (handshake_time("proto_crypt_mkkeys()", nops_perftest,
+	    mkkeys_func, H))
+		goto err1;
+
+	/* Clean up. */
+	handshake_free(H);
+
+	/* Success! */
+	return (0);
+
+err1:
+	handshake_free(H);
+err0:
+	/* Failure! */
+	return (1);
+}
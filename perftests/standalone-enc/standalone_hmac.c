@@ -50,6 +50,98 @@ hmac_func(void * cookie, uint8_t * buf, size_t buflen, size_t nreps)
 	return (0);
 }
 
+/* Cookie for per-packet HMAC tests. */
+struct hmac_packet {
+	HMAC_SHA256_CTX ctx_init;
+	HMAC_SHA256_MIDSTATE mctx;
+	uint8_t lastblock[64];
+};
+
+static int
+hmac_packet_init(void * cookie, uint8_t * buf, size_t buflen)
+{
+	struct hmac_packet * hp = cookie;
+	uint8_t kbuf[32];
+	size_t msglen;
+	size_t i;
+
+	/* The fixed-length path needs the final block to hold the padding. */
+	msglen = 64 + buflen + 8;
+	if (msglen % 64 >= 56) {
+		warn0("Buffer size %zu not supported", buflen);
+		goto err0;
+	}
+
+	/* (Re-)Initialize the context and midstates. */
+	memset(kbuf, 0, 32);
+	HMAC_SHA256_Init(&hp->ctx_init, kbuf, 32);
+	HMAC_SHA256_Midstate_Init(&hp->mctx, kbuf, 32);
+
+	/*
+	 * Build the padding for the final block, as SHA256_PADBLOCK() would
+	 * if the buffer size was known at compile time.
+	 */
+	memset(hp->lastblock, 0, 64);
+	hp->lastblock[msglen % 64] = 0x80;
+	be64enc(&hp->lastblock[56], (uint64_t)msglen * 8);
+
+	/* Set the input. */
+	for (i = 0; i < buflen; i++)
+		buf[i] = (uint8_t)(i & 0xff);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+hmac_packet_generic_func(void * cookie, uint8_t * buf, size_t buflen,
+    size_t nreps)
+{
+	struct hmac_packet * hp = cookie;
+	HMAC_SHA256_CTX ctx;
+	uint8_t hbuf[32];
+	uint8_t pnum_exp[8];
+	size_t i;
+
+	/* HMAC each buffer separately, starting from a copied context. */
+	for (i = 0; i < nreps; i++) {
+		memcpy(&ctx, &hp->ctx_init, sizeof(HMAC_SHA256_CTX));
+		be64enc(pnum_exp, i);
+		HMAC_SHA256_Update(&ctx, buf, buflen);
+		HMAC_SHA256_Update(&ctx, pnum_exp, 8);
+		HMAC_SHA256_Final(hbuf, &ctx);
+	}
+
+	/* Success! */
+	return (0);
+}
+
+static int
+hmac_packet_fixed_func(void * cookie, uint8_t * buf, size_t buflen,
+    size_t nreps)
+{
+	struct hmac_packet * hp = cookie;
+	uint8_t hbuf[32];
+	size_t nblocks = buflen / 64;
+	size_t tail = buflen % 64;
+	size_t i;
+
+	/* HMAC each buffer separately, hashing full blocks in place. */
+	for (i = 0; i < nreps; i++) {
+		memcpy(hp->lastblock, &buf[nblocks * 64], tail);
+		be64enc(&hp->lastblock[tail], i);
+		HMAC_SHA256_Midstate_Final(hbuf, &hp->mctx, buf, nblocks,
+		    hp->lastblock);
+	}
+
+	/* Success! */
+	return (0);
+}
+
 /**
  * hmac_perftest(perfsizes, num_perf, nbytes_perftest, nbytes_warmup):
  * Performance test for HMAC-SHA256.
@@ -59,9 +151,10 @@ hmac_perftest(const size_t * perfsizes, size_t num_perf,
     size_t nbytes_perftest, size_t nbytes_warmup)
 {
 	HMAC_SHA256_CTX ctx;
+	struct hmac_packet hp;
 
 	/* Report what we're doing. */
-	printf("Testing HMAC_SHA256 with iteration numbers\n");
+	perftest_name("HMAC_SHA256 with iteration numbers");
 
 	/* Time the function. */
 	if (perftest_buffers(nbytes_perftest, perfsizes, num_perf,
@@ -70,6 +163,28 @@ hmac_perftest(const size_t * perfsizes, size_t num_perf,
 		goto err0;
 	}
 
+	/* Report what we're doing. */
+	perftest_name("per-packet HMAC_SHA256 with generic updates");
+
+	/* Time the function. */
+	if (perftest_buffers(nbytes_perftest, perfsizes, num_perf,
+	    nbytes_warmup, 0, hmac_packet_init, hmac_packet_generic_func,
+	    NULL, &hp)) {
+		warn0("perftest_buffers");
+		goto err0;
+	}
+
+	/* Report what we're doing. */
+	perftest_name("per-packet HMAC_SHA256 with fixed-length midstates");
+
+	/* Time the function. */
+	if (perftest_buffers(nbytes_perftest, perfsizes, num_perf,
+	    nbytes_warmup, 0, hmac_packet_init, hmac_packet_fixed_func,
+	    NULL, &hp)) {
+		warn0("perftest_buffers");
+		goto err0;
+	}
+
 	/* Success! */
 	return (0);
 
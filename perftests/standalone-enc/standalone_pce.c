@@ -45,11 +45,17 @@ pce_func(void * cookie, uint8_t * buf, size_t buflen, size_t nreps)
 	size_t i;
 
 	/* Encrypt a bunch of times. */
-	for (i = 0; i < nreps; i++)
-		proto_crypt_enc(buf, buflen, encbuf, pce->k);
+	for (i = 0; i < nreps; i++) {
+		if (proto_crypt_enc(buf, buflen, encbuf, pce->k))
+			goto err0;
+	}
 
 	/* Success! */
 	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
 }
 
 static int
@@ -76,7 +82,7 @@ pce_perftest(const size_t * perfsizes, size_t num_perf,
 	struct pce * pce = &pce_actual;
 
 	/* Report what we're doing. */
-	printf("Testing proto_crypt_enc()\n");
+	perftest_name("proto_crypt_enc()");
 
 	/* Time the function. */
 	if (perftest_buffers(nbytes_perftest, perfsizes, num_perf,
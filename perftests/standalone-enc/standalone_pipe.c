@@ -217,7 +217,7 @@ pipe_perftest(const size_t * perfsizes, size_t num_perf,
 	struct pipe pipe_actual;
 
 	/* Report what we're doing. */
-	printf("Testing proto_pipe()\n");
+	perftest_name("proto_pipe()");
 
 	/* Time the function. */
 	if (perftest_buffers(nbytes_perftest, perfsizes, num_perf,
@@ -0,0 +1,111 @@
+#!/bin/sh
+
+# Measure end-to-end throughput through an encrypting and a decrypting spiped
+# on loopback:
+#
+#   send-zeros -> spiped -e -> spiped -d -> recv-zeros
+#
+# Report the aggregate throughput, how fairly it was shared between the
+# streams, the worst per-stream jitter, and for each spiped the CPU time spent
+# per GB transferred and (if perf(1) is available and permitted) the number
+# of system calls made per MB transferred.
+
+set -e -o noclobber -o nounset
+
+usage() {
+	echo "usage: $0 [-b <buffer size>] [-n <streams>] [-t <seconds>]" 1>&2
+	echo "    [-r <MB/s per stream>] [-E <spiped -e flags>]" 1>&2
+	echo "    [-D <spiped -d flags>]" 1>&2
+	exit 1
+}
+
+### Find script directory and load helper functions.
+scriptdir=$(CDPATH='' cd -- "$(dirname -- "$0")" && pwd -P)
+. "${scriptdir}/shared_perftest_functions.sh"
+
+# Defaults.
+bufsize=65536
+nstreams=1
+seconds=10
+mbps=0
+flags_e=""
+flags_d=""
+
+# Parse command line.
+while getopts "b:D:E:n:r:t:" opt; do
+	case ${opt} in
+	b)	bufsize=${OPTARG} ;;
+	D)	flags_d=${OPTARG} ;;
+	E)	flags_e=${OPTARG} ;;
+	n)	nstreams=${OPTARG} ;;
+	r)	mbps=${OPTARG} ;;
+	t)	seconds=${OPTARG} ;;
+	*)	usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+if [ "$#" -ne 0 ]; then
+	usage
+fi
+
+# Set up the tunnel and the traffic sink.
+perftest_setup
+"${recv_zeros_binary}" "${dst_sock}" "${bufsize}" "${nstreams}" &
+recv_pid=$!
+spiped_start "${flags_e}" "${flags_d}"
+
+# Start measuring.
+cpu_e_begin=$(cputime "${spiped_e_pid}")
+cpu_d_begin=$(cputime "${spiped_d_pid}")
+syscalls_start "${spiped_e_pid}" spiped-e
+syscalls_start "${spiped_d_pid}" spiped-d
+
+# Send data until time runs out (or we've sent a petabyte).
+count=$((1000000000000000 / bufsize))
+if ! "${send_zeros_binary}" "${src_sock}" "${bufsize}" "${count}"	\
+    "${seconds}" "${nstreams}" "${mbps}" > "${out}/send.txt"; then
+	echo "send-zeros failed" 1>&2
+	exit 1
+fi
+
+# Stop measuring.
+syscalls_e=$(syscalls_stop spiped-e)
+syscalls_d=$(syscalls_stop spiped-d)
+cpu_e_end=$(cputime "${spiped_e_pid}")
+cpu_d_end=$(cputime "${spiped_d_pid}")
+cpu_e=$(awk "BEGIN { print ${cpu_e_end} - ${cpu_e_begin} }")
+cpu_d=$(awk "BEGIN { print ${cpu_d_end} - ${cpu_d_begin} }")
+if ! wait "${recv_pid}"; then
+	echo "recv-zeros failed" 1>&2
+	exit 1
+fi
+
+# For each stream send-zeros prints: buffer size, buffers sent, seconds,
+# MB/s, and jitter in MB/s.
+awk								\
+    -v nstreams="${nstreams}" -v bufsize="${bufsize}"		\
+    -v cpu_e="${cpu_e}" -v cpu_d="${cpu_d}"				\
+    -v sys_e="${syscalls_e}" -v sys_d="${syscalls_d}" '
+	function persyscall(n) {
+		return (n == "-") ? "-" : sprintf("%.0f", n / (bytes / 1e6))
+	}
+	$1 != "total" {
+		bytes += $1 * $2
+		if ($3 > secs)
+			secs = $3
+		sum += $4
+		sumsq += $4 * $4
+		if ($5 > jitter)
+			jitter = $5
+	}
+	END {
+		printf("streams: %d, buffer size: %d, duration: %.2f s\n",
+		    nstreams, bufsize, secs)
+		printf("throughput: %.3f Gbit/s\n", bytes * 8 / secs / 1e9)
+		printf("fairness: %.4f, max jitter: %.2f MB/s\n",
+		    (sumsq > 0) ? sum * sum / (nstreams * sumsq) : 1, jitter)
+		printf("spiped -e: %.3f CPU-s/GB, %s syscalls/MB\n",
+		    cpu_e / (bytes / 1e9), persyscall(sys_e))
+		printf("spiped -d: %.3f CPU-s/GB, %s syscalls/MB\n",
+		    cpu_d / (bytes / 1e9), persyscall(sys_d))
+	}' "${out}/send.txt"
@@ -0,0 +1,345 @@
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "events.h"
+#include "monoclock.h"
+#include "mpscq.h"
+#include "parsenum.h"
+#include "warnp.h"
+
+/*
+ * Hand items from producer threads to the event loop, either via a
+ * lock-free queue and a coalescing wakeup, or via a mutex-protected list
+ * and a byte written to a socketpair for each item (as dnsthread does).
+ */
+
+/* An item being handed off. */
+struct item {
+	struct mpscq_node node;
+	size_t producer;
+	size_t seq;
+};
+
+/* A producer thread. */
+struct producer {
+	pthread_t thr;
+	struct item * items;
+};
+
+/* Shared state. */
+static int use_mpscq;
+static size_t nproducers;
+static size_t nitems;
+static struct producer * producers;
+static size_t * nextseq;
+static size_t nreceived;
+static size_t nwakeups;
+static int done;
+
+/* mpscq method. */
+static struct mpscq * Q;
+static void * W;
+
+/* socketpair method. */
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct mpscq_node * list_head;
+static struct mpscq_node ** list_tail = &list_head;
+static int s[2];
+
+/* Hand off one item. */
+static int
+handoff(struct item * I)
+{
+	char c = 0;
+	int rc;
+
+	/* Lock-free queue and a wakeup if the queue was empty. */
+	if (use_mpscq) {
+		if (mpscq_push(Q, &I->node) && events_wakeup_signal(W))
+			goto err0;
+		goto done;
+	}
+
+	/* Append to the list. */
+	if ((rc = pthread_mutex_lock(&mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		goto err0;
+	}
+	I->node.next = NULL;
+	*list_tail = &I->node;
+	list_tail = &I->node.next;
+	if ((rc = pthread_mutex_unlock(&mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		goto err0;
+	}
+
+	/* Poke the event loop. */
+	if (write(s[1], &c, 1) != 1) {
+		warnp("write");
+		goto err0;
+	}
+
+done:
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Producer thread. */
+static void *
+workthread(void * cookie)
+{
+	struct producer * P = cookie;
+	size_t i;
+
+	/* Hand off all of our items. */
+	for (i = 0; i < nitems; i++) {
+		if (handoff(&P->items[i]))
+			exit(1);
+	}
+
+	/* We're done. */
+	return (NULL);
+}
+
+/* Check and count a list of received items. */
+static int
+consume(struct mpscq_node * node)
+{
+	struct item * I;
+
+	/* We've been woken up. */
+	nwakeups++;
+
+	/* Process each item. */
+	for (; node != NULL; node = node->next) {
+		I = (struct item *)node;
+
+		/* Items from each producer must arrive in order. */
+		if (I->seq != nextseq[I->producer]) {
+			warn0("Producer %zu: received item %zu, expected %zu",
+			    I->producer, I->seq, nextseq[I->producer]);
+			goto err0;
+		}
+		nextseq[I->producer]++;
+		nreceived++;
+	}
+
+	/* Are we finished? */
+	if (nreceived == nproducers * nitems)
+		done = 1;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Callback for the mpscq method. */
+static int
+callback_wakeup(void * cookie)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* Take everything in the queue. */
+	return (consume(mpscq_drain(Q)));
+}
+
+/* Callback for the socketpair method. */
+static int
+callback_read(void * cookie)
+{
+	struct mpscq_node * node;
+	char buf[4096];
+	int rc;
+
+	(void)cookie; /* UNUSED */
+
+	/* Read the pokes; there is at least one. */
+	if (read(s[0], buf, sizeof(buf)) == -1) {
+		warnp("read");
+		goto err0;
+	}
+
+	/* Take the list. */
+	if ((rc = pthread_mutex_lock(&mtx)) != 0) {
+		warn0("pthread_mutex_lock: %s", strerror(rc));
+		goto err0;
+	}
+	node = list_head;
+	list_head = NULL;
+	list_tail = &list_head;
+	if ((rc = pthread_mutex_unlock(&mtx)) != 0) {
+		warn0("pthread_mutex_unlock: %s", strerror(rc));
+		goto err0;
+	}
+
+	/* Wait for more pokes. */
+	if (events_network_register(callback_read, NULL, s[0],
+	    EVENTS_NETWORK_OP_READ)) {
+		warnp("events_network_register");
+		goto err0;
+	}
+
+	/* Process the items, if any. */
+	if (node == NULL)
+		return (0);
+	return (consume(node));
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+	struct timeval begin, end;
+	double delta;
+	size_t i, j;
+	int rc;
+
+	WARNP_INIT;
+
+	/* Parse command-line arguments. */
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s {mpscq | socketpair} NTHREADS"
+		    " NITEMS\n", argv[0]);
+		goto err0;
+	}
+	if (strcmp(argv[1], "mpscq") == 0)
+		use_mpscq = 1;
+	else if (strcmp(argv[1], "socketpair") == 0)
+		use_mpscq = 0;
+	else {
+		warn0("Unknown method: %s", argv[1]);
+		goto err0;
+	}
+	if (PARSENUM(&nproducers, argv[2], 1, 1024)) {
+		warnp("parsenum");
+		goto err0;
+	}
+	if (PARSENUM(&nitems, argv[3], 1, SIZE_MAX / nproducers /
+	    sizeof(struct item))) {
+		warnp("parsenum");
+		goto err0;
+	}
+
+	/* Allocate producers, items, and sequence numbers. */
+	if ((producers = malloc(nproducers * sizeof(struct producer))) == NULL)
+		goto err0;
+	if ((nextseq = calloc(nproducers, sizeof(size_t))) == NULL)
+		goto err1;
+	for (i = 0; i < nproducers; i++) {
+		if ((producers[i].items =
+		    malloc(nitems * sizeof(struct item))) == NULL)
+			goto err2;
+		for (j = 0; j < nitems; j++) {
+			producers[i].items[j].producer = i;
+			producers[i].items[j].seq = j;
+		}
+	}
+
+	/* Set up the handoff mechanism. */
+	if (use_mpscq) {
+		if ((Q = mpscq_init()) == NULL) {
+			warnp("mpscq_init");
+			goto err2;
+		}
+		if ((W = events_wakeup_register(callback_wakeup, NULL)) ==
+		    NULL) {
+			warnp("events_wakeup_register");
+			goto err2;
+		}
+	} else {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, s)) {
+			warnp("socketpair");
+			goto err2;
+		}
+		if (events_network_register(callback_read, NULL, s[0],
+		    EVENTS_NETWORK_OP_READ)) {
+			warnp("events_network_register");
+			goto err2;
+		}
+	}
+
+	/* Start the clock. */
+	if (monoclock_get(&begin)) {
+		warnp("monoclock_get");
+		goto err2;
+	}
+
+	/* Start the producers. */
+	for (i = 0; i < nproducers; i++) {
+		if ((rc = pthread_create(&producers[i].thr, NULL, workthread,
+		    &producers[i])) != 0) {
+			warn0("pthread_create: %s", strerror(rc));
+			goto err2;
+		}
+	}
+
+	/* Consume items until we have all of them. */
+	if (events_spin(&done)) {
+		warnp("events_spin");
+		goto err2;
+	}
+
+	/* Stop the clock. */
+	if (monoclock_get(&end)) {
+		warnp("monoclock_get");
+		goto err2;
+	}
+
+	/* Wait for the producers to exit. */
+	for (i = 0; i < nproducers; i++) {
+		if ((rc = pthread_join(producers[i].thr, NULL)) != 0) {
+			warn0("pthread_join: %s", strerror(rc));
+			goto err2;
+		}
+	}
+
+	/* Report the results. */
+	delta = timeval_diff(begin, end);
+	printf("%s: %zu items from %zu threads in %.6f s:"
+	    " %.0f items/s, %zu wakeups\n", argv[1], nreceived, nproducers,
+	    delta, (double)nreceived / delta, nwakeups);
+
+	/* Clean up. */
+	if (use_mpscq) {
+		events_wakeup_cancel(W);
+		mpscq_free(Q);
+	} else {
+		events_network_cancel(s[0], EVENTS_NETWORK_OP_READ);
+		close(s[1]);
+		close(s[0]);
+	}
+	for (i = 0; i < nproducers; i++)
+		free(producers[i].items);
+	free(nextseq);
+	free(producers);
+
+	/* Success! */
+	exit(0);
+
+err2:
+	/* The process is exiting, so don't bother stopping the threads. */
+	free(nextseq);
+err1:
+	free(producers);
+err0:
+	/* Failure! */
+	exit(1);
+}
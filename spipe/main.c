@@ -18,6 +18,7 @@
 
 #include "proto_conn.h"
 #include "proto_crypt.h"
+#include "proto_crypt_engine.h"
 
 #include "pushbits.h"
 
@@ -116,7 +117,9 @@ usage(void)
 	fprintf(stderr,
 	    "usage: spipe -t <target socket> -k <key file> [-b <bind address>]"
 	    " [-f | -g] [-j]\n"
-	    "    [-o <connection timeout>]\n"
+	    "    [-E <engine>] [-o <connection timeout>]\n"
+	    "    [--bufsize <bytes>] [--bdp-rate <bytes/s>] "
+	    "[--connect-delay <seconds>]\n"
 	    "       spipe -v\n");
 	exit(1);
 }
@@ -132,6 +135,13 @@ main(int argc, char * argv[])
 {
 	/* Command-line parameters. */
 	const char * opt_b = NULL;
+	int opt_bdp_rate_set = 0;
+	size_t opt_bdp_rate = 0;
+	int opt_bufsize_set = 0;
+	size_t opt_bufsize = 0;
+	int opt_connect_delay_set = 0;
+	double opt_connect_delay = 0.0;
+	const char * opt_E = NULL;
 	int opt_f = 0;
 	int opt_g = 0;
 	int opt_j = 0;
@@ -147,6 +157,7 @@ main(int argc, char * argv[])
 	struct sock_addr ** sas_b = NULL;
 	struct sock_addr ** sas_t;
 	struct proto_secret * K;
+	const struct proto_crypt_engine * E;
 	const char * ch;
 	int s[2];
 	void * conn_cookie;
@@ -162,6 +173,32 @@ main(int argc, char * argv[])
 				usage();
 			opt_b = optarg;
 			break;
+		GETOPT_OPTARG("--bdp-rate"):
+			if (opt_bdp_rate_set)
+				usage();
+			opt_bdp_rate_set = 1;
+			if (PARSENUM(&opt_bdp_rate, optarg))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("--bufsize"):
+			if (opt_bufsize_set)
+				usage();
+			opt_bufsize_set = 1;
+			if (PARSENUM(&opt_bufsize, optarg))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("--connect-delay"):
+			if (opt_connect_delay_set)
+				usage();
+			opt_connect_delay_set = 1;
+			if (PARSENUM(&opt_connect_delay, optarg, 0, INFINITY))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("-E"):
+			if (opt_E)
+				usage();
+			opt_E = optarg;
+			break;
 		GETOPT_OPT("-f"):
 			if (opt_f)
 				usage();
@@ -227,6 +264,26 @@ main(int argc, char * argv[])
 	if (opt_t == NULL)
 		usage();
 
+	/* RFC 8305 says attempts must be at least 10 ms apart. */
+	if ((opt_connect_delay > 0.0) && (opt_connect_delay < 0.01))
+		usage();
+
+	/* Select the packet encryption engine (if applicable). */
+	if (opt_E != NULL) {
+		if ((E = proto_crypt_engine_lookup(opt_E)) == NULL) {
+			warn0("Unknown encryption engine: %s", opt_E);
+			usage();
+		}
+		proto_crypt_engine_select(E);
+	}
+
+	/* Set socket buffer sizes for the connection to the target. */
+	proto_conn_sockbufs(0, opt_bufsize, opt_bdp_rate);
+
+	/* Set the delay between attempts to connect to target addresses. */
+	if (opt_connect_delay_set)
+		proto_conn_connect_delay(opt_connect_delay);
+
 	/* Initialize the "events & threads" cookie. */
 	ET.conndone = 0;
 	ET.connection_error = 0;
@@ -279,7 +336,7 @@ main(int argc, char * argv[])
 
 	/* Set up a connection. */
 	if ((conn_cookie = proto_conn_create(s[1], sas_t, sa_b, 0, opt_f, opt_g,
-	    opt_j, K, opt_o, callback_conndied, &ET)) == NULL) {
+	    opt_j, K, opt_o, NULL, callback_conndied, &ET)) == NULL) {
 		warnp("Could not set up connection");
 		goto err4;
 	}
@@ -0,0 +1,524 @@
+#include <sys/time.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "monoclock.h"
+#include "sock.h"
+#include "sock_util.h"
+#include "warnp.h"
+
+#include "balance.h"
+
+/* Maximum number of doublings of the ejection time. */
+#define EJECT_MAXSHIFT 5
+
+/* A target address. */
+struct balance_target {
+	struct sock_addr * sa;
+	size_t refcount;	/* Balancer (if listed) + connections. */
+	size_t nconn;		/* Connections charged to this address. */
+	unsigned int nfails;	/* Consecutive failures. */
+	struct timeval eject_until;
+};
+
+struct balance {
+	int policy;
+	double ejecttime;
+	struct balance_target ** targets;
+	size_t ntargets;
+	size_t next;
+	uint64_t rng;
+};
+
+struct balance_conn {
+	struct balance * B;
+	struct balance_target ** targets;
+	size_t ntargets;
+	struct balance_target * charged;
+	int connected;
+};
+
+/* Policy names. */
+static const struct {
+	const char * name;
+	int policy;
+} policies[] = {
+	{ "first", BALANCE_FIRST },
+	{ "rr", BALANCE_RR },
+	{ "leastconn", BALANCE_LEASTCONN },
+	{ "p2c", BALANCE_P2C },
+	{ NULL, -1 }
+};
+
+/* Drop a reference to ${T}, and free it if that was the last one. */
+static void
+target_release(struct balance_target * T)
+{
+
+	/* Drop the reference. */
+	assert(T->refcount > 0);
+	if (--T->refcount > 0)
+		return;
+
+	/* Free the target. */
+	sock_addr_free(T->sa);
+	free(T);
+}
+
+/* Is the target ${T} ejected at time ${tv}? */
+static int
+target_ejected(const struct balance_target * T, const struct timeval * tv)
+{
+
+	return ((T->nfails > 0) && (timeval_diff((*tv), T->eject_until) > 0));
+}
+
+/* Record that a connection attempt to ${T} failed. */
+static void
+target_failed(struct balance * B, struct balance_target * T)
+{
+	unsigned int shift;
+	double ejecttime;
+	struct timeval tv;
+
+	/* Back off exponentially if the address keeps failing. */
+	shift = (T->nfails < EJECT_MAXSHIFT) ? T->nfails : EJECT_MAXSHIFT;
+	ejecttime = B->ejecttime * (double)(1 << shift);
+	if (T->nfails <= EJECT_MAXSHIFT)
+		T->nfails++;
+
+	/* Eject the address until then; if we can't tell the time, don't. */
+	if (monoclock_get(&tv)) {
+		warnp("monoclock_get");
+		T->nfails = 0;
+		return;
+	}
+	T->eject_until.tv_sec = tv.tv_sec + (time_t)ejecttime;
+	T->eject_until.tv_usec = tv.tv_usec + (suseconds_t)((ejecttime -
+	    (double)(time_t)ejecttime) * 1000000.0);
+	if (T->eject_until.tv_usec >= 1000000) {
+		T->eject_until.tv_sec += 1;
+		T->eject_until.tv_usec -= 1000000;
+	}
+}
+
+/* Return a pseudo-random number less than ${n}. */
+static size_t
+rng_uniform(struct balance * B, size_t n)
+{
+
+	/* Advance the xorshift64 generator. */
+	B->rng ^= B->rng << 13;
+	B->rng ^= B->rng >> 7;
+	B->rng ^= B->rng << 17;
+
+	/* Modulo bias is irrelevant for load balancing. */
+	return ((size_t)(B->rng % n));
+}
+
+/* Return the index of the ${k}-th target which is not ${ejected}. */
+static size_t
+nth_avail(const int * ejected, size_t k)
+{
+	size_t i;
+
+	/* Skip ejected targets, and count the others. */
+	for (i = 0; ejected[i] || (k-- > 0); i++)
+		continue;
+
+	/* Return the index. */
+	return (i);
+}
+
+/* Choose a target among the ${navail} which are not ${ejected}. */
+static size_t
+choose(struct balance * B, const int * ejected, size_t navail)
+{
+	size_t a, b;
+	size_t i, j;
+
+	switch (B->policy) {
+	case BALANCE_RR:
+		/* The next available target after the last one we chose. */
+		for (a = i = 0; i < B->ntargets; i++) {
+			a = (B->next + i) % B->ntargets;
+			if (!ejected[a])
+				break;
+		}
+		break;
+	case BALANCE_LEASTCONN:
+		/* Fewest connections; break ties in round-robin order. */
+		a = SIZE_MAX;
+		for (i = 0; i < B->ntargets; i++) {
+			j = (B->next + i) % B->ntargets;
+			if (ejected[j])
+				continue;
+			if ((a == SIZE_MAX) ||
+			    (B->targets[j]->nconn < B->targets[a]->nconn))
+				a = j;
+		}
+		break;
+	case BALANCE_P2C:
+		/* Pick two different targets at random. */
+		a = rng_uniform(B, navail);
+		if (navail == 1)
+			return (nth_avail(ejected, a));
+		b = rng_uniform(B, navail - 1);
+		if (b >= a)
+			b++;
+		a = nth_avail(ejected, a);
+		b = nth_avail(ejected, b);
+
+		/* Use the one with fewer connections. */
+		if (B->targets[b]->nconn < B->targets[a]->nconn)
+			a = b;
+		return (a);
+	case BALANCE_FIRST:
+	default:
+		/* The first available target. */
+		return (nth_avail(ejected, 0));
+	}
+
+	/* Continue from the following target next time. */
+	B->next = (a + 1) % B->ntargets;
+	return (a);
+}
+
+/**
+ * balance_policy(name):
+ * Return the load balancing policy called ${name}, or -1 if there is no
+ * such policy.
+ */
+int
+balance_policy(const char * name)
+{
+	size_t i;
+
+	/* Look for the name. */
+	for (i = 0; policies[i].name != NULL; i++) {
+		if (strcmp(policies[i].name, name) == 0)
+			break;
+	}
+
+	/* Return the policy, or -1 from the end of the list. */
+	return (policies[i].policy);
+}
+
+/**
+ * balance_init(policy, ejecttime):
+ * Create a load balancer which distributes connections across its target
+ * addresses according to ${policy}.  An address to which a connection
+ * attempt fails is ejected for ${ejecttime} seconds, doubling for each
+ * consecutive failure; connections are only made to ejected addresses if no
+ * other addresses work.  Set the addresses with balance_update() before
+ * calling balance_pick().
+ */
+struct balance *
+balance_init(int policy, double ejecttime)
+{
+	struct balance * B;
+	struct timeval tv;
+
+	/* Bake a cookie. */
+	if ((B = malloc(sizeof(struct balance))) == NULL)
+		goto err0;
+	B->policy = policy;
+	B->ejecttime = ejecttime;
+	B->targets = NULL;
+	B->ntargets = 0;
+	B->next = 0;
+
+	/* Seed the random number generator; this need not be secure. */
+	if (monoclock_get(&tv))
+		goto err1;
+	B->rng = ((uint64_t)tv.tv_sec << 20) ^ (uint64_t)tv.tv_usec ^
+	    ((uint64_t)getpid() << 40) ^ 0x9e3779b97f4a7c15;
+
+	/* Success! */
+	return (B);
+
+err1:
+	free(B);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * balance_update(B, sas):
+ * Replace the target addresses of ${B} with ${sas}, keeping the connection
+ * counts and health of addresses which are in both lists.  If ${sas} is
+ * empty, or on error, keep the old addresses.  Take ownership of ${sas}.
+ */
+int
+balance_update(struct balance * B, struct sock_addr ** sas)
+{
+	struct balance_target ** targets;
+	struct balance_target * T;
+	size_t n;
+	size_t i, j;
+	int rc = 0;
+
+	/* Count the new addresses; if there are none, keep the old ones. */
+	for (n = 0; sas[n] != NULL; n++)
+		continue;
+	if (n == 0)
+		goto done;
+
+	/* Allocate a new list of targets. */
+	if ((targets = malloc(n * sizeof(struct balance_target *))) == NULL)
+		goto err0;
+
+	for (i = 0; i < n; i++) {
+		/* Look for this address among the existing targets. */
+		for (j = 0; j < B->ntargets; j++) {
+			if (sock_addr_cmp(B->targets[j]->sa, sas[i]) == 0)
+				break;
+		}
+
+		/* If we found it, keep it. */
+		if (j < B->ntargets) {
+			targets[i] = B->targets[j];
+			targets[i]->refcount++;
+			continue;
+		}
+
+		/* Otherwise, create a new target. */
+		if ((T = malloc(sizeof(struct balance_target))) == NULL)
+			goto err1;
+		T->sa = sas[i];
+		T->refcount = 1;
+		T->nconn = 0;
+		T->nfails = 0;
+		sas[i] = NULL;
+		targets[i] = T;
+	}
+
+	/* Release the old list; targets we kept have another reference. */
+	for (j = 0; j < B->ntargets; j++)
+		target_release(B->targets[j]);
+	free(B->targets);
+
+	/* Use the new list. */
+	B->targets = targets;
+	B->ntargets = n;
+	B->next = 0;
+
+done:
+	/* Free any addresses we didn't use, and the list itself. */
+	for (i = 0; i < n; i++)
+		sock_addr_free(sas[i]);
+	free(sas);
+
+	/* Return success/fail status. */
+	return (rc);
+
+err1:
+	/* Undo what we did, and keep the old list. */
+	while (i-- > 0)
+		target_release(targets[i]);
+	free(targets);
+err0:
+	/* Failure! */
+	warnp("Cannot update target addresses");
+	rc = -1;
+	goto done;
+}
+
+/**
+ * balance_pick(B, sas):
+ * Choose a target for a new connection, and set ${sas} to a list of target
+ * addresses to try, starting with the chosen one and followed by the other
+ * addresses as fallbacks.  The list must be freed with sock_addr_freelist().
+ * Return a cookie which must be passed to balance_connected() and
+ * balance_done().
+ */
+struct balance_conn *
+balance_pick(struct balance * B, struct sock_addr *** sas)
+{
+	struct balance_conn * BC;
+	struct sock_addr ** list;
+	int * ejected;
+	struct timeval tv;
+	size_t navail;
+	size_t first;
+	size_t pass;
+	size_t i, j, k;
+
+	/* Which targets are currently ejected? */
+	if (monoclock_get(&tv))
+		goto err0;
+	if ((ejected = malloc(B->ntargets * sizeof(int))) == NULL)
+		goto err0;
+	for (navail = i = 0; i < B->ntargets; i++) {
+		ejected[i] = target_ejected(B->targets[i], &tv);
+		if (!ejected[i])
+			navail++;
+	}
+
+	/* If all of them are, we might as well ignore the ejections. */
+	if (navail == 0) {
+		for (i = 0; i < B->ntargets; i++)
+			ejected[i] = 0;
+		navail = B->ntargets;
+	}
+
+	/* Choose a target. */
+	first = choose(B, ejected, navail);
+
+	/* Bake a cookie. */
+	if ((BC = malloc(sizeof(struct balance_conn))) == NULL)
+		goto err1;
+	BC->B = B;
+	BC->ntargets = B->ntargets;
+	BC->charged = NULL;
+	BC->connected = 0;
+	if ((BC->targets = malloc(BC->ntargets *
+	    sizeof(struct balance_target *))) == NULL)
+		goto err2;
+
+	/*
+	 * List the chosen target first, followed by the other available
+	 * targets and finally the ejected targets; within each group, start
+	 * after the chosen target so that failing over spreads the load.
+	 */
+	for (k = pass = 0; pass < 2; pass++) {
+		for (i = 0; i < B->ntargets; i++) {
+			j = (first + i) % B->ntargets;
+			if (ejected[j] == (int)pass)
+				BC->targets[k++] = B->targets[j];
+		}
+	}
+	assert(k == BC->ntargets);
+
+	/* Duplicate their addresses for the connection. */
+	if ((list = malloc((BC->ntargets + 1) *
+	    sizeof(struct sock_addr *))) == NULL)
+		goto err3;
+	for (i = 0; i < BC->ntargets; i++) {
+		if ((list[i] = sock_addr_dup(BC->targets[i]->sa)) == NULL)
+			goto err4;
+	}
+	list[i] = NULL;
+
+	/* Hold references to the targets, and charge the chosen one. */
+	for (i = 0; i < BC->ntargets; i++)
+		BC->targets[i]->refcount++;
+	BC->charged = BC->targets[0];
+	BC->charged->nconn++;
+
+	/* Clean up. */
+	free(ejected);
+
+	/* Success! */
+	*sas = list;
+	return (BC);
+
+err4:
+	while (i-- > 0)
+		sock_addr_free(list[i]);
+	free(list);
+err3:
+	free(BC->targets);
+err2:
+	free(BC);
+err1:
+	free(ejected);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * balance_failed(BC, i):
+ * Record that for the connection ${BC}, the address at index ${i} in the
+ * list returned by balance_pick() failed to connect, or was overtaken by
+ * another address.
+ */
+void
+balance_failed(struct balance_conn * BC, size_t i)
+{
+
+	/* Sanity-check. */
+	assert(i < BC->ntargets);
+	assert(!BC->connected);
+
+	/* This address was slow or dead. */
+	target_failed(BC->B, BC->targets[i]);
+}
+
+/**
+ * balance_connected(BC, i):
+ * Record that the connection ${BC} was established to the address at index
+ * ${i} in the list returned by balance_pick().
+ */
+void
+balance_connected(struct balance_conn * BC, size_t i)
+{
+
+	/* Sanity-check. */
+	assert(i < BC->ntargets);
+	assert(!BC->connected);
+
+	/* This address is healthy. */
+	BC->targets[i]->nfails = 0;
+
+	/* Move the connection's charge to it. */
+	BC->charged->nconn--;
+	BC->charged = BC->targets[i];
+	BC->charged->nconn++;
+	BC->connected = 1;
+}
+
+/**
+ * balance_done(BC):
+ * Record that the connection ${BC} has ended, and free it.
+ */
+void
+balance_done(struct balance_conn * BC)
+{
+	size_t i;
+
+	/* Be compatible with free(NULL). */
+	if (BC == NULL)
+		return;
+
+	/* This connection is gone. */
+	BC->charged->nconn--;
+
+	/* Release the targets. */
+	for (i = 0; i < BC->ntargets; i++)
+		target_release(BC->targets[i]);
+
+	/* Free the cookie. */
+	free(BC->targets);
+	free(BC);
+}
+
+/**
+ * balance_free(B):
+ * Free the load balancer ${B}.  All connections must have ended.
+ */
+void
+balance_free(struct balance * B)
+{
+	size_t i;
+
+	/* Be compatible with free(NULL). */
+	if (B == NULL)
+		return;
+
+	/* Release the targets. */
+	for (i = 0; i < B->ntargets; i++) {
+		assert(B->targets[i]->refcount == 1);
+		target_release(B->targets[i]);
+	}
+
+	/* Free the balancer. */
+	free(B->targets);
+	free(B);
+}
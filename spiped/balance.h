@@ -0,0 +1,82 @@
+#ifndef _BALANCE_H_
+#define _BALANCE_H_
+
+#include <stddef.h>
+
+/* Opaque types. */
+struct balance;
+struct balance_conn;
+struct sock_addr;
+
+/* Load balancing policies. */
+enum {
+	BALANCE_FIRST = 0,	/* First healthy address, in resolver order */
+	BALANCE_RR,		/* Round-robin */
+	BALANCE_LEASTCONN,	/* Fewest active connections */
+	BALANCE_P2C,		/* Better of two random choices */
+};
+
+/**
+ * balance_policy(name):
+ * Return the load balancing policy called ${name}, or -1 if there is no
+ * such policy.
+ */
+int balance_policy(const char *);
+
+/**
+ * balance_init(policy, ejecttime):
+ * Create a load balancer which distributes connections across its target
+ * addresses according to ${policy}.  An address to which a connection
+ * attempt fails is ejected for ${ejecttime} seconds, doubling for each
+ * consecutive failure; connections are only made to ejected addresses if no
+ * other addresses work.  Set the addresses with balance_update() before
+ * calling balance_pick().
+ */
+struct balance * balance_init(int, double);
+
+/**
+ * balance_update(B, sas):
+ * Replace the target addresses of ${B} with ${sas}, keeping the connection
+ * counts and health of addresses which are in both lists.  If ${sas} is
+ * empty, or on error, keep the old addresses.  Take ownership of ${sas}.
+ */
+int balance_update(struct balance *, struct sock_addr **);
+
+/**
+ * balance_pick(B, sas):
+ * Choose a target for a new connection, and set ${sas} to a list of target
+ * addresses to try, starting with the chosen one and followed by the other
+ * addresses as fallbacks.  The list must be freed with sock_addr_freelist().
+ * Return a cookie which must be passed to balance_connected() and
+ * balance_done().
+ */
+struct balance_conn * balance_pick(struct balance *, struct sock_addr ***);
+
+/**
+ * balance_failed(BC, i):
+ * Record that for the connection ${BC}, the address at index ${i} in the
+ * list returned by balance_pick() failed to connect, or was overtaken by
+ * another address.
+ */
+void balance_failed(struct balance_conn *, size_t);
+
+/**
+ * balance_connected(BC, i):
+ * Record that the connection ${BC} was established to the address at index
+ * ${i} in the list returned by balance_pick().
+ */
+void balance_connected(struct balance_conn *, size_t);
+
+/**
+ * balance_done(BC):
+ * Record that the connection ${BC} has ended, and free it.
+ */
+void balance_done(struct balance_conn *);
+
+/**
+ * balance_free(B):
+ * Free the load balancer ${B}.  All connections must have ended.
+ */
+void balance_free(struct balance *);
+
+#endif /* !_BALANCE_H_ */
@@ -1,8 +1,9 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 
-#include "dnsthread.h"
+#include "dnspool.h"
 #include "events.h"
 #include "network.h"
 #include "queue.h"
@@ -12,12 +13,27 @@
 
 #include "proto_conn.h"
 
+#include "balance.h"
 #include "dispatch.h"
+#include "fleet.h"
+
+/*
+ * Maximum number of connections to accept each time the listening socket
+ * becomes readable; this lets us absorb bursts of connections quickly without
+ * starving established connections.
+ */
+#define ACCEPT_BUDGET 16
+
+/*
+ * Worker processes don't tell each other when they gain or lose connections,
+ * so check the total number of connections this often (in seconds).
+ */
+#define NCONN_POLL 0.1
 
 struct accept_state {
 	int s;
 	const char * tgt;
-	struct sock_addr ** sas;
+	struct balance * B;
 	const struct sock_addr * sa_b;
 	double rtime;
 	int decr;
@@ -29,16 +45,20 @@ struct accept_state {
 	const struct proto_secret * K;
 	size_t nconn;
 	size_t nconn_max;
+	int atlimit;
 	double timeo;
 	void * accept_cookie;
+	void * nconntimer_cookie;
 	void * dnstimer_cookie;
 	LIST_HEAD(conn_head, conn_list_node) conn_cookies;
-	DNSTHREAD T;
+	struct dnspool * P;
+	void * dns_cookie;
 };
 
 /* Doubly linked list. */
 struct conn_list_node {
 	void * conn_cookie;
+	struct balance_conn * BC;
 	LIST_ENTRY(conn_list_node) entries;
 	struct accept_state * A;
 };
@@ -52,14 +72,15 @@ callback_resolve(void * cookie, struct sock_addr ** sas)
 {
 	struct accept_state * A = cookie;
 
-	/* If the address resolution succeeded... */
-	if (sas != NULL) {
-		/* Free the old addresses. */
-		sock_addr_freelist(A->sas);
+	/* The address resolution is no longer pending. */
+	A->dns_cookie = NULL;
 
-		/* Use the new addresses. */
-		A->sas = sas;
-	}
+	/*
+	 * If the address resolution succeeded, use the new addresses.  If we
+	 * can't, keep using the old addresses; we've already warned.
+	 */
+	if (sas != NULL)
+		(void)balance_update(A->B, sas);
 
 	/* Wait a while before resolving again. */
 	if ((A->dnstimer_cookie = events_timer_register_double(
@@ -84,26 +105,69 @@ callback_resolveagain(void * cookie)
 	A->dnstimer_cookie = NULL;
 
 	/* Re-resolve the target address. */
-	return (dnsthread_resolveone(A->T, A->tgt, callback_resolve, A));
+	if ((A->dns_cookie = dnspool_resolve(A->P, A->tgt, callback_resolve,
+	    A)) == NULL)
+		goto err0;
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int doaccept(struct accept_state *);
+
+/* Timer callback to check how many connections other workers have. */
+static int
+callback_nconnpoll(void * cookie)
+{
+	struct accept_state * A = cookie;
+
+	/* This timer is expired. */
+	A->nconntimer_cookie = NULL;
+
+	/* Maybe accept more connections. */
+	return (doaccept(A));
 }
 
 /* Non-blocking accept, if we can have more connections. */
 static int
 doaccept(struct accept_state * A)
 {
+	size_t nconn;
 	int rc = 0;
 
-	/* Warn about reaching nconn_max. */
-	if (A->nconn >= A->nconn_max) {
-		warn0("Maximum number of connections (%zu) reached",
-		    A->nconn_max);
+	/* Count our connections, and those of any other worker processes. */
+	nconn = fleet_nconn(A->nconn);
+
+	/* Warn about reaching nconn_max, and stop accepting connections. */
+	if (nconn >= A->nconn_max) {
+		if (!A->atlimit)
+			warn0("Maximum number of connections (%zu) reached",
+			    A->nconn_max);
+		A->atlimit = 1;
+		if (A->accept_cookie != NULL) {
+			network_accept_cancel(A->accept_cookie);
+			A->accept_cookie = NULL;
+		}
+	} else
+		A->atlimit = 0;
+
+	/* Keep an eye on the other workers (if applicable). */
+	if (fleet_isworker() && (A->nconn_max < SIZE_MAX) &&
+	    (A->nconntimer_cookie == NULL) && !A->shutdown_requested) {
+		if ((A->nconntimer_cookie = events_timer_register_double(
+		    callback_nconnpoll, A, NCONN_POLL)) == NULL)
+			rc = -1;
 	}
 
-	/* If we can, accept a new connection. */
-	if ((A->nconn < A->nconn_max) && (A->accept_cookie == NULL) &&
+	/* If we can, start accepting connections. */
+	if ((nconn < A->nconn_max) && (A->accept_cookie == NULL) &&
 	    !A->shutdown_requested) {
-		if ((A->accept_cookie =
-		    network_accept(A->s, callback_gotconn, A)) == NULL)
+		if ((A->accept_cookie = network_accept_batch(A->s,
+		    ACCEPT_BUDGET, callback_gotconn, A)) == NULL)
 			rc = -1;
 	}
 
@@ -111,6 +175,22 @@ doaccept(struct accept_state * A)
 	return (rc);
 }
 
+/* A connection has reached the target address ${i}, or failed to (${ok}). */
+static int
+callback_target(void * cookie, size_t i, int ok)
+{
+	struct conn_list_node * node_ptr = cookie;
+
+	/* Tell the load balancer. */
+	if (ok)
+		balance_connected(node_ptr->BC, i);
+	else
+		balance_failed(node_ptr->BC, i);
+
+	/* Success! */
+	return (0);
+}
+
 /* A connection has closed.  Accept more if necessary. */
 static int
 callback_conndied(void * cookie, int reason)
@@ -126,6 +206,9 @@ callback_conndied(void * cookie, int reason)
 	/* We've lost a connection. */
 	A->nconn -= 1;
 
+	/* Any target addresses which failed have already been reported. */
+	balance_done(node_ptr->BC);
+
 	/* Remove the closed connection from the list of conn_cookies. */
 	LIST_REMOVE(node_ptr, entries);
 
@@ -148,11 +231,10 @@ callback_gotconn(void * cookie, int s)
 	struct sock_addr ** sas;
 	struct conn_list_node * node_new;
 
-	/* This accept is no longer in progress. */
-	A->accept_cookie = NULL;
-
 	/* If we got a -1 descriptor, something went seriously wrong. */
 	if (s == -1) {
+		/* We are no longer accepting connections. */
+		A->accept_cookie = NULL;
 		warnp("network_accept failed");
 		goto err0;
 	}
@@ -160,19 +242,19 @@ callback_gotconn(void * cookie, int s)
 	/* We have gained a connection. */
 	A->nconn += 1;
 
-	/* Duplicate the target address list. */
-	if ((sas = sock_addr_duplist(A->sas)) == NULL)
-		goto err1;
-
 	/* Create new conn_list_node. */
 	if ((node_new = malloc(sizeof(struct conn_list_node))) == NULL)
-		goto err2;
+		goto err1;
 	node_new->A = A;
 
+	/* Pick the target address list. */
+	if ((node_new->BC = balance_pick(A->B, &sas)) == NULL)
+		goto err2;
+
 	/* Create a new connection. */
 	if ((node_new->conn_cookie = proto_conn_create(s, sas, A->sa_b, A->decr,
 	    A->nopfs, A->requirepfs, A->nokeepalive, A->K, A->timeo,
-	    callback_conndied, node_new)) == NULL) {
+	    callback_target, callback_conndied, node_new)) == NULL) {
 		warnp("Failure setting up new connection");
 		goto err3;
 	}
@@ -180,7 +262,7 @@ callback_gotconn(void * cookie, int s)
 	/* Insert node_new to the beginning of the conn_cookies list. */
 	LIST_INSERT_HEAD(&A->conn_cookies, node_new, entries);
 
-	/* Accept another connection if we can. */
+	/* Stop accepting connections if we've reached our limit. */
 	if (doaccept(A))
 		goto err0;
 
@@ -188,9 +270,10 @@ callback_gotconn(void * cookie, int s)
 	return (0);
 
 err3:
-	free(node_new);
-err2:
 	sock_addr_freelist(sas);
+	balance_done(node_new->BC);
+err2:
+	free(node_new);
 err1:
 	A->nconn -= 1;
 	close(s);
@@ -201,7 +284,7 @@ err0:
 
 /**
  * dispatch_accept(s, tgt, rtime, sas, sa_b, decr, nopfs, requirepfs,
- *     nokeepalive, K, nconn_max, timeo, conndone):
+ *     nokeepalive, K, nconn_max, timeo, policy, ejecttime, conndone):
  * Start accepting connections on the socket ${s}, optionally binding to
  * ${sa_b}.  Connect to the target ${tgt}, re-resolving it every ${rtime}
  * seconds if ${rtime} > 0; on address resolution failure use the most recent
@@ -212,25 +295,30 @@ err0:
  * is non-zero, require that both ends use perfect forward secrecy.  Enable
  * transport layer keep-alives (if applicable) if and only if ${nokeepalive} is
  * zero.  Drop connections if the handshake or connecting to the target takes
- * more than ${timeo} seconds.  If dispatch_request_shutdown() is called then
- * ${conndone} is set to a non-zero value as soon as there are no active
- * connections.  Return a cookie which can be passed to dispatch_shutdown()
- * and dispatch_request_shutdown().
+ * more than ${timeo} seconds.  Distribute connections across the target
+ * addresses according to the load balancing policy ${policy}, ejecting
+ * addresses which fail for ${ejecttime} seconds or more (see balance_init()).
+ * In a fleet worker process, ${nconn_max} limits the total number of
+ * connections held by all of the workers (see fleet_nconn()).
+ * If dispatch_request_shutdown() is called then ${conndone} is set to a
+ * non-zero value as soon as there are no active connections.  Take ownership
+ * of ${sas} on success.  Return a cookie which can be passed to
+ * dispatch_shutdown() and dispatch_request_shutdown().
  */
 void *
 dispatch_accept(int s, const char * tgt, double rtime, struct sock_addr ** sas,
     const struct sock_addr * sa_b, int decr, int nopfs, int requirepfs,
     int nokeepalive, const struct proto_secret * K, size_t nconn_max,
-    double timeo, int * conndone)
+    double timeo, int policy, double ejecttime, int * conndone)
 {
 	struct accept_state * A;
+	struct sock_addr ** sas_copy;
 
 	/* Bake a cookie. */
 	if ((A = malloc(sizeof(struct accept_state))) == NULL)
 		goto err0;
 	A->s = s;
 	A->tgt = tgt;
-	A->sas = sas;
 	A->sa_b = sa_b;
 	A->rtime = rtime;
 	A->decr = decr;
@@ -242,37 +330,54 @@ dispatch_accept(int s, const char * tgt, double rtime, struct sock_addr ** sas,
 	A->K = K;
 	A->nconn = 0;
 	A->nconn_max = nconn_max;
+	A->atlimit = 0;
 	A->timeo = timeo;
-	A->T = NULL;
+	A->P = NULL;
+	A->dns_cookie = NULL;
 	A->accept_cookie = NULL;
+	A->nconntimer_cookie = NULL;
 	A->dnstimer_cookie = NULL;
 	LIST_INIT(&A->conn_cookies);
 
+	/* Set up load balancing across (a copy of) the target addresses. */
+	if ((A->B = balance_init(policy, ejecttime)) == NULL)
+		goto err1;
+	if ((sas_copy = sock_addr_duplist(sas)) == NULL)
+		goto err2;
+	if (balance_update(A->B, sas_copy))
+		goto err2;
+
 	/* If address re-resolution is enabled... */
 	if (rtime > 0.0) {
-		/* Launch an address resolution thread. */
-		if ((A->T = dnsthread_spawn()) == NULL)
-			goto err1;
+		/* Use the process-wide address resolution threads. */
+		if ((A->P = dnspool_shared()) == NULL)
+			goto err2;
 
 		/* Re-resolve the target address after a while. */
 		if ((A->dnstimer_cookie = events_timer_register_double(
 		    callback_resolveagain, A, A->rtime)) == NULL)
-			goto err2;
+			goto err3;
 	}
 
 	/* Accept a connection. */
 	if (doaccept(A))
-		goto err3;
+		goto err4;
+
+	/* We don't need the original addresses any more. */
+	sock_addr_freelist(sas);
 
 	/* Success! */
 	return (A);
 
-err3:
+err4:
+	if (A->nconntimer_cookie != NULL)
+		events_timer_cancel(A->nconntimer_cookie);
 	if (A->dnstimer_cookie != NULL)
 		events_timer_cancel(A->dnstimer_cookie);
+err3:
+	dnspool_free(A->P);
 err2:
-	if (A->T != NULL)
-		dnsthread_kill(A->T);
+	balance_free(A->B);
 err1:
 	free(A);
 err0:
@@ -300,11 +405,14 @@ dispatch_shutdown(void * dispatch_cookie)
 
 	if (A->accept_cookie != NULL)
 		network_accept_cancel(A->accept_cookie);
+	if (A->nconntimer_cookie != NULL)
+		events_timer_cancel(A->nconntimer_cookie);
 	if (A->dnstimer_cookie != NULL)
 		events_timer_cancel(A->dnstimer_cookie);
-	if (A->T != NULL)
-		dnsthread_kill(A->T);
-	sock_addr_freelist(A->sas);
+	if (A->dns_cookie != NULL)
+		dnspool_cancel(A->dns_cookie);
+	dnspool_free(A->P);
+	balance_free(A->B);
 	close(A->s);
 	free(A);
 }
@@ -327,6 +435,12 @@ dispatch_request_shutdown(void * dispatch_cookie)
 		A->accept_cookie = NULL;
 	}
 
+	/* We don't need to wait for other workers' connections to close. */
+	if (A->nconntimer_cookie != NULL) {
+		events_timer_cancel(A->nconntimer_cookie);
+		A->nconntimer_cookie = NULL;
+	}
+
 	/* If no connections are open... */
 	if (A->nconn == 0) {
 		/* Indicate that all connections are closed. */
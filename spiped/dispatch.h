@@ -9,7 +9,7 @@ struct sock_addr;
 
 /**
  * dispatch_accept(s, tgt, rtime, sas, sa_b, decr, nopfs, requirepfs,
- *     nokeepalive, K, nconn_max, timeo, conndone):
+ *     nokeepalive, K, nconn_max, timeo, policy, ejecttime, conndone):
  * Start accepting connections on the socket ${s}, optionally binding to
  * ${sa_b}.  Connect to the target ${tgt}, re-resolving it every ${rtime}
  * seconds if ${rtime} > 0; on address resolution failure use the most recent
@@ -20,14 +20,19 @@ struct sock_addr;
  * is non-zero, require that both ends use perfect forward secrecy.  Enable
  * transport layer keep-alives (if applicable) if and only if ${nokeepalive} is
  * zero.  Drop connections if the handshake or connecting to the target takes
- * more than ${timeo} seconds.  If dispatch_request_shutdown() is called then
- * ${conndone} is set to a non-zero value as soon as there are no active
- * connections.  Return a cookie which can be passed to dispatch_shutdown()
- * and dispatch_request_shutdown().
+ * more than ${timeo} seconds.  Distribute connections across the target
+ * addresses according to the load balancing policy ${policy}, ejecting
+ * addresses which fail for ${ejecttime} seconds or more (see balance_init()).
+ * In a fleet worker process, ${nconn_max} limits the total number of
+ * connections held by all of the workers (see fleet_nconn()).
+ * If dispatch_request_shutdown() is called then ${conndone} is set to a
+ * non-zero value as soon as there are no active connections.  Take ownership
+ * of ${sas} on success.  Return a cookie which can be passed to
+ * dispatch_shutdown() and dispatch_request_shutdown().
  */
 void * dispatch_accept(int, const char *, double, struct sock_addr **,
     const struct sock_addr *, int, int, int, int, const struct proto_secret *,
-    size_t, double, int *);
+    size_t, double, int, double, int *);
 
 /**
  * dispatch_shutdown(dispatch_cookie):
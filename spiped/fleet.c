@@ -0,0 +1,507 @@
+/* We use non-POSIX functionality in this file. */
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+/* CPU affinity masks are a GNU extension on Linux. */
+#if defined(__linux__)
+#define _GNU_SOURCE 1
+#include <sched.h>
+
+#if defined(CPU_SET) && defined(CPU_COUNT)
+#define FLEET_PIN
+#endif
+#endif
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "monoclock.h"
+#include "sock.h"
+#include "warnp.h"
+
+#include "fleet.h"
+
+/* Don't restart a worker more often than this many seconds. */
+#define RESTART_INTERVAL 1.0
+
+/* A worker process. */
+struct worker {
+	pid_t pid;		/* -1 if not running. */
+	int s;			/* Listening socket. */
+	struct timeval started;
+};
+
+/* Fleet state. */
+static struct worker * workers = NULL;
+static size_t nworkers;
+static size_t self;
+static int isworker = 0;
+
+/* Per-worker connection counts, in memory shared by all of the workers. */
+static volatile size_t * nconns = NULL;
+static size_t nconns_len;
+
+/* Signal handling in the supervisor. */
+static volatile sig_atomic_t stopsig = 0;
+static struct sigaction sa_term_orig;
+static struct sigaction sa_int_orig;
+static struct sigaction sa_chld_orig;
+static sigset_t mask_orig;
+
+/* Signal handler for SIGTERM and SIGINT in the supervisor. */
+static void
+handler_stop(int signo)
+{
+
+	stopsig = signo;
+}
+
+/* Signal handler for SIGCHLD; we only need to wake up from sigsuspend(). */
+static void
+handler_chld(int signo)
+{
+
+	(void)signo; /* UNUSED */
+}
+
+/* Close the listening sockets, except for ${s}. */
+static void
+closesockets(int s)
+{
+	size_t i;
+
+	/* Workers may share a socket; only close each one once. */
+	for (i = 0; i < nworkers; i++) {
+		if ((workers[i].s == s) || (workers[i].s == -1) ||
+		    ((i > 0) && (workers[i].s == workers[i - 1].s)))
+			continue;
+		close(workers[i].s);
+	}
+}
+
+/* Install signal handlers in the supervisor. */
+static int
+sigsetup(void)
+{
+	struct sigaction sa;
+	sigset_t mask;
+
+	/* Block the signals we handle, except in sigsuspend(). */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &mask, &mask_orig)) {
+		warnp("sigprocmask");
+		goto err0;
+	}
+
+	/* Install handlers. */
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = handler_stop;
+	if (sigaction(SIGTERM, &sa, &sa_term_orig)) {
+		warnp("sigaction(SIGTERM)");
+		goto err1;
+	}
+	if (sigaction(SIGINT, &sa, &sa_int_orig)) {
+		warnp("sigaction(SIGINT)");
+		goto err2;
+	}
+	sa.sa_handler = handler_chld;
+	if (sigaction(SIGCHLD, &sa, &sa_chld_orig)) {
+		warnp("sigaction(SIGCHLD)");
+		goto err3;
+	}
+
+	/* Success! */
+	return (0);
+
+err3:
+	sigaction(SIGINT, &sa_int_orig, NULL);
+err2:
+	sigaction(SIGTERM, &sa_term_orig, NULL);
+err1:
+	sigprocmask(SIG_SETMASK, &mask_orig, NULL);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Restore the signal handling we found. */
+static void
+sigrestore(void)
+{
+
+	/* This can only fail if we pass invalid arguments. */
+	sigaction(SIGCHLD, &sa_chld_orig, NULL);
+	sigaction(SIGINT, &sa_int_orig, NULL);
+	sigaction(SIGTERM, &sa_term_orig, NULL);
+	sigprocmask(SIG_SETMASK, &mask_orig, NULL);
+}
+
+/* Pin the calling process to the ${i}th CPU it may run on (mod the count). */
+static void
+pincpu(size_t i)
+{
+#ifdef FLEET_PIN
+	cpu_set_t set;
+	int cpu;
+	int ncpus;
+
+	/* Which CPUs may we run on (e.g., as restricted by taskset(1))? */
+	if (sched_getaffinity(0, sizeof(set), &set)) {
+		warnp("sched_getaffinity");
+		return;
+	}
+	if ((ncpus = CPU_COUNT(&set)) == 0)
+		return;
+
+	/* Find the (i mod ncpus)th of them. */
+	i %= (size_t)ncpus;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &set) && (i-- == 0))
+			break;
+	}
+
+	/* Run on that CPU only. */
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		warnp("sched_setaffinity");
+#else
+	(void)i; /* UNUSED */
+#endif
+}
+
+/*
+ * Start worker ${i}.  Return its pid in the supervisor, 0 in the worker, or
+ * -1 on error.
+ */
+static pid_t
+spawn(size_t i)
+{
+	struct timeval now;
+	pid_t pid;
+
+	/* If the worker is dying as soon as it starts, don't spin. */
+	if (monoclock_get(&now)) {
+		warnp("monoclock_get");
+		goto err0;
+	}
+	if (timeval_diff(workers[i].started, now) < RESTART_INTERVAL) {
+		sleep((unsigned int)RESTART_INTERVAL);
+		if (monoclock_get(&now)) {
+			warnp("monoclock_get");
+			goto err0;
+		}
+	}
+	workers[i].started = now;
+
+	/* This worker has no connections yet. */
+	nconns[i] = 0;
+
+	/* Fork. */
+	if ((pid = fork()) == -1) {
+		warnp("fork");
+		goto err0;
+	}
+
+	/* In the supervisor, we're done. */
+	if (pid != 0) {
+		workers[i].pid = pid;
+		return (pid);
+	}
+
+	/* We're a worker; put signal handling back the way it was. */
+	sigrestore();
+
+	/* We're this worker, and we only need our own socket. */
+	isworker = 1;
+	self = i;
+	closesockets(workers[i].s);
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Warn about worker ${i} having exited with ${status}. */
+static void
+reportexit(size_t i, int status)
+{
+
+	if (WIFSIGNALED(status))
+		warn0("Worker %zu (pid %d) killed by signal %d; restarting",
+		    i, (int)workers[i].pid, WTERMSIG(status));
+	else
+		warn0("Worker %zu (pid %d) exited with status %d; restarting",
+		    i, (int)workers[i].pid, WEXITSTATUS(status));
+}
+
+/**
+ * fleet_init(nworkers, sa):
+ * Prepare to run ${nworkers} worker processes which accept connections on
+ * the address ${sa}: create a listening socket for each worker, bound with
+ * SO_REUSEPORT so that the kernel distributes connections between them (or,
+ * if that is not supported, a single listening socket shared by all of the
+ * workers), and allocate shared memory for counting connections.
+ */
+int
+fleet_init(size_t n, const struct sock_addr * sa)
+{
+	size_t i;
+
+	/* Sanity-check. */
+	if (n > SIZE_MAX / sizeof(struct worker)) {
+		errno = ENOMEM;
+		goto err0;
+	}
+
+	/* Allocate worker state. */
+	if ((workers = malloc(n * sizeof(struct worker))) == NULL)
+		goto err0;
+	nworkers = n;
+
+	/* Allocate connection counts which will be shared across fork(2). */
+	nconns_len = n * sizeof(size_t);
+	if ((nconns = mmap(NULL, nconns_len, PROT_READ | PROT_WRITE,
+	    MAP_ANON | MAP_SHARED, -1, 0)) == MAP_FAILED) {
+		warnp("mmap");
+		goto err1;
+	}
+
+	/* Create the first socket, ideally a shareable one. */
+	if ((workers[0].s = sock_listener_reuseport(sa)) == -1) {
+		if (errno != ENOPROTOOPT)
+			goto err2;
+		if ((workers[0].s = sock_listener(sa)) == -1)
+			goto err2;
+
+		/* Everybody uses the same socket. */
+		for (i = 1; i < n; i++)
+			workers[i].s = workers[0].s;
+	} else {
+		/* Create a socket for each of the other workers. */
+		for (i = 1; i < n; i++) {
+			if ((workers[i].s = sock_listener_reuseport(sa)) ==
+			    -1)
+				goto err3;
+		}
+	}
+
+	/* No workers are running yet. */
+	for (i = 0; i < n; i++) {
+		workers[i].pid = -1;
+		workers[i].started.tv_sec = 0;
+		workers[i].started.tv_usec = 0;
+	}
+
+	/* Success! */
+	return (0);
+
+err3:
+	nworkers = i;
+	closesockets(-1);
+err2:
+	munmap((void *)(uintptr_t)nconns, nconns_len);
+	nconns = NULL;
+err1:
+	free(workers);
+	workers = NULL;
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * fleet_start(pin):
+ * Fork the worker processes and supervise them: restart workers which exit,
+ * and pass SIGTERM and SIGINT on to the workers and wait for them to exit.
+ * If ${pin} is non-zero, pin each worker to a different CPU (where
+ * supported).  In each worker, return the listening socket which it should
+ * use.  In the supervisor, free the fleet and return -2 once all of the
+ * workers have exited after a signal, or return -1 on error; this includes
+ * failing to start a worker for the first time, in which case any workers
+ * which were started are stopped first.
+ */
+int
+fleet_start(int pin)
+{
+	size_t nrunning = 0;
+	int allstarted = 0;
+	int forwarded = 0;
+	int failed = 0;
+	int saved_errno = 0;
+	int s;
+	int status;
+	pid_t pid;
+	size_t i;
+
+#ifndef FLEET_PIN
+	/* We can't pin processes to CPUs here. */
+	if (pin)
+		warn0("CPU pinning is not supported on this platform");
+#endif
+
+	/* Handle signals. */
+	if (sigsetup())
+		goto err0;
+
+	/* Supervise. */
+	do {
+		/* Reap workers which have exited. */
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			for (i = 0; i < nworkers; i++) {
+				if (workers[i].pid == pid)
+					break;
+			}
+			if (i == nworkers)
+				continue;
+			if (!stopsig)
+				reportexit(i, status);
+			workers[i].pid = -1;
+			nrunning--;
+		}
+
+		/* Start (or restart) workers, unless we're stopping. */
+		for (i = 0; (i < nworkers) && !stopsig; i++) {
+			if (workers[i].pid != -1)
+				continue;
+			if ((pid = spawn(i)) == 0)
+				goto worker;
+			if (pid == -1) {
+				/*
+				 * If this worker has never run, give up (and
+				 * stop the others); otherwise try again.
+				 */
+				if (!allstarted) {
+					saved_errno = errno;
+					failed = 1;
+					stopsig = SIGTERM;
+				}
+				break;
+			}
+			nrunning++;
+		}
+		if (i == nworkers)
+			allstarted = 1;
+
+		/* Pass a stop signal on to the workers. */
+		if (stopsig && !forwarded) {
+			for (i = 0; i < nworkers; i++) {
+				if ((workers[i].pid != -1) &&
+				    kill(workers[i].pid, stopsig))
+					warnp("kill");
+			}
+			forwarded = 1;
+		}
+
+		/* Wait for a signal, unless we need to retry a fork. */
+		if ((nrunning > 0) && ((i == nworkers) || stopsig))
+			sigsuspend(&mask_orig);
+	} while (!stopsig || (nrunning > 0));
+
+	/* Put signal handling back the way it was. */
+	sigrestore();
+
+	/* Did we fail to start the workers? */
+	if (failed) {
+		errno = saved_errno;
+		goto err0;
+	}
+
+	/* Clean up. */
+	fleet_free();
+
+	/* All of the workers have exited. */
+	return (-2);
+
+worker:
+	/* Pin ourselves to a CPU (if applicable). */
+	if (pin)
+		pincpu(self);
+
+	/* Our caller owns our socket now, and we've closed the others. */
+	s = workers[self].s;
+	for (i = 0; i < nworkers; i++)
+		workers[i].s = -1;
+
+	/* Use our socket. */
+	return (s);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * fleet_isworker(void):
+ * Return non-zero if this process is a fleet worker.
+ */
+int
+fleet_isworker(void)
+{
+
+	return (isworker);
+}
+
+/**
+ * fleet_nconn(nconn):
+ * Record that this process has ${nconn} connections, and return the total
+ * number of connections held by all of the workers; or return ${nconn} if
+ * this process is not a fleet worker.  Workers do not notify each other
+ * when their counts change, so the total may be briefly out of date.
+ */
+size_t
+fleet_nconn(size_t nconn)
+{
+	size_t total = 0;
+	size_t i;
+
+	/* If we're not in a fleet, we're the only worker. */
+	if (nconns == NULL)
+		return (nconn);
+
+	/* Record our count, and add up everybody's. */
+	nconns[self] = nconn;
+	for (i = 0; i < nworkers; i++)
+		total += nconns[i];
+
+	/* Return the total. */
+	return (total);
+}
+
+/**
+ * fleet_free(void):
+ * Free the listening sockets and shared memory allocated by fleet_init(),
+ * except for the socket returned by fleet_start() in a worker process.
+ */
+void
+fleet_free(void)
+{
+
+	/* Behave consistently with free(NULL). */
+	if (workers == NULL)
+		return;
+
+	/* Close the sockets and free the shared memory. */
+	closesockets(-1);
+	munmap((void *)(uintptr_t)nconns, nconns_len);
+	nconns = NULL;
+
+	/* Free the worker state. */
+	free(workers);
+	workers = NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef _FLEET_H_
+#define _FLEET_H_
+
+#include <stddef.h>
+
+/* Opaque types. */
+struct sock_addr;
+
+/**
+ * fleet_init(nworkers, sa):
+ * Prepare to run ${nworkers} worker processes which accept connections on
+ * the address ${sa}: create a listening socket for each worker, bound with
+ * SO_REUSEPORT so that the kernel distributes connections between them (or,
+ * if that is not supported, a single listening socket shared by all of the
+ * workers), and allocate shared memory for counting connections.
+ */
+int fleet_init(size_t, const struct sock_addr *);
+
+/**
+ * fleet_start(pin):
+ * Fork the worker processes and supervise them: restart workers which exit,
+ * and pass SIGTERM and SIGINT on to the workers and wait for them to exit.
+ * If ${pin} is non-zero, pin each worker to a different CPU (where
+ * supported).  In each worker, return the listening socket which it should
+ * use.  In the supervisor, free the fleet and return -2 once all of the
+ * workers have exited after a signal, or return -1 on error; this includes
+ * failing to start a worker for the first time, in which case any workers
+ * which were started are stopped first.
+ */
+int fleet_start(int);
+
+/**
+ * fleet_isworker(void):
+ * Return non-zero if this process is a fleet worker.
+ */
+int fleet_isworker(void);
+
+/**
+ * fleet_nconn(nconn):
+ * Record that this process has ${nconn} connections, and return the total
+ * number of connections held by all of the workers; or return ${nconn} if
+ * this process is not a fleet worker.  Workers do not notify each other
+ * when their counts change, so the total may be briefly out of date.
+ */
+size_t fleet_nconn(size_t);
+
+/**
+ * fleet_free(void):
+ * Free the listening sockets and shared memory allocated by fleet_init(),
+ * except for the socket returned by fleet_start() in a worker process.
+ */
+void fleet_free(void);
+
+#endif /* !_FLEET_H_ */
@@ -11,14 +11,19 @@
 #include "events.h"
 #include "getopt.h"
 #include "graceful_shutdown.h"
+#include "network.h"
 #include "parsenum.h"
 #include "setuidgid.h"
 #include "sock.h"
 #include "sock_util.h"
 #include "warnp.h"
 
+#include "balance.h"
 #include "dispatch.h"
+#include "fleet.h"
+#include "proto_conn.h"
 #include "proto_crypt.h"
+#include "proto_crypt_engine.h"
 
 static void
 usage(void)
@@ -27,10 +32,15 @@ usage(void)
 	fprintf(stderr,
 	    "usage: spiped {-e | -d} -s <source socket> "
 	    "-t <target socket> [-b <bind address>] -k <key file>\n"
-	    "    [-DFj] [-f | -g] [-n <max # connections>] "
+	    "    [-DFj] [-E <engine>] [-f | -g] [-n <max # connections>] "
 	    "[-o <connection timeout>]\n"
-	    "    [-p <pidfile>] [-r <rtime> | -R] [--syslog]\n"
+	    "    [-p <pidfile>] [-r <rtime> | -R] [--io-uring] [--syslog]\n"
 	    "    [-u {<username> | <:groupname> | <username:groupname>}]\n"
+	    "    [--source-bufsize <bytes>] [--target-bufsize <bytes>] "
+	    "[--bdp-rate <bytes/s>]\n"
+	    "    [--connect-delay <seconds>] [--balance <policy>] "
+	    "[--eject-time <seconds>]\n"
+	    "    [--workers <num> [--pin-cpus]]\n"
 	    "       spiped -v\n");
 	exit(1);
 }
@@ -67,11 +77,20 @@ main(int argc, char * argv[])
 {
 	/* Command-line parameters. */
 	const char * opt_b = NULL;
+	const char * opt_balance = NULL;
+	int opt_bdp_rate_set = 0;
+	size_t opt_bdp_rate = 0;
+	int opt_connect_delay_set = 0;
+	double opt_connect_delay = 0.0;
 	int opt_d = 0;
 	int opt_D = 0;
 	int opt_e = 0;
+	const char * opt_E = NULL;
+	int opt_eject_time_set = 0;
+	double opt_eject_time = 0.0;
 	int opt_f = 0;
 	int opt_g = 0;
+	int opt_io_uring = 0;
 	int opt_F = 0;
 	int opt_j = 0;
 	const char * opt_k = NULL;
@@ -80,13 +99,19 @@ main(int argc, char * argv[])
 	int opt_o_set = 0;
 	double opt_o = 0.0;
 	const char * opt_p = NULL;
+	int opt_pin_cpus = 0;
 	int opt_r_set = 0;
 	double opt_r = 0.0;
 	int opt_R = 0;
 	int opt_syslog = 0;
 	const char * opt_s = NULL;
+	int opt_source_bufsize_set = 0;
+	size_t opt_source_bufsize = 0;
 	const char * opt_t = NULL;
+	int opt_target_bufsize_set = 0;
+	size_t opt_target_bufsize = 0;
 	const char * opt_u = NULL;
+	size_t opt_workers = 0;
 
 	/* Working variables. */
 	char * bind_addr = NULL;
@@ -95,6 +120,8 @@ main(int argc, char * argv[])
 	struct sock_addr ** sas_s;
 	struct sock_addr ** sas_t;
 	struct proto_secret * K;
+	const struct proto_crypt_engine * E;
+	int policy = BALANCE_FIRST;
 	const char * ch;
 	char * pidfilename = NULL;
 	int s;
@@ -111,6 +138,25 @@ main(int argc, char * argv[])
 				usage();
 			opt_b = optarg;
 			break;
+		GETOPT_OPTARG("--balance"):
+			if (opt_balance)
+				usage();
+			opt_balance = optarg;
+			break;
+		GETOPT_OPTARG("--bdp-rate"):
+			if (opt_bdp_rate_set)
+				usage();
+			opt_bdp_rate_set = 1;
+			if (PARSENUM(&opt_bdp_rate, optarg))
+				OPT_EPARSE(ch, optarg);
+			break;
+		GETOPT_OPTARG("--connect-delay"):
+			if (opt_connect_delay_set)
+				usage();
+			opt_connect_delay_set = 1;
+			if (PARSENUM(&opt_connect_delay, optarg, 0, INFINITY))
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPT("-d"):
 			if (opt_d || opt_e)
 				usage();
@@ -126,6 +172,18 @@ main(int argc, char * argv[])
 				usage();
 			opt_e = 1;
 			break;
+		GETOPT_OPTARG("-E"):
+			if (opt_E)
+				usage();
+			opt_E = optarg;
+			break;
+		GETOPT_OPTARG("--eject-time"):
+			if (opt_eject_time_set)
+				usage();
+			opt_eject_time_set = 1;
+			if (PARSENUM(&opt_eject_time, optarg, 0, INFINITY))
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPT("-f"):
 			if (opt_f)
 				usage();
@@ -141,6 +199,11 @@ main(int argc, char * argv[])
 				usage();
 			opt_g = 1;
 			break;
+		GETOPT_OPT("--io-uring"):
+			if (opt_io_uring)
+				usage();
+			opt_io_uring = 1;
+			break;
 		GETOPT_OPT("-j"):
 			if (opt_j)
 				usage();
@@ -172,6 +235,11 @@ main(int argc, char * argv[])
 				usage();
 			opt_p = optarg;
 			break;
+		GETOPT_OPT("--pin-cpus"):
+			if (opt_pin_cpus)
+				usage();
+			opt_pin_cpus = 1;
+			break;
 		GETOPT_OPTARG("-r"):
 			if (opt_r_set)
 				usage();
@@ -189,6 +257,13 @@ main(int argc, char * argv[])
 				usage();
 			opt_s = optarg;
 			break;
+		GETOPT_OPTARG("--source-bufsize"):
+			if (opt_source_bufsize_set)
+				usage();
+			opt_source_bufsize_set = 1;
+			if (PARSENUM(&opt_source_bufsize, optarg))
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPT("--syslog"):
 			if (opt_syslog)
 				usage();
@@ -199,11 +274,24 @@ main(int argc, char * argv[])
 				usage();
 			opt_t = optarg;
 			break;
+		GETOPT_OPTARG("--target-bufsize"):
+			if (opt_target_bufsize_set)
+				usage();
+			opt_target_bufsize_set = 1;
+			if (PARSENUM(&opt_target_bufsize, optarg))
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPTARG("-u"):
 			if (opt_u != NULL)
 				usage();
 			opt_u = optarg;
 			break;
+		GETOPT_OPTARG("--workers"):
+			if (opt_workers)
+				usage();
+			if (PARSENUM(&opt_workers, optarg, 1, SIZE_MAX))
+				OPT_EPARSE(ch, optarg);
+			break;
 		GETOPT_OPT("-v"):
 			fprintf(stderr, "spiped @VERSION@\n");
 			exit(0);
@@ -230,6 +318,8 @@ main(int argc, char * argv[])
 		opt_o = 5.0;
 	if (opt_r == 0.0)
 		opt_r = 60.0;
+	if (!opt_eject_time_set)
+		opt_eject_time = 10.0;
 
 	/* Sanity-check options. */
 	if (!opt_d && !opt_e)
@@ -246,6 +336,47 @@ main(int argc, char * argv[])
 		usage();
 	if (opt_t == NULL)
 		usage();
+	if (opt_pin_cpus && !opt_workers)
+		usage();
+
+	/* RFC 8305 says attempts must be at least 10 ms apart. */
+	if ((opt_connect_delay > 0.0) && (opt_connect_delay < 0.01)) {
+		warn0("--connect-delay must be 0 or at least 0.01 seconds");
+		usage();
+	}
+	if (!isfinite(opt_connect_delay)) {
+		warn0("--connect-delay must be finite");
+		usage();
+	}
+
+	/* Attempts are abandoned after the -o timeout, so don't wait longer. */
+	if (opt_connect_delay > opt_o)
+		opt_connect_delay = opt_o;
+
+	/* Look up the load balancing policy (if applicable). */
+	if (opt_balance != NULL) {
+		if ((policy = balance_policy(opt_balance)) == -1) {
+			warn0("Unknown load balancing policy: %s", opt_balance);
+			usage();
+		}
+	}
+
+	/* Select the packet encryption engine (if applicable). */
+	if (opt_E != NULL) {
+		if ((E = proto_crypt_engine_lookup(opt_E)) == NULL) {
+			warn0("Unknown encryption engine: %s", opt_E);
+			usage();
+		}
+		proto_crypt_engine_select(E);
+	}
+
+	/* Set socket buffer sizes for new connections. */
+	proto_conn_sockbufs(opt_source_bufsize, opt_target_bufsize,
+	    opt_bdp_rate);
+
+	/* Set the delay between attempts to connect to target addresses. */
+	if (opt_connect_delay_set)
+		proto_conn_connect_delay(opt_connect_delay);
 
 	/*
 	 * A limit of SIZE_MAX connections is equivalent to any larger limit;
@@ -340,7 +471,12 @@ main(int argc, char * argv[])
 	if (sas_s[1] != NULL)
 		warn0("Listening on first of multiple addresses found for %s",
 		    opt_s);
-	if ((s = sock_listener(sas_s[0])) == -1)
+	if (opt_workers > 0) {
+		/* Create a socket for each worker process. */
+		if (fleet_init(opt_workers, sas_s[0]))
+			goto err6;
+		s = -1;
+	} else if ((s = sock_listener(sas_s[0])) == -1)
 		goto err6;
 
 	/* Daemonize and write pid. */
@@ -360,10 +496,28 @@ main(int argc, char * argv[])
 		goto err7;
 	}
 
+	/*
+	 * Fork worker processes (if applicable).  Each worker continues from
+	 * here with its own listening socket; the supervisor returns once all
+	 * of the workers have exited.
+	 */
+	if (opt_workers > 0) {
+		if ((s = fleet_start(opt_pin_cpus)) == -1) {
+			warnp("Failed to start worker processes");
+			goto err7;
+		}
+		if (s == -2)
+			goto done;
+	}
+
+	/* Submit network operations via io_uring (if applicable). */
+	if (opt_io_uring && network_uring_enable())
+		warn0("io_uring is not available; continuing without it");
+
 	/* Start accepting connections. */
 	if ((dispatch_cookie = dispatch_accept(s, opt_t, opt_R ? 0.0 : opt_r,
-	    sas_t, sa_b, opt_d, opt_f, opt_g, opt_j, K, opt_n, opt_o,
-	    &conndone)) == NULL) {
+	    sas_t, sa_b, opt_d, opt_f, opt_g, opt_j, K, opt_n, opt_o, policy,
+	    opt_eject_time, &conndone)) == NULL) {
 		warnp("Failed to initialize connection acceptor");
 		goto err7;
 	}
@@ -391,10 +545,12 @@ main(int argc, char * argv[])
 	/* Stop accepting connections and shut down the dispatcher. */
 	dispatch_shutdown(dispatch_cookie);
 
+done:
 	/* Free the protocol secret structure. */
 	proto_crypt_secret_free(K);
 
 	/* Free arrays of resolved addresses. */
+	sock_addr_freelist(sas_t);
 	sock_addr_freelist(sas_s);
 	sock_addr_freelist(sas_b);
 
@@ -412,6 +568,7 @@ err8:
 err7:
 	if (s != -1)
 		close(s);
+	fleet_free();
 err6:
 	proto_crypt_secret_free(K);
 err5:
@@ -6,6 +6,7 @@
 ### Constants
 c_valgrind_min=1
 addr_output="${s_basename}-addrs.txt"
+addr_output_pool="${s_basename}-addrs-pool.txt"
 # These don't need a network connection to resolve
 addrs_local="	localhost:80
 	[1.2.3.4]:80
@@ -34,6 +35,18 @@ scenario_cmd() {
 		echo $? > ${c_exitfile}
 	done
 
+	# Resolve them all at once (twice over, to exercise merging of
+	# duplicate lookups) using a pool of threads; we should get the
+	# same answers in the same order.
+	setup_check_variables "dnsthread-resolve -p"
+	${c_valgrind_cmd}					\
+	    ${dnsthread_resolve} -p ${addrs} ${addrs} > ${addr_output_pool}
+	echo $? > ${c_exitfile}
+
+	setup_check_variables "dnsthread-resolve -p output"
+	cat ${addr_output} ${addr_output} | cmp -s - ${addr_output_pool}
+	echo $? > ${c_exitfile}
+
 	# Wait for server(s) to quit.
 	servers_stop
 }
@@ -0,0 +1,13 @@
+#!/bin/sh
+
+### Constants
+c_valgrind_min=1
+cmd="${scriptdir}/proto-crypt-engines/test_proto_crypt_engines"
+
+### Actual command
+scenario_cmd() {
+	# Check the packet encryption engines
+	setup_check_variables "test_proto_crypt_engines"
+	${c_valgrind_cmd} ${cmd} > /dev/null
+	echo $? > ${c_exitfile}
+}
@@ -0,0 +1,85 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a pair of spiped servers (encryption, decryption) with explicit
+#   socket buffer sizes and bandwidth-delay product sizing
+# - establish a connection to the encryption spiped server
+# - open one connection, send a file, close the connection
+# - the received file should match the original one
+# - on Linux (if ss is available), while the connection is open, the
+#   unencrypted sockets should have the buffer sizes which were set
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+sendfile=${scriptdir}/shared_test_functions.sh
+bdp_flags="--bdp-rate 1000000000"
+bufsize=65536
+
+# Print the send and receive buffer sizes of the TCP sockets matching the
+# ss(8) filter ${1}, once for each socket.
+bufsizes() {
+	ss -tmn state established "$1" |			\
+	    sed -n 's/.*,rb\([0-9]*\),.*,tb\([0-9]*\),.*/\1 \2/p'
+}
+
+# Check that the socket matching the ss(8) filter ${1} has the buffer sizes
+# which we asked for.  Linux reports twice the sizes which were set.
+check_bufsizes() {
+	sizes=$(bufsizes "$1")
+	if [ "${sizes}" != "$((bufsize * 2)) $((bufsize * 2))" ]; then
+		if [ ${VERBOSE} -ne 0 ]; then
+			printf "Socket buffer sizes for %s are:\n%s\n"	\
+			    "$1" "${sizes}" 1>&2
+		fi
+		echo 1
+	else
+		echo 0
+	fi > ${c_exitfile}
+}
+
+### Actual command
+scenario_cmd() {
+	# Set up infrastructure.
+	setup_spiped_decryption_server ${ncat_output} 0 1 0 \
+	    "--target-bufsize ${bufsize} ${bdp_flags}"
+	setup_spiped_encryption_server					\
+	    "--source-bufsize ${bufsize} ${bdp_flags}"
+
+	# Open a connection, and keep it open for a while after sending.
+	( cat ${sendfile}; sleep 2 ) | ${nc_client_binary} ${src_sock} &
+	client_pid=$!
+	sleep 1
+
+	# Check the buffer sizes of the unencrypted sockets.
+	if [ "$(uname)" != "Linux" ] || ! command -v ss > /dev/null; then
+		setup_check_variables "spiped bufsize: no ss"
+		echo "-1" > ${c_exitfile}
+	else
+		setup_check_variables "spiped source bufsize"
+		check_bufsizes "( sport = :8001 )"
+		setup_check_variables "spiped target bufsize"
+		check_bufsizes "( dport = :8003 )"
+	fi
+
+	# Wait for the connection to close.
+	setup_check_variables "spiped send"
+	wait ${client_pid}
+	echo $? > ${c_exitfile}
+
+	# Wait for server(s) to quit.
+	servers_stop
+
+	setup_check_variables "spiped send output"
+	if ! cmp -s ${ncat_output} ${sendfile}; then
+		if [ ${VERBOSE} -ne 0 ]; then
+			printf "Test output does not match input;" 1>&2
+			printf -- " output is:\n----\n" 1>&2
+			cat ${ncat_output} 1>&2
+			printf -- "----\n" 1>&2
+		fi
+		echo 1
+	else
+		echo 0
+	fi > ${c_exitfile}
+}
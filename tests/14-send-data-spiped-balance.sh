@@ -0,0 +1,75 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a spiped decryption server listening on 127.0.0.1 only, and a
+#   spiped encryption server whose target, localhost, also resolves to ::1
+#   (where nothing is listening)
+# - for each of the rr and leastconn load balancing policies, open several
+#   connections one after another, sending a file over each
+# - each received file should match the original one
+# - the balancer should be told that ::1 failed, and stop choosing it first
+#   (checked by test_balance)
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+sendfile=${scriptdir}/shared_test_functions.sh
+tgt_sock="localhost:8002"
+nconns=3
+cmd="${scriptdir}/balance/test_balance"
+
+### Actual command
+scenario_cmd() {
+	# Check the load balancer itself.
+	setup_check_variables "test_balance"
+	${c_valgrind_cmd} ${cmd} > /dev/null
+	echo $? > ${c_exitfile}
+
+	# We need the target to resolve to a dead address as well as ours.
+	if [ "$(${dnsthread_resolve} ${tgt_sock} | wc -l)" -lt 2 ]; then
+		setup_check_variables "spiped balance: localhost has one address"
+		echo "-1" > ${c_exitfile}
+		return
+	fi
+
+	for policy in rr leastconn; do
+		# Set up infrastructure.
+		setup_spiped_decryption_server /dev/null 0 0
+
+		# Start spiped to connect source port to localhost.
+		setup_check_variables "spiped -e --balance ${policy}"
+		${c_valgrind_cmd}			\
+		${spiped_binary} -e			\
+			-s ${src_sock}			\
+			-t ${tgt_sock}			\
+			-p ${s_basename}-spiped-e.pid	\
+			-k /dev/null -o 1		\
+			--balance ${policy}
+		echo "$?" > "${c_exitfile}"
+
+		i=0
+		while [ "${i}" -lt "${nconns}" ]; do
+			# Send a file over a new connection.
+			rm -f ${ncat_output}
+			${nc_server_binary} ${dst_sock} ${ncat_output} &
+			nc_pid=$!
+			sleep 1
+			setup_check_variables "spiped ${policy} send ${i}"
+			(
+				${nc_client_binary} ${src_sock} < ${sendfile}
+				echo $? > ${c_exitfile}
+			)
+
+			# Wait for the server to receive everything.
+			wait ${nc_pid}
+
+			setup_check_variables "spiped ${policy} output ${i}"
+			cmp -s ${ncat_output} ${sendfile}
+			echo $? > ${c_exitfile}
+			i=$((i + 1))
+		done
+
+		# Wait for server(s) to quit.
+		servers_stop
+	done
+}
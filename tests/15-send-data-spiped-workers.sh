@@ -0,0 +1,88 @@
+#!/bin/sh
+
+# Goal of this test:
+# - create a spiped decryption server, and a spiped encryption server with
+#   two worker processes, running in the foreground
+# - open several connections one after another, sending a file over each
+# - each received file should match the original one
+# - send SIGTERM to the encryption server's supervisor process
+# - the supervisor should exit with status 0 and without printing anything,
+#   and no worker processes should be left behind
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+spiped_stderr="${s_basename}-spiped-e-stderr.txt"
+sendfile=${scriptdir}/shared_test_functions.sh
+nconns=3
+
+### Actual command
+scenario_cmd() {
+	# Set up infrastructure.
+	setup_spiped_decryption_server /dev/null 0 0
+
+	# Start spiped with worker processes, in the foreground so that we
+	# can find out how it exits.
+	setup_check_variables "spiped -e --workers 2"
+	${c_valgrind_cmd}			\
+	${spiped_binary} -e -F			\
+		-s ${src_sock}			\
+		-t ${mid_sock}			\
+		-k /dev/null -o 1		\
+		--workers 2 2> ${spiped_stderr} &
+	spiped_pid=$!
+	sleep 1
+	if kill -0 ${spiped_pid} 2> /dev/null; then
+		echo 0
+	else
+		echo 1
+	fi > ${c_exitfile}
+
+	i=0
+	while [ "${i}" -lt "${nconns}" ]; do
+		# Send a file over a new connection.
+		rm -f ${ncat_output}
+		${nc_server_binary} ${dst_sock} ${ncat_output} &
+		nc_pid=$!
+		sleep 1
+		setup_check_variables "spiped workers send ${i}"
+		(
+			${nc_client_binary} ${src_sock} < ${sendfile}
+			echo $? > ${c_exitfile}
+		)
+
+		# Wait for the server to receive everything.
+		wait ${nc_pid}
+
+		setup_check_variables "spiped workers output ${i}"
+		cmp -s ${ncat_output} ${sendfile}
+		echo $? > ${c_exitfile}
+		i=$((i + 1))
+	done
+
+	# Stop the supervisor; it should stop the workers and exit cleanly.
+	setup_check_variables "spiped workers SIGTERM"
+	kill ${spiped_pid}
+	wait ${spiped_pid}
+	echo $? > ${c_exitfile}
+
+	setup_check_variables "spiped workers stopped"
+	if has_pid "spiped -e -s ${src_sock}"; then
+		echo 1
+	else
+		echo 0
+	fi > ${c_exitfile}
+
+	setup_check_variables "spiped workers quiet"
+	if [ -s ${spiped_stderr} ]; then
+		if [ ${VERBOSE} -ne 0 ]; then
+			cat ${spiped_stderr} 1>&2
+		fi
+		echo 1
+	else
+		echo 0
+	fi > ${c_exitfile}
+
+	# Wait for server(s) to quit.
+	servers_stop
+}
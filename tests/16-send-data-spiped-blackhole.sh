@@ -0,0 +1,85 @@
+#!/bin/sh
+
+# Goal of this test:
+# - find two addresses for localhost (e.g. ::1 and 127.0.0.1)
+# - make the first address a "black hole", which ignores attempts to connect
+#   to it, and create a spiped decryption server on the second one
+# - create a spiped encryption server whose target is localhost, with a
+#   connect timeout (1 s) which would expire while waiting for the first
+#   address if the attempts were not staggered
+# - open one connection, send a file, close the connection
+# - the received file should match the original one; the connection should
+#   have been made to the second address while still trying the first
+
+### Constants
+c_valgrind_min=1
+ncat_output="${s_basename}-ncat-output.txt"
+sendfile=${scriptdir}/shared_test_functions.sh
+tgt_sock="localhost:8002"
+blackhole_binary="${scriptdir}/blackhole/blackhole"
+
+### Actual command
+scenario_cmd() {
+	# We need the target to resolve to two addresses.
+	addrs=$(${dnsthread_resolve} ${tgt_sock})
+	if [ "$(echo "${addrs}" | wc -l)" -lt 2 ]; then
+		setup_check_variables "spiped blackhole: one address"
+		echo "-1" > ${c_exitfile}
+		return
+	fi
+	addr_dead=$(echo "${addrs}" | sed -n 1p)
+	addr_live=$(echo "${addrs}" | sed -n 2p)
+
+	# Ignore connections to the first address.
+	setup_check_variables "blackhole ${addr_dead}"
+	${blackhole_binary} ${addr_dead} &
+	blackhole_pid=$!
+	sleep 1
+	if kill -0 ${blackhole_pid} 2> /dev/null; then
+		echo 0
+	else
+		echo 1
+	fi > ${c_exitfile}
+
+	# Set up infrastructure, on the second address.
+	mid_sock_orig=${mid_sock}
+	mid_sock=${addr_live}
+	setup_spiped_decryption_server ${ncat_output}
+
+	# Start spiped to connect source port to localhost.
+	setup_check_variables "spiped -e --connect-delay"
+	${c_valgrind_cmd}			\
+	${spiped_binary} -e			\
+		-s ${src_sock}			\
+		-t ${tgt_sock}			\
+		-p ${s_basename}-spiped-e.pid	\
+		-k /dev/null -o 1		\
+		--connect-delay 0.25
+	echo "$?" > "${c_exitfile}"
+
+	# Open and close a connection.
+	setup_check_variables "spiped blackhole send"
+	(
+		${nc_client_binary} ${src_sock} < ${sendfile}
+		echo $? > ${c_exitfile}
+	)
+
+	# Wait for server(s) to quit.
+	servers_stop
+	mid_sock=${mid_sock_orig}
+	kill ${blackhole_pid}
+	wait ${blackhole_pid} 2> /dev/null
+
+	setup_check_variables "spiped blackhole output"
+	if ! cmp -s ${ncat_output} ${sendfile}; then
+		if [ ${VERBOSE} -ne 0 ]; then
+			printf "Test output does not match input;" 1>&2
+			printf -- " output is:\n----\n" 1>&2
+			cat ${ncat_output} 1>&2
+			printf -- "----\n" 1>&2
+		fi
+		echo 1
+	else
+		echo 0
+	fi > ${c_exitfile}
+}
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sock.h"
+#include "sock_util.h"
+#include "warnp.h"
+
+#include "balance.h"
+
+/* Number of connections to make with each policy. */
+#define NCONNS 8
+
+/* Target addresses: nothing will be able to connect to the first one. */
+static struct sock_addr * sa_dead;
+static struct sock_addr * sa_live;
+
+/* Resolve ${addr}, which must be a single address. */
+static struct sock_addr *
+resolve(const char * addr)
+{
+	struct sock_addr ** sas;
+	struct sock_addr * sa;
+
+	/* Resolve the address, and keep a copy of it. */
+	if ((sas = sock_resolve(addr)) == NULL) {
+		warnp("sock_resolve");
+		goto err0;
+	}
+	if ((sa = sock_addr_dup(sas[0])) == NULL) {
+		warnp("sock_addr_dup");
+		goto err1;
+	}
+
+	/* Clean up. */
+	sock_addr_freelist(sas);
+
+	/* Success! */
+	return (sa);
+
+err1:
+	sock_addr_freelist(sas);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Return a list of the target addresses, dead first. */
+static struct sock_addr **
+targets(void)
+{
+	struct sock_addr ** sas;
+
+	/* Allocate a list. */
+	if ((sas = malloc(3 * sizeof(struct sock_addr *))) == NULL)
+		goto err0;
+
+	/* Duplicate the addresses. */
+	if ((sas[0] = sock_addr_dup(sa_dead)) == NULL)
+		goto err1;
+	if ((sas[1] = sock_addr_dup(sa_live)) == NULL)
+		goto err2;
+	sas[2] = NULL;
+
+	/* Success! */
+	return (sas);
+
+err2:
+	sock_addr_free(sas[0]);
+err1:
+	free(sas);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/* Create a load balancer with ${policy} and ${ejecttime}. */
+static struct balance *
+setup(const char * policy, double ejecttime)
+{
+	struct balance * B;
+	struct sock_addr ** sas;
+
+	/* Create the balancer and give it the addresses. */
+	if ((B = balance_init(balance_policy(policy), ejecttime)) == NULL) {
+		warnp("balance_init");
+		goto err0;
+	}
+	if ((sas = targets()) == NULL) {
+		warnp("targets");
+		goto err1;
+	}
+	if (balance_update(B, sas))
+		goto err1;
+
+	/* Success! */
+	return (B);
+
+err1:
+	balance_free(B);
+err0:
+	/* Failure! */
+	return (NULL);
+}
+
+/**
+ * conn(B, BC, ndeadfirst, connect):
+ * Pick a target for a connection with ${B}, and try the addresses as a
+ * connection would, reporting the dead address as failed; stop once the
+ * live address is reached, or after the first address if ${connect} is zero
+ * (as if the connection timed out).  Store the cookie in ${BC}, and count
+ * the connections for which the dead address was listed first in
+ * ${ndeadfirst}.
+ */
+static int
+conn(struct balance * B, struct balance_conn ** BC, size_t * ndeadfirst,
+    int connect)
+{
+	struct sock_addr ** sas;
+	size_t i;
+
+	/* Choose the addresses. */
+	if ((*BC = balance_pick(B, &sas)) == NULL) {
+		warnp("balance_pick");
+		goto err0;
+	}
+
+	/* Both addresses should always be listed. */
+	for (i = 0; sas[i] != NULL; i++)
+		continue;
+	if (i != 2) {
+		warn0("balance_pick listed %zu addresses", i);
+		goto err1;
+	}
+
+	/* Try them. */
+	if (sock_addr_cmp(sas[0], sa_dead) == 0)
+		(*ndeadfirst)++;
+	for (i = 0; sas[i] != NULL; i++) {
+		if (sock_addr_cmp(sas[i], sa_dead) == 0) {
+			balance_failed(*BC, i);
+		} else {
+			balance_connected(*BC, i);
+			break;
+		}
+		if (!connect)
+			break;
+	}
+
+	/* Clean up. */
+	sock_addr_freelist(sas);
+
+	/* Success! */
+	return (0);
+
+err1:
+	sock_addr_freelist(sas);
+	balance_done(*BC);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Check that ${policy} stops choosing the dead address after it fails. */
+static int
+check_policy(const char * policy)
+{
+	struct balance * B;
+	struct balance_conn * BC[NCONNS];
+	size_t ndeadfirst = 0;
+	size_t i;
+
+	/* Create the balancer. */
+	if ((B = setup(policy, 10.0)) == NULL)
+		goto err0;
+
+	/* Open several connections at once. */
+	for (i = 0; i < NCONNS; i++) {
+		if (conn(B, &BC[i], &ndeadfirst, 1))
+			goto err1;
+	}
+
+	/* The dead address should have been tried first at most once. */
+	if (ndeadfirst > 1) {
+		warn0("%s: dead address listed first %zu times", policy,
+		    ndeadfirst);
+		goto err1;
+	}
+
+	/* Clean up. */
+	while (i-- > 0)
+		balance_done(BC[i]);
+	balance_free(B);
+
+	/* Success! */
+	return (0);
+
+err1:
+	while (i-- > 0)
+		balance_done(BC[i]);
+	balance_free(B);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/* Check that only addresses which were tried are ejected, and not forever. */
+static int
+check_ejection(void)
+{
+	struct balance * B;
+	struct balance_conn * BC;
+	struct timespec ts = {0, 600000000};
+	size_t ndeadfirst = 0;
+
+	/* Use the first address, ejecting failed addresses for 0.5 s. */
+	if ((B = setup("first", 0.5)) == NULL)
+		goto err0;
+
+	/* Time out while connecting to the dead address. */
+	if (conn(B, &BC, &ndeadfirst, 0))
+		goto err1;
+	balance_done(BC);
+
+	/* The live address wasn't tried, so it should be used next. */
+	if (conn(B, &BC, &ndeadfirst, 1))
+		goto err1;
+	balance_done(BC);
+	if (ndeadfirst != 1) {
+		warn0("dead address listed first %zu times", ndeadfirst);
+		goto err1;
+	}
+
+	/* Once the ejection expires, the dead address is tried again. */
+	nanosleep(&ts, NULL);
+	if (conn(B, &BC, &ndeadfirst, 1))
+		goto err1;
+	balance_done(BC);
+	if (ndeadfirst != 2) {
+		warn0("dead address not retried after ejection expired");
+		goto err1;
+	}
+
+	/* Having failed again, it is ejected for longer. */
+	if (conn(B, &BC, &ndeadfirst, 1))
+		goto err1;
+	balance_done(BC);
+	if (ndeadfirst != 2) {
+		warn0("dead address not ejected after failing again");
+		goto err1;
+	}
+
+	/* Clean up. */
+	balance_free(B);
+
+	/* Success! */
+	return (0);
+
+err1:
+	balance_free(B);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+	const char * policies[] = {"first", "rr", "leastconn", "p2c", NULL};
+	size_t i;
+
+	WARNP_INIT;
+	(void)argc; /* UNUSED */
+
+	/* Resolve the target addresses. */
+	if ((sa_dead = resolve("[127.0.0.1]:8001")) == NULL)
+		goto err0;
+	if ((sa_live = resolve("[127.0.0.2]:8001")) == NULL)
+		goto err1;
+
+	/* Check each policy. */
+	for (i = 0; policies[i] != NULL; i++) {
+		if (check_policy(policies[i]))
+			goto err2;
+		printf("%s: ok\n", policies[i]);
+	}
+
+	/* Check ejection and its expiry. */
+	if (check_ejection())
+		goto err2;
+	printf("ejection: ok\n");
+
+	/* Clean up. */
+	sock_addr_free(sa_live);
+	sock_addr_free(sa_dead);
+
+	/* Success! */
+	exit(0);
+
+err2:
+	sock_addr_free(sa_live);
+err1:
+	sock_addr_free(sa_dead);
+err0:
+	/* Failure! */
+	exit(1);
+}
@@ -0,0 +1,82 @@
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sock.h"
+#include "warnp.h"
+
+/* Give up if this many connections don't fill the listen queue. */
+#define MAX_CONNS 256
+
+/* How long to wait for each connection to complete, in milliseconds. */
+#define CONNECT_WAIT 200
+
+int
+main(int argc, char ** argv)
+{
+	struct sock_addr ** sas;
+	struct pollfd pfd;
+	int s;
+	int c;
+	int n;
+
+	WARNP_INIT;
+
+	/* Usage. */
+	if (argc != 2) {
+		fprintf(stderr, "usage: blackhole ADDRESS\n");
+		goto err0;
+	}
+
+	/* Resolve the address. */
+	if ((sas = sock_resolve(argv[1])) == NULL) {
+		warnp("Error resolving socket address: %s", argv[1]);
+		goto err0;
+	}
+	if (sas[0] == NULL) {
+		warn0("No addresses found for %s", argv[1]);
+		goto err1;
+	}
+
+	/* Listen on the address, but never accept any connections. */
+	if ((s = sock_listener(sas[0])) == -1)
+		goto err1;
+
+	/*
+	 * Connect to ourselves until a connection doesn't complete, which
+	 * means that the listen queue is full; from then on, the operating
+	 * system ignores attempts to connect to the address.
+	 */
+	for (n = 0; n < MAX_CONNS; n++) {
+		if ((c = sock_connect_nb(sas[0])) == -1)
+			goto err2;
+		pfd.fd = c;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, CONNECT_WAIT) == -1) {
+			warnp("poll");
+			goto err2;
+		}
+		if (pfd.revents == 0)
+			break;
+	}
+	if (n == MAX_CONNS) {
+		warn0("Could not fill the listen queue");
+		goto err2;
+	}
+
+	/* Clean up. */
+	sock_addr_freelist(sas);
+
+	/* Hold the connections open until we're killed. */
+	while (1)
+		pause();
+
+err2:
+	close(s);
+err1:
+	sock_addr_freelist(sas);
+err0:
+	/* Failure! */
+	exit(1);
+}
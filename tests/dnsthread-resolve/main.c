@@ -1,28 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "events.h"
 #include "sock.h"
 #include "sock_util.h"
 #include "warnp.h"
 
+#include "dnspool.h"
 #include "dnsthread.h"
 
 #define MAX_ADDRS 8
 static int doneloop = 0;
 
+/* Results of resolving via a pool, to be printed in order. */
+static struct sock_addr *** results;
+static int npending;
+
+/* Print the addresses ${sas}. */
 static int
-found(void * cookie, struct sock_addr ** sas)
+print_addrs(struct sock_addr ** sas)
 {
 	char * addr;
 	int i;
 
-	(void)cookie; /* UNUSED */
-
-	/* Sanity check. */
-	if (sas == NULL)
-		goto err0;
-
 	/* Print each address. */
 	for (i = 0; i < MAX_ADDRS; i++) {
 		if (sas[i] == NULL)
@@ -31,7 +32,7 @@ found(void * cookie, struct sock_addr ** sas)
 		/* Extract address and print it. */
 		if ((addr = sock_addr_prettyprint(sas[i])) == NULL) {
 			warn0("sock_addr_prettyprint()");
-			goto err1;
+			goto err0;
 		}
 		printf("%s\n", addr);
 
@@ -39,6 +40,28 @@ found(void * cookie, struct sock_addr ** sas)
 		free(addr);
 	}
 
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+static int
+found(void * cookie, struct sock_addr ** sas)
+{
+
+	(void)cookie; /* UNUSED */
+
+	/* Sanity check. */
+	if (sas == NULL)
+		goto err0;
+
+	/* Print the addresses. */
+	if (print_addrs(sas))
+		goto err1;
+
 	/* Clean up. */
 	sock_addr_freelist(sas);
 
@@ -55,6 +78,101 @@ err0:
 	return (-1);
 }
 
+static int
+found_pool(void * cookie, struct sock_addr ** sas)
+{
+	struct sock_addr *** result = cookie;
+
+	/* Sanity check. */
+	if (sas == NULL)
+		return (-1);
+
+	/* Record the addresses. */
+	*result = sas;
+
+	/* Quit event loop once everything has been resolved. */
+	if (--npending == 0)
+		doneloop = 1;
+
+	/* Success! */
+	return (0);
+}
+
+/* Resolve the ${n} addresses ${addrs} in parallel and print them in order. */
+static int
+resolve_pool(int n, char ** addrs)
+{
+	struct dnspool * P;
+	int i;
+
+	/* Space for the results. */
+	if ((results = calloc((size_t)n, sizeof(struct sock_addr **))) == NULL)
+		goto err0;
+
+	/* Start a pool with fewer threads than addresses. */
+	if ((P = dnspool_init(2, 60.0)) == NULL) {
+		warn0("dnspool_init");
+		goto err1;
+	}
+
+	/* Look up all of the addresses at once. */
+	npending = n;
+	for (i = 0; i < n; i++) {
+		if (dnspool_resolve(P, addrs[i], found_pool,
+		    &results[i]) == NULL) {
+			warn0("dnspool_resolve");
+			goto err2;
+		}
+	}
+
+	/* Loop until we're done. */
+	if (events_spin(&doneloop)) {
+		warn0("Error running event loop");
+		goto err2;
+	}
+
+	/* The results should be cached now; look them up again. */
+	doneloop = 0;
+	npending = n;
+	for (i = 0; i < n; i++) {
+		sock_addr_freelist(results[i]);
+		if (dnspool_resolve(P, addrs[i], found_pool,
+		    &results[i]) == NULL) {
+			warn0("dnspool_resolve");
+			goto err2;
+		}
+	}
+	if (events_spin(&doneloop)) {
+		warn0("Error running event loop");
+		goto err2;
+	}
+
+	/* Print the results in order. */
+	for (i = 0; i < n; i++) {
+		if (print_addrs(results[i]))
+			goto err2;
+	}
+
+	/* Clean up. */
+	dnspool_free(P);
+	for (i = 0; i < n; i++)
+		sock_addr_freelist(results[i]);
+	free(results);
+
+	/* Success! */
+	return (0);
+
+err2:
+	dnspool_free(P);
+err1:
+	for (i = 0; i < n; i++)
+		sock_addr_freelist(results[i]);
+	free(results);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
 int
 main(int argc, char ** argv)
 {
@@ -63,10 +181,22 @@ main(int argc, char ** argv)
 
 	/* Usage. */
 	if (argc < 2) {
-		fprintf(stderr, "usage: dnsthread-resolve ADDRESS\n");
+		fprintf(stderr, "usage: dnsthread-resolve ADDRESS\n"
+		    "       dnsthread-resolve -p ADDRESS ...\n");
 		goto err0;
 	}
 
+	/* Resolve several addresses using a pool of threads. */
+	if (strcmp(argv[1], "-p") == 0) {
+		if (argc < 3) {
+			warn0("No addresses to resolve");
+			goto err0;
+		}
+		if (resolve_pool(argc - 2, &argv[2]))
+			goto err0;
+		exit(0);
+	}
+
 	/* Look for address given. */
 	if (dnsthread_resolve(argv[1], found, NULL)) {
 		warn0("fail dns");
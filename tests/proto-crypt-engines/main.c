@@ -0,0 +1,237 @@
+#include <sys/uio.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypto_aes.h"
+#include "crypto_aesctr.h"
+#include "sha256.h"
+#include "sysendian.h"
+#include "warnp.h"
+
+#include "proto_crypt.h"
+#include "proto_crypt_engine.h"
+
+/* Maximum data length we test. */
+#define MAXLEN 8192
+
+/* Data lengths to test. */
+static const size_t lens[] = {
+	1, 17, 1000, PCRYPT_MAXDSZ - 1, PCRYPT_MAXDSZ, PCRYPT_MAXDSZ + 1,
+	3000, MAXLEN
+};
+
+/* Initial packet numbers to test. */
+static const uint64_t pnums[] = {
+	0, 1, 255, 256, UINT32_MAX, (uint64_t)UINT32_MAX + 1,
+	((uint64_t)1 << 63) + 5
+};
+
+/* Buffers, sized for the longest message. */
+static uint8_t kbuf[64];
+static uint8_t ibuf[MAXLEN];
+static uint8_t rbuf[PCRYPT_NPACKETS(MAXLEN) * PCRYPT_ESZ];
+static uint8_t obuf[PCRYPT_NPACKETS(MAXLEN) * PCRYPT_ESZ];
+static struct iovec iov[PCRYPT_NPACKETS(MAXLEN)];
+
+/**
+ * reference_enc(k_aes, pnum, len):
+ * Encrypt ${len} bytes of ${ibuf} into ${rbuf}, starting at packet number
+ * ${pnum}, one step at a time as described in DESIGN.md.
+ */
+static void
+reference_enc(const struct crypto_aes_key * k_aes, uint64_t pnum, size_t len)
+{
+	uint8_t pbuf[PCRYPT_MAXDSZ + 4 + 8];
+	const uint8_t * ip = ibuf;
+	uint8_t * op = rbuf;
+	size_t plen;
+
+	do {
+		/* Data, zero padding, and length. */
+		plen = (len > PCRYPT_MAXDSZ) ? PCRYPT_MAXDSZ : len;
+		memset(pbuf, 0, PCRYPT_MAXDSZ);
+		memcpy(pbuf, ip, plen);
+		be32enc(&pbuf[PCRYPT_MAXDSZ], (uint32_t)plen);
+
+		/* Encrypt using the packet number as the nonce. */
+		crypto_aesctr_buf(k_aes, pnum, pbuf, op, PCRYPT_MAXDSZ + 4);
+
+		/* HMAC the ciphertext followed by the packet number. */
+		memcpy(pbuf, op, PCRYPT_MAXDSZ + 4);
+		be64enc(&pbuf[PCRYPT_MAXDSZ + 4], pnum);
+		HMAC_SHA256_Buf(&kbuf[32], 32, pbuf, PCRYPT_MAXDSZ + 4 + 8,
+		    &op[PCRYPT_MAXDSZ + 4]);
+
+		/* Move on to the next packet. */
+		ip += plen;
+		len -= plen;
+		op += PCRYPT_ESZ;
+		pnum += 1;
+	} while (len > 0);
+}
+
+/**
+ * check_dec(D, ks, pnum, len):
+ * Check that the engine ${D} with key state ${ks} correctly decrypts the
+ * packets in ${rbuf} which encrypt ${len} bytes starting at packet number
+ * ${pnum}, and rejects them if they are modified or misnumbered.
+ */
+static int
+check_dec(const struct proto_crypt_engine * D, void * ks, uint64_t pnum,
+    size_t len)
+{
+	size_t npackets = PCRYPT_NPACKETS(len);
+	size_t esz = npackets * PCRYPT_ESZ;
+	size_t pos;
+	size_t i;
+	ssize_t r;
+
+	/* Decrypt a copy of the packets. */
+	memcpy(obuf, rbuf, esz);
+	if ((r = D->dec_batch(ks, pnum, obuf, npackets, iov)) < 0) {
+		warn0("%s: valid packets rejected", D->name);
+		goto err0;
+	}
+	if ((size_t)r != len) {
+		warn0("%s: decrypted %zd bytes, not %zu", D->name, r, len);
+		goto err0;
+	}
+
+	/* Check that we got the original data back. */
+	for (pos = i = 0; i < npackets; i++) {
+		if (memcmp(iov[i].iov_base, &ibuf[pos], iov[i].iov_len)) {
+			warn0("%s: decrypted data does not match", D->name);
+			goto err0;
+		}
+		pos += iov[i].iov_len;
+	}
+
+	/* Flip a bit in the last packet; the batch must be rejected. */
+	memcpy(obuf, rbuf, esz);
+	obuf[esz - PCRYPT_ESZ + (len % 1031)] ^= 0x10;
+	if (D->dec_batch(ks, pnum, obuf, npackets, iov) != -1) {
+		warn0("%s: modified packet accepted", D->name);
+		goto err0;
+	}
+
+	/* The packets must be rejected with the wrong packet number. */
+	memcpy(obuf, rbuf, esz);
+	if (D->dec_batch(ks, pnum + 1, obuf, npackets, iov) != -1) {
+		warn0("%s: misnumbered packet accepted", D->name);
+		goto err0;
+	}
+
+	/* Success! */
+	return (0);
+
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+/**
+ * check_engine(E):
+ * Check that the engine ${E} produces the same packets as the reference
+ * code, and that every engine can decrypt them.
+ */
+static int
+check_engine(const struct proto_crypt_engine * E)
+{
+	const struct proto_crypt_engine * const * D;
+	struct crypto_aes_key * k_aes;
+	void * ks;
+	void * ks_dec;
+	size_t i, j;
+	size_t esz;
+
+	/* Set up the reference AES key and the engine key state. */
+	if ((k_aes = crypto_aes_key_expand(kbuf, 32)) == NULL) {
+		warn0("crypto_aes_key_expand");
+		goto err0;
+	}
+	if ((ks = E->keysetup(kbuf)) == NULL) {
+		warn0("%s: keysetup failed", E->name);
+		goto err1;
+	}
+
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		esz = PCRYPT_NPACKETS(lens[i]) * PCRYPT_ESZ;
+		for (j = 0; j < sizeof(pnums) / sizeof(pnums[0]); j++) {
+			/* Compare the engine against the reference code. */
+			reference_enc(k_aes, pnums[j], lens[i]);
+			memset(obuf, 0xff, esz);
+			if (E->enc_batch(ks, pnums[j], ibuf, lens[i], obuf)) {
+				warn0("%s: enc_batch failed", E->name);
+				goto err2;
+			}
+			if (memcmp(obuf, rbuf, esz)) {
+				warn0("%s: wrong packets for len %zu,"
+				    " pnum %ju", E->name, lens[i],
+				    (uintmax_t)pnums[j]);
+				goto err2;
+			}
+
+			/* Decrypt them with every engine. */
+			for (D = proto_crypt_engines; *D != NULL; D++) {
+				if ((ks_dec = (*D)->keysetup(kbuf)) == NULL) {
+					warn0("%s: keysetup failed",
+					    (*D)->name);
+					goto err2;
+				}
+				if (check_dec(*D, ks_dec, pnums[j], lens[i])) {
+					(*D)->keyfree(ks_dec);
+					goto err2;
+				}
+				(*D)->keyfree(ks_dec);
+			}
+		}
+	}
+
+	/* Clean up. */
+	E->keyfree(ks);
+	crypto_aes_key_free(k_aes);
+
+	/* Success! */
+	return (0);
+
+err2:
+	E->keyfree(ks);
+err1:
+	crypto_aes_key_free(k_aes);
+err0:
+	/* Failure! */
+	return (-1);
+}
+
+int
+main(int argc, char ** argv)
+{
+	const struct proto_crypt_engine * const * E;
+	size_t i;
+
+	WARNP_INIT;
+	(void)argc; /* UNUSED */
+
+	/* Fixed key and data. */
+	for (i = 0; i < sizeof(kbuf); i++)
+		kbuf[i] = (uint8_t)i;
+	for (i = 0; i < sizeof(ibuf); i++)
+		ibuf[i] = (uint8_t)(i * 7 + 3);
+
+	/* Check each engine. */
+	for (E = proto_crypt_engines; *E != NULL; E++) {
+		if (check_engine(*E))
+			goto err0;
+		printf("%s: ok\n", (*E)->name);
+	}
+
+	/* Success! */
+	exit(0);
+
+err0:
+	/* Failure! */
+	exit(1);
+}
@@ -29,19 +29,20 @@ check_leftover_servers() {
 }
 
 ## setup_spiped_decryption_server(nc_output=/dev/null, use_system_spiped=0,
-#      use_nc=1, nc_bps=0):
+#      use_nc=1, nc_bps=0, spiped_flags=""):
 # Set up a spiped decryption server, translating from ${mid_sock}
 # to ${dst_sock}, saving the exit code to ${c_exitfile}.  Also set
 # up a nc-server listening to ${dst_sock}, saving output to
 # ${nc_output}, unless ${use_nc} is 0.  Uses the system's spiped (instead of
 # the version in this source tree) if ${use_system_spiped} is 1.
 # If ${nc_bps} is non-zero, run nc as an echo server which is
-# limited to ${nc_bps} bytes per second.
+# limited to ${nc_bps} bytes per second.  Pass any ${spiped_flags} to spiped.
 setup_spiped_decryption_server () {
 	nc_output=${1:-/dev/null}
 	use_system_spiped=${2:-0}
 	use_nc=${3:-1}
 	nc_bps=${4:-0}
+	spiped_flags=${5:-}
 	check_leftover_servers
 
 	# We need to set this up here so that ${c_valgrind_cmd} is set.
@@ -68,14 +69,17 @@ setup_spiped_decryption_server () {
 		-s ${mid_sock}			\
 		-t ${dst_sock}			\
 		-p ${s_basename}-spiped-d.pid	\
-		-k /dev/null -o 1
+		-k /dev/null -o 1 ${spiped_flags}
 	echo "$?" > "${c_exitfile}"
 }
 
-## setup_spiped_decryption_server(basename):
+## setup_spiped_encryption_server(spiped_flags=""):
 # Set up a spiped encryption server, translating from ${src_sock}
-# to ${mid_sock}, saving the exit code to ${c_exitfile}.
+# to ${mid_sock}, saving the exit code to ${c_exitfile}.  Pass any
+# ${spiped_flags} to spiped.
 setup_spiped_encryption_server () {
+	spiped_flags=${1:-}
+
 	# Start spiped to connect source port to middle.
 	setup_check_variables "setup_spiped_encryption_server"
 	${c_valgrind_cmd}			\
@@ -83,7 +87,7 @@ setup_spiped_encryption_server () {
 		-s ${src_sock}			\
 		-t ${mid_sock}			\
 		-p ${s_basename}-spiped-e.pid	\
-		-k /dev/null -o 1
+		-k /dev/null -o 1 ${spiped_flags}
 	echo "$?" > "${c_exitfile}"
 }
 